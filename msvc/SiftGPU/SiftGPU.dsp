@@ -96,10 +96,18 @@ LINK32=link.exe
 # PROP Default_Filter "cpp;c;cxx;rc;def;r;odl;idl;hpj;bat"
 # Begin Source File
 
+SOURCE=..\..\src\SiftGPU\FeatureCache.cpp
+# End Source File
+# Begin Source File
+
 SOURCE=..\..\src\SiftGPU\FrameBufferObject.cpp
 # End Source File
 # Begin Source File
 
+SOURCE=..\..\src\SiftGPU\FrameStream.cpp
+# End Source File
+# Begin Source File
+
 SOURCE=..\..\src\SiftGPU\GlobalUtil.cpp
 # End Source File
 # Begin Source File
@@ -132,6 +140,10 @@ SOURCE=..\..\src\SiftGPU\SiftGPU.cpp
 # End Source File
 # Begin Source File
 
+SOURCE=..\..\src\SiftGPU\SiftGPUPool.cpp
+# End Source File
+# Begin Source File
+
 SOURCE=.\SiftGPU.def
 # PROP Exclude_From_Build 1
 # End Source File
@@ -141,6 +153,14 @@ SOURCE=..\..\src\SiftGPU\SiftMatch.cpp
 # End Source File
 # Begin Source File
 
+SOURCE=..\..\src\SiftGPU\SiftProfiler.cpp
+# End Source File
+# Begin Source File
+
+SOURCE=..\..\src\SiftGPU\SiftTracer.cpp
+# End Source File
+# Begin Source File
+
 SOURCE=..\..\src\SiftGPU\SIFTPyramid.cpp
 # End Source File
 # End Group
@@ -149,10 +169,18 @@ SOURCE=..\..\src\SiftGPU\SIFTPyramid.cpp
 # PROP Default_Filter "h;hpp;hxx;hm;inl"
 # Begin Source File
 
+SOURCE=..\..\src\SiftGPU\FeatureCache.h
+# End Source File
+# Begin Source File
+
 SOURCE=..\..\src\SiftGPU\FrameBufferObject.h
 # End Source File
 # Begin Source File
 
+SOURCE=..\..\src\SiftGPU\FrameStream.h
+# End Source File
+# Begin Source File
+
 SOURCE=..\..\src\SiftGPU\GlobalUtil.h
 # End Source File
 # Begin Source File
@@ -181,6 +209,18 @@ SOURCE=..\..\src\ServerSiftGPU\ServerSiftGPU.h
 # End Source File
 # Begin Source File
 
+SOURCE=..\..\src\ServerSiftGPU\ServerQueue.h
+# End Source File
+# Begin Source File
+
+SOURCE=..\..\src\ServerSiftGPU\ServerStore.h
+# End Source File
+# Begin Source File
+
+SOURCE=..\..\src\ServerSiftGPU\ServerCodec.h
+# End Source File
+# Begin Source File
+
 SOURCE=..\..\src\SiftGPU\ShaderMan.h
 # End Source File
 # Begin Source File
@@ -189,10 +229,30 @@ SOURCE=..\..\src\SiftGPU\SiftGPU.h
 # End Source File
 # Begin Source File
 
+SOURCE=..\..\src\SiftGPU\SiftGPUPool.h
+# End Source File
+# Begin Source File
+
+SOURCE=..\..\src\SiftGPU\SiftGPUJobQueue.h
+# End Source File
+# Begin Source File
+
+SOURCE=..\..\src\SiftGPU\SiftGPURequest.h
+# End Source File
+# Begin Source File
+
 SOURCE=..\..\src\SiftGPU\SiftMatch.h
 # End Source File
 # Begin Source File
 
+SOURCE=..\..\src\SiftGPU\SiftProfiler.h
+# End Source File
+# Begin Source File
+
+SOURCE=..\..\src\SiftGPU\SiftTracer.h
+# End Source File
+# Begin Source File
+
 SOURCE=..\..\src\SiftGPU\SIFTPyramid.h
 # End Source File
 # End Group
@@ -0,0 +1,247 @@
+////////////////////////////////////////////////////////////////////////////
+//	File:		ServerCodec.h
+//	Author:		SiftGPU contributors
+//	Description :	the encodings of the features that a server sends,
+//					which are also checked by siftgpu_test.
+//
+//	This file was added to SiftGPU in 2026 and is distributed under the
+//	same terms as the rest of SiftGPU, see the notice in SiftGPU.h.
+//
+////////////////////////////////////////////////////////////////////////////
+
+#ifndef GPU_SIFT_SERVER_CODEC_H
+#define GPU_SIFT_SERVER_CODEC_H
+
+#include <math.h>
+#include <string.h>
+#include <vector>
+#include <algorithm>
+
+#include "../SiftGPU/SiftGPU.h"
+#include "ServerSiftGPU.h"
+
+//the same quantization as SiftGPU::GetFeatureVectorU8
+inline void QuantizeDescriptors(const float* descriptors, int count, unsigned char* bytes)
+{
+	for(int i = 0; i < count; ++i)
+	{
+		int v = (int) floor(0.5 + 512.0f * descriptors[i]);
+		bytes[i] = (unsigned char) (v < 0 ? 0 : (v > 255 ? 255 : v));
+	}
+}
+
+/////////////////////////////////////////////////////////////////////////////
+//a fast LZ77 codec for the features, in the block format of LZ4: each sequence
+//has a token {literal length : 4, match length - 4 : 4}, the extra literal 
+//length bytes, the literals, a 16-bit offset and the extra match length bytes.
+//The last sequence has only literals.
+/////////////////////////////////////////////////////////////////////////////
+inline void LzPutLength(std::vector<char>& out, size_t length)
+{
+	for(; length >= 255; length -= 255) out.push_back((char) 255);
+	out.push_back((char) length);
+}
+
+inline int LzGetLength(const unsigned char* in, size_t size, size_t& pos, size_t& length)
+{
+	unsigned char c;
+	do
+	{
+		if(pos >= size) return 0;
+		c = in[pos++];
+		length += c;
+	}while(c == 255);
+	return 1;
+}
+
+inline void LzCompress(const unsigned char* in, size_t size, std::vector<char>& out)
+{
+	enum { HASH_BITS = 13, MIN_MATCH = 4, MAX_OFFSET = 65535 };
+	std::vector<int> table(1 << HASH_BITS, -1);
+	size_t anchor = 0, pos = 0;
+	while(pos + MIN_MATCH <= size)
+	{
+		unsigned int sequence, ref_sequence;
+		memcpy(&sequence, in + pos, MIN_MATCH);
+		unsigned int hash = (sequence * 2654435761u) >> (32 - HASH_BITS);
+		int ref = table[hash];
+		table[hash] = (int) pos;
+		if(ref >= 0) memcpy(&ref_sequence, in + ref, MIN_MATCH);
+		if(ref < 0 || pos - ref > MAX_OFFSET || ref_sequence != sequence)
+		{
+			pos++;
+			continue;
+		}
+		size_t length = MIN_MATCH, literal = pos - anchor;
+		while(pos + length < size && in[ref + length] == in[pos + length]) length++;
+		size_t extra = length - MIN_MATCH, offset = pos - ref;
+		out.push_back((char) ((std::min(literal, (size_t) 15) << 4) | std::min(extra, (size_t) 15)));
+		if(literal >= 15) LzPutLength(out, literal - 15);
+		out.insert(out.end(), (const char*) in + anchor, (const char*) in + pos);
+		out.push_back((char) (offset & 255));
+		out.push_back((char) (offset >> 8));
+		if(extra >= 15) LzPutLength(out, extra - 15);
+		pos += length;
+		anchor = pos;
+	}
+	size_t literal = size - anchor;
+	out.push_back((char) (std::min(literal, (size_t) 15) << 4));
+	if(literal >= 15) LzPutLength(out, literal - 15);
+	out.insert(out.end(), (const char*) in + anchor, (const char*) in + size);
+}
+
+//returns 0 if the data is corrupted or does not have out_size bytes
+inline int LzDecompress(const unsigned char* in, size_t size, unsigned char* out, size_t out_size)
+{
+	size_t pos = 0, count = 0;
+	while(pos < size)
+	{
+		int token = in[pos++];
+		size_t literal = token >> 4, length = token & 15;
+		if(literal == 15 && !LzGetLength(in, size, pos, literal)) return 0;
+		if(pos + literal > size || count + literal > out_size) return 0;
+		memcpy(out + count, in + pos, literal);
+		pos += literal;
+		count += literal;
+		if(pos == size) break;
+		if(pos + 2 > size) return 0;
+		size_t offset = in[pos] | (in[pos + 1] << 8);
+		pos += 2;
+		if(length == 15 && !LzGetLength(in, size, pos, length)) return 0;
+		length += 4;
+		if(offset == 0 || offset > count || count + length > out_size) return 0;
+		//the match can overlap with the bytes that it produces
+		for(size_t i = 0; i < length; ++i, ++count) out[count] = out[count - offset];
+	}
+	return count == out_size;
+}
+
+//the features in an encoding (ServerSiftGPU::ENCODING_*): {encoding, raw size, 
+//packed size, coordinate step} and the packed keypoints and descriptors
+struct FeatureEncoding
+{
+	int		encoding;
+	int		raw_size;
+	int		packed_size;	//the same as raw_size if it is not compressed
+	float	step;			//the coordinates are multiples of 1/step in ENCODING_KEY16
+};
+
+//the scale in ENCODING_KEY16: a sign bit (the scales of -sign are negative for the 
+//minima) and the log2 of the magnitude in 1/1024 above 2^-16, up to 2^16. 0 is 0
+inline unsigned short EncodeScale16(float s)
+{
+	double a = fabs(s);
+	if(a < 1.0 / 65536) return 0;
+	int v = (int) floor((log(a) / log(2.0) + 16.0) * 1024.0 + 0.5);
+	v = std::max(1, std::min(32767, v));
+	return (unsigned short) (s < 0 ? v | 0x8000 : v);
+}
+
+inline float DecodeScale16(unsigned short q)
+{
+	int v = q & 0x7fff;
+	if(v == 0) return 0.0f;
+	float a = (float) pow(2.0, v / 1024.0 - 16.0);
+	return (q & 0x8000) ? -a : a;
+}
+
+inline void EncodeFeatures(int count, const SiftGPU::SiftKeypoint* keys, const float* descriptors, 
+						   int encoding, std::vector<char>& packed)
+{
+	typedef ServerSiftGPU S;
+	FeatureEncoding header = {encoding, 0, 0, 1.0f};
+	int key_size = (encoding & S::ENCODING_KEY16) ? 4 * sizeof(unsigned short) : sizeof(SiftGPU::SiftKeypoint);
+	int des_size = (encoding & S::ENCODING_U8) ? 128 : 128 * sizeof(float);
+	header.raw_size = header.packed_size = count * (key_size + des_size);
+	packed.resize(sizeof(header) + header.raw_size);
+	char* p = &packed[0] + sizeof(header);
+	if(encoding & S::ENCODING_KEY16)
+	{
+		float extent = 1.0f;
+		for(int i = 0; i < count; ++i) extent = std::max(extent, std::max(keys[i].x, keys[i].y));
+		header.step = std::min(16.0f, 65535.0f / extent);
+		unsigned short* q = (unsigned short*) p;
+		for(int i = 0; i < count; ++i, q += 4)
+		{
+			q[0] = (unsigned short) std::max(0.0f, std::min(65535.0f, floor(keys[i].x * header.step + 0.5f)));
+			q[1] = (unsigned short) std::max(0.0f, std::min(65535.0f, floor(keys[i].y * header.step + 0.5f)));
+			q[2] = EncodeScale16(keys[i].s);
+			q[3] = (unsigned short) (int) floor(keys[i].o * (32768.0 / 3.14159265358979) + 0.5);
+		}
+	}else
+	{
+		memcpy(p, keys, count * key_size);
+	}
+	p += count * key_size;
+	if(encoding & S::ENCODING_U8)
+	{
+		QuantizeDescriptors(descriptors, count * 128, (unsigned char*) p);
+	}else
+	{
+		memcpy(p, descriptors, count * des_size);
+	}
+	if(encoding & S::ENCODING_LZ)
+	{
+		std::vector<char> compressed(sizeof(header));
+		compressed.reserve(packed.size());
+		LzCompress((const unsigned char*) &packed[sizeof(header)], header.raw_size, compressed);
+		//it is sent uncompressed if it does not get smaller
+		if(compressed.size() < packed.size())
+		{
+			header.packed_size = (int) (compressed.size() - sizeof(header));
+			packed.swap(compressed);
+		}
+	}
+	memcpy(&packed[0], &header, sizeof(header));
+}
+
+inline int DecodeFeatures(const char* data, size_t size, int count, 
+						  std::vector<SiftGPU::SiftKeypoint>& keys, std::vector<float>& descriptors)
+{
+	typedef ServerSiftGPU S;
+	FeatureEncoding header;
+	if(size < sizeof(header)) return 0;
+	memcpy(&header, data, sizeof(header));
+	int encoding = header.encoding;
+	size_t key_size = (encoding & S::ENCODING_KEY16) ? 4 * sizeof(unsigned short) : sizeof(SiftGPU::SiftKeypoint);
+	size_t des_size = (encoding & S::ENCODING_U8) ? 128 : 128 * sizeof(float);
+	if(header.raw_size != (int) (count * (key_size + des_size)) || header.packed_size < 0 || 
+		sizeof(header) + header.packed_size > size || header.step <= 0) return 0;
+	const char* p = data + sizeof(header);
+	std::vector<char> raw;
+	if(header.packed_size != header.raw_size)
+	{
+		raw.resize(header.raw_size);
+		if(!LzDecompress((const unsigned char*) p, header.packed_size, (unsigned char*) &raw[0], raw.size())) return 0;
+		p = &raw[0];
+	}
+	keys.resize(count);
+	descriptors.resize(count * 128);
+	if(encoding & S::ENCODING_KEY16)
+	{
+		for(int i = 0; i < count; ++i, p += key_size)
+		{
+			unsigned short q[4];
+			memcpy(q, p, sizeof(q));
+			keys[i].x = q[0] / header.step;
+			keys[i].y = q[1] / header.step;
+			keys[i].s = DecodeScale16(q[2]);
+			keys[i].o = (float) ((short) q[3] * (3.14159265358979 / 32768.0));
+		}
+	}else
+	{
+		memcpy(&keys[0], p, count * key_size);
+		p += count * key_size;
+	}
+	if(encoding & S::ENCODING_U8)
+	{
+		const unsigned char* d = (const unsigned char*) p;
+		for(int i = 0; i < count * 128; ++i) descriptors[i] = d[i] / 512.0f;
+	}else
+	{
+		memcpy(&descriptors[0], p, count * des_size);
+	}
+	return count;
+}
+
+#endif
@@ -0,0 +1,150 @@
+////////////////////////////////////////////////////////////////////////////
+//	File:		ServerQueue.h
+//	Author:		SiftGPU contributors
+//	Description :	the locks and the request queue of the multi-client server,
+//					which are also checked by siftgpu_test.
+//
+//	This file was added to SiftGPU in 2026 and is distributed under the
+//	same terms as the rest of SiftGPU, see the notice in SiftGPU.h.
+//
+////////////////////////////////////////////////////////////////////////////
+
+#ifndef GPU_SIFT_SERVER_QUEUE_H
+#define GPU_SIFT_SERVER_QUEUE_H
+
+#include <deque>
+#ifdef _WIN32
+	#include <winsock2.h>
+#else
+	#include <time.h>
+	#include <pthread.h>
+#endif
+
+#include "../SiftGPU/SiftGPU.h"
+#include "ServerSiftGPU.h"
+
+class ServerSession;
+
+//a mutex and a condition variable
+class ServerLock
+{
+#ifdef _WIN32
+	CRITICAL_SECTION	_mutex;
+	CONDITION_VARIABLE	_cond;
+public:
+	ServerLock()		{InitializeCriticalSection(&_mutex);	InitializeConditionVariable(&_cond);}
+	~ServerLock()		{DeleteCriticalSection(&_mutex); }
+	void Lock()			{EnterCriticalSection(&_mutex); }
+	void Unlock()		{LeaveCriticalSection(&_mutex); }
+	void Wait()			{SleepConditionVariableCS(&_cond, &_mutex, INFINITE); }
+	void Wait(int ms)	{SleepConditionVariableCS(&_cond, &_mutex, ms); }
+	void Signal()		{WakeConditionVariable(&_cond); }
+	void Broadcast()	{WakeAllConditionVariable(&_cond); }
+#else
+	pthread_mutex_t		_mutex;
+	pthread_cond_t		_cond;
+public:
+	ServerLock()		{pthread_mutex_init(&_mutex, NULL);	pthread_cond_init(&_cond, NULL);}
+	~ServerLock()		{pthread_mutex_destroy(&_mutex);	pthread_cond_destroy(&_cond); }
+	void Lock()			{pthread_mutex_lock(&_mutex); }
+	void Unlock()		{pthread_mutex_unlock(&_mutex); }
+	void Wait()			{pthread_cond_wait(&_cond, &_mutex); }
+	//returns after ms milliseconds if it is not signaled
+	void Wait(int ms)
+	{
+		struct timespec ts;
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_sec += ms / 1000;
+		ts.tv_nsec += (ms % 1000) * 1000000L;
+		if(ts.tv_nsec >= 1000000000L)
+		{
+			ts.tv_sec++;
+			ts.tv_nsec -= 1000000000L;
+		}
+		pthread_cond_timedwait(&_cond, &_mutex, &ts);
+	}
+	void Signal()		{pthread_cond_signal(&_cond); }
+	void Broadcast()	{pthread_cond_broadcast(&_cond); }
+#endif
+};
+
+//holds a lock until the end of the scope
+class ServerLockScope
+{
+	ServerLock&		_lock;
+public:
+	ServerLockScope(ServerLock& lock): _lock(lock)	{_lock.Lock(); }
+	~ServerLockScope()	{_lock.Unlock(); }
+};
+
+//the sessions with a command to run, one queue for each priority class
+class ServerQueue
+{
+	ServerLock		_lock;
+	std::deque<ServerSession*> _sessions[ServerSiftGPU::PRIORITY_NUM];
+	int				_stopped;
+	//the number of requests of the same or a higher priority that can be 
+	//queued ahead of a run, 0 for no limit
+	int				_max_depth;
+public:
+	//the CUDA code binds global texture references, one worker at a time
+	ServerLock		_device_lock;
+	//signaled when a worker is initialized
+	ServerLock		_ready_lock;
+public:
+	ServerQueue(int max_depth = 0)	{_stopped = 0; _max_depth = max_depth; }
+	int Depth()
+	{
+		_lock.Lock();
+		int depth = 0;
+		for(int i = 0; i < ServerSiftGPU::PRIORITY_NUM; ++i) depth += (int) _sessions[i].size();
+		_lock.Unlock();
+		return depth;
+	}
+	//a run of the priority can be queued
+	int Admit(int priority)
+	{
+		if(_max_depth <= 0) return 1;
+		_lock.Lock();
+		int ahead = 0;
+		for(int i = 0; i <= priority; ++i) ahead += (int) _sessions[i].size();
+		_lock.Unlock();
+		return ahead < _max_depth;
+	}
+	void Push(ServerSession * session, int priority)
+	{
+		_lock.Lock();
+		_sessions[priority].push_back(session);
+		//the workers wait for different priorities
+		_lock.Broadcast();
+		_lock.Unlock();
+	}
+	//the oldest session of the highest priority up to max_priority,
+	//returns NULL when the queue is stopped
+	ServerSession* Pop(int max_priority)
+	{
+		ServerSession * session = NULL;
+		_lock.Lock();
+		while(!_stopped && session == NULL)
+		{
+			for(int i = 0; i <= max_priority && session == NULL; ++i)
+			{
+				if(_sessions[i].empty()) continue;
+				session = _sessions[i].front();
+				_sessions[i].pop_front();
+			}
+			if(session == NULL) _lock.Wait();
+		}
+		_lock.Unlock();
+		return session;
+	}
+	void Stop()
+	{
+		_lock.Lock();
+		_stopped = 1;
+		_lock.Broadcast();
+		_lock.Unlock();
+	}
+};
+
+#endif
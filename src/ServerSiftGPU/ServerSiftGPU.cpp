@@ -21,6 +21,13 @@
 
 #include <iostream>
 #include <vector>
+#include <string>
+#include <list>
+#include <map>
+#include <algorithm>
+#include <math.h>
+#include <time.h>
+#include <stdarg.h>
 
 using std::cout;
 using std::vector;
@@ -41,19 +48,36 @@ using std::vector;
     #include <stdlib.h>
 	#include <sys/types.h>
 	#include <sys/socket.h>
+	#include <sys/uio.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <fcntl.h>
 	#include <unistd.h>
+	#include <errno.h>
 	#include <pthread.h>
 	#include <spawn.h>
 	#include <netdb.h>
 	#include <netinet/in.h>
+	#if defined(__linux__)
+	#include <sys/epoll.h>
+	#else
+	#include <sys/select.h>
+	#endif
 	//conversion from Win32
 	typedef int SOCKET;
 	#define INVALID_SOCKET -1
 	#define closesocket close
+	#define SD_BOTH SHUT_RDWR
 #endif
 
+#include "../SiftGPU/GlobalUtil.h"
 #include "../SiftGPU/SiftGPU.h"
+#include "../SiftGPU/SiftGPURequest.h"
+#include "../SiftGPU/FeatureCache.h"
 #include "ServerSiftGPU.h"
+#include "ServerQueue.h"
+#include "ServerCodec.h"
+#include "ServerStore.h"
 
 
 
@@ -118,6 +142,104 @@ public:
 		}while(count_read > 0 && count_read_sum < count);
 		return  count_read_sum == count;
 	}
+	//reads up to count bytes that are already received, without blocking. Returns the
+	//number of bytes, or -1 when the connection is closed or fails. Call it when the 
+	//socket is readable, so that no bytes available means the end of the stream
+	static int readsome(SOCKET s, void* data, int count)
+	{
+#ifdef _WIN32
+		u_long avail = 0;
+		if(ioctlsocket(s, FIONREAD, &avail) != 0) return -1;
+		int n = recv(s, (char*) data, avail > 0 && avail < (u_long) count ? (int) avail : count, 0);
+		return n > 0 ? n : -1;
+#else
+		int n = recv(s, (char*) data, count, MSG_DONTWAIT);
+		if(n > 0) return n;
+		if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) return 0;
+		return -1;
+#endif
+	}
+	//the error of the last socket call
+	static int lasterror()
+	{
+#ifdef _WIN32
+		return WSAGetLastError();
+#else
+		return errno;
+#endif
+	}
+	//gather write of several buffers, with as few system calls as possible
+	static int writev(SOCKET s, const char** data, const int* size, int count)
+	{
+#ifdef _WIN32
+		vector<WSABUF> bufs(count);
+		for(int i = 0; i < count; ++i)
+		{
+			bufs[i].buf = (CHAR*) data[i];
+			bufs[i].len = size[i];
+		}
+		DWORD sent = 0;
+		return WSASend(s, &bufs[0], count, &sent, 0, NULL, NULL) == 0;
+#else
+		vector<struct iovec> iov(count);
+		for(int i = 0; i < count; ++i)
+		{
+			iov[i].iov_base = (void*) data[i];
+			iov[i].iov_len = size[i];
+		}
+		int i = 0;
+		while(i < count)
+		{
+			ssize_t n = ::writev(s, &iov[i], count - i < 64 ? count - i : 64);
+			if(n < 0 && errno == EINTR) continue;
+			if(n < 0) return 0;
+			//skip the buffers that are sent, and continue from the partial one
+			while(i < count && n >= (ssize_t) iov[i].iov_len) n -= iov[i++].iov_len;
+			if(i < count)
+			{
+				iov[i].iov_base = (char*) iov[i].iov_base + n;
+				iov[i].iov_len -= n;
+			}
+		}
+		return 1;
+#endif
+	}
+	//bind to the port and listen, returns INVALID_SOCKET on failure
+	static SOCKET openserver(int port, int backlog)
+	{
+		struct	sockaddr_in	serv_addr;
+		memset((char*)&serv_addr, 0, sizeof(serv_addr));
+		serv_addr.sin_family	= AF_INET;
+		serv_addr.sin_port	= htons(port);
+		serv_addr.sin_addr.s_addr = INADDR_ANY;
+		/////////////////////////////////////////////
+		SOCKET sockfd=socket(AF_INET,SOCK_STREAM,0);
+		if(sockfd==INVALID_SOCKET) 
+		{
+			std::cout << "server: can't open stream socket\n";
+			return INVALID_SOCKET;
+		}
+#ifndef _WIN32
+		//a server that is started again can bind while the old connections are in TIME_WAIT
+		int reuse = 1;
+		setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, (const char*) &reuse, sizeof(reuse));
+#endif
+		if(bind(sockfd,(struct sockaddr*)&serv_addr, sizeof(serv_addr)))
+		{
+			std::cout << "server: can't bind to port " <<  port <<"\n";
+			closesocket(sockfd);
+			return INVALID_SOCKET;
+		}else if(listen(sockfd, backlog))
+		{
+			std::cout << "server: failed to listen\n";
+			closesocket(sockfd);
+			return INVALID_SOCKET;
+		}else
+		{
+			std::cout << "server: listent to port "<< port << "\n";
+			return sockfd;
+		}
+	}
 	static int init()
 	{
  
@@ -139,11 +261,634 @@ public:
 };
 
 
+/////////////////////////////////////////////////////////////////////////////
+//a named shared memory region. A client creates one and sends its name with
+//COMMAND_SHARED_MEMORY, and a server on the same computer maps it. The region 
+//starts with a token that the server sends back, so a server on a different
+//computer (that fails to open the name, or opens another region) is detected.
+/////////////////////////////////////////////////////////////////////////////
+class SharedMemory
+{
+	char*		_data;
+	size_t		_size;
+#ifdef _WIN32
+	HANDLE		_handle;
+#endif
+public:
+	SharedMemory()
+	{
+		_data = NULL;	_size = 0;
+#ifdef _WIN32
+		_handle = NULL;
+#endif
+	}
+	~SharedMemory()		{Close(); }
+	char*	GetData()	{return _data; }
+	size_t	GetSize()	{return _size; }
+	//create a new region, or map an existing one
+	int Map(const char* name, size_t size, int create)
+	{
+		Close();
+#ifdef _WIN32
+		if(create)	_handle = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 
+							(DWORD) (((unsigned __int64) size) >> 32), (DWORD) size, name);
+		else		_handle = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, name);
+		if(_handle == NULL || (create && GetLastError() == ERROR_ALREADY_EXISTS))
+		{
+			Close();
+			return 0;
+		}
+		_data = (char*) MapViewOfFile(_handle, FILE_MAP_ALL_ACCESS, 0, 0, size);
+#else
+		int fd = shm_open(name, create ? O_RDWR | O_CREAT | O_EXCL : O_RDWR, 0600);
+		if(fd < 0) return 0;
+		struct stat st;
+		int ok = create ? ftruncate(fd, size) == 0 : fstat(fd, &st) == 0 && (size_t) st.st_size >= size;
+		void* data = ok ? mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+		close(fd);
+		if(data == MAP_FAILED)
+		{
+			if(create) shm_unlink(name);
+			return 0;
+		}
+		_data = (char*) data;
+#endif
+		if(_data == NULL) 
+		{
+			Close();
+			return 0;
+		}
+		_size = size;
+		return 1;
+	}
+	//remove the name once both processes have the region mapped
+	static void Unlink(const char* name)
+	{
+#ifndef _WIN32
+		shm_unlink(name);
+#endif
+	}
+	void Close()
+	{
+#ifdef _WIN32
+		if(_data) UnmapViewOfFile(_data);
+		if(_handle) CloseHandle(_handle);
+		_handle = NULL;
+#else
+		if(_data) munmap(_data, _size);
+#endif
+		_data = NULL;
+		_size = 0;
+	}
+};
+
+/////////////////////////////////////////////////////////////////////////////
+//framed protocol: a client switches to it by sending COMMAND_FRAMED and the
+//version. Each request then has a header and a payload that holds the same
+//bytes as the legacy command. The response has the same id, and it is not
+//sent if FRAME_NO_REPLY is set. The requests can be pipelined, and the 
+//responses are sent in the order of the requests.
+//After COMMAND_SHARED_MEMORY, a request with FRAME_SHARED has its payload in 
+//the shared memory, and the socket carries only {offset, size, out_offset, 
+//out_size}. The response is written to the output area if it fits, and then
+//the socket carries {offset, size} with FRAME_SHARED set in the response.
+//A multi-client server sets FRAME_BUSY and an empty payload in the response
+//of a run or match that it rejects, and the queue depth in the high bits.
+//Version 2 adds COMMAND_SET_ENCODING, after which the features in the responses
+//are encoded (see EncodeFeatures). Version 3 adds COMMAND_STORE_FEATURES and 
+//COMMAND_MATCH_STORED (see ServerFeatureStore).
+/////////////////////////////////////////////////////////////////////////////
+struct ServerFrame
+{
+	int size;		//number of payload bytes after the header
+	int id;			//request id, which is returned with the response
+	int command;
+	int flags;		//FRAME_* of a request; FRAME_SHARED, FRAME_BUSY and the depth in a response
+};
+
+//the commands of one connection, read from the socket in legacy mode,
+//or from the payload of the current request in framed mode
+class ServerStream
+{
+	typedef ServerSiftGPU S;
+	//small writes are copied, large arrays are sent from where they are
+	enum { COPY_SIZE = 4096 };
+	struct Segment
+	{
+		const char*	data;		//NULL for the data copied to _out
+		size_t		offset;
+		int			size;
+	};
+	SOCKET			_socket;
+	int				_framed;
+	ServerFrame		_request;
+	vector<char>	_in;
+	const char*		_in_data;	//the payload, in _in or in the shared memory
+	size_t			_in_size;
+	size_t			_in_pos;
+	vector<char>	_out;
+	vector<Segment>	_segments;
+	SharedMemory	_shm;
+	int				_shared[4];	//{offset, size, out_offset, out_size}
+	int				_response_flags;
+	//the bytes that are received and sent, including those in the shared memory
+	double			_bytes_in, _bytes_out;
+	//a request that is received without blocking, and a legacy command read from it
+	vector<char>	_pending;
+	int				_pending_ready;
+	int				_buffered;
+	//the wire encoding of the features, ENCODING_FLOAT until the client sets it
+	int				_encoding;
+private:
+	//reads from the socket, or from the payload of a request
+	int		FromSocket()	{return !_framed && !_buffered; }
+	static int GetInt(const char* data, size_t pos)
+	{
+		int value;
+		memcpy(&value, data + pos, sizeof(int));
+		return value;
+	}
+	//the end of a line that starts at pos, as SocketUtil::readline reads at most 1023 characters
+	static size_t LineSize(const char* data, size_t size, size_t pos)
+	{
+		for(size_t i = pos; i < size && i < pos + 1023; ++i) if(data[i] == '\n') return i + 1;
+		return size < pos + 1023 ? size + 1 : pos + 1023;
+	}
+	//the size of the array of num items that follows pos, 0 if it is too large
+	static size_t ArraySize(size_t pos, int num, size_t item)
+	{
+		if(num <= 0) return pos;
+		if((double) num * item > S::REQUEST_MAX_SIZE) return 0;
+		return pos + num * item;
+	}
+	//the size of a frame from its first bytes, 0 if its payload is over REQUEST_MAX_SIZE
+	static size_t FrameSize(const char* data, size_t size)
+	{
+		if(size < sizeof(ServerFrame)) return sizeof(ServerFrame);
+		int payload = GetInt(data, 0);
+		if(payload < 0 || payload > S::REQUEST_MAX_SIZE) return 0;
+		return sizeof(ServerFrame) + payload;
+	}
+	//the size of a legacy request (the command and its arguments) from its first bytes.
+	//It is more than size when more bytes are needed, and 0 for an unknown command or
+	//a request over REQUEST_MAX_SIZE
+	static size_t LegacyRequestSize(const char* data, size_t size)
+	{
+		size_t pos = sizeof(int);
+		if(size < pos) return pos;
+		switch(GetInt(data, 0))
+		{
+		case S::COMMAND_NONE:			case S::COMMAND_EXIT:				case S::COMMAND_DISCONNECT:
+		case S::COMMAND_INITIALIZE:		case S::COMMAND_RUNSIFT:			case S::COMMAND_GET_FEATURE_COUNT:
+		case S::COMMAND_GET_KEY_VECTOR:	case S::COMMAND_GET_DES_VECTOR:		case S::COMMAND_GET_DES_VECTOR_U8:
+		case S::COMMAND_MATCH_INITIALIZE:	case S::COMMAND_GET_FEATURES:	case S::COMMAND_GET_METRICS:
+			return pos;
+		case S::COMMAND_FRAMED:			case S::COMMAND_SET_MAX_DIMENSION:	case S::COMMAND_SET_TIGHTPYRAMID:
+		case S::COMMAND_MATCH_SET_LANGUAGE:	case S::COMMAND_MATCH_SET_MAXSIFT:	case S::COMMAND_SET_ENCODING:
+			return pos + sizeof(int);
+		case S::COMMAND_ALLOCATE_PYRAMID:	case S::COMMAND_SET_PRIORITY:
+			return pos + 2 * sizeof(int);
+		case S::COMMAND_MATCH_GET_MATCH:
+			return pos + 4 * sizeof(int);
+		case S::COMMAND_RUNSIFT_FILE:	case S::COMMAND_SAVE_SIFT:	
+		case S::COMMAND_PARSE_PARAM:	case S::COMMAND_STORE_FEATURES:
+			return LineSize(data, size, pos);
+		case S::COMMAND_MATCH_STORED:
+			pos += 4 * sizeof(int);
+			if(size < pos) return pos;
+			pos = LineSize(data, size, pos);
+			return pos > size ? pos : LineSize(data, size, pos);
+		case S::COMMAND_SET_DETECTION_MASK:
+			pos += 2 * sizeof(int);
+			if(size < pos) return pos;
+			return GetInt(data, 8) > 0 ? ArraySize(pos, GetInt(data, 4), GetInt(data, 8)) : pos;
+		case S::COMMAND_SET_DETECTION_ROI:
+			pos += sizeof(int);
+			return size < pos ? pos : ArraySize(pos, GetInt(data, 4), 4 * sizeof(int));
+		case S::COMMAND_RUNSIFT_DATA:
+			pos += 5 * sizeof(int);
+			return size < pos ? pos : ArraySize(pos, GetInt(data, 20), 1);
+		case S::COMMAND_SET_KEYPOINT:	case S::COMMAND_RUNSIFT_KEY:
+			pos += 2 * sizeof(int);
+			return size < pos ? pos : ArraySize(pos, GetInt(data, 4), sizeof(SiftGPU::SiftKeypoint));
+		case S::COMMAND_MATCH_SET_DES_FLOAT:	case S::COMMAND_MATCH_SET_DES_BYTE:
+			pos += 3 * sizeof(int);
+			if(size < pos) return pos;
+			return ArraySize(pos, GetInt(data, 8), GetInt(data, 0) == S::COMMAND_MATCH_SET_DES_BYTE ? 128 : 128 * sizeof(float));
+		default:
+			return 0;
+		}
+	}
+	//the version is the response of COMMAND_FRAMED
+	int SwitchProtocol(int& command)
+	{
+		int version = 0;
+		if(!readint(&version)) return 0;
+		_bytes_out += sizeof(int);
+		_framed = version > 0;
+		_buffered = 0;
+		version = _framed ? std::min(version, (int) S::PROTOCOL_VERSION) : 0;
+		_encoding = S::ENCODING_FLOAT;
+		command = S::COMMAND_NONE;
+		_request.flags = S::FRAME_NO_REPLY;
+		return SocketUtil::writeint(_socket, version);
+	}
+	int InShared(int offset, int size)
+	{
+		return _shm.GetData() && offset >= 0 && size >= 0 && (size_t) offset + size <= _shm.GetSize();
+	}
+	//map the region of the client, and respond with the token in it
+	int MapShared()
+	{
+		int size = 0, token = 0;
+		char name[256];
+		if(_in_size <= sizeof(int) || _in_size > sizeof(int) + sizeof(name) - 1) return 0;
+		memcpy(&size, _in_data, sizeof(int));
+		memcpy(name, _in_data + sizeof(int), _in_size - sizeof(int));
+		name[_in_size - sizeof(int)] = 0;
+		if(size > (int) S::SHARED_HEADER && _shm.Map(name, size, 0)) memcpy(&token, _shm.GetData(), sizeof(int));
+		else _shm.Close();
+		return writeint(token);
+	}
+public:
+	ServerStream(SOCKET s = INVALID_SOCKET)		{SetSocket(s); }
+	void	SetSocket(SOCKET s)	
+	{
+		_socket = s; _framed = 0; _response_flags = 0;
+		_bytes_in = _bytes_out = 0;
+		_pending.clear(); _pending_ready = 0; _buffered = 0;
+		_encoding = S::ENCODING_FLOAT;
+		_in_data = NULL; _in_size = _in_pos = 0; 
+		memset(&_request, 0, sizeof(_request)); 
+		_shm.Close();
+	}
+	SOCKET	GetSocket()			{return _socket; }
+	int		IsFramed()			{return _framed; }
+	int		GetEncoding()		{return _encoding; }
+	void	SetEncoding(int encoding)	{_encoding = encoding & S::ENCODING_ALL; }
+	//the bytes since the last call
+	void	TakeBytes(double& in, double& out)	
+	{
+		in = _bytes_in; out = _bytes_out;
+		_bytes_in = _bytes_out = 0;
+	}
+	//reads the available bytes of the next request without blocking, so that neither 
+	//the poller nor a worker waits for a client. Returns 1 when the request (a frame or
+	//a legacy command) is complete and BeginCommand takes it, 0 when more bytes are 
+	//needed, and -1 when the connection is closed or fails, or the request is too large
+	int Receive()
+	{
+		if(_pending_ready) return 1;
+		for(;;)
+		{
+			size_t have = _pending.size();
+			const char* data = have ? &_pending[0] : NULL;
+			size_t need = _framed ? FrameSize(data, have) : LegacyRequestSize(data, have);
+			if(need == 0) return -1;
+			if(need <= have) return _pending_ready = 1;
+			//the buffer grows with the received bytes, not with the size that is claimed 
+			_pending.resize(have + std::min(need - have, (size_t) 1 << 20));
+			int n = SocketUtil::readsome(_socket, &_pending[have], (int) (_pending.size() - have));
+			_pending.resize(have + std::max(n, 0));
+			if(n <= 0) return n;
+			_bytes_in += n;
+		}
+	}
+	//reads the next command, COMMAND_NONE is returned after switching protocol
+	int BeginCommand(int& command)
+	{
+		if(_pending_ready)
+		{
+			//the arguments or the payload are read from the received request
+			_pending_ready = 0;
+			_in.swap(_pending);
+			_pending.clear();
+			_in_pos = 0;
+			if(_framed)
+			{
+				memcpy(&_request, &_in[0], sizeof(ServerFrame));
+				_in_data = &_in[0] + sizeof(ServerFrame);
+				_in_size = _in.size() - sizeof(ServerFrame);
+				return BeginFrame(command);
+			}
+			command = GetInt(&_in[0], 0);
+			_in_data = &_in[0] + sizeof(int);
+			_in_size = _in.size() - sizeof(int);
+			_buffered = 1;
+			return command == S::COMMAND_FRAMED ? SwitchProtocol(command) : 1;
+		}
+		if(!_framed)
+		{
+			_buffered = 0;
+			if(!SocketUtil::readint(_socket, &command)) return 0;
+			_bytes_in += sizeof(int);
+			return command == S::COMMAND_FRAMED ? SwitchProtocol(command) : 1;
+		}
+		if(!SocketUtil::readdata(_socket, &_request, sizeof(ServerFrame))) return 0;
+		if(_request.size < 0 || _request.size > S::REQUEST_MAX_SIZE) return 0;
+		_in.resize(_request.size);
+		_in_pos = 0;
+		if(_request.size > 0 && !SocketUtil::readdata(_socket, &_in[0], _request.size)) return 0;
+		_in_data = _request.size > 0 ? &_in[0] : NULL;
+		_in_size = _in.size();
+		_bytes_in += sizeof(ServerFrame) + _in_size;
+		return BeginFrame(command);
+	}
+	//the command of the received frame, and its payload in the shared memory
+	int BeginFrame(int& command)
+	{
+		_out.clear();
+		_segments.clear();
+		_response_flags = 0;
+		command = _request.command;
+		if(_request.flags & S::FRAME_SHARED)
+		{
+			//the payload is read from the shared memory without a copy
+			if(_in_size != sizeof(_shared)) return 0;
+			memcpy(_shared, _in_data, sizeof(_shared));
+			if(!InShared(_shared[0], _shared[1]) || !InShared(_shared[2], _shared[3])) return 0;
+			_in_data = _shm.GetData() + _shared[0];
+			_in_size = _shared[1];
+			_bytes_in += _in_size;
+		}else if(command == S::COMMAND_SHARED_MEMORY)
+		{
+			command = S::COMMAND_NONE;
+			return MapShared();
+		}
+		return 1;
+	}
+	//sends the response of the current request with one gather write
+	int EndCommand()
+	{
+		if(!_framed || (_request.flags & S::FRAME_NO_REPLY)) return 1;
+		ServerFrame response = {0, _request.id, _request.command, _response_flags};
+		size_t total = 0;
+		for(size_t i = 0; i < _segments.size(); ++i) total += _segments[i].size;
+		if((_request.flags & S::FRAME_SHARED) && total <= (size_t) _shared[3])
+		{
+			//the response is copied to the output area of the request
+			char* p = _shm.GetData() + _shared[2];
+			for(size_t i = 0; i < _segments.size(); ++i)
+			{
+				memcpy(p, _segments[i].data ? _segments[i].data : &_out[_segments[i].offset], _segments[i].size);
+				p += _segments[i].size;
+			}
+			int location[2] = {_shared[2], (int) total};
+			response.size = sizeof(location);
+			response.flags |= S::FRAME_SHARED;
+			_bytes_out += sizeof(response) + sizeof(location) + total;
+			const char* data[2] = {(const char*) &response, (const char*) location};
+			int size[2] = {(int) sizeof(response), (int) sizeof(location)};
+			return SocketUtil::writev(_socket, data, size, 2);
+		}
+		vector<const char*> data(_segments.size() + 1);
+		vector<int> size(_segments.size() + 1);
+		data[0] = (const char*) &response;
+		size[0] = sizeof(response);
+		for(size_t i = 0; i < _segments.size(); ++i)
+		{
+			data[i + 1] = _segments[i].data ? _segments[i].data : &_out[_segments[i].offset];
+			size[i + 1] = _segments[i].size;
+			response.size += _segments[i].size;
+		}
+		_bytes_out += sizeof(response) + response.size;
+		return SocketUtil::writev(_socket, &data[0], &size[0], (int) data.size());
+	}
+	int WithFeatures()	{return _framed && (_request.flags & S::FRAME_WITH_FEATURES); }
+	int ExpectsReply()	{return _framed && !(_request.flags & S::FRAME_NO_REPLY); }
+	//FRAME_BUSY and the queue depth of the response
+	void SetResponseFlags(int flags)	{_response_flags = flags; }
+	//counts the bytes of a read in legacy mode
+	int Received(int status, int count)
+	{
+		if(status) _bytes_in += count;
+		return status;
+	}
+	/////////////////////////////////////////////////
+	int readint(int* data, int count = 1)
+	{
+		if(FromSocket()) return Received(SocketUtil::readint(_socket, data, count), count * sizeof(int));
+		data[0] = 0;
+		return readdata(data, count * sizeof(int));
+	}
+	int readdata(void* data, int count)
+	{
+		if(FromSocket()) return Received(SocketUtil::readdata(_socket, data, count), count);
+		if(count < 0 || _in_pos + count > _in_size) return 0;
+		if(count > 0) memcpy(data, _in_data + _in_pos, count);
+		_in_pos += count;
+		return 1;
+	}
+	//the next count bytes, which are not copied in framed mode; 
+	//they stay valid until the next command
+	const char* readptr(int count)
+	{
+		if(count < 0) return NULL;
+		if(FromSocket())
+		{
+			_in.resize(count + 1);
+			return Received(SocketUtil::readdata(_socket, &_in[0], count), count) ? &_in[0] : NULL;
+		}
+		if(_in_pos + count > _in_size) return NULL;
+		const char* p = _in_data + _in_pos;
+		_in_pos += count;
+		return p;
+	}
+	int readline(char* buf, int nread)
+	{
+		if(FromSocket()) 
+		{
+			int n = SocketUtil::readline(_socket, buf, nread);
+			if(n > 0) _bytes_in += n;
+			return n;
+		}
+		int n = 0;
+		if(_in_pos >= _in_size) return 0;
+		while(n + 1 < nread && _in_pos < _in_size)
+		{
+			char c = _in_data[_in_pos++];
+			if(c == '\n') break;
+			buf[n++] = c ? c : ' ';
+		}
+		buf[n] = 0;
+		return n + 1;
+	}
+	int writeint(int data)
+	{
+		return writedata(&data, sizeof(int));
+	}
+	//in framed mode, the data must stay valid until EndCommand
+	int writedata(const void* data, int count)
+	{
+		if(!_framed) 
+		{
+			int status = SocketUtil::writedata(_socket, data, count);
+			if(status) _bytes_out += count;
+			return status;
+		}
+		if(count <= 0) return 1;
+		Segment seg;
+		seg.size = count;
+		seg.offset = _out.size();
+		if(count < COPY_SIZE)
+		{
+			seg.data = NULL;
+			_out.insert(_out.end(), (const char*) data, (const char*) data + count);
+		}else
+		{
+			seg.data = (const char*) data;
+		}
+		//merge with the previous copied segment
+		if(seg.data == NULL && _segments.size() && _segments.back().data == NULL)
+			_segments.back().size += count;
+		else
+			_segments.push_back(seg);
+		return 1;
+	}
+};
+
+//count, keys and descriptors in one response, the features are encoded into packed
+static void WriteFeatures(ServerStream& io, int count, const vector<SiftGPU::SiftKeypoint>& keys, 
+						  const vector<float>& descriptors, int encoding, vector<char>& packed)
+{
+	if(count < 0) count = 0;
+	io.writeint(count);
+	if(count == 0 || (encoding & ServerSiftGPU::ENCODING_NO_FEATURES)) return;
+	if(encoding)
+	{
+		EncodeFeatures(count, &keys[0], &descriptors[0], encoding, packed);
+		io.writedata(&packed[0], (int) packed.size());
+		return;
+	}
+	io.writedata(&keys[0], count * sizeof(SiftGPU::SiftKeypoint));
+	io.writedata(&descriptors[0], count * 128 * sizeof(float));
+}
+
+
+//called with the lock held, and returns without it. The callback runs unlocked,
+//and the request is deleted after it if it is released in the callback
+static void FinishRequest(ServerLock& lock, ComboSiftGPU * combo, SiftGPURequest * request)
+{
+	ComboSiftGPU::RequestCallback callback = request->_callback;
+	request->_state = callback ? SiftGPURequest::REQUEST_CALLBACK : SiftGPURequest::REQUEST_FINISHED;
+	lock.Broadcast();
+	lock.Unlock();
+	if(callback == NULL) return;
+	callback(combo, request, request->_user_data);
+	lock.Lock();
+	request->_state = SiftGPURequest::REQUEST_FINISHED;
+	int released = request->_released;
+	lock.Broadcast();
+	lock.Unlock();
+	if(released) delete request;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+//the I/O thread of a client. The requests that expect a response are queued
+//before they are sent, and the thread reads the responses in the same order.
+//Once it is started, the synchronous calls also get their responses from it,
+//so they can not be used in the callbacks.
+/////////////////////////////////////////////////////////////////////////////
+class ServerIO
+{
+public:
+	ServerSiftGPU*	_client;
+	ServerLock		_lock;
+	std::deque<SiftGPURequest*> _pending;
+	SiftGPURequest*	_sync;		//the request of the synchronous call
+	int				_closed;
+	int				_started;
+#if defined(_WIN32)
+	HANDLE			_thread;
+#else
+	pthread_t		_thread;
+#endif
+public:
+	ServerIO(ServerSiftGPU* client)
+	{
+		_client = client;
+		_sync = NULL;
+		_closed = 0;
+		_started = 0;
+	}
+	int Start()
+	{
+#if defined(_WIN32)
+		_thread = CreateThread(NULL, 0, RunThread, this, 0, 0);
+		_started = _thread != NULL;
+#else
+		_started = pthread_create(&_thread, NULL, RunThread, this) == 0;
+#endif
+		return _started;
+	}
+	void Join()
+	{
+		if(!_started) return;
+#if defined(_WIN32)
+		WaitForSingleObject(_thread, INFINITE);
+		CloseHandle(_thread);
+#else
+		pthread_join(_thread, NULL);
+#endif
+		_started = 0;
+	}
+#if defined(_WIN32)
+	static DWORD WINAPI RunThread(LPVOID param)
+#else
+	static void* RunThread(void* param)
+#endif
+	{
+		((ServerIO*) param)->_client->RunIO();
+		return 0;
+	}
+	//called with the lock held, and returns without it
+	void Finish(SiftGPURequest * request)
+	{
+		FinishRequest(_lock, _client, request);
+	}
+};
+
+//count, keys and descriptors at offset of a response, returns the count
+static int ReadFeatureData(const char* data, size_t size, size_t offset, int encoding,
+						   vector<SiftGPU::SiftKeypoint>& keys, vector<float>& descriptors)
+{
+	int num = 0;
+	if(offset + sizeof(int) <= size) memcpy(&num, data + offset, sizeof(int));
+	size_t key_size = num * sizeof(SiftGPU::SiftKeypoint), des_size = num * 128 * sizeof(float);
+	offset += sizeof(int);
+	if(num > 0 && (encoding & ServerSiftGPU::ENCODING_NO_FEATURES))
+	{
+		//only the count is sent
+		keys.clear();
+		descriptors.clear();
+		return num;
+	}
+	if(num > 0 && encoding) return DecodeFeatures(data + offset, size - offset, num, keys, descriptors);
+	if(num <= 0 || offset + key_size + des_size > size) return 0;
+	keys.resize(num);
+	descriptors.resize(num * 128);
+	memcpy(&keys[0], data + offset, key_size);
+	memcpy(&descriptors[0], data + offset + key_size, des_size);
+	return num;
+}
+
 ServerSiftGPU::ServerSiftGPU(int port, char* remote_server)
 {
 	_port = port;
 	_socketfd = INVALID_SOCKET;
     _connected = 0;
+	_streaming = 0;
+	_request_id = 0;
+	_response_data = NULL;
+	_response_size = 0;
+	_feature_num = 0;
+	_shm = NULL;
+	_shm_used = 0;
+	_io = NULL;
+	_queue_depth = 0;
+	_busy = 0;
+	_protocol = 0;
+	_encoding = ENCODING_FLOAT;
 	strcpy(_server_name, remote_server? remote_server : "\0");
 }
 
@@ -224,654 +969,3544 @@ int ServerSiftGPU::ConnectServer(const char* server_name, int port)
 
 void ServerSiftGPU::Disconnect()
 {
-	SocketUtil::writeint(_socketfd, _server_name[0]? COMMAND_DISCONNECT : COMMAND_EXIT);
-	closesocket(_socketfd);
+	Request(_server_name[0]? COMMAND_DISCONNECT : COMMAND_EXIT, FRAME_NO_REPLY);
+	StopIO();
+	CloseSharedMemory();
+	if(_socketfd != INVALID_SOCKET) closesocket(_socketfd);
 	_socketfd = INVALID_SOCKET;
 	_connected = 0;
 }
 
-ServerSiftGPU::~ServerSiftGPU()
+int ServerSiftGPU::IsConnected()
 {
-	if(_connected) Disconnect();
+	return _connected && _socketfd != INVALID_SOCKET && !(_io && _io->_closed);
 }
 
+int ServerSiftGPU::OpenSharedMemory(size_t size)
+{
+	static int count = 0;
+	char name[64];
+	CloseSharedMemory();
+	if(size > SHARED_MAX_SIZE) return 0;
+#ifdef _WIN32
+	int pid = _getpid();
+	sprintf(name, "Local\\siftgpu_%d_%d", pid, ++count);
+#else
+	int pid = (int) getpid();
+	sprintf(name, "/siftgpu_%d_%d", pid, ++count);
+#endif
+	SharedMemory * shm = new SharedMemory;
+	if(!shm->Map(name, size, 1))
+	{
+		delete shm;
+		return 0;
+	}
+	//the server sends back the token if it maps the same region
+	int token = (int) (((unsigned int) time(NULL) ^ ((unsigned int) pid << 12) ^ ((unsigned int) count << 24)) | 1), param = (int) size;
+	memcpy(shm->GetData(), &token, sizeof(int));
+	int ok = Response(Request(COMMAND_SHARED_MEMORY, 0, &param, sizeof(int), name, (int) strlen(name))) && ResponseInt(0) == token;
+	SharedMemory::Unlink(name);
+	if(!ok)
+	{
+		delete shm;
+		return 0;
+	}
+	if(_io) _io->_lock.Lock();
+	_shm = shm;
+	_shm_used = SHARED_HEADER;
+	if(_io) _io->_lock.Unlock();
+	return 1;
+}
 
-inline void ServerSiftGPU::ServerLoop(int port, int argc, char** argv)
+void ServerSiftGPU::CloseSharedMemory()
 {
-	SOCKET sockfd, newsockfd;	
-	struct	sockaddr_in	serv_addr, cli_addr;
-	socklen_t addr_len = sizeof(sockaddr_in);
-	//////////////////////////////////////////////////
-	memset((char*)&serv_addr, 0, sizeof(serv_addr));
-	serv_addr.sin_family	= AF_INET;
-	serv_addr.sin_port	= htons(port);
-	serv_addr.sin_addr.s_addr = INADDR_ANY;
-	/////////////////////////////////////////////
+	if(_io) _io->_lock.Lock();
+	if(_shm) delete _shm;
+	_shm = NULL;
+	_shm_used = 0;
+	if(_io) _io->_lock.Unlock();
+}
 
-    if(ServerSiftGPU::InitSocket() == 0)
+void ServerSiftGPU::GrowSharedMemory(int size, int reply)
+{
+	size_t block = (size + 63) & ~((size_t) 63);
+	if(_io) _io->_lock.Lock();
+	size_t used = _shm_used, need = used + block + (reply ? SHARED_RESERVE : 0);
+	if(_io) _io->_lock.Unlock();
+	//a larger region can only be created when the server is not using this one
+	if(need <= _shm->GetSize() || used > SHARED_HEADER) return;
+	OpenSharedMemory(std::max(_shm->GetSize() * 2, need + SHARED_SIZE));
+}
+
+int ServerSiftGPU::AllocateShared(int size, int reply, int location[4])
+{
+	size_t block = (size + 63) & ~((size_t) 63);
+	if(_shm_used + block + (reply ? SHARED_RESERVE : 0) > _shm->GetSize()) return 0;
+	//the response can use half of the rest, so the next requests can be sent before it
+	size_t rest = _shm->GetSize() - _shm_used - block;
+	size_t out_size = reply ? std::max(rest / 2, std::min(rest, (size_t) SHARED_RESERVE)) : 0;
+	location[0] = (int) _shm_used;
+	location[1] = size;
+	location[2] = reply ? (int) (_shm_used + block) : 0;
+	location[3] = (int) out_size;
+	_shm_used += block + out_size;
+	return 1;
+}
+
+int ServerSiftGPU::Request(int command, int flags, const void * data1, int size1, const void * data2, int size2, 
+						   SiftGPURequest * request)
+{
+	if(_socketfd == INVALID_SOCKET) return 0;
+	if(data1 == NULL) size1 = 0;
+	if(data2 == NULL) size2 = 0;
+	//FRAME_SHARED asks for the response in the shared memory, and it is also 
+	//used for the large payloads
+	int shared = (_shm != NULL) && ((flags & FRAME_SHARED) || size1 + size2 >= SHARED_MIN_SIZE);
+	int reply = !(flags & FRAME_NO_REPLY), location[4];
+	flags &= ~FRAME_SHARED;
+	if(shared) GrowSharedMemory(size1 + size2, reply);
+
+	//the id, the shared memory and the response queue are updated together
+	if(_io)
 	{
-		return;
+		_io->_lock.Lock();
+		if(_io->_closed) 
+		{
+			_io->_lock.Unlock();
+			return 0;
+		}
 	}
-	//////////////////////////////////////////////////////////////
-	sockfd=socket(AF_INET,SOCK_STREAM,0);
-	if(sockfd==INVALID_SOCKET) 
+	shared = shared && _shm && AllocateShared(size1 + size2, reply, location);
+	ServerFrame frame = {shared ? (int) sizeof(location) : size1 + size2, ++_request_id, command, flags};
+	if(_io && reply)
 	{
-		std::cout << "server: can't open stream socket\n";
-		return;
-	}else if(bind(sockfd,(struct sockaddr*)&serv_addr, sizeof(serv_addr)))
-    {
-	    std::cout << "server: can't bind to port " <<  port <<"\n";
-	    return;
-    }else if(listen(sockfd, 1))
+		if(request == NULL)
+		{
+			request = _io->_sync = new SiftGPURequest();
+			request->_sync = 1;
+		}
+		request->_id = frame.id;
+		request->_command = command;
+		_io->_pending.push_back(request);
+	}
+	if(_io) _io->_lock.Unlock();
+
+	int result;
+	if(shared)
 	{
-		std::cout << "server: failed to listen\n";
-		return;
+		char* p = _shm->GetData() + location[0];
+		if(size1 > 0) memcpy(p, data1, size1);
+		if(size2 > 0) memcpy(p + size1, data2, size2);
+		frame.flags |= FRAME_SHARED;
+		const char * data[2] = {(const char*) &frame, (const char*) location};
+		int size[2] = {(int) sizeof(frame), (int) sizeof(location)};
+		result = SocketUtil::writev(_socketfd, data, size, 2);
 	}else
 	{
-		std::cout << "server: listent to port "<< port << "\n";
+		const char * data[3] = {(const char*) &frame, (const char*) data1, (const char*) data2};
+		int size[3] = {(int) sizeof(frame), size1, size2};
+		result = SocketUtil::writev(_socketfd, data, size, 3);
 	}
-		
-	newsockfd = accept(sockfd, (struct sockaddr*) &cli_addr, &addr_len);
-	if(newsockfd == INVALID_SOCKET)
+	//the I/O thread stops and fails the queued requests
+	if(!result && _io) shutdown(_socketfd, SD_BOTH);
+	else if(!result)
 	{
-		std::cout << "error: accept failed\n";
-        closesocket(sockfd);
-		return;
+		closesocket(_socketfd);
+		_socketfd = INVALID_SOCKET;
 	}
-	////////////////////////////////////////////////////////////////
-	char buf[1024];
-	int command, result;
-	int sift_feature_count = 0;;
-	vector<SiftGPU::SiftKeypoint> keys;
-	vector<float> descriptors;
-	vector<char> databuf;
-
-	/////////////////////////////////////////////////////////////////
-	SiftGPU siftgpu;
-	SiftMatchGPU matcher;
-
-	if(argc > 0) siftgpu.ParseParam(argc, argv);
-    
-	/////////////////////
-	siftgpu.SetVerbose(0);
-	/////////////////////////////////////////////////////////////////
+	return result ? frame.id : 0;
+}
+
+int ServerSiftGPU::Response(int id)
+{
+	ServerFrame frame;
+	_response_data = NULL;
+	_response_size = 0;
+	if(_io)
+	{
+		//the response is read by the I/O thread
+		SiftGPURequest* request = _io->_sync;
+		_io->_sync = NULL;
+		if(request == NULL) return 0;
+		_io->_lock.Lock();
+		while(request->_state != SiftGPURequest::REQUEST_FINISHED) _io->_lock.Wait();
+		_io->_lock.Unlock();
+		int result = id == request->_id && request->_result >= 0;
+		_response.swap(request->_response);
+		delete request;
+		_response_data = _response.size() ? &_response[0] : NULL;
+		_response_size = _response.size();
+		return result;
+	}
+	if(id == 0 || _socketfd == INVALID_SOCKET) return 0;
+	int ok = SocketUtil::readdata(_socketfd, &frame, sizeof(frame)) && frame.id == id && frame.size >= 0;
+	if(ok) _response.resize(frame.size);
+	if(ok && frame.size > 0) ok = SocketUtil::readdata(_socketfd, &_response[0], frame.size);
+	//the responses are out of sync after a failure, so the connection is closed
+	if(!ok)
+	{
+		closesocket(_socketfd);
+		_socketfd = INVALID_SOCKET;
+		return 0;
+	}
+	_queue_depth = (unsigned int) frame.flags >> FRAME_DEPTH_SHIFT;
+	_busy = (frame.flags & FRAME_BUSY) != 0;
+	//all the requests are finished, so the shared memory can be reused 
+	if(_shm && id == _request_id) _shm_used = SHARED_HEADER;
+	if(frame.flags & FRAME_SHARED)
+	{
+		int location[2];
+		if(_shm == NULL || frame.size != sizeof(location)) return 0;
+		memcpy(location, &_response[0], sizeof(location));
+		if(location[0] < 0 || location[1] < 0 || (size_t) location[0] + location[1] > _shm->GetSize()) return 0;
+		_response_data = _shm->GetData() + location[0];
+		_response_size = location[1];
+	}else
+	{
+		_response_data = frame.size > 0 ? &_response[0] : NULL;
+		_response_size = frame.size;
+	}
+	return 1;
+}
+
+int ServerSiftGPU::ResponseInt(size_t offset)
+{
+	int value = 0;
+	if(offset + sizeof(int) <= _response_size) memcpy(&value, _response_data + offset, sizeof(int));
+	return value;
+}
+
+void ServerSiftGPU::ReadFeatures(size_t offset)
+{
+	_feature_num = ReadFeatureData(_response_data, _response_size, offset, _encoding, _keys, _descriptors);
+}
+
+int ServerSiftGPU::RunRequest(int command, const void * data1, int size1, const void * data2, int size2)
+{
+	_feature_num = 0;
+	if(!_connected) return 0;
+	//the features come back in the same response
+	int id = Request(command, FRAME_WITH_FEATURES | FRAME_SHARED, data1, size1, data2, size2);
+	if(!Response(id)) return 0;
+	ReadFeatures(sizeof(int));
+	return ResponseInt(0);
+}
+
+int ServerSiftGPU::StartIO()
+{
+	if(_io) return !_io->_closed;
+	if(_socketfd == INVALID_SOCKET) return 0;
+	_io = new ServerIO(this);
+	if(_io->Start()) return 1;
+	delete _io;
+	_io = NULL;
+	return 0;
+}
+
+void ServerSiftGPU::StopIO()
+{
+	if(_io == NULL) return;
+	//the blocking read of the I/O thread returns after shutdown
+	if(_socketfd != INVALID_SOCKET) shutdown(_socketfd, SD_BOTH);
+	_io->Join();
+	delete _io;
+	_io = NULL;
+}
+
+void ServerSiftGPU::RunIO()
+{
+	vector<char> buf;
+	ServerFrame frame;
+	while(SocketUtil::readdata(_socketfd, &frame, sizeof(frame)) && frame.size >= 0)
+	{
+		buf.resize(frame.size);
+		if(frame.size > 0 && !SocketUtil::readdata(_socketfd, &buf[0], frame.size)) break;
+		const char * data = frame.size > 0 ? &buf[0] : NULL;
+		size_t size = frame.size;
+
+		_io->_lock.Lock();
+		SiftGPURequest * request = _io->_pending.size() ? _io->_pending.front() : NULL;
+		if(request == NULL || request->_id != frame.id)
+		{
+			_io->_lock.Unlock();
+			break;
+		}
+		_io->_pending.pop_front();
+		SharedMemory * shm = _shm;
+		_io->_lock.Unlock();
+
+		int ok = 1;
+		if(frame.flags & FRAME_SHARED)
+		{
+			int location[2] = {0, 0};
+			if(data) memcpy(location, data, std::min(size, sizeof(location)));
+			ok = shm && size == sizeof(location) && location[0] >= 0 && location[1] >= 0 && 
+				(size_t) location[0] + location[1] <= shm->GetSize();
+			data = ok ? shm->GetData() + location[0] : NULL;
+			size = ok ? location[1] : 0;
+		}
+		//the results are copied before the shared memory is reused
+		int first = 0;
+		if(size >= sizeof(int)) memcpy(&first, data, sizeof(int));
+		if(!ok || ((frame.flags & FRAME_BUSY) && !request->_sync))
+		{
+			request->_result = -1;
+		}else if(request->_sync)
+		{
+			if(size > 0) request->_response.assign(data, data + size);
+			request->_result = 0;
+		}else if(request->_command == COMMAND_MATCH_GET_MATCH || request->_command == COMMAND_MATCH_STORED)
+		{
+			int nm = first > 0 && sizeof(int) * (2 * (size_t) first + 1) <= size ? first : 0;
+			if(nm > 0) request->_matches.assign((const int*) (data + sizeof(int)), (const int*) (data + sizeof(int)) + 2 * nm);
+			//-1 for an id that is not stored
+			int missing = request->_command == COMMAND_MATCH_STORED && (first < 0 || size < sizeof(int));
+			request->_result = missing ? -1 : nm;
+		}else
+		{
+			request->_result = first ? ReadFeatureData(data, size, sizeof(int), _encoding, request->_keys, request->_descriptors) : -1;
+		}
+
+		_io->_lock.Lock();
+		//all the requests are finished, so the shared memory can be reused 
+		if(_shm && frame.id == _request_id) _shm_used = SHARED_HEADER;
+		_queue_depth = (unsigned int) frame.flags >> FRAME_DEPTH_SHIFT;
+		if(request->_sync) _busy = (frame.flags & FRAME_BUSY) != 0;
+		_io->Finish(request);
+	}
+
+	//the connection is closed, and the queued requests fail
+	_io->_lock.Lock();
+	_io->_closed = 1;
+	while(_io->_pending.size())
+	{
+		SiftGPURequest * request = _io->_pending.front();
+		_io->_pending.pop_front();
+		request->_result = -1;
+		_io->Finish(request);
+		_io->_lock.Lock();
+	}
+	_io->_lock.Unlock();
+}
+
+//a request that is not sent fails in the calling thread
+static SiftGPURequest* FailRequest(ComboSiftGPU * combo, SiftGPURequest * request)
+{
+	request->_result = -1;
+	request->_state = SiftGPURequest::REQUEST_CALLBACK;
+	if(request->_callback) request->_callback(combo, request, request->_user_data);
+	request->_state = SiftGPURequest::REQUEST_FINISHED;
+	if(!request->_released) return request;
+	delete request;
+	return NULL;
+}
+
+SiftGPURequest* ServerSiftGPU::AsyncRequest(SiftGPURequest * request, int command, int flags, 
+						const void * data1, int size1, const void * data2, int size2)
+{
+	if(_connected && StartIO() && Request(command, flags, data1, size1, data2, size2, request)) return request;
+	//the I/O thread finishes a request that is queued before it fails
+	return request->_id ? request : FailRequest(this, request);
+}
+
+//the sub-window roi of the pixels with a row stride, which is copied into a tightly 
+//packed buffer if it is not already. width and height become those of the sub-window,
+//and NULL is returned if it is not valid
+static const void* PackPixels(int& width, int& height, const void * data, int pixel_size, 
+							  int row_bytes, const int * roi, vector<char>& packed)
+{
+	if(width <=0 || height <= 0 || data == NULL || pixel_size == 0) return NULL;
+	int x = 0, y = 0, w = width, h = height;
+	if(roi)
+	{
+		x = roi[0]; y = roi[1]; w = roi[2]; h = roi[3];
+		if(x < 0 || y < 0 || w <= 0 || h <= 0 || x + w > width || y + h > height) return NULL;
+	}
+	if(row_bytes == 0) row_bytes = width * pixel_size;
+	const char * src = ((const char*) data) + y * (size_t) row_bytes + x * pixel_size;
+	width = w;
+	height = h;
+	if(row_bytes == w * pixel_size) return src;
+	packed.resize((size_t) w * h * pixel_size);
+	for(int i = 0; i < h; ++i, src += row_bytes) 
+		memcpy(&packed[0] + (size_t) i * w * pixel_size, src, w * pixel_size);
+	return &packed[0];
+}
+
+SiftGPURequest* ServerSiftGPU::RunSIFTAsync(const char * imgpath, RequestCallback callback, void * user_data)
+{
+	return AsyncRequest(new SiftGPURequest(callback, user_data), COMMAND_RUNSIFT_FILE, 
+						FRAME_WITH_FEATURES | FRAME_SHARED, imgpath, (int) strlen(imgpath));
+}
+
+SiftGPURequest* ServerSiftGPU::RunSIFTAsync(int width, int height, const void * data, unsigned int gl_format, 
+											unsigned int gl_type, RequestCallback callback, void * user_data)
+{
+	SiftGPURequest * request = new SiftGPURequest(callback, user_data);
+	int num_bytes = GetPixelSizeGL(gl_format , gl_type) * width * height;
+	if(width <= 0 || height <= 0 || data == NULL || num_bytes <= 0) return FailRequest(this, request);
+	unsigned int data_des[5] = {(unsigned int) width, (unsigned int) height, gl_format, gl_type, (unsigned int) num_bytes};
+	return AsyncRequest(request, COMMAND_RUNSIFT_DATA, FRAME_WITH_FEATURES | FRAME_SHARED, 
+						data_des, 5 * sizeof(unsigned int), data, num_bytes);
+}
+
+//the packed pixels are sent before returning, so they are not kept
+SiftGPURequest* ServerSiftGPU::RunSIFTAsync(int width, int height, const void * data, unsigned int gl_format, 
+											unsigned int gl_type, int row_bytes, const int * roi, 
+											RequestCallback callback, void * user_data)
+{
+	vector<char> packed;
+	const void * pixels = PackPixels(width, height, data, GetPixelSizeGL(gl_format , gl_type), row_bytes, roi, packed);
+	if(pixels == NULL) return FailRequest(this, new SiftGPURequest(callback, user_data));
+	return RunSIFTAsync(width, height, pixels, gl_format, gl_type, callback, user_data);
+}
+
+SiftGPURequest* ServerSiftGPU::GetSiftMatchAsync(int max_match, float distmax, float ratiomax, 
+						int mutual_best_match, RequestCallback callback, void * user_data)
+{
+	int param[2] = {max_match, mutual_best_match};
+	float fparam[2] = {distmax, ratiomax};
+	return AsyncRequest(new SiftGPURequest(callback, user_data), COMMAND_MATCH_GET_MATCH, 
+						FRAME_SHARED, param, sizeof(param), fparam, sizeof(fparam));
+}
+
+int ServerSiftGPU::WaitRequest(SiftGPURequest * request)
+{
+	if(request == NULL) return -1;
+	if(_io == NULL) return ComboSiftGPU::WaitRequest(request);
+	_io->_lock.Lock();
+	while(request->_state < SiftGPURequest::REQUEST_CALLBACK) _io->_lock.Wait();
+	int result = request->_result;
+	_io->_lock.Unlock();
+	return result;
+}
+
+int ServerSiftGPU::IsRequestFinished(SiftGPURequest * request)
+{
+	if(request == NULL || _io == NULL) return 1;
+	_io->_lock.Lock();
+	int finished = request->_state >= SiftGPURequest::REQUEST_CALLBACK;
+	_io->_lock.Unlock();
+	return finished;
+}
+
+void ServerSiftGPU::ReleaseRequest(SiftGPURequest * request)
+{
+	if(request == NULL) return;
+	if(_io == NULL) 
+	{
+		ComboSiftGPU::ReleaseRequest(request);
+		return;
+	}
+	_io->_lock.Lock();
+	while(request->_state < SiftGPURequest::REQUEST_CALLBACK) _io->_lock.Wait();
+	int in_callback = request->_state == SiftGPURequest::REQUEST_CALLBACK;
+	if(in_callback) request->_released = 1;
+	_io->_lock.Unlock();
+	if(!in_callback) delete request;
+}
+
+void ServerSiftGPU::SetPriority(int priority, int deadline)
+{
+	int param[2] = {priority, deadline};
+	if(_connected) Request(COMMAND_SET_PRIORITY, FRAME_NO_REPLY, param, sizeof(param));
+}
+
+int ServerSiftGPU::GetQueueDepth()
+{
+	return _queue_depth;
+}
+
+int ServerSiftGPU::IsBusy()
+{
+	return _busy;
+}
+
+int ServerSiftGPU::SetEncoding(int encoding)
+{
+	//the servers before version 2 send floats
+	if(!_connected || _protocol < 2) return _encoding;
+	int param = encoding & (_protocol < 3 ? ENCODING_COMPACT : ENCODING_ALL);
+	if(Response(Request(COMMAND_SET_ENCODING, 0, &param, sizeof(int)))) _encoding = ResponseInt(0);
+	return _encoding;
+}
+
+//the ids are sent as lines, and the server reads up to 1023 characters
+static int IsStoreId(const char * id)
+{
+	return id && id[0] && strlen(id) < 1024 && strchr(id, '\n') == NULL;
+}
+
+int ServerSiftGPU::StoreFeatures(const char * id)
+{
+	if(!_connected || _protocol < 3 || !IsStoreId(id)) return 0;
+	return Request(COMMAND_STORE_FEATURES, FRAME_NO_REPLY, id, (int) strlen(id)) != 0;
+}
+
+//{max_match, mutual_best_match}, {distmax, ratiomax} and the two ids
+static void StoredMatchPayload(const char * id1, const char * id2, int max_match, float distmax, 
+							   float ratiomax, int mutual_best_match, std::string& payload)
+{
+	int param[2] = {max_match, mutual_best_match};
+	float fparam[2] = {distmax, ratiomax};
+	payload.assign((const char*) param, sizeof(param));
+	payload.append((const char*) fparam, sizeof(fparam));
+	payload.append(id1);
+	payload += '\n';
+	payload.append(id2);
+}
+
+int ServerSiftGPU::GetStoredMatch(const char * id1, const char * id2, int max_match, int match_buffer[][2],
+								  float distmax, float ratiomax, int mutual_best_match)
+{
+	if(!_connected || _protocol < 3 || !IsStoreId(id1) || !IsStoreId(id2)) return -1;
+	std::string payload;
+	StoredMatchPayload(id1, id2, max_match, distmax, ratiomax, mutual_best_match, payload);
+	if(!Response(Request(COMMAND_MATCH_STORED, FRAME_SHARED, payload.data(), (int) payload.size())) || 
+		_response_size < sizeof(int)) return -1;
+	int nm = ResponseInt(0);
+	if(nm > max_match) nm = max_match;
+	if(nm <= 0 || sizeof(int) * (2 * nm + 1) > _response_size) return nm < 0 ? -1 : 0;
+	memcpy(match_buffer[0], _response_data + sizeof(int), sizeof(int) * 2 * nm);
+	return nm;
+}
+
+SiftGPURequest* ServerSiftGPU::GetStoredMatchAsync(const char * id1, const char * id2, int max_match, float distmax, 
+						float ratiomax, int mutual_best_match, RequestCallback callback, void * user_data)
+{
+	SiftGPURequest * request = new SiftGPURequest(callback, user_data);
+	if(_protocol < 3 || !IsStoreId(id1) || !IsStoreId(id2)) return FailRequest(this, request);
+	std::string payload;
+	StoredMatchPayload(id1, id2, max_match, distmax, ratiomax, mutual_best_match, payload);
+	return AsyncRequest(request, COMMAND_MATCH_STORED, FRAME_SHARED, payload.data(), (int) payload.size());
+}
+
+const char* ServerSiftGPU::GetMetrics()
+{
+	if(!_connected || !Response(Request(COMMAND_GET_METRICS, 0))) return NULL;
+	int size = ResponseInt(0);
+	if(size < 0 || sizeof(int) + size > _response_size) return NULL;
+	_metrics.assign(_response_data + sizeof(int), size);
+	return _metrics.c_str();
+}
+
+ServerSiftGPU::~ServerSiftGPU()
+{
+	if(_connected) Disconnect();
+}
+
+
+//split a line of parameters that is sent by SetParamSiftGPU
+static void ParseParamLine(SiftGPU& siftgpu, char* buf)
+{
+	vector<char*> params;
+	char* p = buf;
+	while(*p)
+	{
+		while(*p == ' ' || *p == '\t')*p++ = 0;
+		params.push_back(p);
+		while(*p && *p != ' ' && *p != '\t') p++;
+	}
+	if(params.size()) siftgpu.ParseParam(params.size(), &params[0]);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+//the counters, gauges and histograms of a server in the Prometheus text 
+//format, which are read with COMMAND_GET_METRICS or from the HTTP listener.
+//The stage latencies come from SiftGPU::_timing (the load and the pyramid 
+//initialization are 0 when the image is run again), and the run latency is
+//the time of the command in the server, without the wait in the queue.
+/////////////////////////////////////////////////////////////////////////////
+class ServerMetrics
+{
+	typedef ServerSiftGPU S;
+	enum
+	{
+		//_timing[0..8], the display VBO is not used by the servers
+		STAGE_NUM		= 9,
+		//a command that runs longer fails the liveness check
+		STALL_SECONDS	= 300
+	};
+	struct Histogram
+	{
+		const double*	bounds;
+		int				num;
+		vector<double>	counts;		//cumulative for each bound, then +Inf
+		double			sum;
+		void Init(const double* b, int n)	{bounds = b; num = n; counts.assign(n + 1, 0); sum = 0; }
+		void Observe(double value)
+		{
+			for(int i = 0; i < num; ++i) if(value <= bounds[i]) counts[i]++;
+			counts[num]++;
+			sum += value;
+		}
+	};
+	ServerLock		_lock;
+	double			_requests[S::COMMAND_NUM];
+	double			_rejected, _expired, _failed;
+	double			_bytes_in, _bytes_out;
+	Histogram		_stages[STAGE_NUM];
+	Histogram		_run_seconds;
+	Histogram		_features;
+	int				_sessions, _max_sessions;
+	int				_workers_ready, _queue_depth, _max_depth;
+	//the pyramid memory of each worker, and when its command started in ClockUS (-1 if idle)
+	vector<int>		_pyramid_kb;
+	vector<long long> _running;
+	long long		_start_time;
+	ServerFeatureStore* _store;
+public:
+	static const char* CommandName(int command)
+	{
+		//in the order of the commands
+		static const char* names[S::COMMAND_NUM] = 
+		{
+			"none", "exit", "disconnect", "initialize", "allocate_pyramid", "runsift", "runsift_file", 
+			"runsift_key", "runsift_data", "save_sift", "set_max_dimension", "set_keypoint", 
+			"get_feature_count", "set_tightpyramid", "get_key_vector", "get_des_vector", "parse_param",
+			"match_initialize", "match_set_language", "match_set_des_float", "match_set_des_byte", 
+			"match_set_maxsift", "match_get_match", "get_des_vector_u8", "set_detection_mask", 
+			"set_detection_roi", "get_features", "framed", "shared_memory", "set_priority", "get_metrics",
+			"set_encoding", "store_features", "match_stored"
+		};
+		return command >= 0 && command < S::COMMAND_NUM && names[command] ? names[command] : "unknown";
+	}
+private:
+	static void Append(std::string& text, const char* format, ...)
+	{
+		char line[512];
+		va_list args;
+		va_start(args, format);
+		vsnprintf(line, sizeof(line), format, args);
+		va_end(args);
+		text += line;
+	}
+	static void WriteHistogram(std::string& text, const char* name, const char* label, const Histogram& h)
+	{
+		const char* sep = label[0] ? "," : "";
+		for(int i = 0; i < h.num; ++i)
+			Append(text, "%s_bucket{%s%sle=\"%g\"} %.0f\n", name, label, sep, h.bounds[i], h.counts[i]);
+		Append(text, "%s_bucket{%s%sle=\"+Inf\"} %.0f\n", name, label, sep, h.counts[h.num]);
+		Append(text, label[0] ? "%s_sum{%s} %.6f\n" : "%s_sum%s %.6f\n", name, label, h.sum);
+		Append(text, label[0] ? "%s_count{%s} %.0f\n" : "%s_count%s %.0f\n", name, label, h.counts[h.num]);
+	}
+	int  Stalled()
+	{
+		long long now = ClockTimer::ClockUS();
+		for(size_t i = 0; i < _running.size(); ++i)
+			if(_running[i] >= 0 && now - _running[i] > STALL_SECONDS * 1000000LL) return 1;
+		return 0;
+	}
+public:
+	//max_sessions is the number of clients that can be served at once (0 for no limit),
+	//and max_depth is the -queue limit of a multi-client server
+	ServerMetrics(int worker_num, int max_sessions, int max_depth, ServerFeatureStore * store)
+	{
+		static const double seconds[] = {0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5};
+		static const double features[] = {0, 100, 500, 1000, 2000, 4000, 8000, 16000, 32000};
+		for(int i = 0; i < S::COMMAND_NUM; ++i) _requests[i] = 0;
+		for(int i = 0; i < STAGE_NUM; ++i) _stages[i].Init(seconds, sizeof(seconds) / sizeof(double));
+		_run_seconds.Init(seconds, sizeof(seconds) / sizeof(double));
+		_features.Init(features, sizeof(features) / sizeof(double));
+		_rejected = _expired = _failed = 0;
+		_bytes_in = _bytes_out = 0;
+		_sessions = 0;
+		_max_sessions = max_sessions;
+		_workers_ready = 0;
+		_queue_depth = 0;
+		_max_depth = max_depth;
+		_pyramid_kb.assign(worker_num, 0);
+		_running.assign(worker_num, -1);
+		_start_time = ClockTimer::ClockUS();
+		_store = store;
+	}
+	//a worker starts a command
+	void Begin(int worker)
+	{
+		_lock.Lock();
+		_running[worker] = ClockTimer::ClockUS();
+		_lock.Unlock();
+		//named by End, when the command is known
+		if(SiftTracer::IsEnabled()) SiftTracer::Begin("command", "server");
+	}
+	//a command is finished (worker < 0 for the commands of the polling thread)
+	void End(int worker, int command, ServerStream& io)
+	{
+		double in, out;
+		io.TakeBytes(in, out);
+		_lock.Lock();
+		if(command > S::COMMAND_NONE && command < S::COMMAND_NUM) _requests[command]++;
+		_bytes_in += in;
+		_bytes_out += out;
+		if(worker >= 0) _running[worker] = -1;
+		_lock.Unlock();
+		if(worker >= 0 && SiftTracer::IsEnabled()) SiftTracer::End(in + out, CommandName(command));
+	}
+	//a run on an image by the SiftGPU of a worker
+	void Run(int worker, SiftGPU& siftgpu, int result, int feature_num)
+	{
+		int pyramid_kb = siftgpu.GetPyramidMemoryKB();
+		_lock.Lock();
+		if(result)
+		{
+			for(int i = 0; i < STAGE_NUM; ++i) _stages[i].Observe(siftgpu._timing[i]);
+			_features.Observe(feature_num);
+		}else
+		{
+			_failed++;
+		}
+		if(_running[worker] >= 0) _run_seconds.Observe((ClockTimer::ClockUS() - _running[worker]) * 1e-6);
+		_pyramid_kb[worker] = pyramid_kb;
+		_lock.Unlock();
+	}
+	void SetPyramid(int worker, SiftGPU& siftgpu)
+	{
+		int pyramid_kb = siftgpu.GetPyramidMemoryKB();
+		_lock.Lock();
+		_pyramid_kb[worker] = pyramid_kb;
+		_lock.Unlock();
+	}
+	//a request is rejected because the queue is full, or it has expired in the queue
+	void Reject(int expired)
+	{
+		_lock.Lock();
+		if(expired) _expired++;
+		else _rejected++;
+		_lock.Unlock();
+	}
+	void AddSessions(int num)
+	{
+		_lock.Lock();
+		_sessions += num;
+		_lock.Unlock();
+	}
+	void SetWorkersReady(int num)
+	{
+		_lock.Lock();
+		_workers_ready = num;
+		_lock.Unlock();
+	}
+	void SetQueueDepth(int depth)
+	{
+		_lock.Lock();
+		_queue_depth = depth;
+		_lock.Unlock();
+	}
+	//liveness: no command is stuck (e.g. a hung GPU)
+	int IsLive()
+	{
+		_lock.Lock();
+		int live = !Stalled();
+		_lock.Unlock();
+		return live;
+	}
+	//readiness: a worker is initialized and a new request would not be rejected
+	int IsReady()
+	{
+		_lock.Lock();
+		int ready = _workers_ready > 0 && !Stalled() && 
+					(_max_sessions <= 0 || _sessions < _max_sessions) &&
+					(_max_depth <= 0 || _queue_depth < _max_depth);
+		_lock.Unlock();
+		return ready;
+	}
+	void Write(std::string& text)
+	{
+		static const char* stages[STAGE_NUM] = 
+		{
+			"load", "init_pyramid", "build_pyramid", "detect", "feature_list", 
+			"orientation", "multi_orientation", "download", "descriptor"
+		};
+		char label[64];
+		double store[5];
+		_store->GetStats(store);
+		text.clear();
+		_lock.Lock();
+		text += "# HELP siftgpu_requests_total Requests by command.\n# TYPE siftgpu_requests_total counter\n";
+		for(int i = 0; i < S::COMMAND_NUM; ++i)
+			if(_requests[i] > 0) Append(text, "siftgpu_requests_total{command=\"%s\"} %.0f\n", CommandName(i), _requests[i]);
+		text += "# HELP siftgpu_rejected_total Runs rejected as busy.\n# TYPE siftgpu_rejected_total counter\n";
+		Append(text, "siftgpu_rejected_total{reason=\"queue_full\"} %.0f\n", _rejected);
+		Append(text, "siftgpu_rejected_total{reason=\"deadline\"} %.0f\n", _expired);
+		text += "# HELP siftgpu_failed_runs_total Runs that failed.\n# TYPE siftgpu_failed_runs_total counter\n";
+		Append(text, "siftgpu_failed_runs_total %.0f\n", _failed);
+		text += "# HELP siftgpu_received_bytes_total Bytes received, including the shared memory.\n# TYPE siftgpu_received_bytes_total counter\n";
+		Append(text, "siftgpu_received_bytes_total %.0f\n", _bytes_in);
+		text += "# HELP siftgpu_sent_bytes_total Bytes sent, including the shared memory.\n# TYPE siftgpu_sent_bytes_total counter\n";
+		Append(text, "siftgpu_sent_bytes_total %.0f\n", _bytes_out);
+		text += "# HELP siftgpu_stage_seconds Latency of the SiftGPU stages of a run.\n# TYPE siftgpu_stage_seconds histogram\n";
+		for(int i = 0; i < STAGE_NUM; ++i)
+		{
+			sprintf(label, "stage=\"%s\"", stages[i]);
+			WriteHistogram(text, "siftgpu_stage_seconds", label, _stages[i]);
+		}
+		text += "# HELP siftgpu_run_seconds Latency of a run in the server.\n# TYPE siftgpu_run_seconds histogram\n";
+		WriteHistogram(text, "siftgpu_run_seconds", "", _run_seconds);
+		text += "# HELP siftgpu_features Features per image.\n# TYPE siftgpu_features histogram\n";
+		WriteHistogram(text, "siftgpu_features", "", _features);
+		text += "# HELP siftgpu_queue_depth Requests waiting for a worker.\n# TYPE siftgpu_queue_depth gauge\n";
+		Append(text, "siftgpu_queue_depth %d\n", _queue_depth);
+		text += "# HELP siftgpu_sessions Connected clients.\n# TYPE siftgpu_sessions gauge\n";
+		Append(text, "siftgpu_sessions %d\n", _sessions);
+		text += "# HELP siftgpu_workers_ready Initialized workers.\n# TYPE siftgpu_workers_ready gauge\n";
+		Append(text, "siftgpu_workers_ready %d\n", _workers_ready);
+		text += "# HELP siftgpu_pyramid_bytes GPU memory of the pyramids.\n# TYPE siftgpu_pyramid_bytes gauge\n";
+		for(size_t i = 0; i < _pyramid_kb.size(); ++i)
+			Append(text, "siftgpu_pyramid_bytes{worker=\"%d\"} %.0f\n", (int) i, _pyramid_kb[i] * 1024.0);
+		text += "# HELP siftgpu_store_entries Feature sets in the memory of the store.\n# TYPE siftgpu_store_entries gauge\n";
+		Append(text, "siftgpu_store_entries %.0f\n", store[0]);
+		text += "# HELP siftgpu_store_bytes Memory of the store.\n# TYPE siftgpu_store_bytes gauge\n";
+		Append(text, "siftgpu_store_bytes %.0f\n", store[1]);
+		text += "# HELP siftgpu_store_lookups_total Lookups of the store by where they are found.\n# TYPE siftgpu_store_lookups_total counter\n";
+		Append(text, "siftgpu_store_lookups_total{result=\"memory\"} %.0f\n", store[2]);
+		Append(text, "siftgpu_store_lookups_total{result=\"disk\"} %.0f\n", store[3]);
+		Append(text, "siftgpu_store_lookups_total{result=\"miss\"} %.0f\n", store[4]);
+		text += "# HELP siftgpu_uptime_seconds Time since the server started.\n# TYPE siftgpu_uptime_seconds gauge\n";
+		Append(text, "siftgpu_uptime_seconds %.3f\n", (ClockTimer::ClockUS() - _start_time) * 1e-6);
+		_lock.Unlock();
+	}
+};
+
+//the response of COMMAND_GET_METRICS, the text must stay valid until EndCommand
+static void WriteMetrics(ServerStream& io, ServerMetrics& metrics, std::string& text)
+{
+	metrics.Write(text);
+	io.writeint((int) text.size());
+	io.writedata(text.c_str(), (int) text.size());
+}
+
+/////////////////////////////////////////////////////////////////////////////
+//the HTTP listener of -http port, one connection at a time: 
+//GET /metrics, /healthz (liveness), /readyz (readiness, 503 when busy)
+//and /trace (the events since -trace, in the Chrome trace format)
+/////////////////////////////////////////////////////////////////////////////
+class ServerHttp
+{
+	enum { REQUEST_SIZE = 4096, TIMEOUT_SECONDS = 2 };
+	ServerMetrics*	_metrics;
+	SOCKET			_sockfd;
+	int				_stopped;
+	int				_started;
+	std::string		_text;
+#if defined(_WIN32)
+	HANDLE			_thread;
+#else
+	pthread_t		_thread;
+#endif
+public:
+	ServerHttp(ServerMetrics * metrics)
+	{
+		_metrics = metrics;
+		_sockfd = INVALID_SOCKET;
+		_stopped = 0;
+		_started = 0;
+	}
+	~ServerHttp()	{Stop(); }
+	int Start(int port)
+	{
+		_sockfd = SocketUtil::openserver(port, SOMAXCONN);
+		if(_sockfd == INVALID_SOCKET) return 0;
+#if defined(_WIN32)
+		_thread = CreateThread(NULL, 0, RunThread, this, 0, 0);
+		_started = _thread != NULL;
+#else
+		_started = pthread_create(&_thread, NULL, RunThread, this) == 0;
+#endif
+		return _started;
+	}
+	void Stop()
+	{
+		_stopped = 1;
+		if(_started)
+		{
+#if defined(_WIN32)
+			WaitForSingleObject(_thread, INFINITE);
+			CloseHandle(_thread);
+#else
+			pthread_join(_thread, NULL);
+#endif
+			_started = 0;
+		}
+		if(_sockfd != INVALID_SOCKET) closesocket(_sockfd);
+		_sockfd = INVALID_SOCKET;
+	}
+#if defined(_WIN32)
+	static DWORD WINAPI RunThread(LPVOID param)
+#else
+	static void* RunThread(void* param)
+#endif
+	{
+		((ServerHttp*) param)->Run();
+		return 0;
+	}
+	void Run()
+	{
+		SiftTracer::SetThreadName("http");
+		while(!_stopped)
+		{
+			//wake up every second to check _stopped
+			fd_set fds;
+			struct timeval timeout;
+			FD_ZERO(&fds);
+			FD_SET(_sockfd, &fds);
+			timeout.tv_sec = 1;
+			timeout.tv_usec = 0;
+			if(select((int) _sockfd + 1, &fds, NULL, NULL, &timeout) <= 0) continue;
+			SOCKET s = accept(_sockfd, NULL, NULL);
+			if(s == INVALID_SOCKET) continue;
+			Serve(s);
+			closesocket(s);
+		}
+	}
+	void Serve(SOCKET s)
+	{
+		//a slow client does not block the listener for long
+#ifdef _WIN32
+		DWORD timeout = TIMEOUT_SECONDS * 1000;
+#else
+		struct timeval timeout;
+		timeout.tv_sec = TIMEOUT_SECONDS;
+		timeout.tv_usec = 0;
+#endif
+		setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, (const char*) &timeout, sizeof(timeout));
+		char request[REQUEST_SIZE];
+		int size = 0, n;
+		request[0] = 0;
+		while(size + 1 < REQUEST_SIZE && !strstr(request, "\r\n\r\n") && !strstr(request, "\n\n") &&
+			(n = recv(s, request + size, REQUEST_SIZE - 1 - size, 0)) > 0)
+		{
+			size += n;
+			request[size] = 0;
+		}
+		char method[16] = "", path[256] = "";
+		sscanf(request, "%15s %255s", method, path);
+		char* query = strchr(path, '?');
+		if(query) *query = 0;
+		const char* status = "200 OK";
+		const char* type = "text/plain; version=0.0.4";
+		if(strcmp(method, "GET") && strcmp(method, "HEAD"))
+		{
+			status = "405 Method Not Allowed";
+			_text = "method not allowed\n";
+		}else if(strcmp(path, "/metrics") == 0)
+		{
+			_metrics->Write(_text);
+		}else if(strcmp(path, "/healthz") == 0)
+		{
+			int live = _metrics->IsLive();
+			if(!live) status = "503 Service Unavailable";
+			_text = live ? "ok\n" : "stalled\n";
+		}else if(strcmp(path, "/readyz") == 0)
+		{
+			int ready = _metrics->IsReady();
+			if(!ready) status = "503 Service Unavailable";
+			_text = ready ? "ready\n" : "busy\n";
+		}else if(strcmp(path, "/trace") == 0)
+		{
+			SiftTracer::GetJSON(_text);
+			type = "application/json";
+		}else
+		{
+			status = "404 Not Found";
+			_text = "not found\n";
+		}
+		char header[256];
+		sprintf(header, "HTTP/1.0 %s\r\nContent-Type: %s\r\n"
+				"Content-Length: %d\r\nConnection: close\r\n\r\n", status, type, (int) _text.size());
+		const char* data[2] = {header, _text.c_str()};
+		int length[2] = {(int) strlen(header), strcmp(method, "HEAD") ? (int) _text.size() : 0};
+		SocketUtil::writev(s, data, length, 2);
+	}
+};
+
+inline void ServerSiftGPU::ServerLoop(int port, int http_port, ServerFeatureStore* store, int argc, char** argv)
+{
+	SOCKET sockfd, newsockfd;	
+	struct	sockaddr_in	cli_addr;
+	socklen_t addr_len = sizeof(sockaddr_in);
+
+    if(ServerSiftGPU::InitSocket() == 0)
+	{
+		return;
+	}
+	//////////////////////////////////////////////////////////////
+	sockfd = SocketUtil::openserver(port, 1);
+	if(sockfd == INVALID_SOCKET) return;
+
+	//the context is created for the first client, and one client is served at a time
+	ServerMetrics metrics(1, 1, 0, store);
+	ServerHttp http(&metrics);
+	metrics.SetWorkersReady(1);
+	if(http_port > 0 && !http.Start(http_port)) std::cout << "error: can't start the HTTP listener\n";
+		
+	newsockfd = accept(sockfd, (struct sockaddr*) &cli_addr, &addr_len);
+	if(newsockfd == INVALID_SOCKET)
+	{
+		std::cout << "error: accept failed\n";
+        closesocket(sockfd);
+		return;
+	}
+	metrics.AddSessions(1);
+	////////////////////////////////////////////////////////////////
+	char buf[1024];
+	int command, result;
+	int sift_feature_count = 0;;
+	vector<SiftGPU::SiftKeypoint> keys;
+	vector<float> descriptors;
+	vector<char> databuf, packed, stored[2];
+	std::string text;
+	ServerStream io(newsockfd);
+
+	/////////////////////////////////////////////////////////////////
+	SiftGPU siftgpu;
+	SiftMatchGPU matcher;
+
+	if(argc > 0) siftgpu.ParseParam(argc, argv);
+	SiftTracer::SetThreadName("server");
+    
+	/////////////////////
+	siftgpu.SetVerbose(0);
+	/////////////////////////////////////////////////////////////////
 
     do
     {
-	    while(SocketUtil::readint(newsockfd, &command) && command != COMMAND_DISCONNECT)
-	    {
-		    switch(command)
-		    {
-			case COMMAND_INITIALIZE:
-				{
-				    result = (siftgpu.CreateContextGL() == SiftGPU::SIFTGPU_FULL_SUPPORTED);
-				    SocketUtil::writeint(newsockfd, result);
-				    if(result)	break;
-				}
-            case COMMAND_EXIT:
-                closesocket(newsockfd);
-                closesocket(sockfd);
-                return;
-		    case COMMAND_ALLOCATE_PYRAMID:
-			    {
-				    int size[2];
-				    SocketUtil::readint(newsockfd, size, 2);
-				    if(size[0] > 0 && size[1] > 0) siftgpu.AllocatePyramid(size[0], size[1]);
-				    break;
-			    }
-		    case COMMAND_GET_KEY_VECTOR:
-			    {
-				    int size = sift_feature_count * sizeof(SiftGPU::SiftKeypoint);
-				    SocketUtil::writedata(newsockfd, &keys[0], size);
-				    break;
-			    }
-		    case COMMAND_GET_DES_VECTOR:
-			    {
-				    int size = sift_feature_count * sizeof(float) * 128;
-				    SocketUtil::writedata(newsockfd, &descriptors[0], size);
-				    break;
-			    }
-		    case COMMAND_RUNSIFT:
-			    {
-				    result = siftgpu.RunSIFT();
-				    if((sift_feature_count = siftgpu.GetFeatureNum()) > 0)
-				    {
-					    keys.resize(sift_feature_count);
-					    descriptors.resize(sift_feature_count * 128);
-					    siftgpu.GetFeatureVector(&keys[0], &descriptors[0]);
-						std::cout << "RunSIFT: [-] [" << sift_feature_count << "]\n";
-				    }
-				    SocketUtil::writeint(newsockfd, result);
-				    break;
-			    }
-		    case COMMAND_RUNSIFT_FILE:
-			    {
-				    SocketUtil::readline(newsockfd, buf, 1024);
+	    while(io.BeginCommand(command) && command != COMMAND_DISCONNECT)
+	    {
+			metrics.Begin(0);
+		    switch(command)
+		    {
+			case COMMAND_NONE:
+				break;
+			case COMMAND_INITIALIZE:
+				{
+				    result = (siftgpu.CreateContextGL() == SiftGPU::SIFTGPU_FULL_SUPPORTED);
+				    io.writeint(result);
+				    if(result)	break;
+					metrics.SetWorkersReady(0);
+				}
+            case COMMAND_EXIT:
+                closesocket(newsockfd);
+                closesocket(sockfd);
+                return;
+		    case COMMAND_ALLOCATE_PYRAMID:
+			    {
+				    int size[2];
+				    io.readint(size, 2);
+				    if(size[0] > 0 && size[1] > 0) siftgpu.AllocatePyramid(size[0], size[1]);
+					metrics.SetPyramid(0, siftgpu);
+				    break;
+			    }
+		    case COMMAND_GET_KEY_VECTOR:
+			    {
+				    int size = sift_feature_count * sizeof(SiftGPU::SiftKeypoint);
+				    io.writedata(&keys[0], size);
+				    break;
+			    }
+		    case COMMAND_GET_DES_VECTOR:
+			    {
+				    int size = sift_feature_count * sizeof(float) * 128;
+				    io.writedata(&descriptors[0], size);
+				    break;
+			    }
+		    case COMMAND_GET_DES_VECTOR_U8:
+			    {
+				    if(sift_feature_count <= 0) break;
+				    databuf.resize(sift_feature_count * 128);
+				    siftgpu.GetFeatureVectorU8(NULL, (unsigned char*) &databuf[0]);
+				    io.writedata(&databuf[0], sift_feature_count * 128);
+				    break;
+			    }
+		    case COMMAND_SET_DETECTION_MASK:
+			    {
+				    int size[2];
+				    if(!io.readint(size, 2)) break;
+				    if(size[0] > 0 && size[1] > 0)
+				    {
+					    databuf.resize(size[0] * size[1]);
+					    if(io.readdata(&databuf[0], size[0] * size[1]))
+						    siftgpu.SetDetectionMask(size[0], size[1], (const unsigned char*) &databuf[0]);
+				    }else
+				    {
+					    siftgpu.SetDetectionMask(0, 0, NULL);
+				    }
+				    break;
+			    }
+		    case COMMAND_SET_DETECTION_ROI:
+			    {
+				    int num;
+				    if(!io.readint(&num)) break;
+				    if(num > 0)
+				    {
+					    databuf.resize(num * 4 * sizeof(int));
+					    if(io.readdata(&databuf[0], num * 4 * sizeof(int)))
+						    siftgpu.SetDetectionROI(num, (const int*) &databuf[0]);
+				    }else
+				    {
+					    siftgpu.SetDetectionROI(0, NULL);
+				    }
+				    break;
+			    }
+		    case COMMAND_RUNSIFT:
+			    {
+				    result = siftgpu.RunSIFT();
+				    if((sift_feature_count = siftgpu.GetFeatureNum()) > 0)
+				    {
+					    keys.resize(sift_feature_count);
+					    descriptors.resize(sift_feature_count * 128);
+					    siftgpu.GetFeatureVector(&keys[0], &descriptors[0]);
+						std::cout << "RunSIFT: [-] [" << sift_feature_count << "]\n";
+				    }
+					metrics.Run(0, siftgpu, result, sift_feature_count);
+				    io.writeint(result);
+				    break;
+			    }
+		    case COMMAND_RUNSIFT_FILE:
+			    {
+				    io.readline(buf, 1024);
+
+				    result = siftgpu.RunSIFT(buf);
+				    if((sift_feature_count = siftgpu.GetFeatureNum()) > 0)
+				    {
+					    keys.resize(sift_feature_count);
+					    descriptors.resize(sift_feature_count * 128);
+					    siftgpu.GetFeatureVector(&keys[0], &descriptors[0]);
+				    }
+					std::cout << "RunSIFT: "<< buf <<" " << sift_feature_count << "\n" ;
+					metrics.Run(0, siftgpu, result, sift_feature_count);
+				    io.writeint(result);
+				    break;
+			    }
+		    case COMMAND_SET_KEYPOINT:
+			    {
+				    int keys_have_orientation;
+				    io.readint(&sift_feature_count);
+				    io.readint(&keys_have_orientation);
+				    if(sift_feature_count > 0)
+				    {
+					    keys.resize(sift_feature_count);
+					    descriptors.resize(sift_feature_count * 128);
+						io.readdata(&keys[0], int(keys.size() * sizeof(SiftGPU::SiftKeypoint)));
+					    siftgpu.SetKeypointList(sift_feature_count, &keys[0], keys_have_orientation);
+				    }
+				    break;
+			    }
+		    case COMMAND_RUNSIFT_KEY:
+			    {
+				    int keys_have_orientation;
+				    io.readint(&sift_feature_count);
+				    io.readint(&keys_have_orientation);
+				    if(sift_feature_count > 0)
+				    {
+						std::cout << "RunSIFT: "<< sift_feature_count << " KEYPOINTS\n" ;
+					    int key_data_size = sift_feature_count * sizeof(SiftGPU::SiftKeypoint);
+					    keys.resize(sift_feature_count);
+					    descriptors.resize(sift_feature_count * 128);
+					    io.readdata(&keys[0], key_data_size);
+					    result = siftgpu.RunSIFT(sift_feature_count, &keys[0], keys_have_orientation);
+					    siftgpu.GetFeatureVector(NULL, &descriptors[0]);
+						metrics.Run(0, siftgpu, result, sift_feature_count);
+				    }else
+				    {
+					    result = 0;
+				    }
+				    io.writeint(result);
+				    break;
+			    }
+		    case COMMAND_RUNSIFT_DATA:
+			    {
+				    int data_des[4], size = 0;	
+				    io.readint(data_des, 4);
+					io.readint(&size, 1);
+					std::cout << "RunSIFT: [" << data_des[0] << "x" << data_des[1] << "]";
+
+					//the pixels are used where they are received (or in the shared memory)
+					const char* data_ptr = io.readptr(size);
+					if(!IsImageData(data_des, size)) data_ptr = NULL;
+
+				    result = data_ptr && siftgpu.RunSIFT(data_des[0], data_des[1], data_ptr, data_des[2], data_des[3]);
+				    if((sift_feature_count = data_ptr ? siftgpu.GetFeatureNum() : 0) > 0)
+				    {
+					    keys.resize(sift_feature_count);
+					    descriptors.resize(sift_feature_count * 128);
+					    siftgpu.GetFeatureVector(&keys[0], &descriptors[0]);
+				    }
+					std::cout << "[" << sift_feature_count << "]\n";
+					metrics.Run(0, siftgpu, result, sift_feature_count);
+				    io.writeint(result);
+				    break;
+			    }
+		    case COMMAND_SAVE_SIFT:
+			    {
+				    io.readline(buf, 1024);
+				    siftgpu.SaveSIFT(buf);
+				    break;
+			    }
+		    case COMMAND_SET_MAX_DIMENSION:
+			    {
+				    int maxd;
+				    if(io.readint(&maxd) && maxd > 0) siftgpu.SetMaxDimension(maxd);
+				    break;
+			    }
+		    case COMMAND_SET_TIGHTPYRAMID:
+			    {
+				    int tight;
+				    if(io.readint(&tight))  siftgpu.SetTightPyramid(tight);
+				    break;
+			    }
+		    case COMMAND_GET_FEATURE_COUNT:
+			    {
+				    io.writeint(sift_feature_count);
+				    break;
+			    }
+			case COMMAND_PARSE_PARAM:
+				{
+				    io.readline(buf, 1024);
+					std::cout << "ParseParam [" << buf << "]\n";
+					ParseParamLine(siftgpu, buf);
+					break;
+				}
+			case COMMAND_MATCH_INITIALIZE:
+				{
+					result = matcher.CreateContextGL();
+					io.writeint(result);
+					break;
+				}
+			case COMMAND_MATCH_SET_LANGUAGE:
+				{
+					int language;
+					if(io.readint(&language)) matcher.SetLanguage(language);
+					break;
+				}
+			case COMMAND_MATCH_SET_DES_FLOAT:
+				{
+					int command[3] = {0, 0, 0};
+					if(io.readdata(command, sizeof(command)))
+					{
+						const char* des = io.readptr(sizeof(float) * 128 * command[1]);
+						if(des) matcher.SetDescriptors(command[0], command[1], (const float*) des, command[2]);
+					}
+					break;
+				}
+			case COMMAND_MATCH_SET_DES_BYTE:
+				{
+					int command[3] = {0, 0, 0};
+					if(io.readdata(command, sizeof(command)))
+					{
+						const char* des = io.readptr(sizeof(unsigned char) * 128 * command[1]);
+						if(des) matcher.SetDescriptors(command[0], command[1], (const unsigned char*) des, command[2]);
+					}
+					break;
+				}
+			case COMMAND_MATCH_GET_MATCH:
+				{
+					int command[2]; float fcommand[2];
+					result = 0;
+					if( io.readdata(command, sizeof(command)) &&
+						io.readdata(fcommand, sizeof(fcommand)))
+					{
+						int max_match  = command[0], mbm = command[1];
+						float distmax = fcommand[0], ratiomax = fcommand[1];
+						databuf.resize(max_match * 2 * sizeof(int));
+						result = matcher.GetSiftMatch(max_match, ( int(*)[2]) (&databuf[0]), distmax, ratiomax, mbm);
+
+					}
+					io.writeint(result);
+					if(result > 0) io.writedata(&databuf[0], sizeof(int) * 2 * result);
+					std::cout << "SiftMatch: " <<  result << "\n"; 
+					break;
+				}
+			case COMMAND_MATCH_SET_MAXSIFT:
+				{
+					int max_sift;
+					if(io.readint(&max_sift)) matcher.SetMaxSift(max_sift);
+					break;
+				}
+				break;
+		    case COMMAND_GET_FEATURES:
+			    {
+				    WriteFeatures(io, sift_feature_count, keys, descriptors, io.GetEncoding(), packed);
+				    break;
+			    }
+			case COMMAND_SET_PRIORITY:
+				{
+					//the requests of the only client are run in order
+					int param[2];
+					io.readint(param, 2);
+					break;
+				}
+			case COMMAND_GET_METRICS:
+				{
+					WriteMetrics(io, metrics, text);
+					break;
+				}
+			case COMMAND_SET_ENCODING:
+				{
+					int encoding;
+					if(io.readint(&encoding)) io.SetEncoding(encoding);
+					io.writeint(io.GetEncoding());
+					break;
+				}
+			case COMMAND_STORE_FEATURES:
+				{
+					if(io.readline(buf, 1024) > 0) store->Put(buf, sift_feature_count, keys, descriptors);
+					break;
+				}
+			case COMMAND_MATCH_STORED:
+				{
+					int command[2]; float fcommand[2]; char id[1024] = "";
+					result = -1;
+					buf[0] = 0;
+					if( io.readdata(command, sizeof(command)) && io.readdata(fcommand, sizeof(fcommand)) &&
+						io.readline(buf, 1024) > 0 && io.readline(id, 1024) > 0)
+					{
+						int num[2] = {store->Get(buf, stored[0]), store->Get(id, stored[1])};
+						//each feature of the first set has one match at most
+						int max_match  = std::min(command[0], num[0]), mbm = command[1];
+						if(num[0] >= 0 && num[1] >= 0 && max_match > 0)
+						{
+							for(int i = 0; i < 2; ++i) 
+								matcher.SetDescriptors(i, num[i], (const unsigned char*) (num[i] > 0 ? &stored[i][0] : NULL));
+							databuf.resize(max_match * 2 * sizeof(int));
+							result = matcher.GetSiftMatch(max_match, ( int(*)[2]) (&databuf[0]), fcommand[0], fcommand[1], mbm);
+						}else if(num[0] >= 0 && num[1] >= 0)
+						{
+							result = 0;
+						}
+					}
+					io.writeint(result);
+					if(result > 0) io.writedata(&databuf[0], sizeof(int) * 2 * result);
+					std::cout << "SiftMatch: [" << buf << "] [" << id << "] " << result << "\n"; 
+					break;
+				}
+		    default:
+			    std::cout << "unrecognized command: " << command << "\n";
+				break;
+		    }
+		    if(io.WithFeatures()) WriteFeatures(io, sift_feature_count, keys, descriptors, io.GetEncoding(), packed);
+		    io.EndCommand();
+			metrics.End(0, command, io);
+	    }
+
+        //client disconneted
+        closesocket(newsockfd);
+		metrics.AddSessions(-1);
+        //wait for the next client.
+        std::cout << "wait for new client...";
+	    newsockfd = accept(sockfd, (struct sockaddr*) &cli_addr, &addr_len);
+	    if(newsockfd == INVALID_SOCKET)
+	    {
+		    std::cout << "error: accept failed";
+            closesocket(sockfd);
+		    return;
+	    }else
+        {
+            std::cout << "connected\n\n";
+            io.SetSocket(newsockfd);
+			metrics.AddSessions(1);
+        }
+   }while(1);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+//multi-client server (server_siftgpu -server port -multi n [siftgpu_param])
+//The client sockets are multiplexed with epoll (select on other systems).
+//A readable session is handed to one of the n workers, which runs one command
+//and gives the session back to the poller. Each worker has its own SiftGPU, 
+//SiftMatchGPU and context, while a session keeps only the CPU data (parameters,
+//input, mask, features and descriptors to match), so any worker can serve it.
+/////////////////////////////////////////////////////////////////////////////
+class ServerSession
+{
+	typedef ServerSiftGPU S;
+public:
+	SOCKET			_socket;
+	int				_id;
+	//parses the parameters of the client, it is never initialized
+	SiftGPU*		_param;
+	//the last input, which is used again by RUNSIFT, RUNSIFT_KEY and SAVE_SIFT
+	std::string		_imgpath;
+	int				_data_des[4];
+	vector<char>	_imgdata;
+	//the keypoint list for the next image, detection mask and rectangles
+	int				_keypoint_orientation;
+	vector<SiftGPU::SiftKeypoint> _keypoint_list;
+	int				_mask_size[2];
+	vector<unsigned char> _mask;
+	vector<int>		_rois;
+	//the features of the last run, and the number of runs
+	int				_feature_count;
+	vector<SiftGPU::SiftKeypoint> _keys;
+	vector<float>	_descriptors;
+	int				_run;
+	//the two sets of descriptors to match
+	int				_max_sift;
+	int				_des_num[2];
+	int				_des_byte[2];
+	vector<char>	_des[2];
+	ServerStream	_stream;
+	//the command that is read by the polling thread, the priority class,
+	//the deadline in milliseconds, and when the command is queued
+	int				_command;
+	int				_priority;
+	int				_deadline;
+	long long		_queued_time;
+	//the encoded features of a response
+	vector<char>	_packed;
+public:
+	ServerSession(SOCKET s, int id, int argc, char** argv)
+	{
+		_socket = s;
+		_stream.SetSocket(s);
+		_id = id;
+		_command = S::COMMAND_NONE;
+		_priority = S::PRIORITY_NORMAL;
+		_deadline = 0;
+		_queued_time = 0;
+		_param = CreateNewSiftGPU();
+		if(argc > 0) _param->ParseParam(argc, argv);
+		_param->SetVerbose(0);
+		_data_des[0] = _data_des[1] = _data_des[2] = _data_des[3] = 0;
+		_keypoint_orientation = 1;
+		_mask_size[0] = _mask_size[1] = 0;
+		_feature_count = 0;
+		_run = 0;
+		_max_sift = 0;
+		_des_num[0] = _des_num[1] = 0;
+		_des_byte[0] = _des_byte[1] = 0;
+	}
+	~ServerSession()
+	{
+		closesocket(_socket);
+		delete _param;
+	}
+	int HasInput() {return _imgpath.size() || _imgdata.size(); }
+	//the runs and matches can be rejected when the server is busy
+	int CanReject()
+	{
+		int command = _command;
+		return _stream.ExpectsReply() && (command == S::COMMAND_RUNSIFT || command == S::COMMAND_RUNSIFT_FILE || 
+			command == S::COMMAND_RUNSIFT_DATA || command == S::COMMAND_RUNSIFT_KEY || command == S::COMMAND_MATCH_GET_MATCH ||
+			command == S::COMMAND_MATCH_STORED);
+	}
+	//the queue depth in the flags of a response
+	static int DepthFlags(int depth)
+	{
+		return std::min(depth, 0x7fff) << S::FRAME_DEPTH_SHIFT;
+	}
+	//respond with FRAME_BUSY and an empty payload, the request is not run
+	int Reject(int depth)
+	{
+		_stream.SetResponseFlags(S::FRAME_BUSY | DepthFlags(depth));
+		return _stream.EndCommand();
+	}
+};
+
+class ServerPoller
+{
+	SOCKET			_listenfd;
+#if defined(__linux__)
+	int				_epollfd;
+#else
+	ServerLock		_lock;
+	vector<ServerSession*> _armed;
+#endif
+public:
+#if defined(__linux__)
+	ServerPoller()	{_epollfd = -1; }
+	~ServerPoller()	{if(_epollfd >= 0) close(_epollfd); }
+	int Init(SOCKET listenfd)
+	{
+		struct epoll_event ev;
+		_listenfd = listenfd;
+		_epollfd = epoll_create(64);
+		if(_epollfd < 0) return 0;
+		ev.events = EPOLLIN;
+		ev.data.ptr = NULL;
+		return epoll_ctl(_epollfd, EPOLL_CTL_ADD, listenfd, &ev) == 0;
+	}
+	//wait for the next command of the session, one worker at a time
+	void Arm(ServerSession * session, int add)
+	{
+		struct epoll_event ev;
+		ev.events = EPOLLIN | EPOLLONESHOT;
+		ev.data.ptr = session;
+		epoll_ctl(_epollfd, add ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, session->_socket, &ev);
+	}
+	void Remove(ServerSession * session)
+	{
+		struct epoll_event ev;
+		epoll_ctl(_epollfd, EPOLL_CTL_DEL, session->_socket, &ev);
+	}
+	//returns 0 if the listening socket fails
+	int Wait(vector<ServerSession*>& ready, int& new_client)
+	{
+		struct epoll_event events[64];
+		int num = epoll_wait(_epollfd, events, 64, -1);
+		if(num < 0) return errno == EINTR;
+		for(int i = 0; i < num; ++i)
+		{
+			if(events[i].data.ptr) ready.push_back((ServerSession*) events[i].data.ptr);
+			else new_client = 1;
+		}
+		return 1;
+	}
+#else
+	int Init(SOCKET listenfd)
+	{
+		_listenfd = listenfd;
+		return 1;
+	}
+	void Arm(ServerSession * session, int add)
+	{
+		_lock.Lock();
+		_armed.push_back(session);
+		_lock.Unlock();
+	}
+	void Remove(ServerSession * session)
+	{
+		//the session is taken by a worker, so it is not armed
+	}
+	//the sessions that are armed during select are picked up in the next round
+	int Wait(vector<ServerSession*>& ready, int& new_client)
+	{
+		fd_set fds;
+		SOCKET maxfd = _listenfd;
+		FD_ZERO(&fds);
+		FD_SET(_listenfd, &fds);
+		_lock.Lock();
+		vector<ServerSession*> armed = _armed;
+		_lock.Unlock();
+		for(size_t i = 0; i < armed.size(); ++i)
+		{
+			FD_SET(armed[i]->_socket, &fds);
+			if(armed[i]->_socket > maxfd) maxfd = armed[i]->_socket;
+		}
+		struct timeval timeout;
+		timeout.tv_sec = 0;
+		timeout.tv_usec = 10000;
+		int num = select((int) maxfd + 1, &fds, NULL, NULL, &timeout);
+		if(num < 0) return 0;
+		if(num == 0) return 1;
+		if(FD_ISSET(_listenfd, &fds)) new_client = 1;
+		_lock.Lock();
+		for(size_t i = 0; i < armed.size(); ++i)
+		{
+			if(!FD_ISSET(armed[i]->_socket, &fds)) continue;
+			ready.push_back(armed[i]);
+			_armed.erase(std::find(_armed.begin(), _armed.end(), armed[i]));
+		}
+		_lock.Unlock();
+		return 1;
+	}
+#endif
+};
+
+class ServerWorker
+{
+	typedef ServerSiftGPU S;
+public:
+	ServerQueue*	_queue;
+	ServerPoller*	_poller;
+	ServerMetrics*	_metrics;
+	ServerFeatureStore* _store;
+	int				_index;
+	SiftGPU*		_siftgpu;
+	SiftMatchGPU*	_matcher;
+	//-1 for starting, 0 for failure, 1 for running
+	int				_status;
+	int				_matcher_status;
+	int				_cuda;
+	//the lowest priority class that the worker runs
+	int				_max_priority;
+	//the session whose image is in the pyramid of _siftgpu, and the run number
+	int				_owner, _owner_run;
+	SiftConfig		_config;
+	vector<char>	_buf;
+	int				_started;
+#if defined(_WIN32)
+	HANDLE			_thread;
+#else
+	pthread_t		_thread;
+#endif
+public:
+	ServerWorker(ServerQueue * queue, ServerPoller * poller, ServerMetrics * metrics, ServerFeatureStore * store, 
+				int index, int argc, char** argv)
+	{
+		_queue = queue;
+		_poller = poller;
+		_metrics = metrics;
+		_store = store;
+		_index = index;
+		_siftgpu = CreateNewSiftGPU();
+		if(argc > 0) _siftgpu->ParseParam(argc, argv);
+		_siftgpu->SetVerbose(0);
+		_matcher = NULL;
+		_status = -1;
+		_matcher_status = -1;
+		_cuda = 0;
+		_owner = _owner_run = 0;
+		_started = 0;
+		_max_priority = S::PRIORITY_NUM - 1;
+	}
+	void Start()
+	{
+#if defined(_WIN32)
+		_thread = CreateThread(NULL, 0, RunThread, this, 0, 0);
+		_started = _thread != NULL;
+#else
+		_started = pthread_create(&_thread, NULL, RunThread, this) == 0;
+#endif
+		if(!_started) _status = 0;
+	}
+	void Join()
+	{
+		if(!_started) return;
+#if defined(_WIN32)
+		WaitForSingleObject(_thread, INFINITE);
+		CloseHandle(_thread);
+#else
+		pthread_join(_thread, NULL);
+#endif
+		_started = 0;
+	}
+#if defined(_WIN32)
+	static DWORD WINAPI RunThread(LPVOID param)
+#else
+	static void* RunThread(void* param)
+#endif
+	{
+		((ServerWorker*) param)->Run();
+		return 0;
+	}
+	void Run()
+	{
+		char name[32];
+		sprintf(name, "worker %d", _index);
+		SiftTracer::SetThreadName(name);
+		//the contexts are created and initialized one at a time
+		GlobalUtil::EnterGlobalLock();
+		int status = _siftgpu->CreateContextGL() == SiftGPU::SIFTGPU_FULL_SUPPORTED;
+		GlobalUtil::LeaveGlobalLock();
+		if(status)
+		{
+			_siftgpu->GetConfig(_config);
+			_cuda = _config._UseCUDA;
+		}
+
+		_queue->_ready_lock.Lock();
+		_status = status;
+		_queue->_ready_lock.Broadcast();
+		_queue->_ready_lock.Unlock();
+
+		ServerSession * session;
+		while(status && (session = _queue->Pop(_max_priority)) != NULL)
+		{
+			_metrics->SetQueueDepth(_queue->Depth());
+			_metrics->Begin(_index);
+			int connected = RunCommand(session);
+			_metrics->End(_index, session->_command, session->_stream);
+			if(connected)
+			{
+				_poller->Arm(session, 0);
+			}else
+			{
+				std::cout << "session " << session->_id << " disconnected\n";
+				_poller->Remove(session);
+				_metrics->AddSessions(-1);
+				delete session;
+			}
+		}
+
+		//the OpenGL resources are released with the context of this thread
+		if(_matcher) delete _matcher;
+		delete _siftgpu;
+		_matcher = NULL;
+		_siftgpu = NULL;
+		GlobalUtil::DestroyWindowEZ();
+	}
+	int  IsOwner(ServerSession * session)
+	{
+		return _owner == session->_id && _owner_run == session->_run;
+	}
+	//load the parameters, the detection mask and rectangles of the session
+	void Prepare(ServerSession * session)
+	{
+		session->_param->GetConfig(_config);
+		_siftgpu->SetConfig(_config);
+		_siftgpu->SetDetectionMask(session->_mask_size[0], session->_mask_size[1],
+								session->_mask.size() ? &session->_mask[0] : NULL);
+		_siftgpu->SetDetectionROI(int(session->_rois.size() / 4),
+								session->_rois.size() ? &session->_rois[0] : NULL);
+	}
+	//run on the last input of the session, with an optional keypoint list
+	int Run(ServerSession * session, int num, const SiftGPU::SiftKeypoint * keys, int keys_have_orientation)
+	{
+		Prepare(session);
+		//the image is still in the pyramid
+		if(num > 0 && IsOwner(session)) return _siftgpu->RunSIFT(num, keys, keys_have_orientation);
+		if(num > 0) _siftgpu->SetKeypointList(num, keys, keys_have_orientation);
+		if(session->_imgpath.size()) return _siftgpu->RunSIFT(session->_imgpath.c_str());
+		return _siftgpu->RunSIFT(session->_data_des[0], session->_data_des[1], &session->_imgdata[0],
+								session->_data_des[2], session->_data_des[3]);
+	}
+	//run and copy the features to the session
+	int RunSIFT(ServerSession * session, int num = 0, const SiftGPU::SiftKeypoint * keys = NULL, int keys_have_orientation = 1)
+	{
+		if(!session->HasInput()) return 0;
+		if(_cuda) _queue->_device_lock.Lock();
+		//the keypoint list of SET_KEYPOINT is used for the next run
+		if(num <= 0 && session->_keypoint_list.size())
+		{
+			num = (int) session->_keypoint_list.size();
+			keys = &session->_keypoint_list[0];
+			keys_have_orientation = session->_keypoint_orientation;
+		}
+		int result = Run(session, num, keys, keys_have_orientation);
+		if((session->_feature_count = _siftgpu->GetFeatureNum()) > 0)
+		{
+			session->_keys.resize(session->_feature_count);
+			session->_descriptors.resize(session->_feature_count * 128);
+			_siftgpu->GetFeatureVector(&session->_keys[0], &session->_descriptors[0]);
+		}
+		_metrics->Run(_index, *_siftgpu, result, session->_feature_count);
+		if(_cuda) _queue->_device_lock.Unlock();
+		session->_keypoint_list.clear();
+		_owner = session->_id;
+		_owner_run = ++session->_run;
+		return result;
+	}
+	//the features are computed again if the pyramid belongs to another session
+	void SaveSIFT(ServerSession * session, const char * path)
+	{
+		if(session->_feature_count <= 0 || !session->HasInput()) return;
+		if(_cuda) _queue->_device_lock.Lock();
+		if(IsOwner(session) || Run(session, session->_feature_count, &session->_keys[0], 1))
+		{
+			_siftgpu->SaveSIFT(path);
+			_owner = session->_id;
+			_owner_run = session->_run;
+		}
+		if(_cuda) _queue->_device_lock.Unlock();
+	}
+	int InitializeMatcher()
+	{
+		if(_matcher_status >= 0) return _matcher_status;
+		//the matcher follows the language of the SiftGPU of this worker
+		_siftgpu->GetConfig(_config);
+		_matcher = CreateNewSiftMatchGPU();
+		GlobalUtil::EnterGlobalLock();
+		_matcher_status = _matcher->CreateContextGL();
+		GlobalUtil::LeaveGlobalLock();
+		return _matcher_status;
+	}
+	int GetSiftMatch(ServerSession * session, int max_match, int mbm, float distmax, float ratiomax)
+	{
+		if(!InitializeMatcher() || max_match <= 0) return 0;
+		if(_cuda) _queue->_device_lock.Lock();
+		if(session->_max_sift > 0) _matcher->SetMaxSift(session->_max_sift);
+		//the descriptor ids are not shared by the sessions
+		for(int i = 0; i < 2; ++i)
+		{
+			if(session->_des_num[i] <= 0)	_matcher->SetDescriptors(i, 0, (const float*) NULL);
+			else if(session->_des_byte[i])	_matcher->SetDescriptors(i, session->_des_num[i], (const unsigned char*) &session->_des[i][0]);
+			else							_matcher->SetDescriptors(i, session->_des_num[i], (const float*) &session->_des[i][0]);
+		}
+		//each feature of the first set has one match at most
+		max_match = std::min(max_match, std::max(session->_des_num[0], 1));
+		_buf.resize(max_match * 2 * sizeof(int));
+		int result = _matcher->GetSiftMatch(max_match, (int(*)[2]) (&_buf[0]), distmax, ratiomax, mbm);
+		if(_cuda) _queue->_device_lock.Unlock();
+		return result;
+	}
+	//run the command that is read by the polling thread, returns 0 when the session is finished
+	int RunCommand(ServerSession * session)
+	{
+		ServerStream& io = session->_stream;
+		char buf[1024];
+		int command = session->_command, result;
+		//the run waited in the queue past its deadline
+		if(session->_deadline > 0 && session->CanReject() &&
+			ClockTimer::ClockUS() / 1000 - session->_queued_time > session->_deadline) 
+		{
+			std::cout << "Expired: [" << session->_id << "] command " << command << "\n";
+			_metrics->Reject(1);
+			return session->Reject(_queue->Depth());
+		}
+		switch(command)
+		{
+		case S::COMMAND_NONE:
+			break;
+		case S::COMMAND_INITIALIZE:
+			//the workers are initialized when the server starts
+			io.writeint(1);
+			break;
+		case S::COMMAND_EXIT:
+		case S::COMMAND_DISCONNECT:
+			//the server keeps running for the other clients
+			return 0;
+		case S::COMMAND_ALLOCATE_PYRAMID:
+			{
+				//the workers allocate their pyramids when needed
+				int size[2];
+				io.readint(size, 2);
+				break;
+			}
+		case S::COMMAND_GET_KEY_VECTOR:
+			{
+				if(session->_feature_count <= 0) break;
+				io.writedata(&session->_keys[0], session->_feature_count * sizeof(SiftGPU::SiftKeypoint));
+				break;
+			}
+		case S::COMMAND_GET_DES_VECTOR:
+			{
+				if(session->_feature_count <= 0) break;
+				io.writedata(&session->_descriptors[0], session->_feature_count * sizeof(float) * 128);
+				break;
+			}
+		case S::COMMAND_GET_DES_VECTOR_U8:
+			{
+				int count = session->_feature_count * 128;
+				if(count <= 0) break;
+				_buf.resize(count);
+				QuantizeDescriptors(&session->_descriptors[0], count, (unsigned char*) &_buf[0]);
+				io.writedata(&_buf[0], count);
+				break;
+			}
+		case S::COMMAND_SET_DETECTION_MASK:
+			{
+				int size[2];
+				if(!io.readint(size, 2)) return 0;
+				if(size[0] > 0 && size[1] > 0)
+				{
+					session->_mask.resize(size[0] * size[1]);
+					if(!io.readdata(&session->_mask[0], size[0] * size[1])) return 0;
+					session->_mask_size[0] = size[0];
+					session->_mask_size[1] = size[1];
+				}else
+				{
+					session->_mask.clear();
+					session->_mask_size[0] = session->_mask_size[1] = 0;
+				}
+				break;
+			}
+		case S::COMMAND_SET_DETECTION_ROI:
+			{
+				int num;
+				if(!io.readint(&num)) return 0;
+				session->_rois.resize(num > 0 ? num * 4 : 0);
+				if(num > 0 && !io.readdata(&session->_rois[0], num * 4 * sizeof(int))) return 0;
+				break;
+			}
+		case S::COMMAND_RUNSIFT:
+			{
+				result = RunSIFT(session);
+				io.writeint(result);
+				break;
+			}
+		case S::COMMAND_RUNSIFT_FILE:
+			{
+				io.readline(buf, 1024);
+				session->_imgpath = buf;
+				session->_imgdata.clear();
+				result = RunSIFT(session);
+				std::cout << "RunSIFT: [" << session->_id << "] " << buf << " " << session->_feature_count << "\n";
+				io.writeint(result);
+				break;
+			}
+		case S::COMMAND_RUNSIFT_DATA:
+			{
+				int size = 0;
+				if(!io.readint(session->_data_des, 4) || !io.readint(&size, 1)) return 0;
+				session->_imgpath.clear();
+				session->_imgdata.resize(size > 0 ? size : 1);
+				if(size > 0 && !io.readdata(&session->_imgdata[0], size)) return 0;
+				//the image must not be read past the received pixels
+				if(!S::IsImageData(session->_data_des, size)) session->_imgdata.clear();
+				result = session->_imgdata.size() ? RunSIFT(session) : 0;
+				std::cout << "RunSIFT: [" << session->_id << "] [" << session->_data_des[0] << "x" 
+						<< session->_data_des[1] << "] " << session->_feature_count << "\n";
+				io.writeint(result);
+				break;
+			}
+		case S::COMMAND_SET_KEYPOINT:
+			{
+				int num;
+				io.readint(&num);
+				io.readint(&session->_keypoint_orientation);
+				if(num > 0)
+				{
+					session->_keypoint_list.resize(num);
+					if(!io.readdata(&session->_keypoint_list[0], num * sizeof(SiftGPU::SiftKeypoint))) return 0;
+					session->_feature_count = num;
+					session->_keys = session->_keypoint_list;
+					session->_descriptors.resize(num * 128);
+				}
+				break;
+			}
+		case S::COMMAND_RUNSIFT_KEY:
+			{
+				int num, keys_have_orientation;
+				io.readint(&num);
+				io.readint(&keys_have_orientation);
+				result = 0;
+				if(num > 0)
+				{
+					vector<SiftGPU::SiftKeypoint> keys(num);
+					if(!io.readdata(&keys[0], num * sizeof(SiftGPU::SiftKeypoint))) return 0;
+					result = RunSIFT(session, num, &keys[0], keys_have_orientation);
+				}
+				io.writeint(result);
+				break;
+			}
+		case S::COMMAND_SAVE_SIFT:
+			{
+				io.readline(buf, 1024);
+				SaveSIFT(session, buf);
+				break;
+			}
+		case S::COMMAND_SET_MAX_DIMENSION:
+			{
+				int maxd;
+				if(io.readint(&maxd) && maxd > 0) session->_param->SetMaxDimension(maxd);
+				break;
+			}
+		case S::COMMAND_SET_TIGHTPYRAMID:
+			{
+				int tight;
+				if(io.readint(&tight)) session->_param->SetTightPyramid(tight);
+				break;
+			}
+		case S::COMMAND_GET_FEATURE_COUNT:
+			{
+				io.writeint(session->_feature_count);
+				break;
+			}
+		case S::COMMAND_PARSE_PARAM:
+			{
+				//the parameters compiled into the programs are those of the server
+				io.readline(buf, 1024);
+				std::cout << "ParseParam: [" << session->_id << "] [" << buf << "]\n";
+				ParseParamLine(*session->_param, buf);
+				break;
+			}
+		case S::COMMAND_MATCH_INITIALIZE:
+			{
+				io.writeint(InitializeMatcher());
+				break;
+			}
+		case S::COMMAND_MATCH_SET_LANGUAGE:
+			{
+				//the matchers use the language of the server
+				int language;
+				io.readint(&language);
+				break;
+			}
+		case S::COMMAND_MATCH_SET_DES_FLOAT:
+		case S::COMMAND_MATCH_SET_DES_BYTE:
+			{
+				int param[3] = {0, 0, 0};
+				if(!io.readdata(param, sizeof(param))) return 0;
+				int index = param[0] ? 1 : 0, num = param[1] > 0 ? param[1] : 0;
+				int byte = command == S::COMMAND_MATCH_SET_DES_BYTE;
+				session->_des[index].resize(num * 128 * (byte ? 1 : sizeof(float)) + 1);
+				if(num > 0 && !io.readdata(&session->_des[index][0], session->_des[index].size() - 1)) return 0;
+				session->_des_num[index] = num;
+				session->_des_byte[index] = byte;
+				break;
+			}
+		case S::COMMAND_MATCH_GET_MATCH:
+			{
+				int param[2]; float fparam[2];
+				result = 0;
+				if( io.readdata(param, sizeof(param)) &&
+					io.readdata(fparam, sizeof(fparam)))
+				{
+					result = GetSiftMatch(session, param[0], param[1], fparam[0], fparam[1]);
+				}
+				io.writeint(result);
+				if(result > 0) io.writedata(&_buf[0], sizeof(int) * 2 * result);
+				std::cout << "SiftMatch: [" << session->_id << "] " <<  result << "\n"; 
+				break;
+			}
+		case S::COMMAND_MATCH_SET_MAXSIFT:
+			{
+				int max_sift;
+				if(io.readint(&max_sift)) session->_max_sift = max_sift;
+				break;
+			}
+		case S::COMMAND_GET_FEATURES:
+			{
+				WriteFeatures(io, session->_feature_count, session->_keys, session->_descriptors, io.GetEncoding(), session->_packed);
+				break;
+			}
+		case S::COMMAND_SET_PRIORITY:
+			{
+				int param[2];
+				if(!io.readint(param, 2)) return 0;
+				session->_priority = std::max(0, std::min((int) S::PRIORITY_NUM - 1, param[0]));
+				session->_deadline = std::max(0, param[1]);
+				break;
+			}
+		case S::COMMAND_SET_ENCODING:
+			{
+				int encoding;
+				if(!io.readint(&encoding)) return 0;
+				io.SetEncoding(encoding);
+				io.writeint(io.GetEncoding());
+				break;
+			}
+		case S::COMMAND_STORE_FEATURES:
+			{
+				if(io.readline(buf, 1024) > 0) _store->Put(buf, session->_feature_count, session->_keys, session->_descriptors);
+				break;
+			}
+		case S::COMMAND_MATCH_STORED:
+			{
+				//the stored descriptors become those of the session to match
+				int param[2]; float fparam[2]; char id[1024] = "";
+				result = -1;
+				buf[0] = 0;
+				if( io.readdata(param, sizeof(param)) && io.readdata(fparam, sizeof(fparam)) &&
+					io.readline(buf, 1024) > 0 && io.readline(id, 1024) > 0)
+				{
+					session->_des_num[0] = _store->Get(buf, session->_des[0]);
+					session->_des_num[1] = _store->Get(id, session->_des[1]);
+					session->_des_byte[0] = session->_des_byte[1] = 1;
+					if(session->_des_num[0] >= 0 && session->_des_num[1] >= 0)
+						result = GetSiftMatch(session, param[0], param[1], fparam[0], fparam[1]);
+					session->_des_num[0] = std::max(session->_des_num[0], 0);
+					session->_des_num[1] = std::max(session->_des_num[1], 0);
+				}
+				io.writeint(result);
+				if(result > 0) io.writedata(&_buf[0], sizeof(int) * 2 * result);
+				std::cout << "SiftMatch: [" << session->_id << "] [" << buf << "] [" << id << "] " <<  result << "\n"; 
+				break;
+			}
+		default:
+			std::cout << "unrecognized command: " << command << "\n";
+			return 0;
+		}
+		if(io.WithFeatures()) 
+			WriteFeatures(io, session->_feature_count, session->_keys, session->_descriptors, io.GetEncoding(), session->_packed);
+		io.SetResponseFlags(ServerSession::DepthFlags(_queue->Depth()));
+		return io.EndCommand();
+	}
+};
+
+void ServerSiftGPU::MultiServerLoop(int port, int http_port, ServerFeatureStore* store, int worker_num, int argc, char** argv)
+{
+	SOCKET sockfd, newsockfd;
+	struct	sockaddr_in	cli_addr;
+	socklen_t addr_len = sizeof(sockaddr_in);
+
+    if(ServerSiftGPU::InitSocket() == 0) return;
+	sockfd = SocketUtil::openserver(port, SOMAXCONN);
+	if(sockfd == INVALID_SOCKET) return;
+
+	//-queue n: the limit of the queued requests, -reserve n: the workers for interactive requests
+	int max_depth = 0, reserve = 0;
+	while(argc >= 2)
+	{
+		if(strcmp(argv[0], "-queue") == 0) sscanf(argv[1], "%d", &max_depth);
+		else if(strcmp(argv[0], "-reserve") == 0) sscanf(argv[1], "%d", &reserve);
+		else break;
+		argc -= 2;
+		argv += 2;
+	}
+	reserve = std::max(0, std::min(reserve, worker_num - 1));
+
+	/////////////////////////////////////////////////////////////////
+	ServerQueue queue(max_depth);
+	ServerPoller poller;
+	ServerMetrics metrics(worker_num, 0, max_depth, store);
+	ServerHttp http(&metrics);
+	std::string text;
+	vector<ServerWorker*> workers(worker_num);
+	int ready = 0, session_id = 0;
+	//not ready until the workers are initialized
+	if(http_port > 0 && !http.Start(http_port)) std::cout << "error: can't start the HTTP listener\n";
+	for(int i = 0; i < worker_num; ++i)
+	{
+		workers[i] = new ServerWorker(&queue, &poller, &metrics, store, i, argc, argv);
+		if(i < reserve) workers[i]->_max_priority = PRIORITY_INTERACTIVE;
+		workers[i]->Start();
+	}
+	queue._ready_lock.Lock();
+	for(int i = 0; i < worker_num; ++i)
+	{
+		while(workers[i]->_status < 0) queue._ready_lock.Wait();
+		ready += workers[i]->_status;
+	}
+	queue._ready_lock.Unlock();
+	std::cout << "server: " << ready << " of " << worker_num << " workers are ready\n";
+	metrics.SetWorkersReady(ready);
+
+	/////////////////////////////////////////////////////////////////
+	SiftTracer::SetThreadName("poller");
+	if(ready > 0 && poller.Init(sockfd))
+	{
+		vector<ServerSession*> sessions;
+		int new_client = 0;
+		while(poller.Wait(sessions, new_client))
+		{
+			if(new_client)
+			{
+				newsockfd = accept(sockfd, (struct sockaddr*) &cli_addr, &addr_len);
+				if(newsockfd == INVALID_SOCKET)
+				{
+					//a failed connection or a full descriptor table must not stop the other sessions
+					int error = SocketUtil::lasterror();
+					std::cout << "error: accept failed (" << error << ")\n";
+#ifdef _WIN32
+					if(error == WSAEMFILE || error == WSAENOBUFS) Sleep(100);
+#else
+					if(error == EMFILE || error == ENFILE || error == ENOBUFS || error == ENOMEM) usleep(100000);
+#endif
+					new_client = 0;
+				}else
+				{
+					ServerSession * session = new ServerSession(newsockfd, ++session_id, argc, argv);
+					std::cout << "session " << session->_id << " connected\n";
+					metrics.AddSessions(1);
+					poller.Arm(session, 1);
+				}
+			}
+			//the commands are read here, so the runs can be rejected before they are queued
+			for(size_t i = 0; i < sessions.size(); ++i)
+			{
+				ServerSession * session = sessions[i];
+				//a request is dispatched when all of it is received, so the workers never wait
+				int status = session->_stream.Receive();
+				if(status == 0)
+				{
+					poller.Arm(session, 0);
+					continue;
+				}
+				status = status > 0 && session->_stream.BeginCommand(session->_command);
+				if(status && session->_command == COMMAND_NONE)
+				{
+					//the protocol switch and the shared memory are done by BeginCommand
+					status = session->_stream.EndCommand();
+				}else if(status && session->_command == COMMAND_GET_METRICS)
+				{
+					//answered right away, not behind the queued runs
+					WriteMetrics(session->_stream, metrics, text);
+					status = session->_stream.EndCommand();
+				}else if(status && session->CanReject() && !queue.Admit(session->_priority))
+				{
+					std::cout << "Busy: [" << session->_id << "] command " << session->_command << "\n";
+					metrics.Reject(0);
+					status = session->Reject(queue.Depth());
+				}else if(status)
+				{
+					session->_queued_time = ClockTimer::ClockUS() / 1000;
+					queue.Push(session, session->_priority);
+					metrics.SetQueueDepth(queue.Depth());
+					continue;
+				}
+				if(status) metrics.End(-1, session->_command, session->_stream);
+				if(status)
+				{
+					poller.Arm(session, 0);
+				}else
+				{
+					std::cout << "session " << session->_id << " disconnected\n";
+					poller.Remove(session);
+					metrics.AddSessions(-1);
+					delete session;
+				}
+			}
+			sessions.clear();
+			new_client = 0;
+		}
+	}
+
+	//the sessions that are still connected are closed with the process
+	queue.Stop();
+	for(int i = 0; i < worker_num; ++i)
+	{
+		workers[i]->Join();
+		delete workers[i];
+	}
+    closesocket(sockfd);
+}
+
+
+void ServerSiftGPU::SetParamSiftGPU(int argc, char** argv)
+{
+	if(!_connected || argc <= 0) return;
+
+	char buf[1025], *p = buf;
+	for(int i = 0; i < argc; ++i)
+	{
+		if(argv[i])	
+		{
+			strcpy(p, argv[i]);
+			p += strlen(argv[i]);
+		}
+		*p++= ((i +1 < argc)? ' ' : '\0');
+	}
+	Request(COMMAND_PARSE_PARAM, FRAME_NO_REPLY, buf, int(p - buf) - 1);
+}
+
+int ServerSiftGPU:: InitializeConnection(int argc, char** argv)
+{
+	char server_name[1024]; 
+	if(!InitSocket()) return 0 ;
+    if(_server_name[0] == 0)
+    {
+	    if(StartServerProcess(argc, argv) == 0) 
+	    {
+		    std::cout<<"Unable to start local siftgpu server\n";
+            return 0 ;
+	    }
+        strcpy(server_name, "127.0.0.1");
+    }else
+    {
+        strcpy(server_name, _server_name);
+    }
+	
+    /////////////////////////////////////////////// 
+	if(ConnectServer(server_name, _port) == 0)
+	{
+        //wait for one second
+#ifdef _WIN32
+	    Sleep(1000);
+#else
+	    sleep(1);
+#endif
+		if(ConnectServer(server_name, _port) == 0)
+		{
+			std::cout<<"Unable to connect siftgpu sever\n";
+			return 0 ;
+		}
+	}
+	//switch to the framed protocol
+	int version = 0;
+	if(!SocketUtil::writeint(_socketfd, COMMAND_FRAMED) || !SocketUtil::writeint(_socketfd, PROTOCOL_VERSION) ||
+		!SocketUtil::readint(_socketfd, &version) || version <= 0 || version > PROTOCOL_VERSION)
+	{
+		std::cout<<"The siftgpu server does not support the framed protocol\n";
+		closesocket(_socketfd);
+		_socketfd = INVALID_SOCKET;
+		return 0;
+	}
+	_protocol = version;
+	//the server sends the exact features until SetEncoding
+	_encoding = ENCODING_FLOAT;
+	//a server on the same computer can map the shared memory
+	if(OpenSharedMemory(SHARED_SIZE)) std::cout<<"Use shared memory with siftgpu server\n";
+	return 1;
+}
+
+void ServerSiftGPU::ParseParam(int argc, char **argv)
+{
+    if(_connected == 1) 
+	{
+		SetParamSiftGPU(argc, argv); 
+	}else	
+	{
+		_connected = InitializeConnection(argc, argv);
+		if(_server_name[0] && argc > 0) SetParamSiftGPU(argc, argv);
+	}
+}
+
+int ServerSiftGPU::VerifyContextGL()
+{
+		////////////////////////////////////////////////////
+	if(!_connected) return 0;
+
+	if(Response(Request(COMMAND_INITIALIZE, 0)) && ResponseInt(0))
+	{
+		return SiftGPU::SIFTGPU_FULL_SUPPORTED;
+	}else
+	{
+		std::cout<<"SifGPU failed to initialize\n";
+		Disconnect();
+		return 0;
+	}
+}
+
+int	ServerSiftGPU::GetFeatureNum()
+{
+	return _connected ? _feature_num : 0;
+}
+
+int ServerSiftGPU::AllocatePyramid(int width, int height)
+{
+	if(!_connected) return 0;
+	int size[2] = {width, height};
+	return Request(COMMAND_ALLOCATE_PYRAMID, FRAME_NO_REPLY, size, sizeof(size)) != 0;
+}
+
+////////////////////////////////////////////////////////////
+void ServerSiftGPU::SaveSIFT(const char * szFileName)
+{
+	if(!_connected) return;
+	Request(COMMAND_SAVE_SIFT, FRAME_NO_REPLY, szFileName, (int)strlen(szFileName));
+}
+
+void ServerSiftGPU::GetFeatureVector(SiftGPU::SiftKeypoint * keys, float * descriptors)
+{
+	if(!_connected || _feature_num <= 0 || _keys.size() < (size_t) _feature_num) return;
+	if(keys) memcpy(keys, &_keys[0], _feature_num * sizeof(SiftGPU::SiftKeypoint));
+	if(descriptors) memcpy(descriptors, &_descriptors[0], _feature_num * 128 * sizeof(float));
+}
+
+void ServerSiftGPU::GetFeatureVectorU8(SiftGPU::SiftKeypoint * keys, unsigned char * descriptors)
+{
+	if(!_connected || _feature_num <= 0 || _keys.size() < (size_t) _feature_num) return;
+	if(keys) memcpy(keys, &_keys[0], _feature_num * sizeof(SiftGPU::SiftKeypoint));
+	if(descriptors) QuantizeDescriptors(&_descriptors[0], _feature_num * 128, descriptors);
+}
+
+void ServerSiftGPU::SetKeypointList(int num, const SiftGPU::SiftKeypoint * keys, int keys_have_orientation)
+{
+	if(!_connected) return;
+
+	int param[2] = {num, keys_have_orientation};
+	Request(COMMAND_SET_KEYPOINT, FRAME_NO_REPLY, param, sizeof(param), keys, sizeof(SiftGPU::SiftKeypoint) * num);	
+	//the server reports the keypoints as the features until the next run
+	if(num > 0)
+	{
+		_feature_num = num;
+		_keys.assign(keys, keys + num);
+		_descriptors.assign(num * 128, 0.0f);
+	}
+}
+
+void ServerSiftGPU::SetDetectionMask(int width, int height, const unsigned char * mask)
+{
+	if(!_connected) return;
+	if(mask == NULL) width = height = 0;
+	int size[2] = {width, height};
+	Request(COMMAND_SET_DETECTION_MASK, FRAME_NO_REPLY, size, sizeof(size), mask, width * height);
+}
+
+void ServerSiftGPU::SetDetectionROI(int num, const int * rois)
+{
+	if(!_connected) return;
+	if(rois == NULL) num = 0;
+	Request(COMMAND_SET_DETECTION_ROI, FRAME_NO_REPLY, &num, sizeof(int), rois, num * 4 * sizeof(int));
+}
+
+void ServerSiftGPU::SetTightPyramid(int tight)
+{
+	if(!_connected) return ;
+	Request(COMMAND_SET_TIGHTPYRAMID, FRAME_NO_REPLY, &tight, sizeof(int));
+}
+
+void ServerSiftGPU::SetMaxDimension(int sz)
+{
+	if(!_connected) return ;
+	Request(COMMAND_SET_MAX_DIMENSION, FRAME_NO_REPLY, &sz, sizeof(int));
+}
+
+//the functions of SiftGPU that have no request in the protocol
+static void PrintUnsupported(const char * function)
+{
+	std::cerr << function << " is not supported by the remote SiftGPU\n";
+}
+
+void ServerSiftGPU::GetConfig(SiftConfig& config)
+{
+	PrintUnsupported("ServerSiftGPU::GetConfig");
+}
+
+void ServerSiftGPU::SetConfig(const SiftConfig& config)
+{
+	PrintUnsupported("ServerSiftGPU::SetConfig");
+}
+
+int ServerSiftGPU::GetPyramidMemoryKB()
+{
+	PrintUnsupported("ServerSiftGPU::GetPyramidMemoryKB");
+	return -1;
+}
+
+int ServerSiftGPU::GetProfileScopeNum()
+{
+	PrintUnsupported("ServerSiftGPU::GetProfileScopeNum");
+	return 0;
+}
+
+int ServerSiftGPU::GetProfileScope(int index, SiftProfileScope& scope)
+{
+	PrintUnsupported("ServerSiftGPU::GetProfileScope");
+	return 0;
+}
+
+const char* ServerSiftGPU::GetProfileJSON()
+{
+	PrintUnsupported("ServerSiftGPU::GetProfileJSON");
+	return NULL;
+}
+
+int ServerSiftGPU::SaveProfile(const char * path)
+{
+	PrintUnsupported("ServerSiftGPU::SaveProfile");
+	return 0;
+}
+
+void ServerSiftGPU::ResetProfile()
+{
+	PrintUnsupported("ServerSiftGPU::ResetProfile");
+}
+
+int ServerSiftGPU::GetPixelSizeGL(unsigned int gl_format, unsigned int gl_type)
+{
+    int num_channel_byte = 0;
+    int num_channels  = 0;
+    switch(gl_type)
+    {
+    case GL_BITMAP:
+    case GL_UNSIGNED_BYTE:
+    case GL_BYTE:
+        num_channel_byte = 1;
+        break;
+    case GL_UNSIGNED_SHORT:
+    case GL_SHORT:
+        num_channel_byte = 2;
+        break;
+    case GL_UNSIGNED_INT:
+    case GL_INT: 
+    case GL_FLOAT:
+        num_channel_byte = 4;
+        break;
+    default:
+        num_channel_byte = 0;
+        break;
+    }
+
+    switch(gl_format)
+    {
+    case GL_RED:
+    case GL_GREEN:
+    case GL_BLUE:
+    case GL_ALPHA:
+    case GL_LUMINANCE:
+        num_channels = 1;
+        break;
+    case GL_RGB:
+    case GL_BGR_EXT:
+        num_channels = 3;
+        break;
+    case GL_RGBA:
+    case GL_BGRA_EXT:
+#ifdef GL_ARGB_I3D
+    case GL_ARGB_I3D:
+#endif
+        num_channels = 4;
+        break;
+    case GL_LUMINANCE_ALPHA:
+#ifdef GL_422_EXT
+    case GL_422_EXT:
+    case GL_422_REV_EXT: 
+    case GL_422_AVERAGE_EXT:
+    case GL_422_REV_AVERAGE_EXT:
+#endif
+        num_channels = 2;
+    default:
+        num_channels = 0;
+        break;
+    }
+    return num_channels * num_channel_byte;
+}
+
+int ServerSiftGPU::IsImageData(const int data_des[4], int size)
+{
+	int pixel_size = GetPixelSizeGL(data_des[2], data_des[3]);
+	if(data_des[0] <= 0 || data_des[1] <= 0 || pixel_size <= 0) return 0;
+	return (double) data_des[0] * data_des[1] * pixel_size <= size;
+}
+
+int ServerSiftGPU::RunSIFT(int width, int height, const void * data, unsigned int gl_format, unsigned int gl_type)
+{
+	if(width <=0 || height <= 0 || data == NULL || !_connected) return 0;
+    int num_bytes = GetPixelSizeGL(gl_format , gl_type) * width * height;
+    if(num_bytes == 0) return 0;
+	unsigned int data_des[5] = {(unsigned int) width, (unsigned int) height, gl_format, gl_type, (unsigned int) num_bytes};
+	return RunRequest(COMMAND_RUNSIFT_DATA, data_des, 5 * sizeof(unsigned int), data, num_bytes);
+}
+
+int ServerSiftGPU::RunSIFT(int width, int height, const void * data, unsigned int gl_format, unsigned int gl_type,
+						   int row_bytes, const int * roi)
+{
+	vector<char> packed;
+	data = PackPixels(width, height, data, GetPixelSizeGL(gl_format , gl_type), row_bytes, roi, packed);
+	return data ? RunSIFT(width, height, data, gl_format, gl_type) : 0;
+}
+
+int ServerSiftGPU::BeginStream(int width, int height, unsigned int gl_format, unsigned int gl_type, int row_bytes)
+{
+	EndStream();
+	if(width <= 0 || height <= 0 || GetPixelSizeGL(gl_format, gl_type) == 0) return 0;
+	_stream_param[0] = width;		_stream_param[1] = height;
+	_stream_param[2] = gl_format;	_stream_param[3] = gl_type;
+	_stream_param[4] = row_bytes;
+	_streaming = 1;
+	return 1;
+}
+
+int ServerSiftGPU::PushFrame(const void * data)
+{
+	if(!_streaming || data == NULL) return 0;
+	_stream_frames.push_back(data);
+	return 1;
+}
+
+int ServerSiftGPU::PopFeatures()
+{
+	if(!_streaming || _stream_frames.empty()) return -1;
+	const void * data = _stream_frames.front();
+	_stream_frames.pop_front();
+	if(!RunSIFT(_stream_param[0], _stream_param[1], data, _stream_param[2], _stream_param[3], _stream_param[4], NULL)) return -1;
+	return GetFeatureNum();
+}
+
+void ServerSiftGPU::EndStream()
+{
+	_stream_frames.clear();
+	_streaming = 0;
+}
+
+int ServerSiftGPU::RunSIFT(int num, const SiftGPU::SiftKeypoint * keys, int keys_have_orientation)
+{
+	if(num <= 0 || keys == NULL) return 0;
+	int param[2] = {num, keys_have_orientation};
+	return RunRequest(COMMAND_RUNSIFT_KEY, param, sizeof(param), keys, sizeof(SiftGPU::SiftKeypoint) * num);
+}
+
+int ServerSiftGPU::RunSIFT()
+{
+	return RunRequest(COMMAND_RUNSIFT);
+}
+
+int ServerSiftGPU::RunSIFT(const char *imgpath)
+{
+	return RunRequest(COMMAND_RUNSIFT_FILE, imgpath, (int)strlen(imgpath));
+}
+
+
+////////////////////////////////////////////////
+int ServerSiftGPU::_VerifyContextGL()
+{
+	if(!_connected) return 0;
+	if(Response(Request(COMMAND_MATCH_INITIALIZE, 0)) && ResponseInt(0))
+	{
+		return 1;
+	}else
+	{
+		Disconnect();
+		return 0;
+	}
+}
+
+void ServerSiftGPU::SetLanguage(int gpu_language)
+{
+	if(!_connected) return ;
+	Request(COMMAND_MATCH_SET_LANGUAGE, FRAME_NO_REPLY, &gpu_language, sizeof(int));
+}
+
+void ServerSiftGPU::SetDeviceParam(int argc, char**argv)
+{
+    ServerSiftGPU::ParseParam(argc, argv);
+}
+
+
+void ServerSiftGPU::SetMaxSift(int max_sift)
+{
+	if(!_connected) return;
+	Request(COMMAND_MATCH_SET_MAXSIFT, FRAME_NO_REPLY, &max_sift, sizeof(int));
+}
+
+void ServerSiftGPU::SetDescriptors(int index, int num, const float* descriptors, int id)
+{
+	if(!_connected) return ;
+	if((_encoding & ENCODING_U8) && num > 0)
+	{
+		//the matchers quantize the descriptors to bytes in the same way
+		vector<unsigned char> des(num * 128);
+		QuantizeDescriptors(descriptors, num * 128, &des[0]);
+		SetDescriptors(index, num, &des[0], id);
+		return;
+	}
+	int param[3] = {index, num, id};
+	Request(COMMAND_MATCH_SET_DES_FLOAT, FRAME_NO_REPLY, param, sizeof(param), descriptors, sizeof(float) * 128 * num);
+}
+
+
+void ServerSiftGPU::SetDescriptors(int index, int num, const unsigned char * descriptors, int id)
+{
+	if(!_connected) return ;
+	int param[3] = {index, num, id};
+	Request(COMMAND_MATCH_SET_DES_BYTE, FRAME_NO_REPLY, param, sizeof(param), descriptors, sizeof(unsigned char) * 128 * num);
+}
+
+int  ServerSiftGPU::GetSiftMatch(int max_match,	int match_buffer[][2], 
+	float distmax, float ratiomax,	int mutual_best_match)
+{
+	if(!_connected) return 0;
+	int param[2] = {max_match, mutual_best_match};
+	float fparam[2] = {distmax, ratiomax};
+	if(!Response(Request(COMMAND_MATCH_GET_MATCH, FRAME_SHARED, param, sizeof(param), fparam, sizeof(fparam)))) return 0;
+	int nm = ResponseInt(0);
+	if(nm > max_match) nm = max_match;
+	if(nm <= 0 || sizeof(int) * (2 * nm + 1) > _response_size) return 0;
+	memcpy(match_buffer[0], _response_data + sizeof(int), sizeof(int) * 2 * nm);
+	return nm;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+//a server of ServerPoolSiftGPU
+class ServerPoolEntry
+{
+public:
+	ServerSiftGPU*	_combo;
+	std::string		_host;		//empty for a server that is started on this computer
+	int				_port;
+	vector<std::string> _params;	//the parameters of this server, e.g. -cuda 1
+	int				_healthy;
+	time_t			_failed_time;	//when it failed, 0 if it is never connected
+	int				_load;			//requests in flight, synchronous or asynchronous
+	int				_connecting;	//reconnected by the pool thread
+public:
+	ServerPoolEntry()
+	{
+		_combo = NULL;
+		_port = 0;
+		_healthy = 0;
+		_failed_time = 0;
+		_load = 0;
+		_connecting = 0;
+	}
+	~ServerPoolEntry()
+	{
+		delete _combo;
+	}
+	//a connection object that is not connected yet
+	ServerSiftGPU* NewConnection()
+	{
+		return new ServerSiftGPU(_port, _host.size() ? (char*) _host.c_str() : NULL);
+	}
+	//a new connection object, the old one is closed
+	void Reset()
+	{
+		delete _combo;
+		_combo = NewConnection();
+	}
+};
+
+//the thread of ServerPoolSiftGPU, see ServerPoolSiftGPU::RunThread
+class ServerPoolThread
+{
+	ServerPoolSiftGPU*	_pool;
+	int				_started;
+#if defined(_WIN32)
+	HANDLE			_thread;
+#else
+	pthread_t		_thread;
+#endif
+public:
+	ServerPoolThread(ServerPoolSiftGPU* pool)
+	{
+		_pool = pool;
+		_started = 0;
+	}
+	int Start()
+	{
+#if defined(_WIN32)
+		_thread = CreateThread(NULL, 0, RunThread, this, 0, 0);
+		_started = _thread != NULL;
+#else
+		_started = pthread_create(&_thread, NULL, RunThread, this) == 0;
+#endif
+		return _started;
+	}
+	void Join()
+	{
+		if(!_started) return;
+#if defined(_WIN32)
+		WaitForSingleObject(_thread, INFINITE);
+		CloseHandle(_thread);
+#else
+		pthread_join(_thread, NULL);
+#endif
+		_started = 0;
+	}
+#if defined(_WIN32)
+	static DWORD WINAPI RunThread(LPVOID param)
+#else
+	static void* RunThread(void* param)
+#endif
+	{
+		((ServerPoolThread*) param)->_pool->RunThread();
+		return 0;
+	}
+};
 
-				    result = siftgpu.RunSIFT(buf);
-				    if((sift_feature_count = siftgpu.GetFeatureNum()) > 0)
-				    {
-					    keys.resize(sift_feature_count);
-					    descriptors.resize(sift_feature_count * 128);
-					    siftgpu.GetFeatureVector(&keys[0], &descriptors[0]);
-				    }
-					std::cout << "RunSIFT: "<< buf <<" " << sift_feature_count << "\n" ;
-				    SocketUtil::writeint(newsockfd, result);
-				    break;
-			    }
-		    case COMMAND_SET_KEYPOINT:
-			    {
-				    int keys_have_orientation;
-				    SocketUtil::readint(newsockfd, &sift_feature_count);
-				    SocketUtil::readint(newsockfd, &keys_have_orientation);
-				    if(sift_feature_count > 0)
-				    {
-					    keys.resize(sift_feature_count);
-					    descriptors.resize(sift_feature_count * 128);
-						SocketUtil::readdata(newsockfd, &keys[0], int(keys.size() * sizeof(SiftGPU::SiftKeypoint)));
-					    siftgpu.SetKeypointList(sift_feature_count, &keys[0], keys_have_orientation);
-				    }
-				    break;
-			    }
-		    case COMMAND_RUNSIFT_KEY:
-			    {
-				    int keys_have_orientation;
-				    SocketUtil::readint(newsockfd, &sift_feature_count);
-				    SocketUtil::readint(newsockfd, &keys_have_orientation);
-				    if(sift_feature_count > 0)
-				    {
-						std::cout << "RunSIFT: "<< sift_feature_count << " KEYPOINTS\n" ;
-					    int key_data_size = sift_feature_count * sizeof(SiftGPU::SiftKeypoint);
-					    keys.resize(sift_feature_count);
-					    descriptors.resize(sift_feature_count * 128);
-					    SocketUtil::readdata(newsockfd, &keys[0], key_data_size);
-					    result = siftgpu.RunSIFT(sift_feature_count, &keys[0], keys_have_orientation);
-					    siftgpu.GetFeatureVector(NULL, &descriptors[0]);
-				    }else
-				    {
-					    result = 0;
-				    }
-				    SocketUtil::writeint(newsockfd, result);
-				    break;
-			    }
-		    case COMMAND_RUNSIFT_DATA:
-			    {
-				    int data_des[4], size = 0;	
-				    SocketUtil::readint(newsockfd, data_des, 4);
-					SocketUtil::readint(newsockfd, &size, 1);
-					std::cout << "RunSIFT: [" << data_des[0] << "x" << data_des[1] << "]";
+//the state of an asynchronous request of ServerPoolSiftGPU
+struct ServerPoolSiftGPU::Task
+{
+	RunInput		input;
+	std::string		imgpath;
+	int				roi[4];
+	int				match;
+	int				max_match, mutual_best_match;
+	float			distmax, ratiomax;
+	ServerPoolEntry*	server;
+	int				attempts;
+public:
+	Task(const RunInput& run)
+	{
+		input = run;
+		if(run.imgpath)
+		{
+			imgpath = run.imgpath;
+			input.imgpath = imgpath.c_str();
+		}
+		if(run.roi)
+		{
+			memcpy(roi, run.roi, sizeof(roi));
+			input.roi = roi;
+		}
+		match = max_match = mutual_best_match = 0;
+		distmax = ratiomax = 0;
+		server = NULL;
+		attempts = 0;
+	}
+};
 
-					databuf.resize(size);
-					void* data_ptr = &databuf[0];
-					SocketUtil::readdata(newsockfd, data_ptr, size);
+//split a parameter string at the spaces
+static void SplitParams(const std::string& str, vector<std::string>& params)
+{
+	size_t pos = 0;
+	while(pos < str.size())
+	{
+		while(pos < str.size() && (str[pos] == ' ' || str[pos] == '\t')) ++pos;
+		size_t end = pos;
+		while(end < str.size() && str[end] != ' ' && str[end] != '\t') ++end;
+		if(end > pos) params.push_back(str.substr(pos, end - pos));
+		pos = end;
+	}
+}
 
+ServerPoolSiftGPU::ServerPoolSiftGPU(const char * servers)
+{
+	_current = _keypoint_server = _matcher = NULL;
+	_lock = new ServerLock();
+	_call_lock = new ServerLock();
+	_stopped = 0;
+	_next = 0;
+	_max_dimension = 0;
+	_tight_pyramid = -1;
+	_mask_size[0] = _mask_size[1] = 0;
+	_language = -1;
+	_max_sift = 0;
+	_match_initialized = 0;
+	_encoding = -1;
+	for(int i = 0; i < 2; ++i)
+	{
+		_des_num[i] = _des_byte[i] = 0;
+		_des_id[i] = -1;
+	}
+	_streaming = 0;
 
-				    result = siftgpu.RunSIFT(data_des[0], data_des[1], data_ptr, data_des[2], data_des[3]);
-				    if((sift_feature_count = siftgpu.GetFeatureNum()) > 0)
-				    {
-					    keys.resize(sift_feature_count);
-					    descriptors.resize(sift_feature_count * 128);
-					    siftgpu.GetFeatureVector(&keys[0], &descriptors[0]);
-				    }
-					std::cout << "[" << sift_feature_count << "]\n";
-				    SocketUtil::writeint(newsockfd, result);
-				    break;
-			    }
-		    case COMMAND_SAVE_SIFT:
-			    {
-				    SocketUtil::readline(newsockfd, buf, 1024);
-				    siftgpu.SaveSIFT(buf);
-				    break;
-			    }
-		    case COMMAND_SET_MAX_DIMENSION:
-			    {
-				    int maxd;
-				    if(SocketUtil::readint(newsockfd, &maxd) && maxd > 0) siftgpu.SetMaxDimension(maxd);
-				    break;
-			    }
-		    case COMMAND_SET_TIGHTPYRAMID:
-			    {
-				    int tight;
-				    if(SocketUtil::readint(newsockfd, &tight))  siftgpu.SetTightPyramid(tight);
-				    break;
-			    }
-		    case COMMAND_GET_FEATURE_COUNT:
-			    {
-				    SocketUtil::writeint(newsockfd, sift_feature_count);
-				    break;
-			    }
-			case COMMAND_PARSE_PARAM:
-				{
-				    SocketUtil::readline(newsockfd, buf, 1024);
-					std::cout << "ParseParam [" << buf << "]\n";
-					vector<char*> params;
-					char* p = buf;
-					while(*p)
-					{
-						while(*p == ' ' || *p == '\t')*p++ = 0;
-						params.push_back(p);
-						while(*p && *p != ' ' && *p != '\t') p++;
-					}
-					siftgpu.ParseParam(params.size(), &params[0]);
-					break;
-				}
-			case COMMAND_MATCH_INITIALIZE:
-				{
-					result = matcher.CreateContextGL();
-					SocketUtil::writeint(newsockfd, result);
-					break;
-				}
-			case COMMAND_MATCH_SET_LANGUAGE:
-				{
-					int language;
-					if(SocketUtil::readint(newsockfd, &language)) matcher.SetLanguage(language);
-					break;
-				}
-			case COMMAND_MATCH_SET_DES_FLOAT:
-				{
-					int command[3] = {0, 0, 0};
-					if(SocketUtil::readdata(newsockfd, command, sizeof(command)))
-					{
-						databuf.resize(sizeof(float) * 128 * command[1]);
-						if(SocketUtil::readdata(newsockfd, &databuf[0], databuf.size()))
-						{
-							matcher.SetDescriptors(command[0], command[1], (float*) (&databuf[0]), command[2]);	
-						}
-					}
-					break;
-				}
-			case COMMAND_MATCH_SET_DES_BYTE:
-				{
-					int command[3] = {0, 0, 0};
-					if(SocketUtil::readdata(newsockfd, command, sizeof(command)))
-					{
-						databuf.resize(sizeof(unsigned char) * 128 * command[1]);
-						if(SocketUtil::readdata(newsockfd, &databuf[0], databuf.size()))
-						{
-							matcher.SetDescriptors(command[0], command[1], (unsigned char*) (&databuf[0]), command[2]);	
-						}
-					}
-					break;
-				}
-			case COMMAND_MATCH_GET_MATCH:
-				{
-					int command[2]; float fcommand[2];
-					result = 0;
-					if( SocketUtil::readdata(newsockfd, command, sizeof(command)) &&
-						SocketUtil::readdata(newsockfd, fcommand, sizeof(fcommand)))
-					{
-						int max_match  = command[0], mbm = command[1];
-						float distmax = fcommand[0], ratiomax = fcommand[1];
-						databuf.resize(max_match * 2 * sizeof(int));
-						result = matcher.GetSiftMatch(max_match, ( int(*)[2]) (&databuf[0]), distmax, ratiomax, mbm);
+	//"port [param]; host:port [param]; ..."
+	std::string config = servers ? servers : "";
+	size_t begin = 0;
+	while(begin < config.size())
+	{
+		size_t end = config.find(';', begin);
+		if(end == std::string::npos) end = config.size();
+		vector<std::string> tokens;
+		SplitParams(config.substr(begin, end - begin), tokens);
+		begin = end + 1;
+		if(tokens.empty()) continue;
+		ServerPoolEntry * server = new ServerPoolEntry();
+		size_t colon = tokens[0].rfind(':');
+		if(colon != std::string::npos) server->_host = tokens[0].substr(0, colon);
+		server->_port = atoi(tokens[0].c_str() + (colon == std::string::npos ? 0 : colon + 1));
+		server->_params.assign(tokens.begin() + 1, tokens.end());
+		if(server->_port > 0)
+		{
+			server->Reset();
+			_servers.push_back(server);
+		}else
+		{
+			std::cout << "ServerPoolSiftGPU: invalid server " << tokens[0] << "\n";
+			delete server;
+		}
+	}
+	_thread = new ServerPoolThread(this);
+	if(!_thread->Start()) std::cout << "ServerPoolSiftGPU: unable to start the thread\n";
+}
 
-					}
-					SocketUtil::writeint(newsockfd, result);
-					if(result > 0) SocketUtil::writedata(newsockfd, &databuf[0], sizeof(int) * 2 * result);
-					std::cout << "SiftMatch: " <<  result << "\n"; 
-					break;
-				}
-			case COMMAND_MATCH_SET_MAXSIFT:
-				{
-					int max_sift;
-					if(SocketUtil::readint(newsockfd, &max_sift)) matcher.SetMaxSift(max_sift);
-					break;
-				}
-				break;
-		    default:
-			    std::cout << "unrecognized command: " << command << "\n";
-				break;
-		    }
-	    }
+ServerPoolSiftGPU::~ServerPoolSiftGPU()
+{
+	//the pool thread and the I/O threads are stopped before the locks are deleted
+	_lock->Lock();
+	_stopped = 1;
+	_lock->Broadcast();
+	_lock->Unlock();
+	_thread->Join();
+	delete _thread;
+	for(size_t i = 0; i < _servers.size(); ++i) delete _servers[i];
+	delete _call_lock;
+	delete _lock;
+}
 
-        //client disconneted
-        closesocket(newsockfd);
-        //wait for the next client.
-        std::cout << "wait for new client...";
-	    newsockfd = accept(sockfd, (struct sockaddr*) &cli_addr, &addr_len);
-	    if(newsockfd == INVALID_SOCKET)
-	    {
-		    std::cout << "error: accept failed";
-            closesocket(sockfd);
-		    return;
-	    }else
-        {
-            std::cout << "connected\n\n";
-        }
-   }while(1);
+int ServerPoolSiftGPU::IsHealthy(ServerPoolEntry * server)
+{
+	_lock->Lock();
+	int healthy = server->_healthy;
+	_lock->Unlock();
+	return healthy && server->_combo->IsConnected();
+}
+
+//connect a connection object with the parameters (which can start a server process),
+//returns whether it can be used
+int ServerPoolSiftGPU::Open(ServerSiftGPU * combo, const vector<std::string>& params)
+{
+	vector<char*> argv;
+	for(size_t i = 0; i < params.size(); ++i) argv.push_back((char*) params[i].c_str());
+	combo->ParseParam((int) argv.size(), argv.size() ? &argv[0] : NULL);
+	return combo->_connected && combo->VerifyContextGL() == SiftGPU::SIFTGPU_FULL_SUPPORTED;
+}
+
+//send the settings to a new connection
+void ServerPoolSiftGPU::Configure(ServerSiftGPU * combo)
+{
+	if(_max_dimension > 0) combo->SetMaxDimension(_max_dimension);
+	if(_tight_pyramid >= 0) combo->SetTightPyramid(_tight_pyramid);
+	if(_mask_size[0] > 0) combo->SetDetectionMask(_mask_size[0], _mask_size[1], &_mask[0]);
+	if(_rois.size()) combo->SetDetectionROI((int) _rois.size() / 4, &_rois[0]);
+	if(_encoding >= 0) combo->SetEncoding(_encoding);
+}
+
+//connect a server and send the settings, returns whether it can be used
+int ServerPoolSiftGPU::Connect(ServerPoolEntry * server)
+{
+	ServerSiftGPU * combo = server->_combo;
+	if(!combo->_connected)
+	{
+		vector<std::string> params(_params);
+		params.insert(params.end(), server->_params.begin(), server->_params.end());
+		if(!Open(combo, params)) return 0;
+		Configure(combo);
+	}
+	return combo->IsConnected();
+}
+
+//reconnect the failed servers after RETRY_SECONDS, when their requests are finished.
+//The new connection is opened without the call lock, so the other servers keep 
+//running, and it replaces the old one with the settings of that time
+void ServerPoolSiftGPU::ReconnectFailed()
+{
+	for(size_t i = 0; i < _servers.size(); ++i)
+	{
+		ServerPoolEntry * server = _servers[i];
+		_lock->Lock();
+		int due = !_stopped && !server->_healthy && !server->_connecting && server->_load == 0 && 
+				server->_failed_time && time(NULL) >= server->_failed_time + RETRY_SECONDS;
+		if(due) server->_connecting = 1;
+		_lock->Unlock();
+		if(!due) continue;
+
+		_call_lock->Lock();
+		//VerifyContextGL may have connected it
+		_lock->Lock();
+		if(server->_healthy) server->_connecting = 0;
+		due = !server->_healthy;
+		_lock->Unlock();
+		if(!due)
+		{
+			_call_lock->Unlock();
+			continue;
+		}
+		vector<std::string> params(_params);
+		size_t param_num = params.size();
+		params.insert(params.end(), server->_params.begin(), server->_params.end());
+		_call_lock->Unlock();
+		ServerSiftGPU * combo = server->NewConnection();
+		int healthy = Open(combo, params);
+
+		_call_lock->Lock();
+		if(healthy)
+		{
+			//the parameters that are added while connecting
+			vector<char*> argv;
+			for(size_t k = param_num; k < _params.size(); ++k) argv.push_back((char*) _params[k].c_str());
+			if(argv.size()) combo->ParseParam((int) argv.size(), &argv[0]);
+			Configure(combo);
+			healthy = combo->IsConnected();
+		}
+		if(healthy)
+		{
+			if(_current == server) _current = NULL;
+			if(_keypoint_server == server) _keypoint_server = NULL;
+			if(_matcher == server) _matcher = NULL;
+			std::swap(combo, server->_combo);
+		}
+		_lock->Lock();
+		server->_healthy = healthy;
+		server->_connecting = 0;
+		if(!healthy) server->_failed_time = time(NULL);
+		_lock->Unlock();
+		_call_lock->Unlock();
+		//the old connection, or the new one that failed
+		delete combo;
+	}
+}
+
+void ServerPoolSiftGPU::SetFailed(ServerPoolEntry * server)
+{
+	_lock->Lock();
+	server->_healthy = 0;
+	server->_failed_time = time(NULL);
+	_lock->Unlock();
+	std::cout << "ServerPoolSiftGPU: server " << server->_host << ":" << server->_port << " failed\n";
+}
+
+//the healthy server with the fewest requests in flight, starting from _next. 
+//It does not connect, the failed servers are reconnected by the pool thread
+ServerPoolEntry* ServerPoolSiftGPU::PickServer()
+{
+	ServerPoolEntry * best = NULL;
+	int best_load = 0, count = (int) _servers.size();
+	for(int k = 0; k < count; ++k)
+	{
+		ServerPoolEntry * server = _servers[(_next + k) % count];
+		_lock->Lock();
+		int healthy = server->_healthy, load = server->_load;
+		_lock->Unlock();
+		if(!healthy) continue;
+		if(!server->_combo->IsConnected())
+		{
+			SetFailed(server);
+			continue;
+		}
+		if(best == NULL || load < best_load)
+		{
+			best = server;
+			best_load = load;
+		}
+	}
+	if(count > 0) _next = (_next + 1) % count;
+	return best;
+}
+
+//the server for matching; a new one gets the settings and the descriptors
+ServerPoolEntry* ServerPoolSiftGPU::PickMatcher()
+{
+	if(_matcher && IsHealthy(_matcher)) return _matcher;
+	_matcher = PickServer();
+	if(_matcher == NULL) return NULL;
+	ServerSiftGPU * combo = _matcher->_combo;
+	if(_language >= 0) combo->SetLanguage(_language);
+	if(_match_initialized) combo->_VerifyContextGL();
+	if(_max_sift > 0) combo->SetMaxSift(_max_sift);
+	SendDescriptors(_matcher, 0);
+	SendDescriptors(_matcher, 1);
+	return _matcher;
+}
+
+void ServerPoolSiftGPU::SendDescriptors(ServerPoolEntry * server, int index)
+{
+	if(_des_num[index] <= 0) return;
+	if(_des_byte[index]) server->_combo->SetDescriptors(index, _des_num[index], &_des_u8[index][0], _des_id[index]);
+	else server->_combo->SetDescriptors(index, _des_num[index], &_des[index][0], _des_id[index]);
+}
+
+int ServerPoolSiftGPU::RunInputOn(ServerSiftGPU * combo, const RunInput& input)
+{
+	if(input.imgpath) return combo->RunSIFT(input.imgpath);
+	if(input.keys) return combo->RunSIFT(input.num, input.keys, input.keys_have_orientation);
+	return combo->RunSIFT(input.width, input.height, input.data, input.gl_format, input.gl_type, input.row_bytes, input.roi);
+}
+
+//run on the picked server, and on the other ones if the connection fails
+int ServerPoolSiftGPU::Run(const RunInput& input)
+{
+	ServerPoolEntry * keypoint_server = _keypoint_server;
+	_keypoint_server = NULL;
+	for(size_t attempt = 0; attempt <= _servers.size(); ++attempt)
+	{
+		//the keypoints of SetKeypointList are on one server
+		ServerPoolEntry * server = keypoint_server && IsHealthy(keypoint_server)? keypoint_server : PickServer();
+		keypoint_server = NULL;
+		if(server == NULL) break;
+		_lock->Lock();
+		server->_load++;
+		_lock->Unlock();
+		int result = RunInputOn(server->_combo, input);
+		_lock->Lock();
+		server->_load--;
+		_lock->Unlock();
+		if(server->_combo->IsConnected())
+		{
+			_current = server;
+			return result;
+		}
+		SetFailed(server);
+	}
+	_current = NULL;
+	return 0;
+}
+
+void ServerPoolSiftGPU::ParseParam(int argc, char **argv)
+{
+	ServerLockScope scope(*_call_lock);
+	for(int i = 0; i < argc; ++i) _params.push_back(argv[i]);
+	for(size_t i = 0; i < _servers.size(); ++i)
+	{
+		if(_servers[i]->_combo->_connected) _servers[i]->_combo->ParseParam(argc, argv);
+	}
+}
+
+//connect the servers that are not connected, and those that failed
+int ServerPoolSiftGPU::VerifyContextGL()
+{
+	ServerLockScope scope(*_call_lock);
+	int ready = 0;
+	for(size_t i = 0; i < _servers.size(); ++i)
+	{
+		ServerPoolEntry * server = _servers[i];
+		if(IsHealthy(server))
+		{
+			ready++;
+			continue;
+		}
+		_lock->Lock();
+		int busy = server->_load > 0 || server->_connecting;
+		time_t failed_time = server->_failed_time;
+		_lock->Unlock();
+		if(busy) continue;
+		if(_current == server) _current = NULL;
+		if(_keypoint_server == server) _keypoint_server = NULL;
+		if(_matcher == server) _matcher = NULL;
+		if(failed_time || server->_combo->_connected) server->Reset();
+		int healthy = Connect(server);
+		_lock->Lock();
+		server->_healthy = healthy;
+		if(!healthy) server->_failed_time = time(NULL);
+		_lock->Unlock();
+		ready += healthy;
+	}
+	return ready ? SiftGPU::SIFTGPU_FULL_SUPPORTED : 0;
+}
+
+int ServerPoolSiftGPU::RunSIFT(const char * imgpath)
+{
+	ServerLockScope scope(*_call_lock);
+	RunInput input = {imgpath, 0, 0, 0, NULL, 0, 0, NULL, 0, 0, NULL};
+	return Run(input);
+}
+
+//the keypoints of SetKeypointList, or the image of the last run
+int ServerPoolSiftGPU::RunSIFT()
+{
+	ServerLockScope scope(*_call_lock);
+	if(_keypoint_server) _current = _keypoint_server;
+	_keypoint_server = NULL;
+	return _current ? _current->_combo->RunSIFT() : 0;
+}
+
+int ServerPoolSiftGPU::RunSIFT(int width, int height, const void * data, unsigned int gl_format, unsigned int gl_type)
+{
+	return RunSIFT(width, height, data, gl_format, gl_type, 0, NULL);
 }
 
-void ServerSiftGPU::SetParamSiftGPU(int argc, char** argv)
+int ServerPoolSiftGPU::RunSIFT(int width, int height, const void * data, unsigned int gl_format, unsigned int gl_type,
+						int row_bytes, const int * roi)
 {
-	if(!_connected || argc <= 0) return;
+	ServerLockScope scope(*_call_lock);
+	RunInput input = {NULL, width, height, row_bytes, data, gl_format, gl_type, roi, 0, 0, NULL};
+	return Run(input);
+}
 
-	char buf[1025], *p = buf, cret = '\n';
-	for(int i = 0; i < argc; ++i)
+int ServerPoolSiftGPU::RunSIFT(int num, const SiftGPU::SiftKeypoint * keys, int keys_have_orientation)
+{
+	ServerLockScope scope(*_call_lock);
+	RunInput input = {NULL, 0, 0, 0, NULL, 0, 0, NULL, num, keys_have_orientation, keys};
+	return Run(input);
+}
+
+int ServerPoolSiftGPU::AllocatePyramid(int width, int height)
+{
+	ServerLockScope scope(*_call_lock);
+	int result = 0;
+	for(size_t i = 0; i < _servers.size(); ++i)
 	{
-		if(argv[i])	
-		{
-			strcpy(p, argv[i]);
-			p += strlen(argv[i]);
-		}
-		*p++= ((i +1 < argc)? ' ' : '\0');
+		if(IsHealthy(_servers[i])) result = _servers[i]->_combo->AllocatePyramid(width, height) || result;
 	}
-	SocketUtil::writeint(_socketfd, COMMAND_PARSE_PARAM);
-	SocketUtil::writedata(_socketfd, buf, (p - buf));
-	SocketUtil::writedata(_socketfd, &cret, 1);
+	return result;
+}
 
+//the frames are kept by the pool, and each one is a run when it is popped
+int ServerPoolSiftGPU::BeginStream(int width, int height, unsigned int gl_format, unsigned int gl_type, int row_bytes)
+{
+	if(width <= 0 || height <= 0 || ServerSiftGPU::GetPixelSizeGL(gl_format, gl_type) <= 0) return 0;
+	_stream_param[0] = width;
+	_stream_param[1] = height;
+	_stream_param[2] = (int) gl_format;
+	_stream_param[3] = (int) gl_type;
+	_stream_param[4] = row_bytes;
+	_stream_frames.clear();
+	_streaming = 1;
+	return 1;
 }
 
-int ServerSiftGPU:: InitializeConnection(int argc, char** argv)
+int ServerPoolSiftGPU::PushFrame(const void * data)
 {
-	char server_name[1024]; 
-	if(!InitSocket()) return 0 ;
-    if(_server_name[0] == 0)
-    {
-	    if(StartServerProcess(argc, argv) == 0) 
-	    {
-		    std::cout<<"Unable to start local siftgpu server\n";
-            return 0 ;
-	    }
-        strcpy(server_name, "127.0.0.1");
-    }else
-    {
-        strcpy(server_name, _server_name);
-    }
-	
-    /////////////////////////////////////////////// 
-	if(ConnectServer(server_name, _port) == 0)
+	if(!_streaming || data == NULL) return 0;
+	_stream_frames.push_back(data);
+	return 1;
+}
+
+int ServerPoolSiftGPU::PopFeatures()
+{
+	if(!_streaming || _stream_frames.empty()) return -1;
+	RunInput input = {NULL, _stream_param[0], _stream_param[1], _stream_param[4], _stream_frames.front(), 
+				(unsigned int) _stream_param[2], (unsigned int) _stream_param[3], NULL, 0, 0, NULL};
+	_stream_frames.pop_front();
+	ServerLockScope scope(*_call_lock);
+	Run(input);
+	return _current ? _current->_combo->GetFeatureNum() : 0;
+}
+
+void ServerPoolSiftGPU::EndStream()
+{
+	_stream_frames.clear();
+	_streaming = 0;
+}
+
+int ServerPoolSiftGPU::GetFeatureNum()
+{
+	ServerLockScope scope(*_call_lock);
+	return _current ? _current->_combo->GetFeatureNum() : 0;
+}
+
+void ServerPoolSiftGPU::SetEncoding(int encoding)
+{
+	ServerLockScope scope(*_call_lock);
+	_encoding = encoding;
+	for(size_t i = 0; i < _servers.size(); ++i)
 	{
-        //wait for one second
-#ifdef _WIN32
-	    Sleep(1000);
-#else
-	    sleep(1);
-#endif
-		if(ConnectServer(server_name, _port) == 0)
-		{
-			std::cout<<"Unable to connect siftgpu sever\n";
-			return 0 ;
-		}
+		if(IsHealthy(_servers[i])) _servers[i]->_combo->SetEncoding(encoding);
 	}
-	return 1;
 }
 
-void ServerSiftGPU::ParseParam(int argc, char **argv)
+void ServerPoolSiftGPU::SetTightPyramid(int tight)
 {
-    if(_connected == 1) 
+	ServerLockScope scope(*_call_lock);
+	_tight_pyramid = tight;
+	for(size_t i = 0; i < _servers.size(); ++i)
 	{
-		SetParamSiftGPU(argc, argv); 
-	}else	
+		if(IsHealthy(_servers[i])) _servers[i]->_combo->SetTightPyramid(tight);
+	}
+}
+
+void ServerPoolSiftGPU::SetMaxDimension(int sz)
+{
+	ServerLockScope scope(*_call_lock);
+	_max_dimension = sz;
+	for(size_t i = 0; i < _servers.size(); ++i)
 	{
-		_connected = InitializeConnection(argc, argv);
-		if(_server_name[0] && argc > 0) SetParamSiftGPU(argc, argv);
+		if(IsHealthy(_servers[i])) _servers[i]->_combo->SetMaxDimension(sz);
 	}
 }
 
-int ServerSiftGPU::VerifyContextGL()
+void ServerPoolSiftGPU::GetFeatureVector(SiftGPU::SiftKeypoint * keys, float * descriptors)
 {
-		////////////////////////////////////////////////////
-	if(!_connected) return 0;
+	ServerLockScope scope(*_call_lock);
+	if(_current) _current->_combo->GetFeatureVector(keys, descriptors);
+}
 
-	int result = 0;
+void ServerPoolSiftGPU::GetFeatureVectorU8(SiftGPU::SiftKeypoint * keys, unsigned char * descriptors)
+{
+	ServerLockScope scope(*_call_lock);
+	if(_current) _current->_combo->GetFeatureVectorU8(keys, descriptors);
+}
 
-	if(SocketUtil::writeint(_socketfd, COMMAND_INITIALIZE) && 
-		SocketUtil::readint(_socketfd, &result) && result)
-	{
-		return SiftGPU::SIFTGPU_FULL_SUPPORTED;
-	}else
+//the keypoints go to one server, which is used by the next run
+void ServerPoolSiftGPU::SetKeypointList(int num, const SiftGPU::SiftKeypoint * keys, int keys_have_orientation)
+{
+	ServerLockScope scope(*_call_lock);
+	_keypoint_server = PickServer();
+	if(_keypoint_server) _keypoint_server->_combo->SetKeypointList(num, keys, keys_have_orientation);
+}
+
+void ServerPoolSiftGPU::SetDetectionMask(int width, int height, const unsigned char * mask)
+{
+	ServerLockScope scope(*_call_lock);
+	int ok = width > 0 && height > 0 && mask != NULL;
+	_mask_size[0] = ok ? width : 0;
+	_mask_size[1] = ok ? height : 0;
+	if(ok) _mask.assign(mask, mask + width * height);
+	else _mask.clear();
+	for(size_t i = 0; i < _servers.size(); ++i)
 	{
-		std::cout<<"SifGPU failed to initialize\n";
-		Disconnect();
-		return 0;
+		if(IsHealthy(_servers[i])) _servers[i]->_combo->SetDetectionMask(width, height, mask);
 	}
 }
 
-int	ServerSiftGPU::GetFeatureNum()
+void ServerPoolSiftGPU::SetDetectionROI(int num, const int * rois)
 {
-	if(!_connected) return 0;
-	int result = 0;
-	SocketUtil::writeint(_socketfd, COMMAND_GET_FEATURE_COUNT);
-	SocketUtil::readint(_socketfd, &result);
-	return result;
+	ServerLockScope scope(*_call_lock);
+	if(num > 0 && rois) _rois.assign(rois, rois + 4 * num);
+	else _rois.clear();
+	for(size_t i = 0; i < _servers.size(); ++i)
+	{
+		if(IsHealthy(_servers[i])) _servers[i]->_combo->SetDetectionROI(num, rois);
+	}
 }
 
-int ServerSiftGPU::AllocatePyramid(int width, int height)
+void ServerPoolSiftGPU::SaveSIFT(const char * szFileName)
 {
-	if(!_connected) return 0;
-	int command[3] = {COMMAND_ALLOCATE_PYRAMID, width, height};
-	return SocketUtil::writedata(_socketfd, command, sizeof(int) * 3);
+	ServerLockScope scope(*_call_lock);
+	if(_current) _current->_combo->SaveSIFT(szFileName);
 }
 
-////////////////////////////////////////////////////////////
-void ServerSiftGPU::SaveSIFT(const char * szFileName)
+void ServerPoolSiftGPU::GetConfig(SiftConfig& config)
 {
-	if(!_connected) return;
+	PrintUnsupported("ServerPoolSiftGPU::GetConfig");
+}
 
-	char cret = '\n';
-	SocketUtil::writeint(_socketfd, COMMAND_SAVE_SIFT);
-	SocketUtil::writedata(_socketfd, szFileName, (int)strlen(szFileName));
-	SocketUtil::writedata(_socketfd, &cret, 1);
+void ServerPoolSiftGPU::SetConfig(const SiftConfig& config)
+{
+	PrintUnsupported("ServerPoolSiftGPU::SetConfig");
+}
 
+int ServerPoolSiftGPU::GetPyramidMemoryKB()
+{
+	PrintUnsupported("ServerPoolSiftGPU::GetPyramidMemoryKB");
+	return -1;
 }
 
-void ServerSiftGPU::GetFeatureVector(SiftGPU::SiftKeypoint * keys, float * descriptors)
+int ServerPoolSiftGPU::GetProfileScopeNum()
 {
-	if(!_connected) return;
+	PrintUnsupported("ServerPoolSiftGPU::GetProfileScopeNum");
+	return 0;
+}
 
-	int num = GetFeatureNum(), result = 1;
-	if(keys && num > 0)
-	{
-		result&= SocketUtil::writeint(_socketfd, COMMAND_GET_KEY_VECTOR);
-		result &= SocketUtil::readdata(_socketfd, keys, num * sizeof(SiftGPU::SiftKeypoint));
-	}
-	if(descriptors && num > 0)
-	{
-		result&= SocketUtil::writeint(_socketfd, COMMAND_GET_DES_VECTOR);
-		result&= SocketUtil::readdata(_socketfd, descriptors, num * 128 * sizeof(float));
-	}
+int ServerPoolSiftGPU::GetProfileScope(int index, SiftProfileScope& scope)
+{
+	PrintUnsupported("ServerPoolSiftGPU::GetProfileScope");
+	return 0;
 }
 
-void ServerSiftGPU::SetKeypointList(int num, const SiftGPU::SiftKeypoint * keys, int keys_have_orientation)
+const char* ServerPoolSiftGPU::GetProfileJSON()
 {
-	if(!_connected) return;
+	PrintUnsupported("ServerPoolSiftGPU::GetProfileJSON");
+	return NULL;
+}
 
-	SocketUtil::writeint(_socketfd, COMMAND_SET_KEYPOINT);
-	SocketUtil::writeint(_socketfd, num);
-	SocketUtil::writeint(_socketfd, keys_have_orientation);
-	SocketUtil::writedata(_socketfd, keys, sizeof(SiftGPU::SiftKeypoint) * num);	
+int ServerPoolSiftGPU::SaveProfile(const char * path)
+{
+	PrintUnsupported("ServerPoolSiftGPU::SaveProfile");
+	return 0;
+}
 
+void ServerPoolSiftGPU::ResetProfile()
+{
+	PrintUnsupported("ServerPoolSiftGPU::ResetProfile");
 }
 
-void ServerSiftGPU::SetTightPyramid(int tight)
+int ServerPoolSiftGPU::_VerifyContextGL()
 {
-	if(!_connected) return ;
-	SocketUtil::writeint(_socketfd, COMMAND_SET_TIGHTPYRAMID);
-	SocketUtil::writeint(_socketfd, tight);
+	ServerLockScope scope(*_call_lock);
+	_match_initialized = 1;
+	for(size_t attempt = 0; attempt <= _servers.size(); ++attempt)
+	{
+		ServerPoolEntry * matcher = PickMatcher();
+		if(matcher == NULL) return 0;
+		int result = matcher->_combo->_VerifyContextGL();
+		if(matcher->_combo->IsConnected()) return result;
+		SetFailed(matcher);
+	}
+	return 0;
+}
 
+void ServerPoolSiftGPU::SetLanguage(int gpu_language)
+{
+	ServerLockScope scope(*_call_lock);
+	_language = gpu_language;
+	if(_matcher && IsHealthy(_matcher)) _matcher->_combo->SetLanguage(gpu_language);
 }
 
-void ServerSiftGPU::SetMaxDimension(int sz)
+void ServerPoolSiftGPU::SetDeviceParam(int argc, char**argv)
 {
-	if(!_connected) return ;
-	SocketUtil::writeint(_socketfd, COMMAND_SET_MAX_DIMENSION);
-	SocketUtil::writeint(_socketfd, sz);
+	ParseParam(argc, argv);
+}
 
+//the verbose level of the servers, which is kept with the parameters
+void ServerPoolSiftGPU::SetVerbose(int verbose)
+{
+	char option[] = "-v", level[16];
+	sprintf(level, "%d", verbose);
+	char * argv[2] = {option, level};
+	ParseParam(2, argv);
 }
 
-int ServerSiftGPU::GetPixelSizeGL(unsigned int gl_format, unsigned int gl_type)
+void ServerPoolSiftGPU::SetMaxSift(int max_sift)
 {
-    int num_channel_byte = 0;
-    int num_channels  = 0;
-    switch(gl_type)
-    {
-    case GL_BITMAP:
-    case GL_UNSIGNED_BYTE:
-    case GL_BYTE:
-        num_channel_byte = 1;
-        break;
-    case GL_UNSIGNED_SHORT:
-    case GL_SHORT:
-        num_channel_byte = 2;
-        break;
-    case GL_UNSIGNED_INT:
-    case GL_INT: 
-    case GL_FLOAT:
-        num_channel_byte = 4;
-        break;
-    default:
-        num_channel_byte = 0;
-        break;
-    }
+	ServerLockScope scope(*_call_lock);
+	_max_sift = max_sift;
+	if(_matcher && IsHealthy(_matcher)) _matcher->_combo->SetMaxSift(max_sift);
+}
 
-    switch(gl_format)
-    {
-    case GL_RED:
-    case GL_GREEN:
-    case GL_BLUE:
-    case GL_ALPHA:
-    case GL_LUMINANCE:
-        num_channels = 1;
-        break;
-    case GL_RGB:
-    case GL_BGR_EXT:
-        num_channels = 3;
-        break;
-    case GL_RGBA:
-    case GL_BGRA_EXT:
-#ifdef GL_ARGB_I3D
-    case GL_ARGB_I3D:
-#endif
-        num_channels = 4;
-        break;
-    case GL_LUMINANCE_ALPHA:
-#ifdef GL_422_EXT
-    case GL_422_EXT:
-    case GL_422_REV_EXT: 
-    case GL_422_AVERAGE_EXT:
-    case GL_422_REV_AVERAGE_EXT:
-#endif
-        num_channels = 2;
-    default:
-        num_channels = 0;
-        break;
-    }
-    return num_channels * num_channel_byte;
+//the descriptors are copied to be sent again if the matching server fails
+void ServerPoolSiftGPU::SetDescriptors(int index, int num, const float* descriptors, int id)
+{
+	ServerLockScope scope(*_call_lock);
+	if(index < 0 || index > 1) return;
+	_des_num[index] = descriptors ? num : 0;
+	_des_id[index] = id;
+	_des_byte[index] = 0;
+	if(_des_num[index] > 0) _des[index].assign(descriptors, descriptors + 128 * num);
+	_des_u8[index].clear();
+	if(_matcher && IsHealthy(_matcher)) SendDescriptors(_matcher, index);
 }
 
-int ServerSiftGPU::RunSIFT(int width, int height, const void * data, unsigned int gl_format, unsigned int gl_type)
+void ServerPoolSiftGPU::SetDescriptors(int index, int num, const unsigned char * descriptors, int id)
 {
-	if(width <=0 || height <= 0 || data == NULL || !_connected) return 0;
-    int num_bytes = GetPixelSizeGL(gl_format , gl_type) * width * height;
-    if(num_bytes == 0) return 0;
-	SocketUtil::writeint(_socketfd, COMMAND_RUNSIFT_DATA);
-	unsigned int data_des[5] = {width, height, gl_format, gl_type, num_bytes};
-	SocketUtil::writedata(_socketfd, data_des, 5 * sizeof(unsigned int));
-	SocketUtil::writedata(_socketfd, data, num_bytes);
-	int result = 0;	
-	return SocketUtil::readint(_socketfd, &result) && result;
+	ServerLockScope scope(*_call_lock);
+	if(index < 0 || index > 1) return;
+	_des_num[index] = descriptors ? num : 0;
+	_des_id[index] = id;
+	_des_byte[index] = 1;
+	if(_des_num[index] > 0) _des_u8[index].assign(descriptors, descriptors + 128 * num);
+	_des[index].clear();
+	if(_matcher && IsHealthy(_matcher)) SendDescriptors(_matcher, index);
 }
 
-int ServerSiftGPU::RunSIFT(int num, const SiftGPU::SiftKeypoint * keys, int keys_have_orientation)
+int ServerPoolSiftGPU::GetSiftMatch(int max_match, int match_buffer[][2], float distmax, float ratiomax, int mutual_best_match)
 {
-	if(num <= 0 || keys == NULL) return 0;
-	if(!_connected) return 0;
-	SocketUtil::writeint(_socketfd, COMMAND_RUNSIFT_KEY);
-	SocketUtil::writeint(_socketfd, num);
-	SocketUtil::writeint(_socketfd, keys_have_orientation);
-	SocketUtil::writedata(_socketfd, keys, sizeof(SiftGPU::SiftKeypoint) * num);
-	int result = 0;	
-	return SocketUtil::readint(_socketfd, &result) && result;
+	ServerLockScope scope(*_call_lock);
+	for(size_t attempt = 0; attempt <= _servers.size(); ++attempt)
+	{
+		ServerPoolEntry * matcher = PickMatcher();
+		if(matcher == NULL) return 0;
+		_lock->Lock();
+		matcher->_load++;
+		_lock->Unlock();
+		int nm = matcher->_combo->GetSiftMatch(max_match, match_buffer, distmax, ratiomax, mutual_best_match);
+		_lock->Lock();
+		matcher->_load--;
+		_lock->Unlock();
+		if(matcher->_combo->IsConnected()) return nm;
+		SetFailed(matcher);
+	}
+	return 0;
 }
 
-int ServerSiftGPU::RunSIFT()
+//called with the lock held, and returns without it
+void ServerPoolSiftGPU::Finish(SiftGPURequest * request)
 {
-	if(!_connected) return 0;
-    int result = 0;
-    SocketUtil::writeint(_socketfd, COMMAND_RUNSIFT);
-	return SocketUtil::readint(_socketfd, &result) && result;
+	delete (Task*) request->_context;
+	request->_context = NULL;
+	FinishRequest(*_lock, this, request);
 }
 
-int ServerSiftGPU::RunSIFT(const char *imgpath)
+//send an asynchronous request to a server, it fails after every server is tried.
+//Called with the call lock held
+void ServerPoolSiftGPU::Submit(SiftGPURequest * request)
 {
-	if(!_connected) return 0;
-	int result = 0;	char cret = '\n';
-	SocketUtil::writeint(_socketfd, COMMAND_RUNSIFT_FILE);
-	SocketUtil::writedata(_socketfd, imgpath, (int)strlen(imgpath));
-	SocketUtil::writedata(_socketfd, &cret, 1);
-	return SocketUtil::readint(_socketfd, &result) && result;
+	Task * task = (Task*) request->_context;
+	ServerPoolEntry * server = NULL;
+	if(task->attempts++ <= (int) _servers.size()) server = task->match ? PickMatcher() : PickServer();
+	if(server == NULL)
+	{
+		_lock->Lock();
+		request->_result = -1;
+		Finish(request);
+		return;
+	}
+	_lock->Lock();
+	server->_load++;
+	task->server = server;
+	_lock->Unlock();
+	const RunInput& input = task->input;
+	if(task->match)
+		server->_combo->GetSiftMatchAsync(task->max_match, task->distmax, task->ratiomax, task->mutual_best_match, OnRequest, request);
+	else if(input.imgpath)
+		server->_combo->RunSIFTAsync(input.imgpath, OnRequest, request);
+	else
+		server->_combo->RunSIFTAsync(input.width, input.height, input.data, input.gl_format, input.gl_type, 
+									input.row_bytes, input.roi, OnRequest, request);
 }
 
+//send the requests of the failed servers again, called with the call lock held
+void ServerPoolSiftGPU::SubmitRetries()
+{
+	_lock->Lock();
+	while(_retry.size())
+	{
+		SiftGPURequest * request = _retry.front();
+		_retry.pop_front();
+		_lock->Unlock();
+		Submit(request);
+		_lock->Lock();
+	}
+	_lock->Unlock();
+}
 
-////////////////////////////////////////////////
-int ServerSiftGPU::_VerifyContextGL()
+//the callback of the requests that are sent to the servers
+void ServerPoolSiftGPU::OnRequest(ComboSiftGPU * combo, SiftGPURequest * inner, void * user_data)
 {
-	if(!_connected) return 0;
-	int result;
-	if( SocketUtil::writeint(_socketfd, COMMAND_MATCH_INITIALIZE) &&
-		SocketUtil::readint(_socketfd, &result) && result)
+	SiftGPURequest * request = (SiftGPURequest*) user_data;
+	ServerPoolSiftGPU * pool = (ServerPoolSiftGPU*) request->_owner;
+	Task * task = (Task*) request->_context;
+	int failed = inner->_result < 0 && !((ServerSiftGPU*) combo)->IsConnected();
+	if(!failed)
 	{
-		return 1;
+		request->_result = inner->_result;
+		request->_keys.swap(inner->_keys);
+		request->_descriptors.swap(inner->_descriptors);
+		request->_matches.swap(inner->_matches);
+	}
+	combo->ReleaseRequest(inner);
+
+	pool->_lock->Lock();
+	task->server->_load--;
+	if(failed)
+	{
+		if(task->server->_healthy) std::cout << "ServerPoolSiftGPU: server " << task->server->_host 
+										<< ":" << task->server->_port << " failed\n";
+		task->server->_healthy = 0;
+		task->server->_failed_time = time(NULL);
+		pool->_retry.push_back(request);
+		pool->_lock->Broadcast();
+		pool->_lock->Unlock();
 	}else
 	{
-		Disconnect();
-		return 0;
+		pool->Finish(request);
 	}
 }
 
-void ServerSiftGPU::SetLanguage(int gpu_language)
+SiftGPURequest* ServerPoolSiftGPU::AsyncRun(Task * task, RequestCallback callback, void * user_data)
 {
-	if(!_connected) return ;
-	SocketUtil::writeint(_socketfd, COMMAND_MATCH_SET_LANGUAGE);
-	SocketUtil::writeint(_socketfd, gpu_language);
+	SiftGPURequest * request = new SiftGPURequest(callback, user_data);
+	request->_owner = this;
+	request->_context = task;
+	ServerLockScope scope(*_call_lock);
+	Submit(request);
+	return request;
 }
 
-void ServerSiftGPU::SetDeviceParam(int argc, char**argv)
+//the pool thread sends the failed requests again, so they are finished without 
+//WaitRequest, and it reconnects the failed servers 
+void ServerPoolSiftGPU::RunThread()
 {
-    ServerSiftGPU::ParseParam(argc, argv);
+	_lock->Lock();
+	while(!_stopped)
+	{
+		if(_retry.empty())
+		{
+			//woken up by a failed request, and once a second for the reconnections
+			_lock->Wait(1000);
+			_lock->Unlock();
+			ReconnectFailed();
+		}else
+		{
+			_lock->Unlock();
+			_call_lock->Lock();
+			SubmitRetries();
+			_call_lock->Unlock();
+		}
+		_lock->Lock();
+	}
+	_lock->Unlock();
 }
 
+SiftGPURequest* ServerPoolSiftGPU::RunSIFTAsync(const char * imgpath, RequestCallback callback, void * user_data)
+{
+	RunInput input = {imgpath, 0, 0, 0, NULL, 0, 0, NULL, 0, 0, NULL};
+	return AsyncRun(new Task(input), callback, user_data);
+}
 
-void ServerSiftGPU::SetMaxSift(int max_sift)
+SiftGPURequest* ServerPoolSiftGPU::RunSIFTAsync(int width, int height, const void * data, unsigned int gl_format, 
+						unsigned int gl_type, RequestCallback callback, void * user_data)
 {
-	if(!_connected) return;
-	SocketUtil::writeint(_socketfd,	COMMAND_MATCH_SET_MAXSIFT);
-	SocketUtil::writeint(_socketfd, max_sift);
+	RunInput input = {NULL, width, height, 0, data, gl_format, gl_type, NULL, 0, 0, NULL};
+	return AsyncRun(new Task(input), callback, user_data);
 }
 
-void ServerSiftGPU::SetDescriptors(int index, int num, const float* descriptors, int id)
+SiftGPURequest* ServerPoolSiftGPU::RunSIFTAsync(int width, int height, const void * data, unsigned int gl_format, 
+						unsigned int gl_type, int row_bytes, const int * roi, RequestCallback callback, void * user_data)
 {
-	if(!_connected) return ;
-	int command[4] = {COMMAND_MATCH_SET_DES_FLOAT, index, num, id};
-	SocketUtil::writedata(_socketfd, command, sizeof(command));
-	SocketUtil::writedata(_socketfd, descriptors, sizeof(float) * 128 * num);
+	RunInput input = {NULL, width, height, row_bytes, data, gl_format, gl_type, roi, 0, 0, NULL};
+	return AsyncRun(new Task(input), callback, user_data);
 }
 
+SiftGPURequest* ServerPoolSiftGPU::GetSiftMatchAsync(int max_match, float distmax, float ratiomax, 
+						int mutual_best_match, RequestCallback callback, void * user_data)
+{
+	RunInput input = {NULL, 0, 0, 0, NULL, 0, 0, NULL, 0, 0, NULL};
+	Task * task = new Task(input);
+	task->match = 1;
+	task->max_match = max_match;
+	task->distmax = distmax;
+	task->ratiomax = ratiomax;
+	task->mutual_best_match = mutual_best_match;
+	return AsyncRun(task, callback, user_data);
+}
 
-void ServerSiftGPU::SetDescriptors(int index, int num, const unsigned char * descriptors, int id)
+int ServerPoolSiftGPU::WaitRequest(SiftGPURequest * request)
 {
-	if(!_connected) return ;
-	int command[4] = {COMMAND_MATCH_SET_DES_BYTE, index, num, id};
-	SocketUtil::writedata(_socketfd, command, sizeof(command));
-	SocketUtil::writedata(_socketfd, descriptors, sizeof(unsigned char) * 128 * num);
+	if(request == NULL) return -1;
+	//the failed requests are sent again by the pool thread
+	_lock->Lock();
+	while(request->_state < SiftGPURequest::REQUEST_CALLBACK) _lock->Wait();
+	int result = request->_result;
+	_lock->Unlock();
+	return result;
 }
 
-int  ServerSiftGPU::GetSiftMatch(int max_match,	int match_buffer[][2], 
-	float distmax, float ratiomax,	int mutual_best_match)
+int ServerPoolSiftGPU::IsRequestFinished(SiftGPURequest * request)
 {
-	if(!_connected) return 0;
-	int command[3] = {COMMAND_MATCH_GET_MATCH, max_match, mutual_best_match};
-	float fcommand[2] = {distmax, ratiomax};
-	SocketUtil::writedata(_socketfd, command, sizeof(command));
-	SocketUtil::writedata(_socketfd, fcommand, sizeof(fcommand));
-	int nm;	SocketUtil::readint(_socketfd, &nm);
-	if(nm > 0) SocketUtil::readint(_socketfd, match_buffer[0], 2 * nm);
-	return nm;
+	if(request == NULL) return 1;
+	_lock->Lock();
+	int finished = request->_state >= SiftGPURequest::REQUEST_CALLBACK;
+	_lock->Unlock();
+	return finished;
 }
 
+void ServerPoolSiftGPU::ReleaseRequest(SiftGPURequest * request)
+{
+	if(request == NULL) return;
+	WaitRequest(request);
+	_lock->Lock();
+	int in_callback = request->_state == SiftGPURequest::REQUEST_CALLBACK;
+	if(in_callback) request->_released = 1;
+	_lock->Unlock();
+	if(!in_callback) delete request;
+}
 void RunServerLoop(int port, int argc, char** argv)
 {
-    ServerSiftGPU::ServerLoop(port, argc, argv);
+	int worker_num, http_port = 0, store_mb = 256, disk_mb = 0;
+	const char* store_dir = NULL;
+	//-http port: serve /metrics, /healthz, /readyz and /trace
+	//-store mb, -store_dir path and -store_disk mb: the memory and the folder of the feature store
+	//-trace n: record the last n events of each thread for /trace
+	while(argc >= 2)
+	{
+		int events;
+		if(strcmp(argv[0], "-http") == 0) sscanf(argv[1], "%d", &http_port);
+		else if(strcmp(argv[0], "-trace") == 0 && sscanf(argv[1], "%d", &events) == 1) SiftTracer::Start(events);
+		else if(strcmp(argv[0], "-store") == 0) sscanf(argv[1], "%d", &store_mb);
+		else if(strcmp(argv[0], "-store_dir") == 0) store_dir = argv[1];
+		else if(strcmp(argv[0], "-store_disk") == 0) sscanf(argv[1], "%d", &disk_mb);
+		else break;
+		argc -= 2;
+		argv += 2;
+	}
+	ServerFeatureStore store(store_mb, store_dir, disk_mb);
+	if(argc >= 2 && strcmp(argv[0], "-multi") == 0 && sscanf(argv[1], "%d", &worker_num) == 1 && worker_num > 0)
+		ServerSiftGPU::MultiServerLoop(port, http_port, &store, worker_num, argc - 2, argv + 2);
+	else
+		ServerSiftGPU::ServerLoop(port, http_port, &store, argc, argv);
 }
 
 
@@ -880,6 +4515,11 @@ ComboSiftGPU* CreateRemoteSiftGPU(int port, char* remote_server)
 	return new ServerSiftGPU(port, remote_server);
 }
 
+ComboSiftGPU* CreateRemoteSiftGPUPool(const char * servers)
+{
+	return new ServerPoolSiftGPU(servers);
+}
+
 
 #else
 
@@ -893,6 +4533,13 @@ ComboSiftGPU* CreateRemoteSiftGPU(int port, char* remote_server)
 	return new ComboSiftGPU;
 }
 
+ComboSiftGPU* CreateRemoteSiftGPUPool(const char * servers)
+{
+    std::cout << "ServerSiftGPU need marcro SERVER_SIFTGPU_EANBLED.\n"
+              << "Use local SiftGPU/SiftMatchGPU instead. \n";
+	return new ComboSiftGPU;
+}
+
 void RunServerLoop(int port, int argc, char** argv)
 {
     std::cout << "ServerSiftGPU need marcro SERVER_SIFTGPU_EANBLED.\n"
@@ -24,9 +24,18 @@
 #ifndef GPU_SIFT_SERVER_H
 #define GPU_SIFT_SERVER_H
 
+#include <deque>
+#include <vector>
+#include <string>
 
 class ComboSiftGPU;
 class LiteWindow;
+class SharedMemory;
+class ServerIO;
+class ServerLock;
+class ServerFeatureStore;
+class ServerPoolEntry;
+class ServerPoolThread;
 
 /////////////////////////////////////////////////////////////////////////////
 //ServerSiftGPU::ServerSiftGPU(int port, char* remote_server)
@@ -39,6 +48,21 @@ class LiteWindow;
 //			Assumes the existenc of a remote server and connects to it
 //			GPU selection is done on the server-end when create the server by running
 //			server_siftgpu -server port [siftgpu_param]
+//			server_siftgpu -server port -multi n [siftgpu_param] starts a server 
+//			that serves many clients with n workers. The parameters that are 
+//			compiled into the programs (e.g. -fo, -d) are those of the server.
+//When the server runs on the same computer, the images, descriptors and 
+//features are passed through a shared memory region instead of the socket.
+//RunSIFTAsync and GetSiftMatchAsync send the request and return; the responses
+//are read by an I/O thread, so one thread can keep many servers busy.
+//A multi-client server runs the requests by priority class (SetPriority), and
+//rejects a run as busy when its queue is full or its deadline has passed.
+//server_siftgpu -server port -http http_port ... also serves /metrics (the
+//same text as GetMetrics), /healthz (liveness) and /readyz (readiness) by HTTP.
+//The server keeps the features that StoreFeatures names with an id, and 
+//GetStoredMatch matches two of them without sending the descriptors again.
+//-store mb sets its memory (default 256), and -store_dir path [-store_disk mb]
+//also writes the features to a folder that is kept when the server restarts.
 /////////////////////////////////////////////////////////////////////////////
 
 
@@ -72,9 +96,76 @@ class ServerSiftGPU: public ComboSiftGPU
 		COMMAND_MATCH_SET_DES_BYTE,
 		COMMAND_MATCH_SET_MAXSIFT,
 		COMMAND_MATCH_GET_MATCH,
+		COMMAND_GET_DES_VECTOR_U8,
+		COMMAND_SET_DETECTION_MASK,
+		COMMAND_SET_DETECTION_ROI,
+		COMMAND_GET_FEATURES,
+		COMMAND_FRAMED,
+		COMMAND_SHARED_MEMORY,
+		COMMAND_SET_PRIORITY,
+		COMMAND_GET_METRICS,
+		COMMAND_SET_ENCODING,
+		COMMAND_STORE_FEATURES,
+		COMMAND_MATCH_STORED,
+		COMMAND_NUM,
 		///////////////////////////////
 		DEFAULT_PORT = 7777
 	};
+	//the framed protocol, see ServerFrame
+	enum
+	{
+		//the lower of the two versions is used, 2 adds COMMAND_SET_ENCODING,
+		//3 adds the feature store and ENCODING_NO_FEATURES
+		PROTOCOL_VERSION	= 3,
+		//no response is sent for the request
+		FRAME_NO_REPLY		= 1,
+		//the features are appended to the response of RUNSIFT*
+		FRAME_WITH_FEATURES	= 2,
+		//the payload is in the shared memory
+		FRAME_SHARED		= 4,
+		//a response: the request is not run because the queue is full or its
+		//deadline has passed. The response flags also carry the queue depth
+		FRAME_BUSY			= 8,
+		FRAME_DEPTH_SHIFT	= 16,
+		//the shared memory: the first bytes hold the token, the payloads smaller
+		//than SHARED_MIN_SIZE are sent through the socket, and a run reserves at
+		//least SHARED_RESERVE bytes for its features
+		SHARED_HEADER		= 64,
+		SHARED_MIN_SIZE		= 4096,
+		SHARED_RESERVE		= 1 << 22,
+		SHARED_SIZE			= 1 << 24,
+		SHARED_MAX_SIZE		= 1 << 30,
+		//the largest request that a multi-client server reads, larger ones close the connection
+		REQUEST_MAX_SIZE	= 1 << 28
+	};
+public:
+	//the priority classes of the requests in a multi-client server, see SetPriority
+	enum
+	{
+		PRIORITY_INTERACTIVE	= 0,
+		PRIORITY_NORMAL			= 1,
+		PRIORITY_BATCH			= 2,
+		PRIORITY_NUM			= 3
+	};
+	//the wire encodings of the features that are returned by the server, see SetEncoding
+	enum
+	{
+		ENCODING_FLOAT			= 0,
+		//the descriptors are sent as bytes with the quantization of GetFeatureVectorU8 
+		//(which stays exact), GetFeatureVector returns the bytes divided by 512
+		ENCODING_U8				= 1,
+		//the keypoints are sent as 16-bit integers: x and y in steps of 1/16 pixel 
+		//(coarser for the images larger than 4096), the sign and the log2 of the scale in
+		//1/1024, and orientation in 2pi/65536
+		ENCODING_KEY16			= 2,
+		//LZ compression of the features
+		ENCODING_LZ				= 4,
+		ENCODING_COMPACT		= 7,
+		//only the number of features is sent, the features stay on the server for 
+		//StoreFeatures and SaveSIFT (GetFeatureVector then returns nothing)
+		ENCODING_NO_FEATURES	= 8,
+		ENCODING_ALL			= 15
+	};
 private:
 #ifdef _WIN64
 	unsigned __int64 _socketfd;
@@ -84,19 +175,102 @@ private:
 	int			 _port;
     int          _connected;
     char		 _server_name[1024];
+	//streaming mode: {width, height, gl_format, gl_type, row_bytes} and the queued frames
+	int			 _stream_param[5];
+	int			 _streaming;
+	std::deque<const void*> _stream_frames;
+	//the last request id, the last response, and the features of the last run
+	int			 _request_id;
+	std::vector<char> _response;
+	const char*	 _response_data;	//in _response or in the shared memory
+	size_t		 _response_size;
+	int			 _feature_num;
+	std::vector<SiftGPU::SiftKeypoint> _keys;
+	std::vector<float> _descriptors;
+	//the shared memory, and the bytes used by the requests that are not finished
+	SharedMemory* _shm;
+	size_t		 _shm_used;
+	//the I/O thread, started by the first asynchronous request
+	ServerIO*	 _io;
+	//the queue depth of the last response, and whether it is rejected as busy
+	int			 _queue_depth;
+	int			 _busy;
+	//the text of the last GetMetrics
+	std::string	 _metrics;
+	//the version of the framed protocol that the server uses, and the encoding of the features
+	int			 _protocol;
+	int			 _encoding;
 private:
 	void		SetParamSiftGPU(int argc, char** argv);
 	int			InitializeConnection(int argc, char** argv);
 	int			StartServerProcess(int argc, char** argv);
 	int			ConnectServer(const char* server_name, int port);
 	void		Disconnect();
+	//send a request with up to two blocks of payload, returns its id or 0.
+	//With the I/O thread, the response goes to request (or to the next Response)
+	int			Request(int command, int flags, const void * data1 = NULL, int size1 = 0, 
+						const void * data2 = NULL, int size2 = 0, SiftGPURequest * request = NULL);
+	//read the response of request id into _response_data
+	int			Response(int id);
+	//create a shared memory region of size bytes and let the server map it
+	int			OpenSharedMemory(size_t size);
+	void		CloseSharedMemory();
+	//make room for a payload of size bytes if the server is not using the shared memory
+	void		GrowSharedMemory(int size, int reply);
+	//find room for a payload of size bytes and the response, {offset, size, out_offset, out_size}
+	int			AllocateShared(int size, int reply, int location[4]);
+	//the I/O thread that reads the responses of the asynchronous requests
+	int			StartIO();
+	void		StopIO();
+	void		RunIO();
+	SiftGPURequest* AsyncRequest(SiftGPURequest * request, int command, int flags, 
+						const void * data1 = NULL, int size1 = 0, const void * data2 = NULL, int size2 = 0);
+	int			ResponseInt(size_t offset);
+	void		ReadFeatures(size_t offset);
+	//a RUNSIFT* request that returns the result and the features
+	int			RunRequest(int command, const void * data1 = NULL, int size1 = 0, 
+						const void * data2 = NULL, int size2 = 0);
     static int  InitSocket();
     static int	GetPixelSizeGL(unsigned int gl_format, unsigned int gl_type);
-	static void ServerLoop(int port, int argc, char** argv);
+	//the received pixels (size bytes) cover the image of data_des {width, height, format, type}
+	static int	IsImageData(const int data_des[4], int size);
+	//the metrics are also served by HTTP on http_port if it is not 0
+	static void ServerLoop(int port, int http_port, ServerFeatureStore* store, int argc, char** argv);
+	//serve many clients with worker_num SiftGPU workers. The options -queue n 
+	//(requests queued ahead of a new one before it is rejected) and -reserve n
+	//(workers that only run interactive requests) come before the parameters
+	static void MultiServerLoop(int port, int http_port, ServerFeatureStore* store, int worker_num, int argc, char** argv);
 public:
 	//two options : multi-threading or multi-processing
 	SIFTGPU_EXPORT ServerSiftGPU(int port = DEFAULT_PORT, char* remote_server = NULL);
 	virtual ~ServerSiftGPU();
+	//the connection is open and has not failed
+	int			 IsConnected();
+	//the priority class (PRIORITY_*) of the next requests, and the milliseconds
+	//they can wait in the queue of a multi-client server (0 for no deadline)
+	SIFTGPU_EXPORT void SetPriority(int priority, int deadline = 0);
+	//the number of requests that are queued in the server with the last response
+	SIFTGPU_EXPORT int  GetQueueDepth();
+	//the last response is rejected because the server is saturated or the deadline has passed
+	SIFTGPU_EXPORT int  IsBusy();
+	//the counters and histograms of the server in the Prometheus text format, 
+	//valid until the next call; NULL if it fails
+	SIFTGPU_EXPORT const char* GetMetrics();
+	//ENCODING_* of the features that the server sends, and of the descriptors that are sent
+	//to the matcher (ENCODING_U8). It is ENCODING_FLOAT, which keeps the exact values, until
+	//it is changed; the servers of version 2 and later accept ENCODING_COMPACT. It is set 
+	//before the asynchronous requests. Returns the encoding that the server accepts
+	SIFTGPU_EXPORT int  SetEncoding(int encoding);
+	//keep the features of the last run in the store of the server under id (a line
+	//of text), replacing those of the same id. Returns 0 if the server has no store
+	SIFTGPU_EXPORT int  StoreFeatures(const char * id);
+	//match the stored features of id1 and id2 on the server, like GetSiftMatch.
+	//Returns -1 if it fails or an id is not in the store
+	SIFTGPU_EXPORT int  GetStoredMatch(const char * id1, const char * id2, int max_match, int match_buffer[][2],
+						float distmax = 0.7, float ratiomax = 0.8, int mutual_best_match = 1);
+	SIFTGPU_EXPORT SiftGPURequest* GetStoredMatchAsync(const char * id1, const char * id2, int max_match, 
+						float distmax = 0.7, float ratiomax = 0.8, int mutual_best_match = 1, 
+						RequestCallback callback = NULL, void * user_data = NULL);
 	////////////////////////////////////////
 	virtual void ParseParam(int argc, char **argv);
     virtual int  VerifyContextGL();
@@ -107,14 +281,26 @@ public:
 	//note the difference with class SiftGPU for the function below, 
 	//you have to provide the number of bytes of the data.
 	virtual int RunSIFT(int width, int height, const void * data, unsigned int gl_format, unsigned int gl_type);
+	//the region of interest is packed on the client, so only its pixels are sent
+	virtual int RunSIFT(int width, int height, const void * data, unsigned int gl_format, unsigned int gl_type,
+						int row_bytes, const int * roi = 0);
 	virtual int RunSIFT(int num, const SiftGPU::SiftKeypoint * keys, int keys_have_orientation = 1);
 	virtual int AllocatePyramid(int width, int height);
+	//the frames are sent one at a time when popped, the conversion is done by the server
+	virtual int  BeginStream(int width, int height, unsigned int gl_format, unsigned int gl_type, int row_bytes = 0);
+	virtual int  PushFrame(const void * data);
+	virtual int  PopFeatures();
+	virtual void EndStream();
 	/////////////////////////////////////////////////////////////////////
 	virtual int	GetFeatureNum();
 	virtual void SetTightPyramid(int tight = 1);
 	virtual void SetMaxDimension(int sz);
 	virtual void GetFeatureVector(SiftGPU::SiftKeypoint * keys, float * descriptors);
+	//the descriptors are quantized by the server, 128 bytes per feature are transferred
+	virtual void GetFeatureVectorU8(SiftGPU::SiftKeypoint * keys, unsigned char * descriptors);
 	virtual void SetKeypointList(int num, const SiftGPU::SiftKeypoint * keys, int keys_have_orientation = 1);
+	virtual void SetDetectionMask(int width, int height, const unsigned char * mask);
+	virtual void SetDetectionROI(int num, const int * rois);
 	/////////////////////////////////////////////////////////////////////////////
 	//the following functions do not block in multi-process mode
 	//for example, SaveSIFT will return before the file is written
@@ -137,11 +323,36 @@ public:
 	virtual void SetDescriptors(int index, int num, const unsigned char * descriptors, int id = -1);
 	virtual int  GetSiftMatch(int max_match,	int match_buffer[][2], //buffeture indices
 				float distmax, float ratiomax,	int mutual_best_match); //
+	//////////////////////////////////////////////////////////////////////
+	//asynchronous requests, the pixels are sent before returning
+	virtual SiftGPURequest* RunSIFTAsync(const char * imgpath, RequestCallback callback = NULL, void * user_data = NULL);
+	virtual SiftGPURequest* RunSIFTAsync(int width, int height, const void * data, unsigned int gl_format, 
+						unsigned int gl_type, RequestCallback callback = NULL, void * user_data = NULL);
+	virtual SiftGPURequest* RunSIFTAsync(int width, int height, const void * data, unsigned int gl_format, 
+						unsigned int gl_type, int row_bytes, const int * roi, 
+						RequestCallback callback = NULL, void * user_data = NULL);
+	virtual SiftGPURequest* GetSiftMatchAsync(int max_match, float distmax = 0.7, float ratiomax = 0.8, 
+						int mutual_best_match = 1, RequestCallback callback = NULL, void * user_data = NULL);
+	virtual int  WaitRequest(SiftGPURequest * request);
+	virtual int  IsRequestFinished(SiftGPURequest * request);
+	virtual void ReleaseRequest(SiftGPURequest * request);
 public:
     //////////////////////////////////////////////////////
     //Some SiftGPU functions  are not supported
     void SetImageList(int nimage, const char** filelist) {}
     void SetVerbose(){}
+	//the protocol carries no typed parameters and no profile, so these print an error:
+	//GetConfig and SetConfig leave the config unchanged (use ParseParam instead),
+	//GetPyramidMemoryKB returns -1, the profile has no scopes, GetProfileJSON returns
+	//NULL and SaveProfile returns 0
+	virtual void GetConfig(SiftConfig& config);
+	virtual void SetConfig(const SiftConfig& config);
+	virtual int  GetPyramidMemoryKB();
+	virtual int  GetProfileScopeNum();
+	virtual int  GetProfileScope(int index, SiftProfileScope& scope);
+	virtual const char* GetProfileJSON();
+	virtual int  SaveProfile(const char * path);
+	virtual void ResetProfile();
 
 	///Guided matching is not supported here, not hard to implement yourself
 	virtual void SetFeautreLocation(int index, const float* locations, int gap) {return ;}
@@ -149,10 +360,161 @@ public:
 		float distmax,	float ratiomax,  float hdistmax, float fdistmax, int mutual_best_match) {return 0; }
 
     friend void RunServerLoop(int port, int argc, char** argv);
+	friend class ServerWorker;
+	friend class ServerSession;
+	friend class ServerMetrics;
+	friend class ServerStream;
+	friend class ServerIO;
+	friend class ServerPoolSiftGPU;
 
 };
 
 
+/////////////////////////////////////////////////////////////////////////////
+//ServerPoolSiftGPU: ComboSiftGPU over several servers, see CreateRemoteSiftGPUPool
+//A run goes to the healthy server with the fewest requests in flight (round robin 
+//among equals), and it is retried on the other servers when the connection fails.
+//The thread of the pool sends the failed asynchronous requests again, and it 
+//reconnects a failed server after RETRY_SECONDS without blocking the runs.
+//The parameters, mask and ROI are sent to all servers and kept to be sent again
+//after a reconnection. GetFeatureVector, SaveSIFT and RunSIFT() use the server
+//of the last run. The matching uses one server, and the descriptors are kept to
+//move to another one if it fails. The pixels of RunSIFTAsync must stay valid
+//until the request is finished, because it may be sent again. The pool is used
+//from one thread, and not in the callbacks of its requests.
+/////////////////////////////////////////////////////////////////////////////
+class ServerPoolSiftGPU: public ComboSiftGPU
+{
+	enum { RETRY_SECONDS = 10 };
+	//the input of a run that can be sent to any server
+	struct RunInput
+	{
+		const char*		imgpath;
+		int				width, height, row_bytes;
+		const void*		data;
+		unsigned int	gl_format, gl_type;
+		const int*		roi;
+		int				num, keys_have_orientation;
+		const SiftGPU::SiftKeypoint* keys;
+	};
+	std::vector<ServerPoolEntry*> _servers;
+	ServerPoolEntry*	_current;		//the server of the last run
+	ServerPoolEntry*	_keypoint_server;	//that has the keypoints for the next run
+	ServerPoolEntry*	_matcher;
+	//_lock guards the loads, the health and the requests, and _call_lock serializes 
+	//the calls to the servers of the calling thread and of the pool thread
+	ServerLock*			_lock;
+	ServerLock*			_call_lock;
+	ServerPoolThread*	_thread;
+	int					_stopped;
+	std::deque<SiftGPURequest*> _retry;	//asynchronous requests to send again
+	int					_next;
+	//the settings that are sent again after a reconnection
+	std::vector<std::string> _params;
+	int					_max_dimension, _tight_pyramid;
+	int					_mask_size[2];
+	std::vector<unsigned char> _mask;
+	std::vector<int>	_rois;
+	int					_language, _max_sift, _match_initialized;
+	//-1 keeps the default encoding of the servers
+	int					_encoding;
+	int					_des_num[2], _des_id[2], _des_byte[2];
+	std::vector<float>	_des[2];
+	std::vector<unsigned char> _des_u8[2];
+	//streaming mode: {width, height, gl_format, gl_type, row_bytes} and the queued frames
+	int					_stream_param[5];
+	int					_streaming;
+	std::deque<const void*> _stream_frames;
+private:
+	struct Task;
+	int			IsHealthy(ServerPoolEntry * server);
+	static int	Open(ServerSiftGPU * combo, const std::vector<std::string>& params);
+	void		Configure(ServerSiftGPU * combo);
+	int			Connect(ServerPoolEntry * server);
+	void		ReconnectFailed();
+	ServerPoolEntry* PickServer();
+	ServerPoolEntry* PickMatcher();
+	void		SetFailed(ServerPoolEntry * server);
+	int			RunInputOn(ServerSiftGPU * combo, const RunInput& input);
+	int			Run(const RunInput& input);
+	void		SendDescriptors(ServerPoolEntry * server, int index);
+	void		Submit(SiftGPURequest * request);
+	void		SubmitRetries();
+	SiftGPURequest* AsyncRun(Task * task, RequestCallback callback, void * user_data);
+	static void	OnRequest(ComboSiftGPU * combo, SiftGPURequest * inner, void * user_data);
+	void		Finish(SiftGPURequest * request);
+	void		RunThread();
+	friend class ServerPoolThread;
+public:
+	ServerPoolSiftGPU(const char * servers);
+	virtual ~ServerPoolSiftGPU();
+	//the wire encoding of all servers, see ServerSiftGPU::SetEncoding
+	SIFTGPU_EXPORT void SetEncoding(int encoding);
+	////////////////////////////////////////
+	virtual void ParseParam(int argc, char **argv);
+	virtual int  VerifyContextGL();
+	virtual int  RunSIFT(const char * imgpath);
+	virtual int  RunSIFT();
+	virtual int  RunSIFT(int width, int height, const void * data, unsigned int gl_format, unsigned int gl_type);
+	virtual int  RunSIFT(int width, int height, const void * data, unsigned int gl_format, unsigned int gl_type,
+						int row_bytes, const int * roi = 0);
+	virtual int  RunSIFT(int num, const SiftGPU::SiftKeypoint * keys, int keys_have_orientation = 1);
+	virtual int  AllocatePyramid(int width, int height);
+	virtual int  BeginStream(int width, int height, unsigned int gl_format, unsigned int gl_type, int row_bytes = 0);
+	virtual int  PushFrame(const void * data);
+	virtual int  PopFeatures();
+	virtual void EndStream();
+	virtual int	 GetFeatureNum();
+	virtual void SetTightPyramid(int tight = 1);
+	virtual void SetMaxDimension(int sz);
+	virtual void GetFeatureVector(SiftGPU::SiftKeypoint * keys, float * descriptors);
+	virtual void GetFeatureVectorU8(SiftGPU::SiftKeypoint * keys, unsigned char * descriptors);
+	virtual void SetKeypointList(int num, const SiftGPU::SiftKeypoint * keys, int keys_have_orientation = 1);
+	virtual void SetDetectionMask(int width, int height, const unsigned char * mask);
+	virtual void SetDetectionROI(int num, const int * rois);
+	virtual void SaveSIFT(const char * szFileName);
+	//simplified functions
+	int  GetImageCount(){return 1;}
+	int  CreateContextGL(){return VerifyContextGL();}
+	int  IsFullSupported(){return VerifyContextGL() == SiftGPU::SIFTGPU_FULL_SUPPORTED;}
+	int  RunSIFT(int index) {return RunSIFT();}
+	void SetImageList(int nimage, const char** filelist) {}
+	virtual void SetVerbose(int verbose = 4);
+	//not supported, like ServerSiftGPU
+	virtual void GetConfig(SiftConfig& config);
+	virtual void SetConfig(const SiftConfig& config);
+	virtual int  GetPyramidMemoryKB();
+	virtual int  GetProfileScopeNum();
+	virtual int  GetProfileScope(int index, SiftProfileScope& scope);
+	virtual const char* GetProfileJSON();
+	virtual int  SaveProfile(const char * path);
+	virtual void ResetProfile();
+	////////////////////////////////////////
+	virtual int  _CreateContextGL() {return _VerifyContextGL();}
+	virtual int  _VerifyContextGL();
+	virtual void SetLanguage(int gpu_language);
+	virtual void SetDeviceParam(int argc, char**argv);
+	virtual void SetMaxSift(int max_sift);
+	virtual void SetDescriptors(int index, int num, const float* descriptors, int id  = -1);
+	virtual void SetDescriptors(int index, int num, const unsigned char * descriptors, int id = -1);
+	virtual int  GetSiftMatch(int max_match, int match_buffer[][2], float distmax, float ratiomax, int mutual_best_match);
+	virtual void SetFeautreLocation(int index, const float* locations, int gap) {return ;}
+	virtual int  GetGuidedSiftMatch(int max_match, int match_buffer[][2], float H[3][3],float F[3][3],
+		float distmax,	float ratiomax,  float hdistmax, float fdistmax, int mutual_best_match) {return 0; }
+	////////////////////////////////////////
+	virtual SiftGPURequest* RunSIFTAsync(const char * imgpath, RequestCallback callback = NULL, void * user_data = NULL);
+	virtual SiftGPURequest* RunSIFTAsync(int width, int height, const void * data, unsigned int gl_format, 
+						unsigned int gl_type, RequestCallback callback = NULL, void * user_data = NULL);
+	virtual SiftGPURequest* RunSIFTAsync(int width, int height, const void * data, unsigned int gl_format, 
+						unsigned int gl_type, int row_bytes, const int * roi, 
+						RequestCallback callback = NULL, void * user_data = NULL);
+	virtual SiftGPURequest* GetSiftMatchAsync(int max_match, float distmax = 0.7, float ratiomax = 0.8, 
+						int mutual_best_match = 1, RequestCallback callback = NULL, void * user_data = NULL);
+	virtual int  WaitRequest(SiftGPURequest * request);
+	virtual int  IsRequestFinished(SiftGPURequest * request);
+	virtual void ReleaseRequest(SiftGPURequest * request);
+};
+
 
 #endif
 
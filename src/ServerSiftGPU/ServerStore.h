@@ -0,0 +1,298 @@
+////////////////////////////////////////////////////////////////////////////
+//	File:		ServerStore.h
+//	Author:		SiftGPU contributors
+//	Description :	the feature store of the server (StoreFeatures and 
+//					GetStoredMatch), which is also checked by siftgpu_test.
+//
+//	This file was added to SiftGPU in 2026 and is distributed under the
+//	same terms as the rest of SiftGPU, see the notice in SiftGPU.h.
+//
+////////////////////////////////////////////////////////////////////////////
+
+#ifndef GPU_SIFT_SERVER_STORE_H
+#define GPU_SIFT_SERVER_STORE_H
+
+#include <string.h>
+#include <string>
+#include <vector>
+#include <list>
+#include <map>
+#include <deque>
+#include <algorithm>
+#ifdef _WIN32
+	#include <winsock2.h>
+#else
+	#include <pthread.h>
+#endif
+
+#include "../SiftGPU/SiftGPU.h"
+#include "../SiftGPU/FeatureCache.h"
+#include "ServerQueue.h"
+#include "ServerCodec.h"
+
+/////////////////////////////////////////////////////////////////////////////
+//the features that the clients keep on the server with StoreFeatures, which
+//are shared by all clients. Only the descriptors are kept in memory, quantized
+//to the bytes that the matcher uses, and the least recently used ones are 
+//dropped when they exceed the memory of -store mb. With -store_dir, the 
+//features are also saved by a FeatureCache in that folder, so they are loaded
+//from there after they are dropped or the server restarts. The files are 
+//written (and the old ones evicted) by a thread of the store, not by the 
+//worker that runs StoreFeatures.
+/////////////////////////////////////////////////////////////////////////////
+class ServerFeatureStore
+{
+	enum 
+	{
+		//the seed of the file keys, so they differ from those of the image cache
+		STORE_SEED	= 0x53475354,
+		//the features that can wait to be written before Put waits for the disk
+		WRITE_QUEUE	= 64
+	};
+	struct Entry
+	{
+		std::string			id;
+		int					num;
+		std::vector<char>	descriptors;
+		size_t				bytes;
+	};
+	//the features of a Put that are not written yet
+	struct Write
+	{
+		std::string			id;
+		int					num;
+		std::vector<float>	keys;
+		std::vector<float>	descriptors;
+	};
+	typedef std::list<Entry*> EntryList;
+	typedef std::map<std::string, EntryList::iterator> EntryIndex;
+	ServerLock		_lock;
+	EntryList		_entries;	//the most recently used first
+	EntryIndex		_index;
+	size_t			_bytes, _max_bytes;
+	double			_hits, _disk_hits, _misses;
+	//FeatureCache is not thread-safe, and the files are not read with _lock held
+	ServerLock		_disk_lock;
+	FeatureCache*	_disk;
+	//the writes in the order of Put, the first one is being written by the thread
+	ServerLock		_write_lock;
+	std::deque<Write*> _writes;
+	int				_stopped, _started;
+#if defined(_WIN32)
+	HANDLE			_thread;
+#else
+	pthread_t		_thread;
+#endif
+private:
+	static FeatureCache::Key DiskKey(const char * id)
+	{
+		return FeatureCache::HashData(id, strlen(id), STORE_SEED);
+	}
+	static Entry* NewEntry(const char * id, int num, const float * descriptors)
+	{
+		Entry * entry = new Entry;
+		entry->id = id;
+		entry->num = num;
+		entry->descriptors.resize(num * 128);
+		if(num > 0) QuantizeDescriptors(descriptors, num * 128, (unsigned char*) &entry->descriptors[0]);
+		entry->bytes = sizeof(Entry) + entry->id.size() + entry->descriptors.size();
+		return entry;
+	}
+	//with the lock held
+	void Erase(EntryIndex::iterator it)
+	{
+		Entry * entry = *it->second;
+		_bytes -= entry->bytes;
+		_entries.erase(it->second);
+		_index.erase(it);
+		delete entry;
+	}
+	void Insert(Entry * entry)
+	{
+		EntryIndex::iterator it = _index.find(entry->id);
+		if(it != _index.end()) Erase(it);
+		if(entry->bytes > _max_bytes)
+		{
+			delete entry;
+			return;
+		}
+		_entries.push_front(entry);
+		_index[entry->id] = _entries.begin();
+		_bytes += entry->bytes;
+		while(_bytes > _max_bytes) Erase(_index.find(_entries.back()->id));
+	}
+	void Save(Write * write)
+	{
+		_disk_lock.Lock();
+		_disk->Save(DiskKey(write->id.c_str()), write->num, write->num > 0 ? &write->keys[0] : NULL, 
+					write->num > 0 ? &write->descriptors[0] : NULL);
+		_disk_lock.Unlock();
+	}
+	//the thread that writes the files, until the store is deleted and the writes are done
+	void WriteFiles()
+	{
+		_write_lock.Lock();
+		for(;;)
+		{
+			if(_writes.empty())
+			{
+				if(_stopped) break;
+				_write_lock.Wait();
+				continue;
+			}
+			Write * write = _writes.front();
+			_write_lock.Unlock();
+			Save(write);
+			_write_lock.Lock();
+			_writes.pop_front();
+			delete write;
+			//Put may wait for the queue
+			_write_lock.Broadcast();
+		}
+		_write_lock.Unlock();
+	}
+#if defined(_WIN32)
+	static DWORD WINAPI RunThread(LPVOID param)
+#else
+	static void* RunThread(void* param)
+#endif
+	{
+		((ServerFeatureStore*) param)->WriteFiles();
+		return 0;
+	}
+	//the number of features of id in a write that is not done, -1 if there is none
+	int GetWrite(const char * id, std::vector<float>& descriptors)
+	{
+		int num = -1;
+		_write_lock.Lock();
+		for(std::deque<Write*>::reverse_iterator it = _writes.rbegin(); it != _writes.rend(); ++it)
+		{
+			if((*it)->id != id) continue;
+			num = (*it)->num;
+			descriptors = (*it)->descriptors;
+			break;
+		}
+		_write_lock.Unlock();
+		return num;
+	}
+public:
+	//directory can be NULL for a store in memory only
+	ServerFeatureStore(int max_mb, const char * directory, int disk_mb)
+	{
+		_bytes = 0;
+		_max_bytes = (size_t) std::max(max_mb, 0) << 20;
+		_hits = _disk_hits = _misses = 0;
+		_disk = directory && directory[0] ? new FeatureCache(directory, disk_mb) : NULL;
+		_stopped = _started = 0;
+		if(_disk == NULL) return;
+#if defined(_WIN32)
+		_thread = CreateThread(NULL, 0, RunThread, this, 0, 0);
+		_started = _thread != NULL;
+#else
+		_started = pthread_create(&_thread, NULL, RunThread, this) == 0;
+#endif
+	}
+	~ServerFeatureStore()
+	{
+		if(_started)
+		{
+			_write_lock.Lock();
+			_stopped = 1;
+			_write_lock.Broadcast();
+			_write_lock.Unlock();
+#if defined(_WIN32)
+			WaitForSingleObject(_thread, INFINITE);
+			CloseHandle(_thread);
+#else
+			pthread_join(_thread, NULL);
+#endif
+		}
+		for(EntryList::iterator it = _entries.begin(); it != _entries.end(); ++it) delete *it;
+		if(_disk) delete _disk;
+	}
+	//keep the features of a run under id
+	void Put(const char * id, int num, const std::vector<SiftGPU::SiftKeypoint>& keys, const std::vector<float>& descriptors)
+	{
+		if(id[0] == 0) return;
+		if(num < 0 || keys.size() < (size_t) num || descriptors.size() < (size_t) num * 128) num = 0;
+		_lock.Lock();
+		Insert(NewEntry(id, num, num > 0 ? &descriptors[0] : NULL));
+		_lock.Unlock();
+		if(_disk == NULL) return;
+		Write * write = new Write;
+		write->id = id;
+		write->num = num;
+		if(num > 0)
+		{
+			write->keys.assign((const float*) &keys[0], (const float*) &keys[0] + num * 4);
+			write->descriptors.assign(descriptors.begin(), descriptors.begin() + num * 128);
+		}
+		if(!_started)
+		{
+			Save(write);
+			delete write;
+			return;
+		}
+		_write_lock.Lock();
+		//the memory of the writes is bounded when the disk is slower than the runs
+		while(_writes.size() >= WRITE_QUEUE) _write_lock.Wait();
+		_writes.push_back(write);
+		_write_lock.Broadcast();
+		_write_lock.Unlock();
+	}
+	//the number of features of id and their byte descriptors, -1 if id is not stored
+	int Get(const char * id, std::vector<char>& descriptors)
+	{
+		_lock.Lock();
+		EntryIndex::iterator it = _index.find(id);
+		if(it != _index.end())
+		{
+			_entries.splice(_entries.begin(), _entries, it->second);
+			it->second = _entries.begin();
+			//the entry can be dropped by another thread once the lock is released
+			Entry * entry = *it->second;
+			int num = entry->num;
+			descriptors = entry->descriptors;
+			_hits++;
+			_lock.Unlock();
+			return num;
+		}
+		_lock.Unlock();
+
+		int num = -1;
+		std::vector<float> keys, values;
+		//the features that are dropped from memory before they are written
+		if(_disk) num = GetWrite(id, values);
+		if(_disk && num < 0)
+		{
+			_disk_lock.Lock();
+			num = _disk->Load(DiskKey(id), keys, values);
+			_disk_lock.Unlock();
+		}
+		if(num >= 0 && values.size() < (size_t) num * 128) num = -1;
+		Entry * entry = num >= 0 ? NewEntry(id, num, num > 0 ? &values[0] : NULL) : NULL;
+		if(entry) descriptors = entry->descriptors;
+
+		_lock.Lock();
+		if(entry == NULL)					_misses++;
+		else								_disk_hits++;
+		//unless it is stored again while it is loaded
+		if(entry && _index.find(id) == _index.end())	Insert(entry);
+		else if(entry)									delete entry;
+		_lock.Unlock();
+		return num;
+	}
+	//{entries, bytes, memory hits, disk hits, misses}
+	void GetStats(double stats[5])
+	{
+		_lock.Lock();
+		stats[0] = (double) _entries.size();
+		stats[1] = (double) _bytes;
+		stats[2] = _hits;
+		stats[3] = _disk_hits;
+		stats[4] = _misses;
+		_lock.Unlock();
+	}
+};
+
+#endif
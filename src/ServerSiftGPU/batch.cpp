@@ -0,0 +1,202 @@
+////////////////////////////////////////////////////////////////////////////
+//	File:		batch.cpp
+//	Author:		SiftGPU contributors
+//	Description :	siftgpu_batch, extract the features of an image list with
+//					a pool of SiftGPU servers and write them to one archive.
+//
+//	This file was added to SiftGPU in 2026 and is distributed under the
+//	same terms as the rest of SiftGPU, see the notice in SiftGPU.h.
+//
+////////////////////////////////////////////////////////////////////////////
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <deque>
+using std::cout;
+
+#ifdef _WIN32
+	#define WIN32_LEAN_AND_MEAN
+	#include <windows.h>
+	#define SleepSeconds(n) Sleep((n) * 1000)
+#else
+	#include <unistd.h>
+	#define SleepSeconds(n) sleep(n)
+#endif
+
+#include "../SiftGPU/SiftGPU.h"
+#include "ServerSiftGPU.h"
+
+//The images are decoded by the servers (RUNSIFT_FILE), so the paths must be valid
+//on the computers where the servers run. The requests go to the least loaded
+//server, and the images of a crashed server are sent to the other ones by
+//CreateRemoteSiftGPUPool. When every server is down, a failed image waits until
+//one is connected again (a local server is started again) and is sent again.
+//
+//The archive has a header {'SGFA', version, image count}, then for each image of
+//the list in the same order: {name length, name, num, 128} and num records of
+//{y, x, scale, orientation, 128 float descriptor}, the same as the binary .sift
+//file of -b. num is -1 if the image fails.
+
+#define ARCHIVE_MAGIC	0x41464753	//"SGFA"
+#define ARCHIVE_VERSION	1
+
+static void WriteRecord(std::ofstream& out, const std::string& name, int num,
+						const SiftGPU::SiftKeypoint* keys, const float* descriptors)
+{
+	int length = (int) name.size(), dim = num > 0 ? 128 : 0;
+	out.write((const char*) &length, sizeof(int));
+	out.write(name.c_str(), length);
+	out.write((const char*) &num, sizeof(int));
+	out.write((const char*) &dim, sizeof(int));
+	for(int i = 0; i < num; ++i)
+	{
+		const SiftGPU::SiftKeypoint& key = keys[i];
+		float location[4] = {key.y, key.x, key.s, key.o};
+		out.write((const char*) location, 4 * sizeof(float));
+		out.write((const char*) (descriptors + 128 * i), 128 * sizeof(float));
+	}
+}
+
+//the file names in an image list are relative to the folder of the list, like -il
+static int LoadImageList(const char* imlist, std::vector<std::string>& images)
+{
+	std::ifstream in(imlist);
+	if(!in.is_open()) return 0;
+	std::string folder = imlist, filename;
+	size_t slash = folder.find_last_of("/\\");
+	folder = slash == std::string::npos ? "" : folder.substr(0, slash + 1);
+	while(in >> filename)
+	{
+		int absolute = filename[0] == '/' || filename[0] == '\\' || (filename.size() > 1 && filename[1] == ':');
+		images.push_back(absolute ? filename : folder + filename);
+	}
+	return (int) images.size();
+}
+
+int main(int argc, char** argv)
+{
+	const char* imlist = NULL, *output = "features.sga", *servers = "7777";
+	int window = 2, retry = 2, wait_seconds = 60, compact = 0;
+	std::vector<char*> params;
+	for(int i = 1; i < argc; ++i)
+	{
+		if(strcmp(argv[i], "-il") == 0 && i + 1 < argc)				imlist = argv[++i];
+		else if(strcmp(argv[i], "-o") == 0 && i + 1 < argc)			output = argv[++i];
+		else if(strcmp(argv[i], "-servers") == 0 && i + 1 < argc)	servers = argv[++i];
+		else if(strcmp(argv[i], "-window") == 0 && i + 1 < argc)	sscanf(argv[++i], "%d", &window);
+		else if(strcmp(argv[i], "-retry") == 0 && i + 1 < argc)		sscanf(argv[++i], "%d", &retry);
+		else if(strcmp(argv[i], "-wait") == 0 && i + 1 < argc)		sscanf(argv[++i], "%d", &wait_seconds);
+		else if(strcmp(argv[i], "-compact") == 0)					compact = 1;
+		else params.push_back(argv[i]);
+	}
+	if(imlist == NULL)
+	{
+		std::cout
+		<<"usage: siftgpu_batch -il <image list> [-o <archive>] [-servers <servers>]\n"
+		<<"                     [-window <n>] [-retry <n>] [-wait <seconds>] [-compact] [siftgpu_param]\n"
+		<<"-servers is the list of CreateRemoteSiftGPUPool, e.g. \"7777 -cuda 0; 7778 -cuda 1; host:7777\"\n"
+		<<"            a port alone starts a local server_siftgpu (default 7777)\n"
+		<<"-window n   requests in flight for each server (default 2)\n"
+		<<"-retry n    times a failed image is sent again (default 2)\n"
+		<<"-wait n     seconds to wait for a server when all of them fail (default 60)\n"
+		<<"-compact    receive byte descriptors, 16-bit keypoints and LZ compression\n"
+		<<"            instead of the exact float features\n"
+		<<"The images are read by the servers, so their paths must be valid there\n"
+		<<"\n";
+		return 1;
+	}
+
+	std::vector<std::string> images;
+	if(LoadImageList(imlist, images) == 0)
+	{
+		std::cout << "No image in " << imlist << "\n";
+		return 1;
+	}
+	int server_num = 0;
+	for(const char* p = servers; *p; )
+	{
+		while(*p == ' ' || *p == '\t' || *p == ';') ++p;
+		if(*p) server_num++;
+		while(*p && *p != ';') ++p;
+	}
+	if(window < 1) window = 1;
+	size_t in_flight = (size_t) window * (server_num > 0 ? server_num : 1);
+
+	ComboSiftGPU* combo = CreateRemoteSiftGPUPool(servers);
+	SiftGPU* sift = combo;
+	sift->ParseParam((int) params.size(), params.size() ? &params[0] : NULL);
+	if(sift->VerifyContextGL() != SiftGPU::SIFTGPU_FULL_SUPPORTED)
+	{
+		std::cout << "No SiftGPU server is available\n";
+		delete combo;
+		return 1;
+	}
+	//with the compact encoding, the descriptors in the archive are the bytes divided by 512
+	ServerPoolSiftGPU* pool = dynamic_cast<ServerPoolSiftGPU*>(combo);
+	if(pool && compact) pool->SetEncoding(ServerSiftGPU::ENCODING_COMPACT);
+
+	std::ofstream out(output, std::ios::binary);
+	if(!out.is_open())
+	{
+		std::cout << "Unable to write " << output << "\n";
+		delete combo;
+		return 1;
+	}
+	int header[3] = {ARCHIVE_MAGIC, ARCHIVE_VERSION, (int) images.size()};
+	out.write((const char*) header, sizeof(header));
+
+	//the requests are queued in the list order, and their results are written in the same order
+	std::deque<SiftGPURequest*> requests;
+	std::vector<SiftGPU::SiftKeypoint> keys;
+	std::vector<float> descriptors;
+	size_t next = 0, done = 0, failed = 0;
+	int attempt = 0;
+	double feature_count = 0;
+	time_t start = time(NULL);
+	while(done < images.size())
+	{
+		while(next < images.size() && requests.size() < in_flight)
+		{
+			requests.push_back(combo->RunSIFTAsync(images[next++].c_str()));
+		}
+		SiftGPURequest* request = requests.front();
+		requests.pop_front();
+		int num = combo->WaitRequest(request);
+		if(num < 0 && attempt < retry)
+		{
+			//wait until a server is connected, then send the image again
+			combo->ReleaseRequest(request);
+			for(int waited = 0; sift->VerifyContextGL() != SiftGPU::SIFTGPU_FULL_SUPPORTED && waited < wait_seconds; ++waited) SleepSeconds(1);
+			requests.push_front(combo->RunSIFTAsync(images[done].c_str()));
+			attempt++;
+			continue;
+		}
+		attempt = 0;
+		if(num > 0)
+		{
+			keys.resize(num);
+			descriptors.resize(num * 128);
+			combo->GetRequestFeatures(request, &keys[0], &descriptors[0]);
+			feature_count += num;
+		}else if(num < 0)
+		{
+			std::cout << "Failed: " << images[done] << "\n";
+			failed++;
+		}
+		combo->ReleaseRequest(request);
+		WriteRecord(out, images[done], num, num > 0 ? &keys[0] : NULL, num > 0 ? &descriptors[0] : NULL);
+		if(++done % 100 == 0 || done == images.size())
+		{
+			std::cout << done << "/" << images.size() << " images, " << feature_count << " features, "
+					  << failed << " failed, " << (time(NULL) - start) << " seconds\n";
+		}
+	}
+	out.close();
+	delete combo;
+	return failed ? 2 : 0;
+}
+
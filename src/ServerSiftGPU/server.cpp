@@ -111,6 +111,19 @@ int main(int argc, char** argv)
         <<"try -test_remote remote_sever_name remote_server_port\n"
         <<"            to create a client and connect to remote server\n"
         <<"use -server port [siftgpu_param] to start a server\n"
+        <<"use -server port -multi n [siftgpu_param] to start a server\n"
+        <<"            that serves many clients with n workers\n"
+        <<"use -server port -multi n [-queue m] [-reserve r] [siftgpu_param]\n"
+        <<"            to reject runs when m requests are queued ahead of them,\n"
+        <<"            and keep r workers for the interactive requests\n"
+        <<"use -server port -http http_port [-multi n ...] [siftgpu_param]\n"
+        <<"            to serve /metrics, /healthz and /readyz by HTTP\n"
+        <<"use -server port -store mb [-store_dir path [-store_disk mb]] [-multi n ...]\n"
+        <<"            to keep up to mb of stored features in memory (default 256),\n"
+        <<"            and save them in a folder that is kept across restarts\n"
+        <<"use -server port -http http_port -trace n [-multi n ...] [siftgpu_param]\n"
+        <<"            to serve the last n events of each thread at /trace,\n"
+        <<"            which can be opened by chrome://tracing or ui.perfetto.dev\n"
         <<"Note [siftgpu_param] allows you to select GPU from multi-GPUs\n"
         <<"\n";
 	}
@@ -209,6 +209,8 @@ int CLTexImage::CopyToPBO(GLuint pbo)
 void CLTexImage::CopyToHost(void * buf)
 {
 	if(_clData == NULL) return;
+	SiftTraceScope trace("CLTexImage::CopyToHost", "readback");
+	trace.SetValue(_imgWidth * _imgHeight * _numChannel * (double) sizeof(float));
     cl_int status;
     if(_bufferLen)
     { 
@@ -149,12 +149,16 @@ void CuTexImage::CopyFromHost(const void * buf)
 void CuTexImage::CopyToHost(void * buf)
 {
 	if(_cuData == NULL) return;
+	SiftTraceScope trace("CuTexImage::CopyToHost", "readback");
+	trace.SetValue(_imgWidth * _imgHeight * _numChannel * (double) sizeof(float));
 	cudaMemcpy(buf, _cuData, _imgWidth * _imgHeight * _numChannel * sizeof(float), cudaMemcpyDeviceToHost);
 }
 
 void CuTexImage::CopyToHost(void * buf, int stream)
 {
 	if(_cuData == NULL) return;
+	SiftTraceScope trace("CuTexImage::CopyToHostAsync", "readback");
+	trace.SetValue(_imgWidth * _imgHeight * _numChannel * (double) sizeof(float));
 	cudaMemcpyAsync(buf, _cuData, _imgWidth * _imgHeight * _numChannel * sizeof(float), cudaMemcpyDeviceToHost, (cudaStream_t)stream);
 }
 
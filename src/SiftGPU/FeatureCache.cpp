@@ -0,0 +1,275 @@
+////////////////////////////////////////////////////////////////////////////
+//	File:		FeatureCache.cpp
+//	Author:		SiftGPU contributors
+//	Description :	implementation of the FeatureCache class.
+//
+//	This file was added to SiftGPU in 2026 and is distributed under the
+//	same terms as the rest of SiftGPU, see the notice in SiftGPU.h.
+//
+////////////////////////////////////////////////////////////////////////////
+
+
+#include "GL/glew.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+using std::string;
+using std::vector;
+
+#if defined(_WIN32)
+	#ifndef WIN32_LEAN_AND_MEAN
+	#define WIN32_LEAN_AND_MEAN
+	#endif
+	#include <windows.h>
+	#include <direct.h>
+	#include <process.h>
+	#include <io.h>
+	#include <fcntl.h>
+	#include <sys/types.h>
+	#include <sys/stat.h>
+	#include <sys/utime.h>
+	#define getpid _getpid
+#else
+	#include <unistd.h>
+	#include <dirent.h>
+	#include <fcntl.h>
+	#include <utime.h>
+	#include <sys/types.h>
+	#include <sys/stat.h>
+#endif
+
+#include "GlobalUtil.h"
+#include "SiftGPU.h"
+#include "FeatureCache.h"
+
+//"SGCF" and the version of the cached data, change it when the features of the same input change
+#define FEATURE_CACHE_MAGIC		0x46434753
+#define FEATURE_CACHE_VERSION	1
+
+//a 64-bit hash with the constants and the mixing steps of xxHash64
+#define HASH_PRIME1	11400714785074694791ULL
+#define HASH_PRIME2	14029467366897019727ULL
+#define HASH_PRIME3	 1609587929392839161ULL
+#define HASH_PRIME5	 2870177450012600261ULL
+
+static inline FeatureCache::Key HashRotate(FeatureCache::Key x, int r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+FeatureCache::Key FeatureCache::HashData(const void * data, size_t size, Key seed)
+{
+	const unsigned char * p = (const unsigned char*) data;
+	Key v[4] = {seed + HASH_PRIME1 + HASH_PRIME2, seed + HASH_PRIME2, seed, seed - HASH_PRIME1};
+	size_t i = 0;
+	for(; i + 32 <= size; i += 32)
+	{
+		for(int k = 0; k < 4; ++k)
+		{
+			Key w;	memcpy(&w, p + i + 8 * k, 8);
+			v[k] = HashRotate(v[k] + w * HASH_PRIME2, 31) * HASH_PRIME1;
+		}
+	}
+	Key h = HashRotate(v[0], 1) + HashRotate(v[1], 7) + HashRotate(v[2], 12) + HashRotate(v[3], 18) + size;
+	for(; i < size; ++i) h = HashRotate(h ^ (p[i] * HASH_PRIME5), 11) * HASH_PRIME1;
+	h ^= h >> 33;	h *= HASH_PRIME2;
+	h ^= h >> 29;	h *= HASH_PRIME3;
+	h ^= h >> 32;
+	return h;
+}
+
+FeatureCache::Key FeatureCache::HashParam(const SiftParam& param)
+{
+	int ivalue[] = 
+	{
+		FEATURE_CACHE_VERSION, 
+		param._dog_level_num, param._level_min, param._level_max,
+		GlobalUtil::_octave_min_default, GlobalUtil::_octave_num_default,
+		GlobalUtil::_texMaxDim, GlobalUtil::_texMinDim, GlobalUtil::_MemCapGPU, GlobalUtil::_FitMemoryCap,
+		GlobalUtil::_UseCUDA, GlobalUtil::_UseOpenCL, GlobalUtil::_usePackedTex, GlobalUtil::_MaxFilterWidth,
+		GlobalUtil::_MaxOrientation, GlobalUtil::_OrientationPack2, GlobalUtil::_FixedOrientation,
+		GlobalUtil::_MaxLevelFeatureNum, GlobalUtil::_SubpixelLocalization, GlobalUtil::_DescriptorPPT,
+		GlobalUtil::_NormalizedSIFT, GlobalUtil::_FeatureCountThreshold, GlobalUtil::_TruncateMethod,
+		GlobalUtil::_LoweOrigin, GlobalUtil::_KeepExtremumSign, GlobalUtil::_PreciseBorder, 
+		GlobalUtil::_DarknessAdaption, GlobalUtil::_PreProcessOnCPU, GlobalUtil::_DownSampleAverage,
+		GlobalUtil::_FeatureGridSize, GlobalUtil::_FeatureANMS, GlobalUtil::_DescriptorU8
+	};
+	float fvalue[] = 
+	{
+		param._sigma0, param._sigman, param._dog_threshold, param._edge_threshold,
+		GlobalUtil::_FilterWidthFactor, GlobalUtil::_OrientationWindowFactor, 
+		GlobalUtil::_DescriptorWindowFactor, GlobalUtil::_MaxFeaturePercent,
+		GlobalUtil::_MulitiOrientationThreshold, GlobalUtil::_OrientationGaussianFactor
+	};
+	return HashData(fvalue, sizeof(fvalue), HashData(ivalue, sizeof(ivalue), 0));
+}
+
+FeatureCache::FeatureCache(const char * directory, int max_mb)
+{
+	_directory = directory;
+	if(_directory.size() > 0 && _directory[_directory.size() - 1] != '/' && _directory[_directory.size() - 1] != '\\')
+		_directory += '/';
+	_max_size = Key(max_mb > 0 ? max_mb : 1024) << 20;
+#if defined(_WIN32)
+	_mkdir(directory);
+#else
+	mkdir(directory, 0755);
+#endif
+	//the size of the existing files, and trim the cache if the limit is lower than before
+	_total_size = _max_size + 1;
+	EvictFiles();
+}
+
+void FeatureCache::GetFilePath(Key key, string& path) const
+{
+	char name[32];
+	sprintf(name, "%08x%08x.sgc", (unsigned int) (key >> 32), (unsigned int) key);
+	path = _directory + name;
+}
+
+int FeatureCache::Load(Key key, vector<float>& keys, vector<float>& descriptors)
+{
+	string path;	GetFilePath(key, path);
+	FILE * file = fopen(path.c_str(), "rb");
+	if(file == NULL) return -1;
+	int header[4] = {0, 0, 0, 0}, num = -1;
+	if(fread(header, sizeof(int), 4, file) == 4 && header[0] == FEATURE_CACHE_MAGIC && 
+		header[1] == FEATURE_CACHE_VERSION && header[2] >= 0 && (header[3] == 0 || header[3] == 128))
+	{
+		size_t nkey = 4 * (size_t) header[2], ndes = header[3] * (size_t) header[2];
+		if(keys.size() < nkey) keys.resize(nkey);
+		if(descriptors.size() < ndes) descriptors.resize(ndes);
+		if((nkey == 0 || fread(&keys[0], sizeof(float), nkey, file) == nkey) &&
+		   (ndes == 0 || fread(&descriptors[0], sizeof(float), ndes, file) == ndes)) num = header[2];
+	}
+	fclose(file);
+
+	//mark the entry as recently used
+	if(num >= 0) utime(path.c_str(), NULL);
+	else if(GlobalUtil::_verbose) std::cerr << "Invalid feature cache file " << path << "\n";
+	return num;
+}
+
+//a new file next to path, named with the process id and a counter of the process. 
+//It is created exclusively, so two writers of the same entry never share a file
+static FILE * CreateTempFile(const string& path, string& temp)
+{
+#if defined(_WIN32)
+	static volatile LONG counter = 0;
+#else
+	static volatile int counter = 0;
+#endif
+	for(int attempt = 0; attempt < 8; ++attempt)
+	{
+#if defined(_WIN32)
+		int id = (int) InterlockedIncrement(&counter);
+#else
+		int id = __sync_add_and_fetch(&counter, 1);
+#endif
+		char suffix[48];	sprintf(suffix, ".%d.%d", (int) getpid(), id);
+		temp = path + suffix;
+#if defined(_WIN32)
+		int fd = _open(temp.c_str(), _O_WRONLY | _O_CREAT | _O_EXCL | _O_BINARY, _S_IREAD | _S_IWRITE);
+		FILE * file = fd < 0 ? NULL : _fdopen(fd, "wb");
+		if(fd >= 0 && file == NULL) _close(fd);
+#else
+		int fd = open(temp.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+		FILE * file = fd < 0 ? NULL : fdopen(fd, "wb");
+		if(fd >= 0 && file == NULL) close(fd);
+#endif
+		if(file) return file;
+		//a file left by a process of the same id, try the next name
+		if(fd >= 0 || errno != EEXIST) break;
+	}
+	return NULL;
+}
+
+void FeatureCache::Save(Key key, int num, const float * keys, const float * descriptors)
+{
+	string path, temp;	GetFilePath(key, path);
+
+	//write to a temporary file first, so that other processes never read a partial file
+	FILE * file = CreateTempFile(path, temp);
+	if(file == NULL) return;
+	int header[4] = {FEATURE_CACHE_MAGIC, FEATURE_CACHE_VERSION, num, descriptors ? 128 : 0};
+	size_t nkey = 4 * (size_t) num, ndes = header[3] * (size_t) num;
+	int done = fwrite(header, sizeof(int), 4, file) == 4 &&
+			   (nkey == 0 || fwrite(keys, sizeof(float), nkey, file) == nkey) &&
+			   (ndes == 0 || fwrite(descriptors, sizeof(float), ndes, file) == ndes);
+	done = (fclose(file) == 0) && done;
+#if defined(_WIN32)
+	if(done) remove(path.c_str());
+#endif
+	if(!done || rename(temp.c_str(), path.c_str()))
+	{
+		remove(temp.c_str());
+		return;
+	}
+	_total_size += sizeof(header) + (nkey + ndes) * sizeof(float);
+	if(_total_size > _max_size) EvictFiles();
+}
+
+struct CacheFileInfo
+{
+	string		name;
+	long long	time;
+	long long	size;
+	bool operator < (const CacheFileInfo& other) const {return time < other.time; }
+};
+
+void FeatureCache::EvictFiles()
+{
+	vector<CacheFileInfo> files;
+	Key total = 0;
+#if defined(_WIN32)
+	WIN32_FIND_DATAA data;
+	HANDLE find = FindFirstFileA((_directory + "*.sgc").c_str(), &data);
+	if(find != INVALID_HANDLE_VALUE)
+	{
+		do
+		{
+			CacheFileInfo info;
+			info.name = data.cFileName;
+			info.time = ((long long) data.ftLastWriteTime.dwHighDateTime << 32) | data.ftLastWriteTime.dwLowDateTime;
+			info.size = ((long long) data.nFileSizeHigh << 32) | data.nFileSizeLow;
+			files.push_back(info);
+		}while(FindNextFileA(find, &data));
+		FindClose(find);
+	}
+#else
+	DIR * dir = opendir(_directory.c_str());
+	if(dir)
+	{
+		struct dirent * entry;
+		while((entry = readdir(dir)) != NULL)
+		{
+			size_t len = strlen(entry->d_name);
+			if(len < 4 || strcmp(entry->d_name + len - 4, ".sgc")) continue;
+			struct stat st;
+			if(stat((_directory + entry->d_name).c_str(), &st)) continue;
+			CacheFileInfo info;
+			info.name = entry->d_name;
+			info.time = st.st_mtime;
+			info.size = st.st_size;
+			files.push_back(info);
+		}
+		closedir(dir);
+	}
+#endif
+	for(size_t i = 0; i < files.size(); ++i) total += files[i].size;
+	if(total > _max_size)
+	{
+		//remove the least recently used files until the cache is below 90% of the limit
+		std::sort(files.begin(), files.end());
+		for(size_t i = 0; i < files.size() && total > _max_size / 10 * 9; ++i)
+		{
+			if(remove((_directory + files[i].name).c_str()) == 0) total -= files[i].size;
+		}
+	}
+	_total_size = total;
+}
+
@@ -0,0 +1,47 @@
+////////////////////////////////////////////////////////////////////////////
+//	File:		FeatureCache.h
+//	Author:		SiftGPU contributors
+//	Description :	interface for the FeatureCache class.
+//		FeatureCache:	on-disk cache of SIFT results, keyed by a hash of the
+//						decoded pixels and of the parameters that change the 
+//						result, with a size limit and least-recently-used eviction
+//
+//	This file was added to SiftGPU in 2026 and is distributed under the
+//	same terms as the rest of SiftGPU, see the notice in SiftGPU.h.
+//
+////////////////////////////////////////////////////////////////////////////
+
+
+#ifndef FEATURE_CACHE_H
+#define FEATURE_CACHE_H
+
+#include <string>
+#include <vector>
+
+class SiftParam;
+
+class FeatureCache
+{
+public:
+	typedef unsigned long long Key;
+private:
+	std::string		_directory;
+	Key				_max_size;
+	Key				_total_size;
+private:
+	void	GetFilePath(Key key, std::string& path) const;
+	void	EvictFiles();
+public:
+	//hash of a block of memory, chained through seed
+	static Key HashData(const void * data, size_t size, Key seed);
+	//hash of the parameters that change the features of an image
+	static Key HashParam(const SiftParam& param);
+	//return the number of features and fill the buffers if the key is in the cache, -1 otherwise
+	int		Load(Key key, std::vector<float>& keys, std::vector<float>& descriptors);
+	//descriptors can be NULL if they are not computed
+	void	Save(Key key, int num, const float * keys, const float * descriptors);
+	FeatureCache(const char * directory, int max_mb);
+};
+
+#endif
+
@@ -29,7 +29,7 @@
 
 //whether use only one FBO globally
 int		FrameBufferObject::UseSingleFBO=1;
-GLuint	FrameBufferObject::GlobalFBO=0;
+SIFTGPU_THREAD_LOCAL GLuint	FrameBufferObject::GlobalFBO=0;
 
 //////////////////////////////////////////////////////////////////////
 // Construction/Destruction
@@ -27,7 +27,7 @@
 
 class FrameBufferObject  
 {
-	static GLuint	GlobalFBO;   //not thread-safe
+	static SIFTGPU_THREAD_LOCAL GLuint	GlobalFBO;   //one for each thread (OpenGL context)
 	GLuint _fboID;
 public:
 	static int		UseSingleFBO;
@@ -0,0 +1,315 @@
+////////////////////////////////////////////////////////////////////////////
+//	File:		FrameStream.cpp
+//	Author:		SiftGPU contributors
+//	Description :	implementation of the FrameStream class.
+//
+//	This file was added to SiftGPU in 2026 and is distributed under the
+//	same terms as the rest of SiftGPU, see the notice in SiftGPU.h.
+//
+////////////////////////////////////////////////////////////////////////////
+
+
+#include "GL/glew.h"
+#include <stdlib.h>
+#include <string.h>
+
+#include "GlobalUtil.h"
+#include "GLTexImage.h"
+#include "SiftGPU.h"
+#include "FrameStream.h"
+
+
+FrameStream::FrameStream(GLTexInput * input, int width, int height, unsigned int gl_format, unsigned int gl_type, int row_bytes)
+{
+	_inputs[0] = input;
+	_inputs[1] = new GLTexInput;
+	_width = width;
+	_height = height;
+	_gl_format = gl_format;
+	_gl_type = gl_type;
+	_row_bytes = row_bytes;
+	_pushed = _uploaded = _frame_count = 0;
+	_queue = NULL;
+	_queue_size = _queue_begin = _queue_num = 0;
+	_job_num = _stopped = _started = 0;
+	_config = new SiftConfig;
+	GlobalParam::SaveConfig(*_config);
+#if defined(_WIN32)
+	InitializeCriticalSection(&_mutex);
+	InitializeConditionVariable(&_job_cond);
+	InitializeConditionVariable(&_done_cond);
+#else
+	pthread_mutex_init(&_mutex, NULL);
+	pthread_cond_init(&_job_cond, NULL);
+	pthread_cond_init(&_done_cond, NULL);
+#endif
+
+	//In OpenGL mode, the frames are staged in pixel buffer objects and uploaded from 
+	//them without waiting for the copy. The CUDA/OpenCL inputs keep a pointer to the
+	//data until the pyramid is built, and only the converted data needs staging
+	_converted_size = input->GetConvertedSize(width, height, gl_format, gl_type, row_bytes);
+	_staging_kept = GlobalUtil::_UseCUDA || GlobalUtil::_UseOpenCL;
+	int use_pbo = !_staging_kept && _converted_size >= 0 && GLEW_ARB_pixel_buffer_object;
+	_staging_size = use_pbo && _converted_size == 0 ? width * height * GLTexInput::GetPixelSizeGL(gl_format, gl_type) : _converted_size;
+	for(int i = 0; i < STAGE_NUM; ++i)
+	{
+		Stage& stage = _stage[i];
+		stage.frame = -1;
+		stage.data = NULL;
+		stage.buffer = stage.host = NULL;
+		stage.pbo = 0;
+		stage.state = STAGE_FREE;
+		if(_staging_size <= 0) continue;
+		if(use_pbo)	glGenBuffersARB(1, &stage.pbo);
+		else		stage.host = new char[_staging_size];
+	}
+	if(_staging_size <= 0) return;
+
+	//the staging runs on the calling thread if the helper thread can't be created
+#if defined(_WIN32)
+	_thread = CreateThread(NULL, 0, RunStage, this, 0, 0);
+	_started = _thread != NULL;
+#else
+	_started = pthread_create(&_thread, NULL, RunStage, this) == 0;
+#endif
+}
+
+FrameStream::~FrameStream()
+{
+	if(_started)
+	{
+		Lock();
+		_stopped = 1;
+		SignalJob();
+		Unlock();
+#if defined(_WIN32)
+		WaitForSingleObject(_thread, INFINITE);
+		CloseHandle(_thread);
+#else
+		pthread_join(_thread, NULL);
+#endif
+	}
+	for(int i = 0; i < STAGE_NUM; ++i)
+	{
+		UnmapStage(_stage[i]);
+		if(_stage[i].pbo) glDeleteBuffersARB(1, &_stage[i].pbo);
+		if(_stage[i].host) delete[] _stage[i].host;
+	}
+#if defined(_WIN32)
+	DeleteCriticalSection(&_mutex);
+#else
+	pthread_mutex_destroy(&_mutex);
+	pthread_cond_destroy(&_job_cond);
+	pthread_cond_destroy(&_done_cond);
+#endif
+	delete _inputs[1];
+	if(_queue) delete[] _queue;
+	delete _config;
+}
+
+#if defined(_WIN32)
+void FrameStream::Lock()		{EnterCriticalSection(&_mutex); }
+void FrameStream::Unlock()		{LeaveCriticalSection(&_mutex); }
+void FrameStream::WaitJob()		{SleepConditionVariableCS(&_job_cond, &_mutex, INFINITE); }
+void FrameStream::WaitDone()	{SleepConditionVariableCS(&_done_cond, &_mutex, INFINITE); }
+void FrameStream::SignalJob()	{WakeConditionVariable(&_job_cond); }
+void FrameStream::SignalDone()	{WakeConditionVariable(&_done_cond); }
+#else
+void FrameStream::Lock()		{pthread_mutex_lock(&_mutex); }
+void FrameStream::Unlock()		{pthread_mutex_unlock(&_mutex); }
+void FrameStream::WaitJob()		{pthread_cond_wait(&_job_cond, &_mutex); }
+void FrameStream::WaitDone()	{pthread_cond_wait(&_done_cond, &_mutex); }
+void FrameStream::SignalJob()	{pthread_cond_signal(&_job_cond); }
+void FrameStream::SignalDone()	{pthread_cond_signal(&_done_cond); }
+#endif
+
+void FrameStream::PushFrame(const void * data)
+{
+	if(_queue_num == _queue_size)
+	{
+		//grow the ring buffer 
+		int size = _queue_size ? _queue_size * 2 : 8;
+		const void** queue = new const void* [size];
+		for(int i = 0; i < _queue_num; ++i) queue[i] = _queue[(_queue_begin + i) % _queue_size];
+		if(_queue) delete[] _queue;
+		_queue = queue;
+		_queue_size = size;
+		_queue_begin = 0;
+	}
+	_queue[(_queue_begin + _queue_num) % _queue_size] = data;
+	_queue_num++;
+	_pushed++;
+	FeedStages();
+}
+
+void FrameStream::FeedStages()
+{
+	//the queued frames take the free stages in frame order
+	for(int i = 0; i < STAGE_NUM && _queue_num > 0; ++i)
+	{
+		Lock();
+		int busy = _stage[i].state != STAGE_FREE;
+		Unlock();
+		if(busy) continue;
+		const void* data = _queue[_queue_begin];
+		int frame = _pushed - _queue_num;
+		_queue_begin = (_queue_begin + 1) % _queue_size;
+		_queue_num--;
+		StartStage(_stage[i], frame, data);
+	}
+}
+
+int FrameStream::MapStage(Stage& stage)
+{
+	stage.buffer = stage.host;
+	if(stage.pbo == 0) return 1;
+	//the storage of the previous upload is orphaned, so that mapping doesn't wait for it
+	glBindBufferARB(GL_PIXEL_UNPACK_BUFFER_ARB, stage.pbo);
+	glBufferDataARB(GL_PIXEL_UNPACK_BUFFER_ARB, _staging_size, NULL, GL_STREAM_DRAW_ARB);
+	stage.buffer = (char*) glMapBufferARB(GL_PIXEL_UNPACK_BUFFER_ARB, GL_WRITE_ONLY_ARB);
+	glBindBufferARB(GL_PIXEL_UNPACK_BUFFER_ARB, 0);
+	if(stage.buffer) return 1;
+
+	//use host memory for this stage if the buffer can't be mapped
+	glDeleteBuffersARB(1, &stage.pbo);
+	stage.pbo = 0;
+	stage.host = new char[_staging_size];
+	stage.buffer = stage.host;
+	return 0;
+}
+
+void FrameStream::UnmapStage(Stage& stage)
+{
+	if(stage.pbo == 0 || stage.buffer == NULL) return;
+	glBindBufferARB(GL_PIXEL_UNPACK_BUFFER_ARB, stage.pbo);
+	glUnmapBufferARB(GL_PIXEL_UNPACK_BUFFER_ARB);
+	glBindBufferARB(GL_PIXEL_UNPACK_BUFFER_ARB, 0);
+	stage.buffer = NULL;
+}
+
+void FrameStream::StartStage(Stage& stage, int frame, const void * data)
+{
+	stage.frame = frame;
+	stage.data = data;
+	MapStage(stage);
+	if(stage.buffer == NULL)
+	{
+		//the frame is uploaded as it is
+		stage.state = STAGE_READY;
+	}else if(_started)
+	{
+		Lock();
+		stage.state = STAGE_BUSY;
+		_jobs[_job_num++] = (int) (&stage - _stage);
+		SignalJob();
+		Unlock();
+	}else
+	{
+		ConvertStage(stage);
+		stage.state = STAGE_READY;
+	}
+}
+
+void FrameStream::ConvertStage(Stage& stage)
+{
+	if(_converted_size > 0)
+	{
+		_inputs[0]->ConvertImageData(_width, _height, stage.data, _gl_format, 
+									_gl_type, _row_bytes, stage.buffer);
+	}else
+	{
+		//the rows are copied tightly packed
+		size_t line = _staging_size / _height, pitch = _row_bytes ? _row_bytes : line;
+		for(int i = 0; i < _height; ++i)
+			memcpy(stage.buffer + i * line, ((const char*) stage.data) + i * pitch, line);
+	}
+}
+
+void FrameStream::RunThread()
+{
+	//the parameters are thread-local
+	GlobalParam::LoadConfig(*_config);
+	Lock();
+	while(1)
+	{
+		while(_job_num == 0 && !_stopped) WaitJob();
+		if(_stopped) break;
+		Stage& stage = _stage[_jobs[0]];
+		for(int i = 1; i < _job_num; ++i) _jobs[i - 1] = _jobs[i];
+		_job_num--;
+		Unlock();
+		ConvertStage(stage);
+		Lock();
+		stage.state = STAGE_READY;
+		SignalDone();
+	}
+	Unlock();
+}
+
+#if defined(_WIN32)
+DWORD WINAPI FrameStream::RunStage(LPVOID param)
+#else
+void* FrameStream::RunStage(void* param)
+#endif
+{
+	((FrameStream*) param)->RunThread();
+	return 0;
+}
+
+GLTexInput* FrameStream::UploadFrame(int next, int wait)
+{
+	int frame = _frame_count + next;
+	if(frame < _uploaded) return _inputs[frame % INPUT_NUM];
+	if(frame != _uploaded || frame >= _pushed) return NULL;
+
+	Stage* stage = NULL;
+	Lock();
+	for(int i = 0; i < STAGE_NUM; ++i)
+	{
+		if(_stage[i].state != STAGE_FREE && _stage[i].frame == frame) stage = _stage + i;
+	}
+	if(stage == NULL || (!wait && stage->state == STAGE_BUSY))
+	{
+		Unlock();
+		return NULL;
+	}
+	while(stage->state == STAGE_BUSY) WaitDone();
+	Unlock();
+
+	//the staging data is tightly packed, unless it is converted. A pixel buffer 
+	//object is unmapped and bound, and the data is then the offset in it
+	GLTexInput * input = _inputs[frame % INPUT_NUM];
+	const void * data = stage->pbo ? NULL : (stage->buffer ? stage->buffer : stage->data);
+	int row_bytes = stage->buffer && _converted_size == 0 ? 0 : _row_bytes;
+	if(stage->pbo)
+	{
+		UnmapStage(*stage);
+		glBindBufferARB(GL_PIXEL_UNPACK_BUFFER_ARB, stage->pbo);
+	}
+	int done = input->UploadImageData(_width, _height, data, _gl_format, _gl_type, row_bytes);
+	if(stage->pbo) glBindBufferARB(GL_PIXEL_UNPACK_BUFFER_ARB, 0);
+	if(done) _uploaded++;
+
+	//the stage can take the next frame, unless the input still points to it
+	if(!_staging_kept || !done)
+	{
+		stage->state = STAGE_FREE;
+		FeedStages();
+	}
+	return done ? input : NULL;
+}
+
+void FrameStream::ReleaseFrame()
+{
+	if(_frame_count >= _pushed) return;
+	_frame_count++;
+	if(_uploaded < _frame_count) _uploaded = _frame_count;
+	Lock();
+	for(int i = 0; i < STAGE_NUM; ++i)
+	{
+		if(_stage[i].state == STAGE_READY && _stage[i].frame < _frame_count) _stage[i].state = STAGE_FREE;
+	}
+	Unlock();
+	FeedStages();
+}
+
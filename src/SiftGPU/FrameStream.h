@@ -0,0 +1,118 @@
+////////////////////////////////////////////////////////////////////////////
+//	File:		FrameStream.h
+//	Author:		SiftGPU contributors
+//	Description :	interface for the FrameStream class.
+//		FrameStream:	queue of frames of the same size and format. A helper
+//						thread converts or copies the next frames to staging
+//						buffers (pixel buffer objects in OpenGL mode) while the
+//						current frame is processed, and the frames are uploaded
+//						one ahead to two input textures in turn.
+//
+//	This file was added to SiftGPU in 2026 and is distributed under the
+//	same terms as the rest of SiftGPU, see the notice in SiftGPU.h.
+//
+////////////////////////////////////////////////////////////////////////////
+
+
+#ifndef FRAME_STREAM_H
+#define FRAME_STREAM_H
+
+#if defined(_WIN32)
+	#ifndef WIN32_LEAN_AND_MEAN
+	#define WIN32_LEAN_AND_MEAN
+	#endif
+	#include <windows.h>
+#else
+	#include <pthread.h>
+#endif
+
+class GLTexInput;
+class SiftConfig;
+
+class FrameStream
+{
+	enum { STAGE_NUM = 2, INPUT_NUM = 2 };
+	enum { STAGE_FREE, STAGE_BUSY, STAGE_READY };
+	struct Stage
+	{
+		int				frame;		//the index of the frame in the stream
+		const void*		data;		//frame data given to PushFrame
+		char*			buffer;		//the staging data, NULL if the frame is uploaded as it is
+		char*			host;		//the staging memory when there is no pixel buffer object
+		unsigned int	pbo;
+		int				state;
+	};
+	//frame i is uploaded to _inputs[i % INPUT_NUM], and _inputs[0] is owned by SiftGPU
+	GLTexInput*		_inputs[INPUT_NUM];
+	int				_width, _height, _row_bytes;
+	unsigned int	_gl_format, _gl_type;
+	int				_converted_size;
+	//the size of the staging data, and whether the inputs keep a pointer to it
+	int				_staging_size;
+	int				_staging_kept;
+	int				_pushed, _uploaded, _frame_count;
+	Stage			_stage[STAGE_NUM];
+	//the parameters for the helper thread
+	SiftConfig*		_config;
+	//frames waiting for a free stage, as a ring buffer
+	const void**	_queue;
+	int				_queue_size, _queue_begin, _queue_num;
+	//the stages for the helper thread, in frame order
+	int				_jobs[STAGE_NUM];
+	int				_job_num, _stopped, _started;
+#if defined(_WIN32)
+	HANDLE				_thread;
+	CRITICAL_SECTION	_mutex;
+	CONDITION_VARIABLE	_job_cond;
+	CONDITION_VARIABLE	_done_cond;
+#else
+	pthread_t			_thread;
+	pthread_mutex_t		_mutex;
+	pthread_cond_t		_job_cond;
+	pthread_cond_t		_done_cond;
+#endif
+private:
+	void Lock();
+	void Unlock();
+	void WaitJob();
+	void WaitDone();
+	void SignalJob();
+	void SignalDone();
+	void FeedStages();
+	void StartStage(Stage& stage, int frame, const void * data);
+	int  MapStage(Stage& stage);
+	void UnmapStage(Stage& stage);
+	void ConvertStage(Stage& stage);
+	void RunThread();
+#if defined(_WIN32)
+	static DWORD WINAPI RunStage(LPVOID param);
+#else
+	static void* RunStage(void* param);
+#endif
+public:
+	int		 IsValid() const			{return _converted_size >= 0; }
+	int		 GetWidth() const		{return _width; }
+	int		 GetHeight() const		{return _height; }
+	unsigned int GetFormat() const	{return _gl_format; }
+	unsigned int GetType() const	{return _gl_type; }
+	int		 GetRowBytes() const		{return _row_bytes; }
+	//number of frames that have been popped
+	int		 GetFrameCount() const	{return _frame_count; }
+	//number of frames that are pushed but not yet popped
+	int		 GetQueuedNum() const	{return _pushed - _frame_count; }
+	//whether the next-th frame after the popped ones is uploaded
+	int		 IsUploaded(int next) const	{return _frame_count + next < _uploaded; }
+	GLTexInput* GetInput(int index) const	{return _inputs[index]; }
+	void	 PushFrame(const void * data);
+	//upload the next-th frame after the popped ones, and return its input (NULL if there is 
+	//no such frame, or it fails). The frames are uploaded in order, and if wait is 0, the
+	//frame is not uploaded when its staging is not finished
+	GLTexInput* UploadFrame(int next, int wait);
+	//the oldest frame is processed
+	void	 ReleaseFrame();
+	FrameStream(GLTexInput * input, int width, int height, unsigned int gl_format, unsigned int gl_type, int row_bytes);
+	~FrameStream();
+};
+
+#endif
+
@@ -27,9 +27,12 @@
 #include <iostream>
 #include <fstream>
 #include <vector>
+#include <string>
 #include <algorithm>
 #include <stdlib.h>
 #include <math.h>
+#include <ctype.h>
+#include <limits.h>
 using namespace std;
 
 
@@ -39,6 +42,7 @@ using namespace std;
 #include "GLTexImage.h" 
 #include "FrameBufferObject.h"
 #include "ShaderMan.h"
+#include "FeatureCache.h"
 
 
 //#define SIFTGPU_NO_DEVIL
@@ -52,6 +56,23 @@ using namespace std;
     #endif
 #else
 	#include <string.h>
+	#if defined(_WIN32)
+		#define WIN32_LEAN_AND_MEAN
+		#include <windows.h>
+	#else
+		#include <fcntl.h>
+		#include <unistd.h>
+		#include <sys/mman.h>
+		#include <sys/stat.h>
+	#endif
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#include <emmintrin.h>
+	#define SIFTGPU_SSE2
+#endif
+#if defined(__SSSE3__)
+	#include <tmmintrin.h>
 #endif
 //////////////////////////////////////////////////////////////////////
 // Construction/Destruction
@@ -735,67 +756,255 @@ void GLTexImage::UnbindMultiTex(int n)
 	}
 }
 
-template <class Uint> int 
+//////////////////////////////////////////////////////////////////////
+// CPU-side RGB to intensity conversion and down-sampling.
+// The output rows are split into bands that run on GlobalUtil::RunParallel,
+// and the full-resolution conversions of 8-bit and float data use SSE.
+//////////////////////////////////////////////////////////////////////
 
-#if !defined(_MSC_VER) || _MSC_VER > 1200
-GLTexInput::
+struct DownSampleJob
+{
+	int			nchannel;		//number of channels of an input pixel
+	int			ds, ws, hs;		//down-sample factor, and the output size
+	int			linestep;		//distance between two sampled input rows, in channel values
+	int			box;			//average the ds x ds blocks instead of point sampling
+	int			band;			//number of output rows per band
+	int			iw[3];			//16-bit fixed point weights in input channel order
+	float		fw[3];			//floating point weights in input channel order
+	float		scale;			//for converting the averaged integers to float
+	const void*	pin;
+	void*		pout;
+};
+
+static int InitDownSampleJob(DownSampleJob& job, unsigned int gl_format, int width, int height, int ds, int skip, int pitch)
+{
+	int bgr = 0;
+	switch(gl_format)
+	{
+	case GL_LUMINANCE:			job.nchannel = 1;	break;
+	case GL_LUMINANCE_ALPHA:	job.nchannel = 2;	break;
+	case GL_RGB:				job.nchannel = 3;	break;
+	case GL_RGBA:				job.nchannel = 4;	break;
+	case GL_BGR:				job.nchannel = 3;	bgr = 1; break;
+	case GL_BGRA:				job.nchannel = 4;	bgr = 1; break;
+	default:
+		return 0;
+	}
+	job.ds = ds;
+	job.ws = width / ds - skip;
+	job.hs = height / ds;
+	job.linestep = (pitch ? pitch : width * job.nchannel) * ds;
+	job.box = GlobalUtil::_DownSampleAverage && ds > 1;
+	job.iw[0] = bgr ? 7471 : 19595;		job.iw[1] = 38470;		job.iw[2] = bgr ? 19595 : 7471;
+	job.fw[0] = bgr ? 0.114f : 0.299f;	job.fw[1] = 0.587f;		job.fw[2] = bgr ? 0.299f : 0.114f;
+	job.scale = 1.0f;
+	return 1;
+}
+
+//conversion of a single sample, overloaded for each pair of input/output types
+inline void ConvertGray(unsigned char v, unsigned char& o)	{o = v; }
+inline void ConvertGray(unsigned short v, unsigned short& o){o = v; }
+inline void ConvertGray(unsigned char v, float& o)			{o = v / 255.0f; }
+inline void ConvertGray(unsigned short v, float& o)			{o = v / 65535.0f; }
+inline void ConvertGray(float v, float& o)					{o = v; }
+
+inline void ConvertRGB(const DownSampleJob& job, const unsigned char* p, unsigned char& o)
+{
+	//o = int(p[0]*0.299 + p[1] * 0.587 + p[2]* 0.114 + 0.5);
+	o = (unsigned char) ((job.iw[0] * p[0] + job.iw[1] * p[1] + job.iw[2] * p[2] + 32768) >> 16);
+}
+inline void ConvertRGB(const DownSampleJob& job, const unsigned short* p, unsigned short& o)
+{
+	//unsigned arithmetic, the sum of 16-bit samples overflows int
+	o = (unsigned short) ((unsigned(job.iw[0]) * p[0] + unsigned(job.iw[1]) * p[1] + unsigned(job.iw[2]) * p[2] + 32768u) >> 16);
+}
+inline void ConvertRGB(const DownSampleJob& job, const unsigned char* p, float& o)
+{
+	o = (job.iw[0] * p[0] + job.iw[1] * p[1] + job.iw[2] * p[2]) / (65535.0f * 255.0f);
+}
+inline void ConvertRGB(const DownSampleJob& job, const unsigned short* p, float& o)
+{
+	o = (unsigned(job.iw[0]) * p[0] + unsigned(job.iw[1]) * p[1] + unsigned(job.iw[2]) * p[2]) / (65535.0f * 65535.0f);
+}
+inline void ConvertRGB(const DownSampleJob& job, const float* p, float& o)
+{
+	o = job.fw[0] * p[0] + job.fw[1] * p[1] + job.fw[2] * p[2];
+}
+
+inline void StoreAverage(float v, unsigned char& o, float)	{o = (unsigned char) (v + 0.5f); }
+inline void StoreAverage(float v, unsigned short& o, float) {o = (unsigned short) (v + 0.5f); }
+inline void StoreAverage(float v, float& o, float scale)	{o = v * scale; }
+
+//vectorized full-resolution rows, returns the number of output values written
+template <class Tin, class Tout> inline int ConvertRowSSE(const DownSampleJob&, const Tin*, Tout*)
+{
+	return 0;
+}
+
+#if defined(SIFTGPU_SSE2)
+
+//weighted sum of 4 pixels, each 32-bit lane holds the first three 8-bit channels of a pixel
+inline __m128 WeightedSumSSE(__m128i v, const __m128* w)
+{
+	const __m128i mask = _mm_set1_epi32(0xff);
+	__m128 c0 = _mm_cvtepi32_ps(_mm_and_si128(v, mask));
+	__m128 c1 = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(v, 8), mask));
+	__m128 c2 = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(v, 16), mask));
+	return _mm_add_ps(_mm_add_ps(_mm_mul_ps(c0, w[0]), _mm_mul_ps(c1, w[1])), _mm_mul_ps(c2, w[2]));
+}
+
+//load 16 pixels of 8-bit RGB or RGBA data into the layout used by WeightedSumSSE
+inline void LoadPixelsSSE(const unsigned char* p, int nchannel, __m128i* v)
+{
+	if(nchannel == 4)
+	{
+		for(int k = 0; k < 4; ++k) v[k] = _mm_loadu_si128((const __m128i*) (p + 16 * k));
+	}else
+	{
+#if defined(__SSSE3__)
+		const __m128i expand = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+		for(int k = 0; k < 4; ++k) v[k] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*) (p + 12 * k)), expand);
 #endif
+	}
+}
 
-DownSamplePixelDataI(unsigned int gl_format, int width, int height, int ds, 
-									const Uint * pin, Uint * pout)	
-{
-	int step, linestep;
-	int i, j; 
-	int ws = width/ds;
-	int hs = height/ds;
-	const Uint * line = pin, * p;
-	Uint *po = pout;
-	switch(gl_format)
+//the integer weighted sums are below 2^24, so they are exact in single precision
+inline int ConvertRowSSE(const DownSampleJob& job, const unsigned char* line, unsigned char* po)
+{
+	int j = 0, n = job.ws, nch = job.nchannel;
+#if !defined(__SSSE3__)
+	if(nch == 3) return 0;
+#endif
+	if(nch < 3) return 0;
+	//3-channel rows read 4 bytes beyond the last pixel of a block
+	int tail = nch == 3 ? 2 : 0;
+	const __m128 w[3] = {_mm_set1_ps((float) job.iw[0]), _mm_set1_ps((float) job.iw[1]), _mm_set1_ps((float) job.iw[2])};
+	const __m128 half = _mm_set1_ps(32768.0f), inv = _mm_set1_ps(1.0f / 65536.0f);
+	for(; j + 16 + tail <= n; j += 16, line += 16 * nch)
 	{
-	case GL_LUMINANCE:
-	case GL_LUMINANCE_ALPHA:
-		step = ds * (gl_format == GL_LUMINANCE? 1: 2); 
-		linestep = width * step; 
-		for(i = 0 ; i < hs; i++, line+=linestep)
-		{
-			for(j = 0, p = line; j < ws; j++, p+=step)
-			{
-				*po++ = *p;
-			}
-		}
-		break;
-	case GL_RGB:
-	case GL_RGBA:
-		step = ds * (gl_format == GL_RGB? 3: 4); 
-		linestep = width * step; 
+		__m128i v[4], g[4];
+		LoadPixelsSSE(line, nch, v);
+		for(int k = 0; k < 4; ++k) g[k] = _mm_cvttps_epi32(_mm_mul_ps(_mm_add_ps(WeightedSumSSE(v[k], w), half), inv));
+		_mm_storeu_si128((__m128i*) (po + j), _mm_packus_epi16(_mm_packs_epi32(g[0], g[1]), _mm_packs_epi32(g[2], g[3])));
+	}
+	return j;
+}
 
-		for(i = 0 ; i < hs; i++, line+=linestep)
+inline int ConvertRowSSE(const DownSampleJob& job, const unsigned char* line, float* po)
+{
+	int j = 0, n = job.ws, nch = job.nchannel;
+	const __m128 factor = _mm_set1_ps(65535.0f * 255.0f);
+	if(nch == 1)
+	{
+		const __m128i zero = _mm_setzero_si128();
+		const __m128 f255 = _mm_set1_ps(255.0f);
+		for(; j + 16 <= n; j += 16, line += 16)
 		{
-			for(j = 0, p = line; j < ws; j++, p+=step)
-			{
-				//*po++ = int(p[0]*0.299 + p[1] * 0.587 + p[2]* 0.114 + 0.5);
-				*po++ = ((19595*p[0] + 38470*p[1] + 7471*p[2]+ 32768)>>16);
-			}
+			__m128i v = _mm_loadu_si128((const __m128i*) line);
+			__m128i lo = _mm_unpacklo_epi8(v, zero), hi = _mm_unpackhi_epi8(v, zero);
+			_mm_storeu_ps(po + j,      _mm_div_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(lo, zero)), f255));
+			_mm_storeu_ps(po + j + 4,  _mm_div_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(lo, zero)), f255));
+			_mm_storeu_ps(po + j + 8,  _mm_div_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(hi, zero)), f255));
+			_mm_storeu_ps(po + j + 12, _mm_div_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(hi, zero)), f255));
 		}
-		break;
-	case GL_BGR:
-	case GL_BGRA:
-		step = ds * (gl_format == GL_BGR? 3: 4); 
-		linestep = width * step; 
-		for(i = 0 ; i < hs; i++, line+=linestep)
+		return j;
+	}
+#if !defined(__SSSE3__)
+	if(nch == 3) return 0;
+#endif
+	if(nch < 3) return 0;
+	int tail = nch == 3 ? 2 : 0;
+	const __m128 w[3] = {_mm_set1_ps((float) job.iw[0]), _mm_set1_ps((float) job.iw[1]), _mm_set1_ps((float) job.iw[2])};
+	for(; j + 16 + tail <= n; j += 16, line += 16 * nch)
+	{
+		__m128i v[4];
+		LoadPixelsSSE(line, nch, v);
+		for(int k = 0; k < 4; ++k) _mm_storeu_ps(po + j + 4 * k, _mm_div_ps(WeightedSumSSE(v[k], w), factor));
+	}
+	return j;
+}
+
+inline int ConvertRowSSE(const DownSampleJob& job, const float* line, float* po)
+{
+	int j = 0, n = job.ws;
+	if(job.nchannel != 4) return 0;
+	const __m128 w0 = _mm_set1_ps(job.fw[0]), w1 = _mm_set1_ps(job.fw[1]), w2 = _mm_set1_ps(job.fw[2]);
+	for(; j + 4 <= n; j += 4, line += 16)
+	{
+		__m128 c0 = _mm_loadu_ps(line), c1 = _mm_loadu_ps(line + 4);
+		__m128 c2 = _mm_loadu_ps(line + 8), c3 = _mm_loadu_ps(line + 12);
+		_MM_TRANSPOSE4_PS(c0, c1, c2, c3);
+		_mm_storeu_ps(po + j, _mm_add_ps(_mm_add_ps(_mm_mul_ps(c0, w0), _mm_mul_ps(c1, w1)), _mm_mul_ps(c2, w2)));
+	}
+	return j;
+}
+
+#endif
+
+template <class Tin, class Tout> static void DownSampleRow(const DownSampleJob& job, int row)
+{
+	const Tin * line = ((const Tin*) job.pin) + (size_t) row * job.linestep, * p;
+	Tout * po = ((Tout*) job.pout) + (size_t) row * job.ws;
+	int j = 0, n = job.ws, nch = job.nchannel, step = job.ds * nch;
+	if(job.box)
+	{
+		//area average of the ds x ds block, the alpha channel is ignored
+		int ds = job.ds, pitch = job.linestep / ds, nc = nch < 3 ? 1 : 3;
+		float norm = 1.0f / (ds * ds);
+		for(j = 0; j < n; ++j, line += step)
 		{
-			for(j = 0, p = line; j < ws; j++, p+=step)
+			float c[3] = {0, 0, 0};
+			for(int y = 0; y < ds; ++y)
 			{
-				*po++ = ((7471*p[0] + 38470*p[1] + 19595*p[2]+ 32768)>>16);
+				p = line + y * pitch;
+				for(int x = 0; x < ds; ++x, p += nch)
+					for(int k = 0; k < nc; ++k) c[k] += p[k];
 			}
+			float v = nc == 1 ? c[0] : (job.fw[0] * c[0] + job.fw[1] * c[1] + job.fw[2] * c[2]);
+			StoreAverage(v * norm, po[j], job.scale);
 		}
-		break;
-	default:
-		return 0;
+	}else if(nch < 3)
+	{
+		if(job.ds == 1) j = ConvertRowSSE(job, line, po);
+		for(p = line + j * step; j < n; ++j, p += step) ConvertGray(*p, po[j]);
+	}else
+	{
+		if(job.ds == 1) j = ConvertRowSSE(job, line, po);
+		for(p = line + j * step; j < n; ++j, p += step) ConvertRGB(job, p, po[j]);
 	}
+}
 
-	return 1;
+template <class Tin, class Tout> static void DownSampleBand(void* arg, int index)
+{
+	const DownSampleJob& job = *(const DownSampleJob*) arg;
+	int end = std::min(job.hs, (index + 1) * job.band);
+	for(int i = index * job.band; i < end; ++i) DownSampleRow<Tin, Tout>(job, i);
+}
+
+template <class Tin, class Tout> static void RunDownSampleJob(DownSampleJob& job, const Tin* pin, Tout* pout)
+{
+	//bands of at least 64K output values, so that small images don't pay for threads
+	int nband = (int) std::min((size_t) GlobalUtil::GetCPUThreadNum(), (size_t) job.hs * job.ws / 65536);
+	if(nband < 1) nband = 1;
+	job.band = (job.hs + nband - 1) / nband;
+	job.pin = pin;
+	job.pout = pout;
+	GlobalUtil::RunParallel(nband, DownSampleBand<Tin, Tout>, &job);
+}
+
+template <class Uint> int 
+
+#if !defined(_MSC_VER) || _MSC_VER > 1200
+GLTexInput::
+#endif
 
+DownSamplePixelDataI(unsigned int gl_format, int width, int height, int ds, 
+									const Uint * pin, Uint * pout, int pitch)	
+{
+	DownSampleJob job;
+	if(!InitDownSampleJob(job, gl_format, width, height, ds, 0, pitch)) return 0;
+	RunDownSampleJob(job, pin, pout);
+	return 1;
 }
 
 
@@ -806,206 +1015,255 @@ GLTexInput::
 #endif
 
 DownSamplePixelDataI2F(unsigned int gl_format, int width, int height, int ds, 
-									const Uint * pin, float * pout, int skip)	
-{
-	int step, linestep;
-	int i, j; 
-	int ws = width/ds - skip;
-	int hs = height/ds;
-	const Uint * line = pin, * p;
-	float *po = pout;
-    const float factor = (sizeof(Uint) == 1? 255.0f : 65535.0f); 
-	switch(gl_format)
-	{
-	case GL_LUMINANCE:
-	case GL_LUMINANCE_ALPHA:
-		step = ds * (gl_format == GL_LUMINANCE? 1: 2); 
-		linestep = width * step; 
-		for(i = 0 ; i < hs; i++, line+=linestep)
-		{
-			for(j = 0, p = line; j < ws; j++, p+=step)
-			{
-				*po++ = (*p) / factor; 
-			}
-		}
-		break;
-	case GL_RGB:
-	case GL_RGBA:
-		step = ds * (gl_format == GL_RGB? 3: 4); 
-		linestep = width * step; 
+									const Uint * pin, float * pout, int skip, int pitch)	
+{
+	DownSampleJob job;
+	if(!InitDownSampleJob(job, gl_format, width, height, ds, skip, pitch)) return 0;
+	job.scale = 1.0f / (sizeof(Uint) == 1? 255.0f : 65535.0f); 
+	RunDownSampleJob(job, pin, pout);
+	return 1;
+}
 
-		for(i = 0 ; i < hs; i++, line+=linestep)
-		{
-			for(j = 0, p = line; j < ws; j++, p+=step)
-			{
-				//*po++ = int(p[0]*0.299 + p[1] * 0.587 + p[2]* 0.114 + 0.5);
-				*po++ = ((19595*p[0] + 38470*p[1] + 7471*p[2]) / (65535.0f * factor));
-			}
-		}
-		break;
-	case GL_BGR:
-	case GL_BGRA:
-		step = ds * (gl_format == GL_BGR? 3: 4); 
-		linestep = width * step; 
-		for(i = 0 ; i < hs; i++, line+=linestep)
-		{
-			for(j = 0, p = line; j < ws; j++, p+=step)
-			{
-				*po++ = ((7471*p[0] + 38470*p[1] + 19595*p[2]) / (65535.0f * factor));
-			}
-		}
-		break;
-	default:
-		return 0;
-	}
+#if !defined(_MSC_VER) || _MSC_VER > 1200
+//the members are public, and the calls in this file can be inlined without leaving a definition
+template int GLTexInput::DownSamplePixelDataI<unsigned char>(unsigned int, int, int, int, const unsigned char*, unsigned char*, int);
+template int GLTexInput::DownSamplePixelDataI<unsigned short>(unsigned int, int, int, int, const unsigned short*, unsigned short*, int);
+template int GLTexInput::DownSamplePixelDataI2F<unsigned char>(unsigned int, int, int, int, const unsigned char*, float*, int, int);
+template int GLTexInput::DownSamplePixelDataI2F<unsigned short>(unsigned int, int, int, int, const unsigned short*, float*, int, int);
+#endif
+
+int GLTexInput::DownSamplePixelDataF(unsigned int gl_format, int width, int height, int ds, const float * pin, float * pout, int skip, int pitch)	
+{
+	DownSampleJob job;
+	if(!InitDownSampleJob(job, gl_format, width, height, ds, skip, pitch)) return 0;
+	RunDownSampleJob(job, pin, pout);
 	return 1;
 }
 
-int GLTexInput::DownSamplePixelDataF(unsigned int gl_format, int width, int height, int ds, const float * pin, float * pout, int skip)	
+int GLTexInput::GetPixelSizeGL(unsigned int gl_format, unsigned int gl_type)
 {
-	int step, linestep;
-	int i, j; 
-	int ws = width/ds - skip;
-	int hs = height/ds;
-	const float * line = pin, * p;
-	float *po = pout;
-	switch(gl_format)
+    int num_channel_byte, num_channels;
+    switch(gl_type)
+    {
+    case GL_UNSIGNED_BYTE:
+    case GL_BYTE:
+        num_channel_byte = 1;	break;
+    case GL_UNSIGNED_SHORT:
+    case GL_SHORT:
+        num_channel_byte = 2;	break;
+    case GL_UNSIGNED_INT:
+    case GL_INT: 
+    case GL_FLOAT:
+        num_channel_byte = 4;	break;
+    default:
+        return 0;
+    }
+    switch(gl_format)
+    {
+    case GL_RED:
+    case GL_GREEN:
+    case GL_BLUE:
+    case GL_ALPHA:
+    case GL_LUMINANCE:
+        num_channels = 1;		break;
+    case GL_LUMINANCE_ALPHA:
+        num_channels = 2;		break;
+    case GL_RGB:
+    case GL_BGR:
+        num_channels = 3;		break;
+    case GL_RGBA:
+    case GL_BGRA:
+        num_channels = 4;		break;
+    default:
+        return 0;
+    }
+    return num_channels * num_channel_byte;
+}
+
+//express a row stride with GL_UNPACK_ROW_LENGTH or GL_UNPACK_ALIGNMENT, (0, 0, 0) restores the default
+int GLTexInput::SetUnpackRowBytes(int width, int pixel_size, int row_bytes)
+{
+	if(row_bytes == 0)
 	{
-	case GL_LUMINANCE:
-	case GL_LUMINANCE_ALPHA:
-		step = ds * (gl_format == GL_LUMINANCE? 1: 2); 
-		linestep = width * step; 
-		for(i = 0 ; i < hs; i++, line+=linestep)
-		{
-			for(j = 0, p = line; j < ws; j++, p+=step)
-			{
-				*po++ = *p;
-			}
-		}
-		break;
-	case GL_RGB:
-	case GL_RGBA:
-		step = ds * (gl_format == GL_RGB? 3: 4); 
-		linestep = width * step; 
-		for(i = 0 ; i < hs; i++, line+=linestep)
-		{
-			for(j = 0, p = line; j < ws; j++, p+=step)
-			{
-				*po++ = (0.299f*p[0] + 0.587f*p[1] + 0.114f*p[2]);
-			}
-		}
-		break;
-	case GL_BGR:
-	case GL_BGRA:
-		step = ds * (gl_format == GL_BGR? 3: 4); 
-		linestep = width * step; 
-		for(i = 0 ; i < hs; i++, line+=linestep)
+		glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+		glPixelStorei(GL_UNPACK_ALIGNMENT , 1); 
+		return 1;
+	}else if(row_bytes % pixel_size == 0)
+	{
+		glPixelStorei(GL_UNPACK_ROW_LENGTH, row_bytes / pixel_size);
+		return 1;
+	}
+	for(int align = 2; align <= 8; align *= 2)
+	{
+		if(row_bytes == (width * pixel_size + align - 1) / align * align)
 		{
-			for(j = 0, p = line; j < ws; j++, p+=step)
-			{
-				*po++ = (0.114f*p[0] + 0.587f*p[1] + 0.299f * p[2]); 
-			}
+			glPixelStorei(GL_UNPACK_ALIGNMENT , align);
+			return 1;
 		}
-		break;
-	default:
-		return 0;
 	}
-
-	return 1;
-
+	return 0;
 }
 
-int GLTexInput::SetImageData( int width,  int height, const void * data, 
-							 unsigned int gl_format, unsigned int gl_type )
+//decide how an input image is processed: ds is the down-sample level, and when cpu conversion 
+//is needed, the converted data is a GL_LUMINANCE image of cwidth x (height >> ds) of type ctype.
+//returns 1 if the data is converted on cpu, 0 if it is uploaded as it is, -1 if it is not supported
+int GLTexInput::GetInputLayout(int width, int height, unsigned int gl_format, unsigned int gl_type, 
+							   int row_bytes, int & ds, int & cwidth, unsigned int & ctype) const
 {
 	int simple_format = IsSimpleGlFormat(gl_format, gl_type);//no cpu code to handle other formats
-	int ws, hs, done = 1;
-	
-	if(_converted_data) {delete [] _converted_data; _converted_data  = NULL; }
-
-	_rgb_converted = 1; 
-    _data_modified = 0; 
+	int pixel_size = GetPixelSizeGL(gl_format, gl_type);
+	int channel_size = gl_type == GL_UNSIGNED_BYTE ? 1 : (gl_type == GL_UNSIGNED_SHORT ? 2 : 4);
+	int tight = (row_bytes == 0 || row_bytes == width * pixel_size);
+	if(!tight && (pixel_size == 0 || row_bytes < width * pixel_size || row_bytes % channel_size))
+	{
+		std::cerr << "Invalid row stride for the pixel format\n";
+		return -1;
+	}
 
 	if( simple_format 
 		&& ( width > _texMaxDim || height > _texMaxDim || GlobalUtil::_PreProcessOnCPU) 
 		&& GlobalUtil::_octave_min_default >0   )
+		ds = GlobalUtil::_octave_min_default; 
+	else
+		ds = 0; 
+
+	while((width >> ds) > _texMaxDim || (height >> ds) > _texMaxDim)
 	{
-		_down_sampled = GlobalUtil::_octave_min_default; 
-		ws = width >> GlobalUtil::_octave_min_default;
-		hs = height >> GlobalUtil::_octave_min_default;
+		if(!simple_format)
+		{
+			std::cerr<<"Input images is too big to fit into a texture\n";
+			return -1;
+		}
+		ds ++;
+	}
+
+	if(GlobalUtil::_UseCUDA || GlobalUtil::_UseOpenCL)
+	{
+		if(!simple_format) 
+		{
+			std::cerr << "Input format not supported under current settings.\n";
+			return -1;
+		}
+		//CUDA/OpenCL read tightly packed float data of width multiple of 4
+		cwidth = TruncateWidthCU(width >> ds);
+		ctype = GL_FLOAT;
+		return ds > 0 || gl_format != GL_LUMINANCE || gl_type != GL_FLOAT || cwidth != width || !tight;
 	}else
 	{
-		_down_sampled = 0; 
-		ws = width;
-		hs = height;
+		cwidth = width >> ds;
+		ctype = gl_type;
+		return simple_format && ( ds > 0 || (gl_format != GL_LUMINANCE && GlobalUtil::_PreProcessOnCPU));
 	}
-	
-	if ( ws > _texMaxDim || hs > _texMaxDim)
+}
+
+int GLTexInput::GetConvertedSize(int width, int height, unsigned int gl_format, unsigned int gl_type, int row_bytes) const
+{
+	int ds, cwidth;		unsigned int ctype;
+	int convert = GetInputLayout(width, height, gl_format, gl_type, row_bytes, ds, cwidth, ctype);
+	if(convert <= 0) return convert;
+	int channel_size = ctype == GL_UNSIGNED_BYTE ? 1 : (ctype == GL_UNSIGNED_SHORT ? 2 : 4);
+	return cwidth * (height >> ds) * channel_size;
+}
+
+int GLTexInput::ConvertImageData(int width, int height, const void * data, unsigned int gl_format, 
+								 unsigned int gl_type, int row_bytes, void * buffer) const
+{
+	int ds, cwidth;		unsigned int ctype;
+	if(GetInputLayout(width, height, gl_format, gl_type, row_bytes, ds, cwidth, ctype) <= 0) return 0;
+	//row pitch in number of channel values, as used by the DownSample functions
+	int channel_size = gl_type == GL_UNSIGNED_BYTE ? 1 : (gl_type == GL_UNSIGNED_SHORT ? 2 : 4);
+	int pitch = row_bytes / channel_size;
+	int skip = (width >> ds) - cwidth;
+	if(ctype == GL_FLOAT && gl_type == GL_UNSIGNED_BYTE)
+		return DownSamplePixelDataI2F(gl_format, width, height, 1<<ds, (const unsigned char*) data, (float*) buffer, skip, pitch);
+	else if(ctype == GL_FLOAT && gl_type == GL_UNSIGNED_SHORT)
+		return DownSamplePixelDataI2F(gl_format, width, height, 1<<ds, (const unsigned short*) data, (float*) buffer, skip, pitch);
+	else if(gl_type == GL_UNSIGNED_BYTE)
+		return DownSamplePixelDataI(gl_format, width, height, 1<<ds, (const unsigned char*) data, (unsigned char*) buffer, pitch);
+	else if(gl_type == GL_UNSIGNED_SHORT)
+		return DownSamplePixelDataI(gl_format, width, height, 1<<ds, (const unsigned short*) data, (unsigned short*) buffer, pitch);
+	else
+		return DownSamplePixelDataF(gl_format, width, height, 1<<ds, (const float*) data, (float*) buffer, skip, pitch);
+}
+
+int GLTexInput::SetImageData( int width,  int height, const void * data, 
+							 unsigned int gl_format, unsigned int gl_type, int row_bytes )
+{
+	int size = GetConvertedSize(width, height, gl_format, gl_type, row_bytes);
+	if(size < 0) return 0;
+	FeatureCache::Key hash = 0;
+	if(_cache)
 	{
-		if(simple_format)
+		//hash the pixels row by row, together with the image size and format
+		int pixel_size = GetPixelSizeGL(gl_format, gl_type), line_bytes = width * pixel_size;
+		unsigned int layout[4] = {(unsigned int) width, (unsigned int) height, gl_format, gl_type};
+		hash = FeatureCache::HashData(layout, sizeof(layout), 0);
+		int pitch = row_bytes == 0 ? line_bytes : row_bytes;
+		for(int i = 0; i < height && line_bytes > 0; ++i)
+			hash = FeatureCache::HashData(((const char*) data) + i * (size_t) pitch, line_bytes, hash);
+		if(line_bytes == 0) hash = 0;
+
+		//the image is not converted or uploaded if its features are in the cache
+		int hit = hash == 0 ? -1 : _cache->Load(FeatureCache::HashData(&hash, sizeof(hash), _cache_seed), 
+												*_cache_keys, *_cache_descriptors);
+		if(hit >= 0)
 		{
-			if(GlobalUtil::_verbose) std::cout<<"Automatic down-sampling is used\n";
-			do
-			{
-				_down_sampled ++;
-				ws >>= 1;
-				hs >>= 1;
-			}while(ws > _texMaxDim || hs > _texMaxDim);
-		}else
+			int ds, cwidth;		unsigned int ctype;
+			GetInputLayout(width, height, gl_format, gl_type, row_bytes, ds, cwidth, ctype);
+			_down_sampled = ds;
+			_imgWidth = _drawWidth = width >> ds;
+			_imgHeight = _drawHeight = height >> ds;
+			_data_hash = hash;
+			_cache_hit = hit;
+			return 1;
+		}
+	}
+	if(size > 0)
+	{
+		//the conversion buffer is kept for the following images 
+		if(size > _converted_size)
 		{
-			std::cerr<<"Input images is too big to fit into a texture\n";
-			return 0;
+			if(_converted_data) delete [] _converted_data;
+			_converted_data = new float [(size + 3) / 4];
+			_converted_size = (size + 3) / 4 * 4;
 		}
+		ConvertImageData(width, height, data, gl_format, gl_type, row_bytes, _converted_data);
 	}
+	if(!UploadImageData(width, height, size > 0 ? _converted_data : data, gl_format, gl_type, row_bytes)) return 0;
+	_data_hash = hash;
+	return 1;
+}
 
+int GLTexInput::UploadImageData( int width,  int height, const void * data, 
+							 unsigned int gl_format, unsigned int gl_type, int row_bytes )
+{
+	int ds, cwidth;		unsigned int ctype;
+	int convert = GetInputLayout(width, height, gl_format, gl_type, row_bytes, ds, cwidth, ctype);
+	if(convert < 0) return 0;
+	int ws = width >> ds, hs = height >> ds;
+
+	_down_sampled = ds;
+	_rgb_converted = 1; 
+    _data_modified = 0; 
+	_data_hash = 0;
+	_cache_hit = -1;
 	_texWidth = _imgWidth = _drawWidth = ws;	
 	_texHeight = _imgHeight = _drawHeight = hs;
 
 	if(GlobalUtil::_verbose)
 	{
+		if(ds > 0 && ((width >> (ds - 1)) > _texMaxDim || (height >> (ds - 1)) > _texMaxDim))
+			std::cout<<"Automatic down-sampling is used\n";
 		std::cout<<"Image size :\t"<<width<<"x"<<height<<"\n";
 		if(_down_sampled >0) 	std::cout<<"Down sample to \t"<<ws<<"x"<<hs<<"\n";
 	}
 
-
     if(GlobalUtil::_UseCUDA || GlobalUtil::_UseOpenCL)
     {
-        //////////////////////////////////////
-        int tWidth = TruncateWidthCU(_imgWidth);
-        int skip = _imgWidth - tWidth; 
-        //skip = 0;
-        if(!simple_format) 
-        {
-            std::cerr << "Input format not supported under current settings.\n";
-            return 0;
-        }else if(_down_sampled > 0 || gl_format != GL_LUMINANCE || gl_type != GL_FLOAT)
-        {
-		    _converted_data = new float [_imgWidth * _imgHeight];
-            if(gl_type == GL_UNSIGNED_BYTE)
-		        DownSamplePixelDataI2F(gl_format, width, height, 1<<_down_sampled, 
-                                        ((const unsigned char*) data), _converted_data, skip);
-	        else if(gl_type == GL_UNSIGNED_SHORT)
-		        DownSamplePixelDataI2F(gl_format, width, height, 1<<_down_sampled, 
-                                        ((const unsigned short*) data), _converted_data, skip);
-	        else
-		        DownSamplePixelDataF(gl_format, width, height, 1<<_down_sampled, (float*)data, _converted_data, skip);
-            _rgb_converted = 2;  //indidates a new data copy
-            _pixel_data = _converted_data;
-        }else
-        {
-            //Luminance data that doesn't need to down sample
-            _rgb_converted = 1;
-            _pixel_data = data;
-            if(skip > 0)
-            {
-                for(int i = 1; i < _imgHeight; ++i)
-                {   
-                    float * dst = ((float*)data) + i * tWidth, * src = ((float*)data) + i * _imgWidth;
-                    for(int j = 0; j < tWidth; ++j) *dst++ = * src++;
-                }
-            }
-        }
-        _texWidth = _imgWidth = _drawWidth = tWidth;
+        //either the converted data, or luminance float data that doesn't need to down sample
+        _rgb_converted = convert ? 2 : 1;  //2 indidates a new data copy
+        _pixel_data = data;
+        _texWidth = _imgWidth = _drawWidth = cwidth;
         _data_modified = 1; 
     }else
     {
@@ -1016,44 +1274,20 @@ int GLTexInput::SetImageData( int width,  int height, const void * data,
 		glTexParameteri (_texTarget, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE); 
 	    glPixelStorei(GL_UNPACK_ALIGNMENT , 1); 
 
-	    if(simple_format && ( _down_sampled> 0 || (gl_format != GL_LUMINANCE && GlobalUtil::_PreProcessOnCPU) ))
+	    if(convert)
 	    {
-
-		    if(gl_type == GL_UNSIGNED_BYTE)
-		    {
-			    unsigned char * newdata = new unsigned char [_imgWidth * _imgHeight];
-			    DownSamplePixelDataI(gl_format, width, height, 1<<_down_sampled, ((const unsigned char*) data), newdata);
-			    glTexImage2D(_texTarget, 0, GL_LUMINANCE32F_ARB, //internal format changed
-                    _imgWidth, _imgHeight, 0,
-					GL_LUMINANCE, GL_UNSIGNED_BYTE, newdata);
-			    delete[] newdata;
-		    }else if(gl_type == GL_UNSIGNED_SHORT)
-		    {
-			    unsigned short * newdata = new unsigned short [_imgWidth * _imgHeight];
-			    DownSamplePixelDataI(gl_format, width, height, 1<<_down_sampled, ((const unsigned short*) data), newdata);
-    			
-			    glTexImage2D(_texTarget, 0, GL_LUMINANCE32F_ARB,   //internal format changed
-                    _imgWidth, _imgHeight, 0,
-					GL_LUMINANCE, GL_UNSIGNED_SHORT, newdata);
-			    delete[] newdata;
-		    }else if(gl_type == GL_FLOAT)
-		    {
-			    float * newdata = new float [_imgWidth * _imgHeight];
-			    DownSamplePixelDataF(gl_format, width, height, 1<<_down_sampled, (float*)data, newdata);
-			    glTexImage2D(_texTarget, 0, GL_LUMINANCE32F_ARB, //internal format changed
-                    _imgWidth, _imgHeight, 0,
-					GL_LUMINANCE, GL_FLOAT, newdata);
-			    delete[] newdata;
-		    }else
-		    {
-			    //impossible
-			    done = 0;
-			    _rgb_converted = 0;
-		    }
+		    glTexImage2D(_texTarget, 0, GL_LUMINANCE32F_ARB, //internal format changed
+                _imgWidth, _imgHeight, 0, GL_LUMINANCE, ctype, data);
 		    GlobalUtil::FitViewPort(1, 1);  //this used to be necessary
 	    }else
 	    {
 		    //ds must be 0 here if not simpleformat
+		    int tight = (row_bytes == 0 || row_bytes == width * GetPixelSizeGL(gl_format, gl_type));
+		    if(!tight && !SetUnpackRowBytes(width, GetPixelSizeGL(gl_format, gl_type), row_bytes))
+		    {
+			    std::cerr << "Row stride is not supported by OpenGL for the pixel format\n";
+			    return 0;
+		    }
 		    if(gl_format == GL_LUMINANCE || gl_format == GL_LUMINANCE_ALPHA)
             {
                 //use one channel internal format if data is intensity image 
@@ -1070,10 +1304,11 @@ int GLTexInput::SetImageData( int width,  int height, const void * data,
 		        else
 			        _rgb_converted = 0;  //In CUDA mode, the conversion will be done by CUDA kernel
             }
+		    if(!tight) SetUnpackRowBytes(0, 0, 0);
 	    }
 	    UnbindTex();
     }
-	return done;
+	return 1;
 }
 
 
@@ -1082,14 +1317,285 @@ GLTexInput::~GLTexInput()
     if(_converted_data) delete [] _converted_data; 
 }
 
+int GLTexInput::ParseNetpbmHeader(const unsigned char * data, size_t size, int header[4], size_t & offset)
+{
+	//magic width height maxval, followed by one whitespace for the raw formats
+	const unsigned char * p = data + 2, * end = data + size;
+	int magic = (size > 2 && data[0] == 'P')? data[1] : 0;
+	if(magic != '2' && magic != '3' && magic != '5' && magic != '6') return 0;
+	header[0] = magic;
+	for(int i = 1; i < 4; ++i)
+	{
+		while(p < end && (isspace(*p) || *p == '#'))
+		{
+			if(*p == '#')	while(p < end && *p != '\n') ++p;
+			else			++p;
+		}
+		if(p >= end || !isdigit(*p)) return 0;
+		//the digits stop being added once the value is out of range
+		for(header[i] = 0; p < end && isdigit(*p); ++p) 
+			if(header[i] <= NETPBM_MAX_VALUE) header[i] = header[i] * 10 + (*p - '0');
+		if(header[i] <= 0 || header[i] > NETPBM_MAX_VALUE) return 0;
+	}
+	if(p < end) ++p;
+	offset = p - data;
+	//the samples are counted with int
+	int nchannel = (magic == '3' || magic == '6') ? 3 : 1;
+	return double(header[1]) * header[2] * nchannel <= INT_MAX;
+}
+
+size_t GLTexInput::GetNetpbmRasterSize(const int header[4])
+{
+	int nchannel = (header[0] == '3' || header[0] == '6') ? 3 : 1;
+	return size_t(header[1]) * size_t(header[2]) * nchannel * (header[3] > 255 ? 2 : 1);
+}
+
+
+#ifdef SIFTGPU_NO_DEVIL
+//read-only view of an input file through a private (copy-on-write) mapping,
+//so that pixel data can be fixed up in place and passed without a copy
+class MappedFile
+{
+public:
+	unsigned char *	_data;
+	size_t			_size;
+#if defined(_WIN32)
+	HANDLE			_file, _mapping;
+#endif
+public:
+	MappedFile() : _data(NULL), _size(0)
+	{
+#if defined(_WIN32)
+		_file = INVALID_HANDLE_VALUE;	_mapping = NULL;
+#endif
+	}
+	int Open(const char * path)
+	{
+#if defined(_WIN32)
+		_file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+		if(_file == INVALID_HANDLE_VALUE) return 0;
+		LARGE_INTEGER size;
+		if(!GetFileSizeEx(_file, &size) || size.QuadPart == 0) return 0;
+		_mapping = CreateFileMapping(_file, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+		if(_mapping == NULL) return 0;
+		_data = (unsigned char*) MapViewOfFile(_mapping, FILE_MAP_COPY, 0, 0, 0);
+		if(_data == NULL) return 0;
+		_size = (size_t) size.QuadPart;
+#else
+		int fd = open(path, O_RDONLY);
+		if(fd < 0) return 0;
+		struct stat st;
+		if(fstat(fd, &st) == 0 && st.st_size > 0)
+		{
+			void * addr = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+			if(addr != MAP_FAILED)
+			{
+				madvise(addr, st.st_size, MADV_SEQUENTIAL);
+				_data = (unsigned char*) addr;
+				_size = st.st_size;
+			}
+		}
+		close(fd);
+#endif
+		return _data != NULL;
+	}
+	~MappedFile()
+	{
+#if defined(_WIN32)
+		if(_data) UnmapViewOfFile(_data);
+		if(_mapping) CloseHandle(_mapping);
+		if(_file != INVALID_HANDLE_VALUE) CloseHandle(_file);
+#else
+		if(_data) munmap(_data, _size);
+#endif
+	}
+};
+
+//gray = 0.28965 * r + 0.60581 * g + 0.10454 * b, in 15-bit fixed point
+#define NETPBM_WEIGHT_R		9491
+#define NETPBM_WEIGHT_G		19851
+#define NETPBM_WEIGHT_B		3426
+
+static void NetpbmRGB2Gray(const unsigned char * rgb, unsigned char * gray, int num)
+{
+	int i = 0;
+#if defined(__SSSE3__)
+	//16 pixels per iteration: de-interleave with pshufb, then two pmaddwd per 4 pixels
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i wrg = _mm_set_epi16(NETPBM_WEIGHT_G, NETPBM_WEIGHT_R, NETPBM_WEIGHT_G, NETPBM_WEIGHT_R, 
+									NETPBM_WEIGHT_G, NETPBM_WEIGHT_R, NETPBM_WEIGHT_G, NETPBM_WEIGHT_R);
+	const __m128i wb1 = _mm_set_epi16(1 << 14, NETPBM_WEIGHT_B, 1 << 14, NETPBM_WEIGHT_B, 
+									1 << 14, NETPBM_WEIGHT_B, 1 << 14, NETPBM_WEIGHT_B);
+	const __m128i one = _mm_set1_epi16(1);
+	const __m128i mr0 = _mm_setr_epi8(0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+	const __m128i mr1 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14, -1, -1, -1, -1, -1);
+	const __m128i mr2 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 1, 4, 7, 10, 13);
+	const __m128i mg0 = _mm_setr_epi8(1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+	const __m128i mg1 = _mm_setr_epi8(-1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1);
+	const __m128i mg2 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14);
+	const __m128i mb0 = _mm_setr_epi8(2, 5, 8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+	const __m128i mb1 = _mm_setr_epi8(-1, -1, -1, -1, -1, 1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1);
+	const __m128i mb2 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15);
+	for(; i + 16 <= num; i += 16, rgb += 48)
+	{
+		__m128i a = _mm_loadu_si128((const __m128i*) rgb);
+		__m128i b = _mm_loadu_si128((const __m128i*) (rgb + 16));
+		__m128i c = _mm_loadu_si128((const __m128i*) (rgb + 32));
+		__m128i r = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(a, mr0), _mm_shuffle_epi8(b, mr1)), _mm_shuffle_epi8(c, mr2));
+		__m128i g = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(a, mg0), _mm_shuffle_epi8(b, mg1)), _mm_shuffle_epi8(c, mg2));
+		__m128i bl = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(a, mb0), _mm_shuffle_epi8(b, mb1)), _mm_shuffle_epi8(c, mb2));
+		__m128i rg[2] = {_mm_unpacklo_epi8(r, g), _mm_unpackhi_epi8(r, g)};
+		__m128i b1[2] = {_mm_unpacklo_epi8(bl, zero), _mm_unpackhi_epi8(bl, zero)};
+		__m128i g16[2];
+		for(int k = 0; k < 2; ++k)
+		{
+			//r, g and b, 1 pairs; the constant 1 carries the rounding term
+			__m128i rgl = _mm_unpacklo_epi8(rg[k], zero), rgh = _mm_unpackhi_epi8(rg[k], zero);
+			__m128i bol = _mm_unpacklo_epi16(b1[k], one), boh = _mm_unpackhi_epi16(b1[k], one);
+			__m128i sl = _mm_add_epi32(_mm_madd_epi16(rgl, wrg), _mm_madd_epi16(bol, wb1));
+			__m128i sh = _mm_add_epi32(_mm_madd_epi16(rgh, wrg), _mm_madd_epi16(boh, wb1));
+			g16[k] = _mm_packs_epi32(_mm_srai_epi32(sl, 15), _mm_srai_epi32(sh, 15));
+		}
+		_mm_storeu_si128((__m128i*) (gray + i), _mm_packus_epi16(g16[0], g16[1]));
+	}
+#endif
+	for(; i < num; ++i, rgb += 3)
+	{
+		gray[i] = (unsigned char) ((NETPBM_WEIGHT_R * rgb[0] + NETPBM_WEIGHT_G * rgb[1] + NETPBM_WEIGHT_B * rgb[2] + (1 << 14)) >> 15);
+	}
+}
+
+static void NetpbmRGB2Gray(const unsigned short * rgb, unsigned short * gray, int num)
+{
+	for(int i = 0; i < num; ++i, rgb += 3)
+	{
+		gray[i] = (unsigned short) ((NETPBM_WEIGHT_R * rgb[0] + NETPBM_WEIGHT_G * rgb[1] + NETPBM_WEIGHT_B * rgb[2] + (1 << 14)) >> 15);
+	}
+}
+
+//raw 16-bit samples are big-endian, convert to host order and rescale maxval to 65535
+static void NetpbmSwapScale16(unsigned short * data, int num, int maxval)
+{
+	const unsigned char * bytes = (const unsigned char*) data;
+	if(maxval == 65535)
+	{
+		for(int i = 0; i < num; ++i, bytes += 2)	data[i] = (unsigned short) ((bytes[0] << 8) | bytes[1]);
+	}else
+	{
+		for(int i = 0; i < num; ++i, bytes += 2)
+		{
+			unsigned int v = std::min((bytes[0] << 8) | bytes[1], maxval);
+			data[i] = (unsigned short) ((v * 65535 + maxval / 2) / maxval);
+		}
+	}
+}
+
+static void NetpbmScale8(unsigned char * data, int num, int maxval)
+{
+	if(maxval == 255) return;
+	unsigned char table[256];
+	for(int v = 0; v < 256; ++v) table[v] = (unsigned char) ((std::min(v, maxval) * 255 + maxval / 2) / maxval);
+	for(int i = 0; i < num; ++i) data[i] = table[data[i]];
+}
+
+static void NetpbmScaleASCII(unsigned short * data, int num, int maxval, int range)
+{
+	if(maxval == range) return;
+	for(int i = 0; i < num; ++i)
+	{
+		unsigned int v = std::min((int) data[i], maxval);
+		data[i] = (unsigned short) ((v * range + maxval / 2) / maxval);
+	}
+}
+
+//plain (ASCII) rasters are split into chunks at whitespace; one pass counts the 
+//samples in each chunk and a second pass parses them to their final offsets
+struct NetpbmASCIIChunks
+{
+	vector<const unsigned char*>	bound;
+	vector<int>						count;
+	unsigned short *				values;
+	int								limit;
+	int								pass;
+};
+
+static void NetpbmParseChunk(void * arg, int index)
+{
+	NetpbmASCIIChunks * chunks = (NetpbmASCIIChunks *) arg;
+	const unsigned char * p = chunks->bound[index], *end = chunks->bound[index + 1];
+	int num = 0;
+	if(chunks->pass == 0)
+	{
+		while(p < end)
+		{
+			while(p < end && !isdigit(*p)) ++p;
+			if(p == end) break;
+			while(p < end && isdigit(*p)) ++p;
+			++num;
+		}
+		chunks->count[index] = num;
+	}else
+	{
+		int offset = chunks->count[index], capacity = chunks->limit - offset;
+		unsigned short * out = chunks->values + offset;
+		while(p < end && num < capacity)
+		{
+			while(p < end && !isdigit(*p)) ++p;
+			if(p == end) break;
+			unsigned int v = 0;
+			while(p < end && isdigit(*p)) v = v * 10 + (*p++ - '0');
+			out[num++] = (unsigned short) std::min(v, 65535u);
+		}
+	}
+}
+
+static int NetpbmParseASCII(const unsigned char * p, const unsigned char * end, unsigned short * values, int num)
+{
+	const size_t min_chunk = 1 << 16;
+	int nchunk = std::max(1, std::min(GlobalUtil::GetCPUThreadNum() * 4, int((end - p) / min_chunk)));
+	NetpbmASCIIChunks chunks;
+	chunks.bound.push_back(p);
+	for(int i = 1; i < nchunk; ++i)
+	{
+		const unsigned char * q = std::max(chunks.bound.back(), p + (end - p) * i / nchunk);
+		while(q < end && isdigit(*q)) ++q;
+		chunks.bound.push_back(q);
+	}
+	chunks.bound.push_back(end);
+	chunks.count.resize(nchunk);
+	chunks.values = values;
+	chunks.limit = num;
+
+	chunks.pass = 0;
+	GlobalUtil::RunParallel(nchunk, NetpbmParseChunk, &chunks);
+	//exclusive prefix sum gives the output offset of each chunk,
+	//and samples beyond the raster size are ignored
+	int total = 0;
+	for(int i = 0; i < nchunk; ++i)
+	{
+		int count = chunks.count[i];
+		chunks.count[i] = total;
+		total += count;
+		if(total >= num) {nchunk = i + 1; break;}
+	}
+	if(total < num) return 0;
+	chunks.pass = 1;
+	GlobalUtil::RunParallel(nchunk, NetpbmParseChunk, &chunks);
+	return 1;
+}
+#endif
 
 int GLTexInput::LoadImageFile(char *imagepath, int &w, int &h )
 {
+	SiftTraceScope trace("Load Image", "io", imagepath);
 #ifndef SIFTGPU_NO_DEVIL
     static int devil_loaded = 0; 
 	unsigned int imID;
-	int done = 1;
+	int done = 1, ilformat = 0;
+	std::vector<unsigned char> pixels;
 
+	//DevIL is not thread-safe, and the decoded pixels are copied out of the lock
+	GlobalUtil::EnterGlobalLock();
     if(devil_loaded == 0)
     {
 	    ilInit();
@@ -1106,16 +1612,9 @@ int GLTexInput::LoadImageFile(char *imagepath, int &w, int &h )
 	{
 		w = ilGetInteger(IL_IMAGE_WIDTH);
 		h = ilGetInteger(IL_IMAGE_HEIGHT);
-		int ilformat = ilGetInteger(IL_IMAGE_FORMAT);
-
-		if(SetImageData(w, h, ilGetData(), ilformat, GL_UNSIGNED_BYTE)==0)
-		{
-			done =0;
-		}else 	if(GlobalUtil::_verbose)
-		{
-			std::cout<<"Image loaded :\t"<<imagepath<<"\n";
-		}
-
+		ilformat = ilGetInteger(IL_IMAGE_FORMAT);
+		const unsigned char * data = ilGetData();
+		pixels.assign(data, data + ilGetInteger(IL_IMAGE_SIZE_OF_DATA));
 	}else
 	{
 		std::cerr<<"Unable to open image [code = "<<ilGetError()<<"]\n";
@@ -1123,69 +1622,108 @@ int GLTexInput::LoadImageFile(char *imagepath, int &w, int &h )
 	}
 
 	ilDeleteImages(1, &imID); 
+	GlobalUtil::LeaveGlobalLock();
+
+	if(!done) 
+	{
+		return 0;
+	}else if(SetImageData(w, h, &pixels[0], ilformat, GL_UNSIGNED_BYTE)==0)
+	{
+		done =0;
+	}else 	if(GlobalUtil::_verbose)
+	{
+		std::cout<<"Image loaded :\t"<<imagepath<<"\n";
+	}
 
 	return done;
 #else
-	FILE * file = fopen(imagepath, "rb"); if (file ==NULL) return 0;
-
-	char buf[8];	int  width, height, cn, g, done = 1; 
+	MappedFile file;
+	if(!file.Open(imagepath))
+	{
+		std::cerr << "Unable to open image " << imagepath << "\n";
+		return 0;
+	}
 
-	if(fscanf(file, "%s %d %d %d", buf, &width, &height, &cn )<4 ||  cn > 255 || width < 0 || height < 0)
+	int header[4];
+	size_t offset;
+	if(!ParseNetpbmHeader(file._data, file._size, header, offset))
 	{
-		fclose(file);
         std::cerr << "ERROR: fileformat not supported\n";
 		return 0;
-	}else
-    {
-        w = width;
-        h = height; 
-    }
-    unsigned char * data = new unsigned char[width * height];
-	unsigned char * pixels = data;
-	if (strcmp(buf, "P5")==0 )
-	{
-		fscanf(file, "%c",buf);//skip one byte
-		fread(pixels, 1, width*height, file);
-	}else if (strcmp(buf, "P2")==0 )
+	}
+	const unsigned char * p = file._data + offset, * end = file._data + file._size;
+	int magic = header[0], width = header[1], height = header[2], maxval = header[3];
+
+	//16-bit data is uploaded as GL_UNSIGNED_SHORT, and both are rescaled to the full range.
+	//The header bounds the samples of the image to an int
+	int wide = maxval > 255, done = 1; 
+	int nchannel = (magic == '3' || magic == '6') ? 3 : 1;
+	size_t npixel = size_t(width) * height, nsample = npixel * nchannel;
+	unsigned int gl_type = wide ? GL_UNSIGNED_SHORT : GL_UNSIGNED_BYTE;
+	const void * pixels = NULL;
+	vector<unsigned char> buffer;
+
+	if(magic == '5' || magic == '6')
 	{
-		for (int i = 0 ; i< height; i++)
+		size_t nbyte = GetNetpbmRasterSize(header);
+		if(size_t(end - p) < nbyte)
 		{
-			for ( int j = 0; j < width; j++)
-			{
-				fscanf(file, "%d", &g);
-				*pixels++ = (unsigned char) g;
-			}
+			std::cerr << "ERROR: image file is truncated\n";
+			return 0;
 		}
-	}else if (strcmp(buf, "P6")==0 )
-	{
-		fscanf(file, "%c", buf);//skip one byte
-		int j, num = height*width;
-        unsigned char buf[3];
-		for ( j =0 ; j< num; j++)
+		//the mapping is private, so the raster can be fixed up in place
+		unsigned char * raster = file._data + (p - file._data);
+		if(wide && (size_t(raster) & 1))
 		{
-			fread(buf,1,3, file);
-			*pixels++=int(0.10454f* buf[2]+0.60581f* buf[1]+0.28965f* buf[0]);
+			//keep 16-bit samples aligned, the header is always in front of the raster
+			memmove(raster - 1, raster, nbyte);
+			raster -= 1;
 		}
-	}else if (strcmp(buf, "P3")==0 )
-	{
-		int r, g, b;
-		int i , num =height*width;
-		for ( i = 0 ; i< num; i++)
+		if(wide)	NetpbmSwapScale16((unsigned short*) raster, (int) nsample, maxval);
+		else		NetpbmScale8(raster, (int) nsample, maxval);
+
+		if(nchannel == 1)
 		{
-			fscanf(file, "%d %d %d", &r, &g, &b);
-			*pixels++ = int(0.10454f* b+0.60581f* g+0.28965f* r);
+			//P5 goes to SetImageData directly from the mapped file
+			pixels = raster; 
+		}else
+		{
+			buffer.resize(npixel * (wide ? 2 : 1));
+			if(wide)	NetpbmRGB2Gray((const unsigned short*) raster, (unsigned short*) &buffer[0], (int) npixel);
+			else		NetpbmRGB2Gray(raster, &buffer[0], (int) npixel);
+			pixels = &buffer[0];
 		}
-
 	}else
 	{
-        std::cerr << "ERROR: fileformat not supported\n";
-		done = 0;
+		vector<unsigned short> values(nsample);
+		if(!NetpbmParseASCII(p, end, &values[0], (int) values.size()))
+		{
+			std::cerr << "ERROR: image file is truncated\n";
+			return 0;
+		}
+		NetpbmScaleASCII(&values[0], (int) values.size(), maxval, wide ? 65535 : 255);
+		buffer.resize(npixel * (wide ? 2 : 1));
+		if(wide)
+		{
+			unsigned short * out = (unsigned short*) &buffer[0];
+			if(nchannel == 3)	NetpbmRGB2Gray(&values[0], out, (int) npixel);
+			else				std::copy(values.begin(), values.end(), out);
+		}else
+		{
+			//narrow the samples in place, byte i never overwrites an unread sample
+			unsigned char * narrow = (unsigned char*) &values[0];
+			for(size_t i = 0; i < values.size(); ++i) narrow[i] = (unsigned char) values[i];
+			if(nchannel == 3)	NetpbmRGB2Gray(narrow, &buffer[0], (int) npixel);
+			else				memcpy(&buffer[0], narrow, npixel);
+		}
+		pixels = &buffer[0];
 	}
-    if(done)    SetImageData(width, height, data, GL_LUMINANCE, GL_UNSIGNED_BYTE);
-	fclose(file);
-    delete data; 
+
+	done = SetImageData(width, height, pixels, GL_LUMINANCE, gl_type);
+	w = width;
+	h = height; 
     if(GlobalUtil::_verbose && done) std::cout<< "Image loaded :\t" << imagepath << "\n";
-	return 1;
+	return done;
 #endif
 }
 
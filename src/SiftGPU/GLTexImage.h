@@ -27,7 +27,10 @@
 #ifndef GL_TEX_IMAGE_H
 #define GL_TEX_IMAGE_H
 
+#include <vector>
+
 class GlobalUtil;
+class FeatureCache;
 class GLTexImage :public GlobalUtil 
 {	
 protected:
@@ -101,7 +104,16 @@ public:
 
     //////////////////////////
 	float *        _converted_data;
+	int            _converted_size;
     const void*    _pixel_data;
+	//feature cache lookup, done by SetImageData on the host pixels before the upload when
+	//_cache is set. _data_hash is the hash of the pixels, and _cache_hit is the number of 
+	//features loaded to _cache_keys/_cache_descriptors, or -1 if the pixels are uploaded
+	FeatureCache * _cache;
+	unsigned long long _cache_seed;
+	unsigned long long _data_hash;
+	int            _cache_hit;
+	std::vector<float> * _cache_keys, * _cache_descriptors;
 public:
 	static int  IsSimpleGlFormat(unsigned int gl_format, unsigned int gl_type)
 	{
@@ -111,23 +123,51 @@ public:
 				gl_format == GL_BGR || gl_format == GL_BGRA) && 
 				(gl_type == GL_UNSIGNED_BYTE || gl_type == GL_FLOAT || gl_type == GL_UNSIGNED_SHORT); 
 	}
+	static int  GetPixelSizeGL(unsigned int gl_format, unsigned int gl_type);
+	//the header {magic, width, height, maxval} of a P2/P3/P5/P6 file and the offset of its 
+	//raster. It returns 0 for other formats, for a value over NETPBM_MAX_VALUE, and for
+	//images with more samples than an int
+	enum { NETPBM_MAX_VALUE = 65535 };
+	static int  ParseNetpbmHeader(const unsigned char * data, size_t size, int header[4], size_t & offset);
+	//the bytes of the raster of a P5/P6 file
+	static size_t GetNetpbmRasterSize(const int header[4]);
+	static int  SetUnpackRowBytes(int width, int pixel_size, int row_bytes);
+//pitch is the distance between two rows in number of channel values, 0 for tightly packed rows
 //in vc6, template member function doesn't work
 #if !defined(_MSC_VER) || _MSC_VER > 1200
 	template <class Uint> 
 	static int DownSamplePixelDataI(unsigned int gl_format, int width, int height, 
-		int ds, const Uint * pin, Uint * pout);
+		int ds, const Uint * pin, Uint * pout, int pitch = 0);
 	template <class Uint> 
 	static int DownSamplePixelDataI2F(unsigned int gl_format, int width, int height, 
-		int ds, const Uint * pin, float * pout, int skip  = 0);
+		int ds, const Uint * pin, float * pout, int skip  = 0, int pitch = 0);
 #endif
 	static int DownSamplePixelDataF(unsigned int gl_format, int width, int height, 
-		int ds, const float * pin, float * pout, int skip = 0);
+		int ds, const float * pin, float * pout, int skip = 0, int pitch = 0);
     static int TruncateWidthCU(int w) {return  w & 0xfffffffc; }
+private:
+	int GetInputLayout(int width, int height, unsigned int gl_format, unsigned int gl_type, 
+					int row_bytes, int & ds, int & cwidth, unsigned int & ctype) const;
 public:
 	GLTexInput() : _down_sampled(0), _rgb_converted(0), _data_modified(0), 
-                    _converted_data(0), _pixel_data(0){}
+                    _converted_data(0), _converted_size(0), _pixel_data(0),
+                    _cache(0), _cache_seed(0), _data_hash(0), _cache_hit(-1),
+                    _cache_keys(0), _cache_descriptors(0){}
+	//row_bytes is the distance between two rows in bytes, 0 for tightly packed rows.
+	//the data is never modified, and is only referenced until the function returns
+	//except for tightly packed GL_LUMINANCE/GL_FLOAT data in CUDA/OpenCL mode. 
 	int SetImageData(int width, int height, const void * data, 
-					unsigned int gl_format, unsigned int gl_type);
+					unsigned int gl_format, unsigned int gl_type, int row_bytes = 0);
+	//SetImageData in two steps, so that the cpu part can run on another thread.
+	//GetConvertedSize returns the size in bytes of the cpu-converted data (0 if the data is uploaded 
+	//as it is, -1 if not supported), and ConvertImageData writes the converted data to buffer
+	//without any OpenGL call. UploadImageData takes the converted data, or the original data if
+	//no conversion is needed, with the parameters of the original data.
+	int GetConvertedSize(int width, int height, unsigned int gl_format, unsigned int gl_type, int row_bytes = 0) const;
+	int ConvertImageData(int width, int height, const void * data, unsigned int gl_format, 
+					unsigned int gl_type, int row_bytes, void * buffer) const;
+	int UploadImageData(int width, int height, const void * data, 
+					unsigned int gl_format, unsigned int gl_type, int row_bytes = 0);
 	int LoadImageFile(char * imagepath, int & w, int &h);
     void VerifyTexture();
     virtual ~GLTexInput();
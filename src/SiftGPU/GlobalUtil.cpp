@@ -26,14 +26,17 @@ using std::cout;
 
 #include "GL/glew.h"
 #include "GlobalUtil.h"
+#include "SiftGPU.h"
 
 //for windows, the default timing uses timeGetTime, you can define TIMING_BY_CLOCK to use clock()
-//for other os, the timing uses gettimeofday
+//for other os, the timing uses gettimeofday. ClockUS is monotonic on all of them
 
 
 #if defined(_WIN32)
 	#if defined(TIMING_BY_CLOCK)
 		#include <time.h>
+	    #define WIN32_LEAN_AND_MEAN
+	    #include <windows.h>
 	#else
 	    #define WIN32_LEAN_AND_MEAN
 	    #include <windows.h>
@@ -41,103 +44,171 @@ using std::cout;
 	#endif
 #else
 	#include <sys/time.h>
+	#include <time.h>
 	#include <stdio.h>
+	#include <unistd.h>
+	#include <pthread.h>
 #endif
+#include <string>
+#include <vector>
+#include <algorithm>
 
 #include "LiteWindow.h"
+#include "SiftProfiler.h"
 
 //
-int GlobalParam::		_verbose =  1;   
-int	GlobalParam::       _timingS = 1;  //print out information of each step
-int	GlobalParam::       _timingO = 0;  //print out information of each octave
-int	GlobalParam::       _timingL = 0;	//print out information of each level
-GLuint GlobalParam::	_texTarget = GL_TEXTURE_RECTANGLE_ARB; //only this one is supported
-GLuint GlobalParam::	_iTexFormat =GL_RGBA32F_ARB;	//or GL_RGBA16F_ARB
-int	GlobalParam::		_debug = 0;		//enable debug code?
-int	GlobalParam::		_usePackedTex = 1;//packed implementation
-int	GlobalParam::		_UseCUDA = 0;
-int GlobalParam::       _UseOpenCL = 0;
-int GlobalParam::		_MaxFilterWidth = -1;	//maximum filter width, use when GPU is not good enough
-float GlobalParam::     _FilterWidthFactor	= 4.0f;	//the filter size will be _FilterWidthFactor*sigma*2+1
-float GlobalParam::     _DescriptorWindowFactor = 3.0f; //descriptor sampling window factor
-int GlobalParam::		_SubpixelLocalization = 1; //sub-pixel and sub-scale localization 	
-int	GlobalParam::       _MaxOrientation = 2;	//whether we find multiple orientations for each feature 
-int	GlobalParam::       _OrientationPack2 = 0;  //use one float to store two orientations
-float GlobalParam::		_MaxFeaturePercent = 0.005f;//at most 0.005 of all pixels
-int	GlobalParam::		_MaxLevelFeatureNum = 4096; //maximum number of features of a level
-int GlobalParam::		_FeatureTexBlock = 4; //feature texture storagte alignment
-int	GlobalParam::		_NarrowFeatureTex = 0; 
+SIFTGPU_THREAD_LOCAL int GlobalParam::		_verbose =  1;   
+SIFTGPU_THREAD_LOCAL int	GlobalParam::       _timingS = 1;  //print out information of each step
+SIFTGPU_THREAD_LOCAL int	GlobalParam::       _timingO = 0;  //print out information of each octave
+SIFTGPU_THREAD_LOCAL int	GlobalParam::       _timingL = 0;	//print out information of each level
+SIFTGPU_THREAD_LOCAL int	GlobalParam::		_ProfileDetail = 0;	//profile the stages(1), octaves(2) and levels(3)
+SIFTGPU_THREAD_LOCAL GLuint GlobalParam::	_texTarget = GL_TEXTURE_RECTANGLE_ARB; //only this one is supported
+SIFTGPU_THREAD_LOCAL GLuint GlobalParam::	_iTexFormat =GL_RGBA32F_ARB;	//or GL_RGBA16F_ARB
+SIFTGPU_THREAD_LOCAL int	GlobalParam::		_debug = 0;		//enable debug code?
+SIFTGPU_THREAD_LOCAL int	GlobalParam::		_usePackedTex = 1;//packed implementation
+SIFTGPU_THREAD_LOCAL int	GlobalParam::		_UseCUDA = 0;
+SIFTGPU_THREAD_LOCAL int GlobalParam::       _UseOpenCL = 0;
+SIFTGPU_THREAD_LOCAL int GlobalParam::		_MaxFilterWidth = -1;	//maximum filter width, use when GPU is not good enough
+SIFTGPU_THREAD_LOCAL float GlobalParam::     _FilterWidthFactor	= 4.0f;	//the filter size will be _FilterWidthFactor*sigma*2+1
+SIFTGPU_THREAD_LOCAL float GlobalParam::     _DescriptorWindowFactor = 3.0f; //descriptor sampling window factor
+SIFTGPU_THREAD_LOCAL int GlobalParam::		_SubpixelLocalization = 1; //sub-pixel and sub-scale localization 	
+SIFTGPU_THREAD_LOCAL int	GlobalParam::       _MaxOrientation = 2;	//whether we find multiple orientations for each feature 
+SIFTGPU_THREAD_LOCAL int	GlobalParam::       _OrientationPack2 = 0;  //use one float to store two orientations
+SIFTGPU_THREAD_LOCAL float GlobalParam::		_MaxFeaturePercent = 0.005f;//at most 0.005 of all pixels
+SIFTGPU_THREAD_LOCAL int	GlobalParam::		_MaxLevelFeatureNum = 4096; //maximum number of features of a level
+SIFTGPU_THREAD_LOCAL int GlobalParam::		_FeatureTexBlock = 4; //feature texture storagte alignment
+SIFTGPU_THREAD_LOCAL int	GlobalParam::		_NarrowFeatureTex = 0; 
 
 //if _ForceTightPyramid is not 0, pyramid will be reallocated to fit the size of input images.
 //otherwise, pyramid can be reused for smaller input images. 
-int GlobalParam::		_ForceTightPyramid = 0;
+SIFTGPU_THREAD_LOCAL int GlobalParam::		_ForceTightPyramid = 0;
 
 //use gpu or cpu to generate feature list ...gpu is a little bit faster
-int GlobalParam::		_ListGenGPU =	1;	
-int	GlobalParam::       _ListGenSkipGPU = 6;  //how many levels are skipped on gpu
-int GlobalParam::		_PreProcessOnCPU = 1; //convert rgb 2 intensity on gpu, down sample on GPU
+SIFTGPU_THREAD_LOCAL int GlobalParam::		_ListGenGPU =	1;	
+SIFTGPU_THREAD_LOCAL int	GlobalParam::       _ListGenSkipGPU = 6;  //how many levels are skipped on gpu
+SIFTGPU_THREAD_LOCAL int GlobalParam::		_PreProcessOnCPU = 1; //convert rgb 2 intensity on gpu, down sample on GPU
 
 //hardware parameter,   automatically retrieved
-int GlobalParam::		_texMaxDim = 3200;	//Maximum working size for SiftGPU, 3200 for packed
-int	GlobalParam::		_texMaxDimGL = 4096;        //GPU texture limit
-int GlobalParam::       _texMinDim = 16; //
-int	GlobalParam::		_MemCapGPU = 0;
-int GlobalParam::		_FitMemoryCap = 0;
-int	GlobalParam::		_IsNvidia = 0;				//GPU vendor
-int GlobalParam::		_KeepShaderLoop = 0;
+SIFTGPU_THREAD_LOCAL int GlobalParam::		_texMaxDim = 3200;	//Maximum working size for SiftGPU, 3200 for packed
+SIFTGPU_THREAD_LOCAL int	GlobalParam::		_texMaxDimGL = 4096;        //GPU texture limit
+SIFTGPU_THREAD_LOCAL int GlobalParam::       _texMinDim = 16; //
+SIFTGPU_THREAD_LOCAL int	GlobalParam::		_MemCapGPU = 0;
+SIFTGPU_THREAD_LOCAL int GlobalParam::		_FitMemoryCap = 0;
+SIFTGPU_THREAD_LOCAL int	GlobalParam::		_IsNvidia = 0;				//GPU vendor
+SIFTGPU_THREAD_LOCAL int GlobalParam::		_KeepShaderLoop = 0;
 
 //you can't change the following 2 values
 //all other versions of code are now dropped
-int GlobalParam::       _DescriptorPPR = 8;
-int	GlobalParam::		_DescriptorPPT = 16;
+SIFTGPU_THREAD_LOCAL int GlobalParam::       _DescriptorPPR = 8;
+SIFTGPU_THREAD_LOCAL int	GlobalParam::		_DescriptorPPT = 16;
 
 //whether orientation/descriptor is supported by hardware
-int GlobalParam::		_SupportNVFloat = 0;
-int GlobalParam::       _SupportTextureRG = 0;
-int	GlobalParam::		_UseDynamicIndexing = 0; 
-int GlobalParam::		_FullSupported = 1;
+SIFTGPU_THREAD_LOCAL int GlobalParam::		_SupportNVFloat = 0;
+SIFTGPU_THREAD_LOCAL int GlobalParam::       _SupportTextureRG = 0;
+SIFTGPU_THREAD_LOCAL int	GlobalParam::		_UseDynamicIndexing = 0; 
+SIFTGPU_THREAD_LOCAL int GlobalParam::		_FullSupported = 1;
 
 //when SiftGPUEX is not used, display VBO generation is skipped
-int GlobalParam::		_UseSiftGPUEX = 0;
-int GlobalParam::		_InitPyramidWidth=0;
-int GlobalParam::		_InitPyramidHeight=0;
-int	GlobalParam::		_octave_min_default=0;
-int	GlobalParam::		_octave_num_default=-1;
+SIFTGPU_THREAD_LOCAL int GlobalParam::		_UseSiftGPUEX = 0;
+SIFTGPU_THREAD_LOCAL int GlobalParam::		_InitPyramidWidth=0;
+SIFTGPU_THREAD_LOCAL int GlobalParam::		_InitPyramidHeight=0;
+SIFTGPU_THREAD_LOCAL int	GlobalParam::		_octave_min_default=0;
+SIFTGPU_THREAD_LOCAL int	GlobalParam::		_octave_num_default=-1;
 
 
 //////////////////////////////////////////////////////////////////
-int	GlobalParam::		_GoodOpenGL = -1;      //indicates OpenGl initialization status
-int	GlobalParam::		_FixedOrientation = 0; //upright
-int	GlobalParam::		_LoweOrigin = 0;       //(0, 0) to be at the top-left corner.
-int	GlobalParam::       _NormalizedSIFT = 1;   //normalize descriptor
-int GlobalParam::       _BinarySIFT = 0;       //saving binary format
-int	GlobalParam::		_ExitAfterSIFT = 0;    //exif after saving result
-int	GlobalParam::		_KeepExtremumSign = 0; // if 1, scales of dog-minimum will be multiplied by -1
+SIFTGPU_THREAD_LOCAL int	GlobalParam::		_GoodOpenGL = -1;      //indicates OpenGl initialization status
+SIFTGPU_THREAD_LOCAL int	GlobalParam::		_FixedOrientation = 0; //upright
+SIFTGPU_THREAD_LOCAL int	GlobalParam::		_LoweOrigin = 0;       //(0, 0) to be at the top-left corner.
+SIFTGPU_THREAD_LOCAL int	GlobalParam::       _NormalizedSIFT = 1;   //normalize descriptor
+SIFTGPU_THREAD_LOCAL int GlobalParam::       _BinarySIFT = 0;       //saving binary format (2 for uint8 descriptors)
+SIFTGPU_THREAD_LOCAL int GlobalParam::       _DescriptorU8 = 0;     //read back uint8 descriptors
+SIFTGPU_THREAD_LOCAL int	GlobalParam::		_ExitAfterSIFT = 0;    //exif after saving result
+SIFTGPU_THREAD_LOCAL int	GlobalParam::		_KeepExtremumSign = 0; // if 1, scales of dog-minimum will be multiplied by -1
 ///
-int GlobalParam::       _KeyPointListForceLevel0 = 0;
-int GlobalParam::		_DarknessAdaption = 0;
-int	GlobalParam::		_ProcessOBO = 0;
-int GlobalParam::       _TruncateMethod = 0;
-int	GlobalParam::		_PreciseBorder = 1;
+SIFTGPU_THREAD_LOCAL int GlobalParam::       _KeyPointListForceLevel0 = 0;
+SIFTGPU_THREAD_LOCAL int GlobalParam::		_DarknessAdaption = 0;
+SIFTGPU_THREAD_LOCAL int GlobalParam::		_CPUThreadNum = 0;     //threads for cpu-side work, 0 for all cores
+SIFTGPU_THREAD_LOCAL int GlobalParam::		_DownSampleAverage = 0; //box filter instead of point sampling for cpu down-sampling
+SIFTGPU_THREAD_LOCAL int	GlobalParam::		_ProcessOBO = 0;
+SIFTGPU_THREAD_LOCAL int GlobalParam::       _TruncateMethod = 0;
+SIFTGPU_THREAD_LOCAL int	GlobalParam::		_PreciseBorder = 1;
 
 // parameter changing for better matching with Lowe's SIFT
-float GlobalParam::		_OrientationWindowFactor = 2.0f;	// 1.0(-v292), 2(v293-), 
-float GlobalParam::		_OrientationGaussianFactor = 1.5f;	// 4.5(-v292), 1.5(v293-)
-float GlobalParam::     _MulitiOrientationThreshold = 0.8f;
+SIFTGPU_THREAD_LOCAL float GlobalParam::		_OrientationWindowFactor = 2.0f;	// 1.0(-v292), 2(v293-), 
+SIFTGPU_THREAD_LOCAL float GlobalParam::		_OrientationGaussianFactor = 1.5f;	// 4.5(-v292), 1.5(v293-)
+SIFTGPU_THREAD_LOCAL float GlobalParam::     _MulitiOrientationThreshold = 0.8f;
 ///
-int GlobalParam::       _FeatureCountThreshold = -1;
+SIFTGPU_THREAD_LOCAL int GlobalParam::       _FeatureCountThreshold = -1;
+SIFTGPU_THREAD_LOCAL int GlobalParam::		_FeatureGridSize = 0;	//spread the feature budget over a grid of NxN cells
+SIFTGPU_THREAD_LOCAL int GlobalParam::		_FeatureANMS = 0;		//adaptive non-maximal suppression for the feature budget
 
 ///////////////////////////////////////////////
-int	GlobalParam::			_WindowInitX = -1;
-int GlobalParam::			_WindowInitY = -1;
-int GlobalParam::           _DeviceIndex = 0; 
-const char * GlobalParam::	_WindowDisplay = NULL;
+SIFTGPU_THREAD_LOCAL int	GlobalParam::			_WindowInitX = -1;
+SIFTGPU_THREAD_LOCAL int GlobalParam::			_WindowInitY = -1;
+SIFTGPU_THREAD_LOCAL int GlobalParam::           _DeviceIndex = 0; 
+SIFTGPU_THREAD_LOCAL const char * GlobalParam::	_WindowDisplay = NULL;
 
 
 
 /////////////////
 ////
-ClockTimer GlobalUtil::	_globalTimer;
+SIFTGPU_THREAD_LOCAL ClockTimer GlobalUtil::	_globalTimer;
+SIFTGPU_THREAD_LOCAL SiftProfiler* GlobalUtil::	_profiler = NULL;
+
+
+//the device status and the options that are compiled into the programs
+#define SIFTGPU_INIT_PARAMS(P) \
+	P(_texTarget) P(_iTexFormat) P(_texMaxDimGL) P(_MemCapGPU) P(_usePackedTex) P(_IsNvidia) \
+	P(_KeepShaderLoop) P(_UseCUDA) P(_UseOpenCL) P(_DeviceIndex) P(_SupportNVFloat) \
+	P(_SupportTextureRG) P(_FullSupported) P(_UseDynamicIndexing) P(_MaxFilterWidth) \
+	P(_DescriptorPPR) P(_UseSiftGPUEX) P(_GoodOpenGL) P(_MaxOrientation) P(_OrientationPack2) \
+	P(_SubpixelLocalization) P(_DescriptorPPT) P(_ListGenGPU) P(_ListGenSkipGPU) \
+	P(_octave_num_default) P(_KeepExtremumSign)
+
+//the options that can be changed at any time
+#define SIFTGPU_TUNING_PARAMS(P) \
+	P(_texMaxDim) P(_texMinDim) P(_FitMemoryCap) P(_verbose) P(_timingS) P(_timingO) P(_timingL) \
+	P(_ProfileDetail) P(_debug) P(_FilterWidthFactor) P(_OrientationWindowFactor) P(_DescriptorWindowFactor) \
+	P(_MaxFeaturePercent) P(_MaxLevelFeatureNum) P(_FeatureTexBlock) P(_NarrowFeatureTex) \
+	P(_ProcessOBO) P(_TruncateMethod) P(_PreciseBorder) P(_ForceTightPyramid) \
+	P(_octave_min_default) P(_InitPyramidWidth) P(_InitPyramidHeight) P(_PreProcessOnCPU) \
+	P(_FixedOrientation) P(_LoweOrigin) P(_ExitAfterSIFT) P(_NormalizedSIFT) P(_BinarySIFT) P(_DescriptorU8) \
+	P(_FeatureCountThreshold) P(_FeatureGridSize) P(_FeatureANMS) P(_KeyPointListForceLevel0) \
+	P(_DarknessAdaption) P(_CPUThreadNum) P(_DownSampleAverage) P(_OrientationGaussianFactor) \
+	P(_MulitiOrientationThreshold) P(_WindowInitX) P(_WindowInitY) P(_WindowDisplay)
+
+#define LOAD_CONFIG_PARAM(name)	name = config.name;
+#define SAVE_CONFIG_PARAM(name)	config.name = name;
+
+void GlobalParam::LoadConfig(const SiftConfig& config, int all)
+{
+	if(all) { SIFTGPU_INIT_PARAMS(LOAD_CONFIG_PARAM) }
+	SIFTGPU_TUNING_PARAMS(LOAD_CONFIG_PARAM)
+}
+
+void GlobalParam::SaveConfig(SiftConfig& config)
+{
+	SIFTGPU_INIT_PARAMS(SAVE_CONFIG_PARAM)
+	SIFTGPU_TUNING_PARAMS(SAVE_CONFIG_PARAM)
+}
+
+//the default values, captured before any parameter is changed
+static SiftConfig	s_default_config;
+static int			s_default_config_saved = 0;
+
+SiftConfig::SiftConfig()
+{
+	if(s_default_config_saved)
+	{
+		*this = s_default_config;
+	}else
+	{
+		//during the static initialization, the parameters still have the default values
+		GlobalParam::SaveConfig(*this);
+		if(this == &s_default_config) s_default_config_saved = 1;
+	}
+}
 
 
 #ifdef _DEBUG
@@ -324,6 +395,21 @@ int ClockTimer::ClockMS()
 #endif
 }
 
+long long ClockTimer::ClockUS()
+{
+#if defined(_WIN32)
+	LARGE_INTEGER counter, frequency;
+	QueryPerformanceCounter(&counter);
+	QueryPerformanceFrequency(&frequency);
+	return counter.QuadPart / frequency.QuadPart * 1000000 + 
+			counter.QuadPart % frequency.QuadPart * 1000000 / frequency.QuadPart;
+#else
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000LL + now.tv_nsec / 1000;
+#endif
+}
+
 double ClockTimer::CLOCK()
 {
 	return ClockMS() * 0.001;
@@ -360,6 +446,36 @@ float ClockTimer::GetElapsedTime()
 	return (_time_stop - _time_start)  * 0.001f;
 }
 
+void GlobalUtil::ProfileBegin(const char * event)
+{
+	_profiler->Begin(event);
+}
+
+void GlobalUtil::ProfileEnd()
+{
+	_profiler->End();
+}
+
+void GlobalUtil::ProfileOctaveBegin(int octave)
+{
+	_profiler->BeginOctave(octave, _ProfileDetail);
+}
+
+void GlobalUtil::ProfileOctaveEnd()
+{
+	_profiler->EndOctave();
+}
+
+void GlobalUtil::ProfileNextLevel()
+{
+	_profiler->NextLevel();
+}
+
+void GlobalUtil::ProfileData(int features, double bytes)
+{
+	if(_profiler) _profiler->SetData(features, bytes);
+}
+
 void GlobalUtil::SetGLParam()
 {
     if(GlobalUtil::_UseCUDA) return;
@@ -493,7 +609,12 @@ void GlobalUtil::SelectDisplay()
 int GlobalUtil::CreateWindowEZ(LiteWindow* window)
 {
 	if(window == NULL) return 0;
-    if(!window->IsValid())window->Create(_WindowInitX, _WindowInitY, _WindowDisplay);
+    if(!window->IsValid())
+	{
+		EnterGlobalLock();
+		window->Create(_WindowInitX, _WindowInitY, _WindowDisplay);
+		LeaveGlobalLock();
+	}
     if(window->IsValid()) 
     {
         window->MakeCurrent();
@@ -507,13 +628,145 @@ int GlobalUtil::CreateWindowEZ(LiteWindow* window)
     }
 }
 
+//each thread has its own window and OpenGL context
+static SIFTGPU_THREAD_LOCAL LiteWindow* s_thread_window = NULL;
+
 int GlobalUtil::CreateWindowEZ()
 {
-	static LiteWindow window;
-    return CreateWindowEZ(&window);
+	if(s_thread_window == NULL) s_thread_window = new LiteWindow;
+    return CreateWindowEZ(s_thread_window);
+}
+
+void GlobalUtil::DestroyWindowEZ()
+{
+	if(s_thread_window == NULL) return;
+	EnterGlobalLock();
+	delete s_thread_window;
+	s_thread_window = NULL;
+	LeaveGlobalLock();
 }
 
 int CreateLiteWindow(LiteWindow* window)
 {
     return GlobalUtil::CreateWindowEZ(window);
 }
+
+int GlobalUtil::GetCPUThreadNum()
+{
+	if(_CPUThreadNum > 0) return _CPUThreadNum;
+#if defined(_WIN32)
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	int num = (int) info.dwNumberOfProcessors;
+#else
+	int num = (int) sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+	return num > 0 ? num : 1;
+}
+
+//work item for RunParallel, thread t processes index t, t + n, t + 2n...
+struct ParallelTask
+{
+	void (*func)(void*, int);
+	void*	arg;
+	int		start;
+	int		step;
+	int		count;
+};
+
+#if defined(_WIN32)
+static DWORD WINAPI RunParallelTask(LPVOID param)
+#else
+static void* RunParallelTask(void* param)
+#endif
+{
+	ParallelTask* task = (ParallelTask*) param;
+	for(int i = task->start; i < task->count; i += task->step) task->func(task->arg, i);
+	return 0;
+}
+
+void GlobalUtil::RunParallel(int count, void (*func)(void* arg, int index), void* arg)
+{
+	int nthread = std::min(GetCPUThreadNum(), count);
+	if(nthread <= 1)
+	{
+		for(int i = 0; i < count; ++i) func(arg, i);
+		return;
+	}
+#if defined(_WIN32)
+	//WaitForMultipleObjects is limited to MAXIMUM_WAIT_OBJECTS handles
+	if(nthread > MAXIMUM_WAIT_OBJECTS) nthread = MAXIMUM_WAIT_OBJECTS;
+#endif
+
+	std::vector<ParallelTask> tasks(nthread);
+	for(int t = 0; t < nthread; ++t)
+	{
+		tasks[t].func = func;	tasks[t].arg = arg;
+		tasks[t].start = t;		tasks[t].step = nthread;
+		tasks[t].count = count;
+	}
+
+	//the calling thread takes the first share of the work
+#if defined(_WIN32)
+	std::vector<HANDLE> threads(nthread - 1);
+	for(int t = 1; t < nthread; ++t)
+		threads[t - 1] = CreateThread(NULL, 0, RunParallelTask, &tasks[t], 0, 0);
+	RunParallelTask(&tasks[0]);
+	WaitForMultipleObjects(nthread - 1, &threads[0], TRUE, INFINITE);
+	for(int t = 0; t < nthread - 1; ++t) CloseHandle(threads[t]);
+#else
+	std::vector<pthread_t> threads(nthread - 1);
+	std::vector<int> started(nthread - 1, 0);
+	for(int t = 1; t < nthread; ++t)
+		started[t - 1] = pthread_create(&threads[t - 1], NULL, RunParallelTask, &tasks[t]) == 0;
+	RunParallelTask(&tasks[0]);
+	for(int t = 1; t < nthread; ++t)
+	{
+		if(started[t - 1])	pthread_join(threads[t - 1], NULL);
+		else				RunParallelTask(&tasks[t]);
+	}
+#endif
+}
+
+#if defined(_WIN32)
+//initialized before any thread is started
+static struct GlobalLock
+{
+	CRITICAL_SECTION	cs;
+	GlobalLock()		{InitializeCriticalSection(&cs); }
+	~GlobalLock()		{DeleteCriticalSection(&cs); }
+} s_global_lock;
+
+void GlobalUtil::EnterGlobalLock()
+{
+	EnterCriticalSection(&s_global_lock.cs);
+}
+
+void GlobalUtil::LeaveGlobalLock()
+{
+	LeaveCriticalSection(&s_global_lock.cs);
+}
+#else
+static pthread_mutex_t	s_global_lock;
+static pthread_once_t	s_global_lock_once = PTHREAD_ONCE_INIT;
+
+static void InitGlobalLock()
+{
+	pthread_mutexattr_t attr;
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&s_global_lock, &attr);
+	pthread_mutexattr_destroy(&attr);
+}
+
+void GlobalUtil::EnterGlobalLock()
+{
+	pthread_once(&s_global_lock_once, InitGlobalLock);
+	pthread_mutex_lock(&s_global_lock);
+}
+
+void GlobalUtil::LeaveGlobalLock()
+{
+	pthread_mutex_unlock(&s_global_lock);
+}
+#endif
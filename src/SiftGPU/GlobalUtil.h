@@ -26,81 +26,103 @@
 #ifndef _GLOBAL_UTILITY_H
 #define _GLOBAL_UTILITY_H
 
+#include "SiftTracer.h"
 
 //wrapper for some shader function
 //class ProgramGPU;
 class LiteWindow;
+class SiftConfig;
+class SiftProfiler;
+
+//the parameters are thread-local, and each SiftGPU instance loads its own 
+//parameters (SiftConfig) into them when its functions are called
+#if defined(_MSC_VER)
+	#define SIFTGPU_THREAD_LOCAL __declspec(thread)
+#else
+	#define SIFTGPU_THREAD_LOCAL __thread
+#endif
 
 class GlobalParam
 {
 public:
-	static GLuint	_texTarget;
-	static GLuint   _iTexFormat;
-	static int		_texMaxDim;
-	static int		_texMaxDimGL; 
-    static int      _texMinDim;
-	static int		_MemCapGPU;
-	static int		_FitMemoryCap;
-	static int		_verbose;
-	static int		_timingS;
-	static int		_timingO;
-	static int		_timingL;
-	static int		_usePackedTex;
-	static int		_IsNvidia;
-	static int		_KeepShaderLoop;
-	static int		_UseCUDA;
-    static int      _UseOpenCL;
-	static int		_UseDynamicIndexing; 
-	static int		_debug;
-	static int		_MaxFilterWidth;
-	static float	_FilterWidthFactor;
-	static float    _OrientationWindowFactor;
-	static float	_DescriptorWindowFactor; 
-	static int		_MaxOrientation;
-	static int      _OrientationPack2;
-	static int		_ListGenGPU;
-	static int		_ListGenSkipGPU;
-	static int		_SupportNVFloat;
-	static int		_SupportTextureRG;
-	static int		_FullSupported;
-	static float	_MaxFeaturePercent;
-	static int		_MaxLevelFeatureNum;
-	static int		_DescriptorPPR; 
-	static int		_DescriptorPPT; //pixel per texture for one descriptor
-	static int		_FeatureTexBlock;
-	static int		_NarrowFeatureTex; //implemented but no performance improvement
-	static int		_SubpixelLocalization;
-	static int		_ProcessOBO; //not implemented yet
-    static int      _TruncateMethod;
-	static int		_PreciseBorder; //implemented
-	static int		_UseSiftGPUEX;
-	static int		_ForceTightPyramid;
-	static int		_octave_min_default;
-	static int		_octave_num_default;
-	static int		_InitPyramidWidth;
-	static int		_InitPyramidHeight;
-	static int		_PreProcessOnCPU;
-	static int		_GoodOpenGL;
-	static int		_FixedOrientation;
-	static int		_LoweOrigin;
-	static int		_ExitAfterSIFT; 
-	static int		_NormalizedSIFT;
-	static int		_BinarySIFT;
-	static int		_KeepExtremumSign;
-	static int		_FeatureCountThreshold;
-    static int      _KeyPointListForceLevel0;
-	static int		_DarknessAdaption;
+	static SIFTGPU_THREAD_LOCAL GLuint	_texTarget;
+	static SIFTGPU_THREAD_LOCAL GLuint   _iTexFormat;
+	static SIFTGPU_THREAD_LOCAL int		_texMaxDim;
+	static SIFTGPU_THREAD_LOCAL int		_texMaxDimGL; 
+    static SIFTGPU_THREAD_LOCAL int      _texMinDim;
+	static SIFTGPU_THREAD_LOCAL int		_MemCapGPU;
+	static SIFTGPU_THREAD_LOCAL int		_FitMemoryCap;
+	static SIFTGPU_THREAD_LOCAL int		_verbose;
+	static SIFTGPU_THREAD_LOCAL int		_timingS;
+	static SIFTGPU_THREAD_LOCAL int		_timingO;
+	static SIFTGPU_THREAD_LOCAL int		_timingL;
+	static SIFTGPU_THREAD_LOCAL int		_ProfileDetail;
+	static SIFTGPU_THREAD_LOCAL int		_usePackedTex;
+	static SIFTGPU_THREAD_LOCAL int		_IsNvidia;
+	static SIFTGPU_THREAD_LOCAL int		_KeepShaderLoop;
+	static SIFTGPU_THREAD_LOCAL int		_UseCUDA;
+    static SIFTGPU_THREAD_LOCAL int      _UseOpenCL;
+	static SIFTGPU_THREAD_LOCAL int		_UseDynamicIndexing; 
+	static SIFTGPU_THREAD_LOCAL int		_debug;
+	static SIFTGPU_THREAD_LOCAL int		_MaxFilterWidth;
+	static SIFTGPU_THREAD_LOCAL float	_FilterWidthFactor;
+	static SIFTGPU_THREAD_LOCAL float    _OrientationWindowFactor;
+	static SIFTGPU_THREAD_LOCAL float	_DescriptorWindowFactor; 
+	static SIFTGPU_THREAD_LOCAL int		_MaxOrientation;
+	static SIFTGPU_THREAD_LOCAL int      _OrientationPack2;
+	static SIFTGPU_THREAD_LOCAL int		_ListGenGPU;
+	static SIFTGPU_THREAD_LOCAL int		_ListGenSkipGPU;
+	static SIFTGPU_THREAD_LOCAL int		_SupportNVFloat;
+	static SIFTGPU_THREAD_LOCAL int		_SupportTextureRG;
+	static SIFTGPU_THREAD_LOCAL int		_FullSupported;
+	static SIFTGPU_THREAD_LOCAL float	_MaxFeaturePercent;
+	static SIFTGPU_THREAD_LOCAL int		_MaxLevelFeatureNum;
+	static SIFTGPU_THREAD_LOCAL int		_DescriptorPPR; 
+	static SIFTGPU_THREAD_LOCAL int		_DescriptorPPT; //pixel per texture for one descriptor
+	static SIFTGPU_THREAD_LOCAL int		_FeatureTexBlock;
+	static SIFTGPU_THREAD_LOCAL int		_NarrowFeatureTex; //implemented but no performance improvement
+	static SIFTGPU_THREAD_LOCAL int		_SubpixelLocalization;
+	static SIFTGPU_THREAD_LOCAL int		_ProcessOBO; //not implemented yet
+    static SIFTGPU_THREAD_LOCAL int      _TruncateMethod;
+	static SIFTGPU_THREAD_LOCAL int		_PreciseBorder; //implemented
+	static SIFTGPU_THREAD_LOCAL int		_UseSiftGPUEX;
+	static SIFTGPU_THREAD_LOCAL int		_ForceTightPyramid;
+	static SIFTGPU_THREAD_LOCAL int		_octave_min_default;
+	static SIFTGPU_THREAD_LOCAL int		_octave_num_default;
+	static SIFTGPU_THREAD_LOCAL int		_InitPyramidWidth;
+	static SIFTGPU_THREAD_LOCAL int		_InitPyramidHeight;
+	static SIFTGPU_THREAD_LOCAL int		_PreProcessOnCPU;
+	static SIFTGPU_THREAD_LOCAL int		_GoodOpenGL;
+	static SIFTGPU_THREAD_LOCAL int		_FixedOrientation;
+	static SIFTGPU_THREAD_LOCAL int		_LoweOrigin;
+	static SIFTGPU_THREAD_LOCAL int		_ExitAfterSIFT; 
+	static SIFTGPU_THREAD_LOCAL int		_NormalizedSIFT;
+	static SIFTGPU_THREAD_LOCAL int		_BinarySIFT;
+	static SIFTGPU_THREAD_LOCAL int		_DescriptorU8;
+	static SIFTGPU_THREAD_LOCAL int		_KeepExtremumSign;
+	static SIFTGPU_THREAD_LOCAL int		_FeatureCountThreshold;
+	static SIFTGPU_THREAD_LOCAL int		_FeatureGridSize;
+	static SIFTGPU_THREAD_LOCAL int		_FeatureANMS;
+    static SIFTGPU_THREAD_LOCAL int      _KeyPointListForceLevel0;
+	static SIFTGPU_THREAD_LOCAL int		_DarknessAdaption;
+	static SIFTGPU_THREAD_LOCAL int		_CPUThreadNum;
+	static SIFTGPU_THREAD_LOCAL int		_DownSampleAverage;
 
 	//for compatability with old version:
-	static float	_OrientationExtraFactor;
-	static float	_OrientationGaussianFactor;
-	static float    _MulitiOrientationThreshold;
+	static SIFTGPU_THREAD_LOCAL float	_OrientationExtraFactor;
+	static SIFTGPU_THREAD_LOCAL float	_OrientationGaussianFactor;
+	static SIFTGPU_THREAD_LOCAL float    _MulitiOrientationThreshold;
 
 	////////////////////////////////////////
-	static int				_WindowInitX;
-	static int				_WindowInitY;
-	static const char*		_WindowDisplay;
-    static int              _DeviceIndex; 
+	static SIFTGPU_THREAD_LOCAL int				_WindowInitX;
+	static SIFTGPU_THREAD_LOCAL int				_WindowInitY;
+	static SIFTGPU_THREAD_LOCAL const char*		_WindowDisplay;
+    static SIFTGPU_THREAD_LOCAL int              _DeviceIndex; 
+public:
+	//copy the parameters from/to a SiftConfig, the device status 
+	//and the compiled options are skipped if (!all)
+	static void LoadConfig(const SiftConfig& config, int all = 1);
+	static void SaveConfig(SiftConfig& config);
 };
 
 
@@ -112,6 +134,8 @@ private:
 	int  _time_stop;
 public:
 	static int	  ClockMS();
+	//microseconds of a monotonic clock, which does not wrap or follow the system time
+	static long long ClockUS();
 	static double CLOCK();
 	static void	  InitHighResolution();
 	void StopTimer(int verb = 1);
@@ -121,12 +145,26 @@ public:
 
 class GlobalUtil:public GlobalParam
 {
-    static ClockTimer _globalTimer;                             
+    static SIFTGPU_THREAD_LOCAL ClockTimer _globalTimer;                             
+	static void ProfileBegin(const char * event);
+	static void ProfileEnd();
+	static void ProfileOctaveBegin(int octave);
+	static void ProfileOctaveEnd();
+	static void ProfileNextLevel();
 public:
+	//the profiler of the running SiftGPU instance if -profile is on, NULL otherwise
+	static SIFTGPU_THREAD_LOCAL SiftProfiler* _profiler;
 	inline static double CLOCK()				{	return ClockTimer::CLOCK();			}
-	inline static void StopTimer()				{	_globalTimer.StopTimer(_timingS);			}
-	inline static void StartTimer(const char * event)	{	_globalTimer.StartTimer(event, _timingO);	}
+	inline static void StopTimer()				{	_globalTimer.StopTimer(_timingS); if(_profiler) ProfileEnd(); if(SiftTracer::IsEnabled()) SiftTracer::End();	}
+	inline static void StartTimer(const char * event)	{	if(SiftTracer::IsEnabled()) SiftTracer::Begin(event, "stage"); if(_profiler) ProfileBegin(event); _globalTimer.StartTimer(event, _timingO);	}
 	inline static float GetElapsedTime()		{	return _globalTimer.GetElapsedTime();		}
+	//the steps of the profile, the callers wait for the GPU before a step ends if Profiling(detail)
+	inline static int  Profiling(int detail)	{	return _profiler != NULL && _ProfileDetail >= detail;	}
+	inline static void ProfileOctave(int octave){	if(Profiling(2)) ProfileOctaveBegin(octave);	}
+	inline static void ProfileLevel()			{	if(Profiling(3)) ProfileNextLevel();			}
+	inline static void ProfileOctaveFinish()	{	if(Profiling(2)) ProfileOctaveEnd();			}
+	//the features and bytes of the stage that is stopped last
+	static void ProfileData(int features, double bytes = 0);
 
 	static void FitViewPort(int width, int height);
 	static void SetTextureParameter();
@@ -142,9 +180,17 @@ public:
 	static void InitGLParam(int NotTargetGL = 0);
 	static void SetGLParam();
 	static int  CreateWindowEZ();
+	static void DestroyWindowEZ();
 	static void CleanupOpenGL();
     static void SetDeviceParam(int argc, char** argv);
     static int  CreateWindowEZ(LiteWindow* window);
+	//run func(arg, i) for i in [0, count) with up to _CPUThreadNum threads
+	static int  GetCPUThreadNum();
+	static void RunParallel(int count, void (*func)(void* arg, int index), void* arg);
+	//recursive process-wide lock for the state that is shared by the threads 
+	//(DevIL, window/context creation and initialization)
+	static void EnterGlobalLock();
+	static void LeaveGlobalLock();
 };
 
 
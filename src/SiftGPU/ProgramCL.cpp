@@ -1296,6 +1296,8 @@ const char* ProgramBagCL::GetErrorString(cl_int error)
 
 bool ProgramBagCL::CheckErrorCL(cl_int error, const char* location)
 {
+    //the kernels are checked right after they are queued
+    if(SiftTracer::IsEnabled()) SiftTracer::Instant(location ? location : "OpenCL", "kernel");
     if(error == CL_SUCCESS) return true;
 	const char *errstr = GetErrorString(error);
 	if(errstr && errstr[0]) std::cerr << errstr; 
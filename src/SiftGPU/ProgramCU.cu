@@ -735,7 +735,8 @@ void ProgramCU::ReduceHistogram(CuTexImage*hist1, CuTexImage* hist2)
 }
 
 
-void __global__ ListGen_Kernel(int4* d_list, int width)
+//the last pass stores the DoG response of the feature in w, as float bits
+template <bool RESPONSE> void __global__ ListGen_Kernel(int4* d_list, int width, int dog_width)
 {
 	int idx1 = IMUL(blockIdx.x, blockDim.x) + threadIdx.x;
     int4 pos = tex1Dfetch(texDataList, idx1);
@@ -757,18 +758,26 @@ void __global__ ListGen_Kernel(int4* d_list, int width)
 		pos.x += 1;
 		pos.z -= temp.x;
 	}
+	if(RESPONSE) pos.w = __float_as_int(fabs(tex1Dfetch(texC, IMUL(pos.y, dog_width) + pos.x)));
 	d_list[idx1] = pos;
 }
 
 //input list (x, y) (x, y) ....
-void ProgramCU::GenerateList(CuTexImage* list, CuTexImage* hist)
+void ProgramCU::GenerateList(CuTexImage* list, CuTexImage* hist, CuTexImage* dog)
 {
 	int len = list->GetImgWidth();
 	list->BindTexture(texDataList);
 	hist->BindTexture(texDataI4);
 	dim3  grid((len + LISTGEN_BLOCK_DIM -1) /LISTGEN_BLOCK_DIM);
 	dim3  block(LISTGEN_BLOCK_DIM);
-	ListGen_Kernel<<<grid, block>>>((int4*) list->_cuData, hist->GetImgWidth());
+	if(dog)
+	{
+		dog->BindTexture(texC);
+		ListGen_Kernel<true><<<grid, block>>>((int4*) list->_cuData, hist->GetImgWidth(), dog->GetImgWidth());
+	}else
+	{
+		ListGen_Kernel<false><<<grid, block>>>((int4*) list->_cuData, hist->GetImgWidth(), 0);
+	}
 }
 
 void __global__ ComputeOrientation_Kernel(float4* d_list, 
@@ -1114,7 +1123,20 @@ template <bool DYNAMIC_INDEXING> void __global__ ComputeDescriptorRECT_Kernel(fl
 	d_des[didx+1] = make_float4(des[4], des[5], des[6], des[7]);
 }
 
-void __global__ NormalizeDescriptor_Kernel(float4* d_des, int num)
+//the same quantization as SiftPyramid::CopyFeatureVectorU8, floor(512 * v + 0.5) saturated to 255
+__device__ inline unsigned char QuantizeDescriptor(float v)
+{
+	return (unsigned char) min(255, max(0, __float2int_rd(512.0f * v + 0.5f)));
+}
+
+__device__ inline uchar4 QuantizeDescriptor(float4 v)
+{
+	return make_uchar4(QuantizeDescriptor(v.x), QuantizeDescriptor(v.y), 
+					QuantizeDescriptor(v.z), QuantizeDescriptor(v.w));
+}
+
+//the normalized descriptors are written back, or as bytes to d_u8 with -u8
+template <bool U8> void __global__ NormalizeDescriptor_Kernel(float4* d_des, uchar4* d_u8, int num)
 {
 	float4 temp[32];
 	int idx = IMUL(blockIdx.x, blockDim.x) + threadIdx.x;
@@ -1147,11 +1169,20 @@ void __global__ NormalizeDescriptor_Kernel(float4* d_des, int num)
 	{
 		temp[i].x *= norm2;		temp[i].y *= norm2;
 		temp[i].z *= norm2;		temp[i].w *= norm2;
-		d_des[sidx + i] = temp[i];
+		if(U8)	d_u8[sidx + i] = QuantizeDescriptor(temp[i]);
+		else	d_des[sidx + i] = temp[i];
 	}
 }
 
-void ProgramCU::ComputeDescriptor(CuTexImage*list, CuTexImage* got, CuTexImage* dtex, int rect, int stream)
+//-u8 without normalization
+void __global__ QuantizeDescriptor_Kernel(uchar4* d_u8, int num)
+{
+	int idx = IMUL(blockIdx.x, blockDim.x) + threadIdx.x;
+	if(idx >= num) return;
+	d_u8[idx] = QuantizeDescriptor(tex1Dfetch(texDataF4, idx));
+}
+
+void ProgramCU::ComputeDescriptor(CuTexImage*list, CuTexImage* got, CuTexImage* dtex, int rect, int stream, CuTexImage* btex)
 {
 	int num = list->GetImgWidth();
 	int width = got->GetImgWidth();
@@ -1178,13 +1209,23 @@ void ProgramCU::ComputeDescriptor(CuTexImage*list, CuTexImage* got, CuTexImage*
 	    else
 	    	ComputeDescriptor_Kernel<false><<<grid, block>>>((float4*) dtex->_cuData, num, width, height, GlobalUtil::_DescriptorWindowFactor);
     }
+	//the bytes of -u8 are 32 floats of btex for each descriptor
+	if(btex) btex->InitTexture(num * 32, 1, 1);
 	if(GlobalUtil::_NormalizedSIFT)
 	{
 		dtex->BindTexture(texDataF4);
 		const int block_width = DESCRIPTOR_NORMALIZ_PER_BLOCK;
 		dim3 grid((num + block_width -1) / block_width);
 		dim3 block(block_width);
-		NormalizeDescriptor_Kernel<<<grid, block>>>((float4*) dtex->_cuData, num);
+		if(btex)	NormalizeDescriptor_Kernel<true><<<grid, block>>>((float4*) dtex->_cuData, (uchar4*) btex->_cuData, num);
+		else		NormalizeDescriptor_Kernel<false><<<grid, block>>>((float4*) dtex->_cuData, NULL, num);
+	}else if(btex)
+	{
+		dtex->BindTexture(texDataF4);
+		const int block_width = DESCRIPTOR_COMPUTE_BLOCK_SIZE;
+		dim3 grid((num * 32 + block_width -1) / block_width);
+		dim3 block(block_width);
+		QuantizeDescriptor_Kernel<<<grid, block>>>((uchar4*) btex->_cuData, num * 32);
 	}
 	CheckErrorCUDA("ComputeDescriptor");
 }
@@ -1197,6 +1238,8 @@ void ProgramCU::FinishCUDA()
 
 int ProgramCU::CheckErrorCUDA(const char* location)
 {
+	//the kernels are checked right after they are launched
+	if(SiftTracer::IsEnabled()) SiftTracer::Instant(location ? location : "CUDA", "kernel");
 	cudaError_t e = cudaGetLastError();
 	if(e)
 	{
@@ -42,10 +42,10 @@ public:
 	static void ComputeKEY(CuTexImage* dog, CuTexImage* key, float Tdog, float Tedge);
 	static void InitHistogram(CuTexImage* key, CuTexImage* hist);
 	static void ReduceHistogram(CuTexImage*hist1, CuTexImage* hist2);
-	static void GenerateList(CuTexImage* list, CuTexImage* hist);
+	static void GenerateList(CuTexImage* list, CuTexImage* hist, CuTexImage* dog = NULL);
 	static void ComputeOrientation(CuTexImage*list, CuTexImage* got, CuTexImage*key, 
 		float sigma, float sigma_step, int existing_keypoint);
-	static void ComputeDescriptor(CuTexImage*list, CuTexImage* got, CuTexImage* dtex, int rect = 0, int stream = 0);
+	static void ComputeDescriptor(CuTexImage*list, CuTexImage* got, CuTexImage* dtex, int rect = 0, int stream = 0, CuTexImage* btex = NULL);
 
     //data conversion
 	static void SampleImageU(CuTexImage *dst, CuTexImage *src, int log_scale);
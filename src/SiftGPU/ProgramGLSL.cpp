@@ -551,6 +551,7 @@ ShaderBag::ShaderBag()
 	s_genlist_start = 0;
 	s_genlist_step = 0;
 	s_genlist_end = 0;
+	s_genlist_response = 0;
 	s_vertex_list = 0;
 	s_descriptor_fp = 0;
 	s_margin_copy = 0;
@@ -580,6 +581,7 @@ ShaderBag::~ShaderBag()
 	if(s_genlist_start)delete s_genlist_start;
 	if(s_genlist_step)delete s_genlist_step;
 	if(s_genlist_end)delete s_genlist_end;
+	if(s_genlist_response)delete s_genlist_response;
 	if(s_vertex_list)delete s_vertex_list;
 	if(s_descriptor_fp)delete s_descriptor_fp;
 	if(s_margin_copy) delete s_margin_copy;
@@ -1080,6 +1082,13 @@ void ShaderBagGLSL::LoadGenListShader(int ndoglev, int nlev)
 	s_genlist_step = program = LoadGenListStepShader(0, 1);
 	_param_genlist_step_tex0= glGetUniformLocation(*program, "tex0");
 
+	//the DoG (green) at the location of each feature
+	s_genlist_response = program = new ProgramGLSL(
+	"uniform sampler2DRect tex; uniform sampler2DRect dtex; void main (void){\n"
+	"vec4 key = texture2DRect(tex, gl_TexCoord[0].xy);\n"
+	"gl_FragColor = vec4(abs(texture2DRect(dtex, key.xy).g));\n"
+	"}");
+	_param_genlist_response_dtex = glGetUniformLocation(*program, "dtex");
 }
 
 void ShaderBagGLSL::SetMarginCopyParam(int xmax, int ymax)
@@ -1093,6 +1102,11 @@ void ShaderBagGLSL::SetGenListInitParam(int w, int h)
 	float bbox[2] = {w - 1.0f, h - 1.0f};
 	glUniform2fv(_param_genlist_init_bbox, 1, bbox);
 }
+void ShaderBagGLSL::SetGenListResponseParam(int dtex)
+{
+	glUniform1i(_param_genlist_response_dtex, 1);
+}
+
 void ShaderBagGLSL::SetGenListStartParam(float width, int tex0)
 {
 	glUniform1f(_param_ftex_width, width);
@@ -2012,6 +2026,20 @@ void ShaderBagPKSL::LoadGenListShader(int ndoglev,int nlev)
 
 	_param_genlist_end_ktex = glGetUniformLocation(*program, "ktex");
 
+	//the DoG at the location of each feature, the pixel (x, y) is in the channel
+	//(x & 1) + (y & 1) * 2 of the texel (x / 2, y / 2)
+	s_genlist_response = program = new ProgramGLSL(
+	"uniform sampler2DRect tex; uniform sampler2DRect dtex; void main()\n"
+	"{\n"
+	"	vec4 key = texture2DRect(tex, gl_TexCoord[0].xy);\n"
+	"	vec2 pos = floor(key.xy), half_pos = floor(pos * 0.5);\n"
+	"	vec2 odd = pos - half_pos * 2.0;\n"
+	"	vec4 dog = texture2DRect(dtex, half_pos + 0.5);\n"
+	"	float v = dot(dog, vec4(equal(vec4(odd.x + odd.y * 2.0), vec4(0.0, 1.0, 2.0, 3.0))));\n"
+	"	gl_FragColor = vec4(abs(v));\n"
+	"}");
+	_param_genlist_response_dtex = glGetUniformLocation(*program, "dtex");
+
 	//reduction ...
 	s_genlist_histo = new ProgramGLSL(
 	"uniform sampler2DRect tex; void main ()\n"
@@ -2673,6 +2701,11 @@ void ShaderBagPKSL::SetGenListEndParam(int ktex)
 {
 	glUniform1i(_param_genlist_end_ktex, 1);
 }
+
+void ShaderBagPKSL::SetGenListResponseParam(int dtex)
+{
+	glUniform1i(_param_genlist_response_dtex, 1);
+}
 void ShaderBagPKSL::SetGenListInitParam(int w, int h)
 {
 	float bbox[4] = {(w -1.0f) * 0.5f +0.25f, (w-1.0f) * 0.5f - 0.25f,  (h - 1.0f) * 0.5f + 0.25f, (h-1.0f) * 0.5f - 0.25f};
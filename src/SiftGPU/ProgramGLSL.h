@@ -130,6 +130,8 @@ public:
 	ProgramGPU	* s_genlist_start;
 	ProgramGPU	* s_genlist_step;
 	ProgramGPU	* s_genlist_end;
+	//shader:	the DoG response at each feature of a list
+	ProgramGPU	* s_genlist_response;
 	ProgramGPU	* s_zero_pass;
 	//shader:	generate vertex to display SIFT as a square
 	ProgramGPU  * s_vertex_list;
@@ -146,6 +148,7 @@ public:
 public:
 	virtual void SetGenListInitParam(int w, int h){};
 	virtual void SetGenListEndParam(int ktex){};
+	virtual void SetGenListResponseParam(int dtex){};
 	virtual void SetMarginCopyParam(int xmax, int ymax){};
 	virtual void LoadDescriptorShader(){};
 	virtual void SetFeatureDescirptorParam(int gtex, int otex, float dwidth, float fwidth, float width, float height, float sigma){};
@@ -184,6 +187,7 @@ class ShaderBagGLSL:public ShaderBag
 	GLint _param_orientation_stex;
 	GLint _param_margin_copy_truncate;
 	GLint _param_genlist_init_bbox;
+	GLint _param_genlist_response_dtex;
 	GLint _param_descriptor_gtex;
 	GLint _param_descriptor_size;
 	GLint _param_descriptor_dsize;
@@ -199,6 +203,7 @@ public:
 	static ProgramGLSL* LoadGenListStepShader(int start, int step);
 	virtual void SetGenListInitParam(int w, int h);
 	virtual void SetGenListStartParam(float width, int tex0);
+	virtual void SetGenListResponseParam(int dtex);
 	virtual void LoadGenListShader(int ndoglev, int nlev);
 	virtual void UnloadProgram();
 	virtual void LoadKeypointShader(float threshold, float edgeTrheshold);
@@ -224,6 +229,7 @@ private:
 	GLint	_param_ftex_width;
 	GLint	_param_genlist_step_tex0;
 	GLint	_param_genlist_end_ktex;
+	GLint	_param_genlist_response_dtex;
 	GLint	_param_genvbo_size;
 	GLint	_param_orientation_gtex;
 	GLint	_param_orientation_otex;
@@ -258,6 +264,7 @@ public:
 	virtual void SetFeatureOrientationParam(int gtex, int width, int height, float sigma, int stex, float step);
 	virtual void SetSimpleOrientationInput(int oTex, float sigma, float sigma_step);
 	virtual void SetGenListEndParam(int ktex);
+	virtual void SetGenListResponseParam(int dtex);
 	virtual void SetGenListInitParam(int w, int h);
 	virtual void SetMarginCopyParam(int xmax, int ymax);
 };
@@ -42,9 +42,12 @@ using namespace std;
 
 
 #define USE_TIMING()		double t, t0, tt;
-#define OCTAVE_START()		if(GlobalUtil::_timingO){	t = t0 = CLOCK();	cout<<"#"<<i+_down_sample_factor<<"\t";	}
-#define LEVEL_FINISH()		if(GlobalUtil::_timingL){	_OpenCL->FinishCL();	tt = CLOCK();cout<<(tt-t)<<"\t";	t = CLOCK();}
-#define OCTAVE_FINISH()		if(GlobalUtil::_timingO)cout<<"|\t"<<(CLOCK()-t0)<<endl;
+#define OCTAVE_START()		GlobalUtil::ProfileOctave(i+_down_sample_factor);\
+							if(GlobalUtil::_timingO){	t = t0 = CLOCK();	cout<<"#"<<i+_down_sample_factor<<"\t";	}
+#define LEVEL_FINISH()		if(GlobalUtil::Profiling(3)){	_OpenCL->FinishCL();	GlobalUtil::ProfileLevel();	}\
+							if(GlobalUtil::_timingL){	_OpenCL->FinishCL();	tt = CLOCK();cout<<(tt-t)<<"\t";	t = CLOCK();}
+#define OCTAVE_FINISH()		if(GlobalUtil::Profiling(2)){	_OpenCL->FinishCL();	GlobalUtil::ProfileOctaveFinish();	}\
+							if(GlobalUtil::_timingO)cout<<"|\t"<<(CLOCK()-t0)<<endl;
 
 
 PyramidCL::PyramidCL(SiftParam& sp) : SiftPyramid(sp)
@@ -74,6 +77,11 @@ PyramidCL::~PyramidCL()
     if(_bufferTEX) delete _bufferTEX;
 }
 
+void PyramidCL::FinishDevice()
+{
+	_OpenCL->FinishCL();
+}
+
 void PyramidCL::InitializeContext()
 {
     GlobalUtil::InitGLParam(1);
@@ -234,6 +242,7 @@ void PyramidCL::ResizePyramid(int w, int h)
 	totalkb += ResizeFeatureStorage();
 
 	_allocated = 1;
+	_allocated_kb = totalkb;
 
 	if(GlobalUtil::_verbose && GlobalUtil::_timingS) std::cout<<"[Allocate Pyramid]:\t" <<(totalkb/1024)<<"MB\n";
 
@@ -703,6 +712,27 @@ void PyramidCL::DownloadKeypoints()
 	}
 }
 
+int PyramidCL::DownloadFeatureList(int idx, float * list, float * xy, float * response)
+{
+	//the DoG responses are not sampled here, so the budget falls back to dropping levels
+	if(response) return 0;
+	//the generated list has the integer location of each feature
+	int num = _levelFeatureNum[idx];
+	_featureTex[idx].CopyToHost(list);
+	const int * ilist = (const int*) list;
+	for(int k = 0; k < num; ++k)
+	{
+		xy[k * 2] = ilist[k * 4] + 0.5f;	xy[k * 2 + 1] = ilist[k * 4 + 1] + 0.5f;
+	}
+	return 1;
+}
+
+void PyramidCL::UploadFeatureList(int idx, const float * list, int num)
+{
+	SetLevelFeatureNum(idx, num);
+	if(num > 0) _featureTex[idx].CopyFromHost(list);
+}
+
 void PyramidCL::GenerateFeatureListCPU()
 {
 	//no cpu version provided
@@ -788,9 +818,11 @@ void PyramidCL::GenerateFeatureList()
 		//for(int j = 0; j < param._dog_level_num; j++, idx++)
         FOR_EACH_LEVEL(j, reverse)
 		{
-            if(GlobalUtil::_TruncateMethod && GlobalUtil::_FeatureCountThreshold > 0 && _featureNum > GlobalUtil::_FeatureCountThreshold) continue;
+            if(GlobalUtil::_TruncateMethod && !IsSelectingFeatures() && GlobalUtil::_FeatureCountThreshold > 0 && _featureNum > GlobalUtil::_FeatureCountThreshold) continue;
 
 	        GenerateFeatureList(i, j, reduction_count, hbuffer);
+			//the masked features do not count for the level dropping
+			if(HasDetectionMask()) MaskFeatureList(i * param._dog_level_num + j);
 
 			/////////////////////////////
 			if(GlobalUtil::_timingO)
@@ -968,6 +1000,7 @@ void PyramidCL::DetectKeypointsEX()
 
 	for ( i = _octave_min; i < _octave_min + _octave_num; i++)
 	{
+		GlobalUtil::ProfileOctave(i + _down_sample_factor);
 		if(GlobalUtil::_timingO)
 		{
 			t0 = CLOCK();
@@ -987,6 +1020,16 @@ void PyramidCL::DetectKeypointsEX()
 			{
 				std::cout<<(CLOCK()-t)<<"\t";
 			}
+			if(GlobalUtil::Profiling(3))
+			{
+				_OpenCL->FinishCL();
+				GlobalUtil::ProfileLevel();
+			}
+		}
+		if(GlobalUtil::Profiling(2))
+		{
+			_OpenCL->FinishCL();
+			GlobalUtil::ProfileOctaveFinish();
 		}
 		if(GlobalUtil::_timingO)
 		{
@@ -58,6 +58,9 @@ public:
 	virtual void GetSimplifiedOrientation();
 	virtual void InitPyramid(int w, int h, int ds = 0);
 	virtual void ResizePyramid(int w, int h);
+	virtual int  DownloadFeatureList(int idx, float * list, float * xy, float * response);
+	virtual void UploadFeatureList(int idx, const float * list, int num);
+	virtual void FinishDevice();
 	
 	//////////
 	void CopyGradientTex();
@@ -47,9 +47,12 @@ using namespace std;
 
 
 #define USE_TIMING()		double t, t0, tt;
-#define OCTAVE_START()		if(GlobalUtil::_timingO){	t = t0 = CLOCK();	cout<<"#"<<i+_down_sample_factor<<"\t";	}
-#define LEVEL_FINISH()		if(GlobalUtil::_timingL){	ProgramCU::FinishCUDA();	tt = CLOCK();cout<<(tt-t)<<"\t";	t = CLOCK();}
-#define OCTAVE_FINISH()		if(GlobalUtil::_timingO)cout<<"|\t"<<(CLOCK()-t0)<<endl;
+#define OCTAVE_START()		GlobalUtil::ProfileOctave(i+_down_sample_factor);\
+							if(GlobalUtil::_timingO){	t = t0 = CLOCK();	cout<<"#"<<i+_down_sample_factor<<"\t";	}
+#define LEVEL_FINISH()		if(GlobalUtil::Profiling(3)){	ProgramCU::FinishCUDA();	GlobalUtil::ProfileLevel();	}\
+							if(GlobalUtil::_timingL){	ProgramCU::FinishCUDA();	tt = CLOCK();cout<<(tt-t)<<"\t";	t = CLOCK();}
+#define OCTAVE_FINISH()		if(GlobalUtil::Profiling(2)){	ProgramCU::FinishCUDA();	GlobalUtil::ProfileOctaveFinish();	}\
+							if(GlobalUtil::_timingO)cout<<"|\t"<<(CLOCK()-t0)<<endl;
 
 
 PyramidCU::PyramidCU(SiftParam& sp) : SiftPyramid(sp)
@@ -58,6 +61,7 @@ PyramidCU::PyramidCU(SiftParam& sp) : SiftPyramid(sp)
 	_histoPyramidTex = NULL;
 	_featureTex = NULL;
 	_descriptorTex = NULL;
+	_descriptorTexU8 = NULL;
 	_orientationTex = NULL;
 	_bufferPBO = 0;
     _bufferTEX = NULL;
@@ -77,6 +81,11 @@ PyramidCU::~PyramidCU()
     if(_bufferTEX) delete _bufferTEX;
 }
 
+void PyramidCU::FinishDevice()
+{
+	ProgramCU::FinishCUDA();
+}
+
 void PyramidCU::InitializeContext()
 {
     GlobalUtil::InitGLParam(1);
@@ -250,6 +259,7 @@ void PyramidCU::ResizePyramid(int w, int h)
 	if(ProgramCU::CheckErrorCUDA("ResizePyramid")) SetFailStatus(); 
 
 	_allocated = 1;
+	_allocated_kb = totalkb;
 
 	if(GlobalUtil::_verbose && GlobalUtil::_timingS) std::cout<<"[Allocate Pyramid]:\t" <<(totalkb/1024)<<"MB\n";
 
@@ -395,12 +405,21 @@ void PyramidCU::GetFeatureDescriptors()
 	//descriptors...
 	float* pd =  &_descriptor_buffer[0];
 	vector<float> descriptor_buffer2;
+	//-u8 quantizes in the normalization kernel and reads back bytes
+	unsigned char * pb = GlobalUtil::_DescriptorU8 ? &_descriptor_buffer_u8[0] : NULL;
+	vector<unsigned char> descriptor_buffer_u8;
+	if(pb && _descriptorTexU8 == NULL) _descriptorTexU8 = new CuTexImage;
 
 	//use another buffer if we need to re-order the descriptors
 	if(_keypoint_index.size() > 0)
 	{
 		descriptor_buffer2.resize(_descriptor_buffer.size());
 		pd = &descriptor_buffer2[0];
+		if(pb)
+		{
+			descriptor_buffer_u8.resize(_descriptor_buffer_u8.size());
+			pb = &descriptor_buffer_u8[0];
+		}
 	}
 
 	CuTexImage * got, * ftex= _featureTex;
@@ -410,9 +429,17 @@ void PyramidCU::GetFeatureDescriptors()
 		for(int j = 0; j < param._dog_level_num; j++, ftex++, idx++, got++)
 		{
 			if(_levelFeatureNum[idx]==0) continue;
-            ProgramCU::ComputeDescriptor(ftex, got, _descriptorTex, IsUsingRectDescription());//process
-			_descriptorTex->CopyToHost(pd); //readback descriptor
-			pd += 128*_levelFeatureNum[idx];
+			if(pb)
+			{
+				ProgramCU::ComputeDescriptor(ftex, got, _descriptorTex, IsUsingRectDescription(), 0, _descriptorTexU8);
+				_descriptorTexU8->CopyToHost(pb); //readback the bytes
+				pb += 128*_levelFeatureNum[idx];
+			}else
+			{
+				ProgramCU::ComputeDescriptor(ftex, got, _descriptorTex, IsUsingRectDescription());//process
+				_descriptorTex->CopyToHost(pd); //readback descriptor
+				pd += 128*_levelFeatureNum[idx];
+			}
 		}
 	}
 
@@ -424,9 +451,11 @@ void PyramidCU::GetFeatureDescriptors()
 		for(int i = 0; i < _featureNum; ++i)
 		{
 			int index = _keypoint_index[i];
-			memcpy(&_descriptor_buffer[index*128], &descriptor_buffer2[i*128], 128 * sizeof(float));
+			if(pb)	memcpy(&_descriptor_buffer_u8[index*128], &descriptor_buffer_u8[i*128], 128);
+			else	memcpy(&_descriptor_buffer[index*128], &descriptor_buffer2[i*128], 128 * sizeof(float));
 		}
 	}
+	if(pb) _descriptor_u8 = 1;
 
 	if(ProgramCU::CheckErrorCUDA("PyramidCU::GetFeatureDescriptors")) SetFailStatus(); 
 }
@@ -623,6 +652,11 @@ void PyramidCU::DestroySharedData()
 		delete _descriptorTex;
 		_descriptorTex = NULL;
 	}
+	if(_descriptorTexU8)
+	{
+		delete _descriptorTexU8;
+		_descriptorTexU8 = NULL;
+	}
 	//cpu reduction buffer.
 	if(_histo_buffer)
 	{
@@ -729,6 +763,27 @@ void PyramidCU::DownloadKeypoints()
 	}
 }
 
+int PyramidCU::DownloadFeatureList(int idx, float * list, float * xy, float * response)
+{
+	//the generated list has the integer location of each feature
+	int num = _levelFeatureNum[idx];
+	_featureTex[idx].CopyToHost(list);
+	const int * ilist = (const int*) list;
+	for(int k = 0; k < num; ++k)
+	{
+		xy[k * 2] = ilist[k * 4] + 0.5f;	xy[k * 2 + 1] = ilist[k * 4 + 1] + 0.5f;
+	}
+	//the list generation stored the DoG response in w
+	for(int k = 0; response && k < num; ++k)	response[k] = list[k * 4 + 3];
+	return 1;
+}
+
+void PyramidCU::UploadFeatureList(int idx, const float * list, int num)
+{
+	SetLevelFeatureNum(idx, num);
+	if(num > 0) _featureTex[idx].CopyFromHost(list);
+}
+
 void PyramidCU::GenerateFeatureListCPU()
 {
 	//no cpu version provided
@@ -786,10 +841,12 @@ void PyramidCU::GenerateFeatureList(int i, int j, int reduction_count, vector<in
 		_featureTex[idx].CopyFromHost(&_keypoint_buffer[0]);
 	
 		////////////////////////////////////////////
-		ProgramCU::GenerateList(_featureTex + idx, ++htex);
-		for(k = 2; k < reduction_count; k++)
+		//the last pass has the pixel locations, and stores the DoG response of each
+		CuTexImage * dog = GetBaseLevel(_octave_min + i, DATA_DOG) + 2 + j;
+		int steps = max(reduction_count - 1, 1);
+		for(k = 0; k < steps; k++)
 		{
-			ProgramCU::GenerateList(_featureTex + idx, ++htex);
+			ProgramCU::GenerateList(_featureTex + idx, ++htex, k == steps - 1 ? dog : NULL);
 		}
 	}
 }
@@ -818,9 +875,11 @@ void PyramidCU::GenerateFeatureList()
 		//for(int j = 0; j < param._dog_level_num; j++, idx++)
         FOR_EACH_LEVEL(j, reverse)
 		{
-            if(GlobalUtil::_TruncateMethod && GlobalUtil::_FeatureCountThreshold > 0 && _featureNum > GlobalUtil::_FeatureCountThreshold) continue;
+            if(GlobalUtil::_TruncateMethod && !IsSelectingFeatures() && GlobalUtil::_FeatureCountThreshold > 0 && _featureNum > GlobalUtil::_FeatureCountThreshold) continue;
 
 	        GenerateFeatureList(i, j, reduction_count, hbuffer);
+			//the masked features do not count for the level dropping
+			if(HasDetectionMask()) MaskFeatureList(i * param._dog_level_num + j);
 
 			/////////////////////////////
 			if(GlobalUtil::_timingO)
@@ -1027,6 +1086,7 @@ void PyramidCU::DetectKeypointsEX()
 
 	for ( i = _octave_min; i < _octave_min + _octave_num; i++)
 	{
+		GlobalUtil::ProfileOctave(i + _down_sample_factor);
 		if(GlobalUtil::_timingO)
 		{
 			t0 = CLOCK();
@@ -1046,6 +1106,16 @@ void PyramidCU::DetectKeypointsEX()
 			{
 				std::cout<<(CLOCK()-t)<<"\t";
 			}
+			if(GlobalUtil::Profiling(3))
+			{
+				ProgramCU::FinishCUDA();
+				GlobalUtil::ProfileLevel();
+			}
+		}
+		if(GlobalUtil::Profiling(2))
+		{
+			ProgramCU::FinishCUDA();
+			GlobalUtil::ProfileOctaveFinish();
 		}
 		if(GlobalUtil::_timingO)
 		{
@@ -35,6 +35,7 @@ class PyramidCU:public SiftPyramid
 	CuTexImage* _histoPyramidTex;
 	CuTexImage* _featureTex;
 	CuTexImage* _descriptorTex;
+	CuTexImage* _descriptorTexU8;
 	CuTexImage* _orientationTex;
 	GLuint		_bufferPBO;
     GLTexImage* _bufferTEX;
@@ -59,6 +60,9 @@ public:
 	virtual void InitPyramid(int w, int h, int ds = 0);
 	virtual void ResizePyramid(int w, int h);
     virtual int  IsUsingRectDescription(){return _existing_keypoints & SIFT_RECT_DESCRIPTION; }	
+	virtual int  DownloadFeatureList(int idx, float * list, float * xy, float * response);
+	virtual void UploadFeatureList(int idx, const float * list, int num);
+	virtual void FinishDevice();
 	//////////
 	void CopyGradientTex();
 	void FitPyramid(int w, int h);
@@ -27,6 +27,7 @@
 #include <algorithm>
 #include <fstream>
 #include <math.h>
+#include <float.h>
 #include <string.h>
 using namespace std;
 
@@ -49,9 +50,20 @@ using namespace std;
 
 
 #define USE_TIMING()		double t, t0, tt;
-#define OCTAVE_START()		if(GlobalUtil::_timingO){	t = t0 = CLOCK();	cout<<"#"<<i+_down_sample_factor<<"\t";	}
-#define LEVEL_FINISH()		if(GlobalUtil::_timingL){	glFinish();	tt = CLOCK();cout<<(tt-t)<<"\t";	t = CLOCK();}
-#define OCTAVE_FINISH()		if(GlobalUtil::_timingO)cout<<"|\t"<<(CLOCK()-t0)<<endl;
+#define OCTAVE_START()		GlobalUtil::ProfileOctave(i+_down_sample_factor);\
+							if(GlobalUtil::_timingO){	t = t0 = CLOCK();	cout<<"#"<<i+_down_sample_factor<<"\t";	}
+#define LEVEL_FINISH()		if(GlobalUtil::Profiling(3)){	glFinish();	GlobalUtil::ProfileLevel();	}\
+							if(GlobalUtil::_timingL){	glFinish();	tt = CLOCK();cout<<(tt-t)<<"\t";	t = CLOCK();}
+#define OCTAVE_FINISH()		if(GlobalUtil::Profiling(2)){	glFinish();	GlobalUtil::ProfileOctaveFinish();	}\
+							if(GlobalUtil::_timingO)cout<<"|\t"<<(CLOCK()-t0)<<endl;
+
+//the readbacks of the float RGBA framebuffer, traced with the bytes read
+static void ReadPixelsRGBA(int x, int y, int w, int h, void * data)
+{
+	SiftTraceScope trace("glReadPixels", "readback");
+	glReadPixels(x, y, w, h, GL_RGBA, GL_FLOAT, data);
+	trace.SetValue(w * h * 4.0 * sizeof(float));
+}
 
 
 //////////////////////////////////////////////////////////////////////
@@ -163,6 +175,7 @@ PyramidGL::PyramidGL(SiftParam &sp):SiftPyramid(sp)
 	_orientationTex = NULL;
 	_descriptorTex = NULL;
 	_histoPyramidTex = NULL;	
+	_shader_bag = NULL;
     //////////////////////////
     InitializeContext();
 }
@@ -171,7 +184,7 @@ PyramidGL::~PyramidGL()
 {
 	DestroyPerLevelData();
 	DestroySharedData();
-	ShaderMan::DestroyShaders();
+	if(_shader_bag) ShaderMan::DestroyShaders(_shader_bag);
 }
 
 void PyramidGL::InitializeContext()
@@ -180,7 +193,7 @@ void PyramidGL::InitializeContext()
     if(!GlobalUtil::_GoodOpenGL) return;
 
     //////////////////////////////////////////////
-	ShaderMan::InitShaderMan(param);
+	_shader_bag = ShaderMan::InitShaderMan(param);
 }
 
 void PyramidGL::DestroyPerLevelData()
@@ -459,6 +472,7 @@ void PyramidNaive::ResizePyramid( int w,  int h)
 
 	//
 	_allocated = 1;
+	_allocated_kb = totalkb;
 
 	if(GlobalUtil::_verbose && GlobalUtil::_timingS) std::cout<<"[Allocate Pyramid]:\t" <<(totalkb/1024)<<"MB\n";
 
@@ -761,6 +775,7 @@ void PyramidNaive::DetectKeypointsEX()
 	glDrawBuffers(2, buffers);
 	for ( i = _octave_min; i < _octave_min + _octave_num; i++)
 	{
+		GlobalUtil::ProfileOctave(i + _down_sample_factor);
 		if(GlobalUtil::_timingO)
 		{
 			t0 = CLOCK();
@@ -789,9 +804,19 @@ void PyramidNaive::DetectKeypointsEX()
 				glFinish();
 				std::cout<<(CLOCK()-t)<<"\t";
 			}
+			if(GlobalUtil::Profiling(3))
+			{
+				glFinish();
+				GlobalUtil::ProfileLevel();
+			}
 			tex->DetachFBO(0);
 			aux->DetachFBO(1);
 		}
+		if(GlobalUtil::Profiling(2))
+		{
+			glFinish();
+			GlobalUtil::ProfileOctaveFinish();
+		}
 		if(GlobalUtil::_timingO)
 		{
 			std::cout<<"|\t"<<(CLOCK()-t0)<<"\n";
@@ -855,7 +880,7 @@ void PyramidNaive::GenerateFeatureList(int i, int j)
 	{	
 		//read back one pixel
 		float fn[4], fcount;
-		glReadPixels(0, 0, 1, 1, GL_RGBA , GL_FLOAT, fn);
+		ReadPixelsRGBA(0, 0, 1, 1, fn);
 		fcount = (fn[0] + fn[1] + fn[2] + fn[3]);
 		if(fcount < 1) fcount = 0;
 
@@ -902,7 +927,7 @@ void PyramidNaive::GenerateFeatureList(int i, int j)
 
 		int tw = htex[1].GetDrawWidth(), th = htex[1].GetDrawHeight();
 		int fc = 0;
-		glReadPixels(0, 0, tw, th, GL_RGBA , GL_FLOAT, _histo_buffer);	
+		ReadPixelsRGBA(0, 0, tw, th, _histo_buffer);	
 		_keypoint_buffer.resize(0);
 		for(int y = 0, pos = 0; y < th; y++)
 		{
@@ -990,7 +1015,7 @@ void PyramidNaive::GenerateFeatureList()
         FOR_EACH_LEVEL(j, reverse)
         {
 
-            if(GlobalUtil::_TruncateMethod && GlobalUtil::_FeatureCountThreshold > 0
+            if(GlobalUtil::_TruncateMethod && !IsSelectingFeatures() && GlobalUtil::_FeatureCountThreshold > 0
 				&& _featureNum > GlobalUtil::_FeatureCountThreshold) 
 			{
 				_levelFeatureNum[i * param._dog_level_num + j] = 0;
@@ -998,6 +1023,12 @@ void PyramidNaive::GenerateFeatureList()
 			}else
 			{
 				GenerateFeatureList(i, j); 
+				if(HasDetectionMask())
+				{
+					//the masked features do not count for the level dropping
+					MaskFeatureList(i * param._dog_level_num + j);
+					fbo.BindFBO();
+				}
 				if(GlobalUtil::_timingO)	
 				{
 					int idx = i * param._dog_level_num + j;
@@ -1072,7 +1103,7 @@ void PyramidGL::GenerateFeatureDisplayVBO()
 			}
 
 			//read back if we have enough buffer
-			if(bsize >= esize) glReadPixels(0, 0, ftex->GetImgWidth(), ftex->GetImgHeight(), GL_RGBA, GL_FLOAT, 0);
+			if(bsize >= esize) ReadPixelsRGBA(0, 0, ftex->GetImgWidth(), ftex->GetImgHeight(), 0);
 			else  glBufferData(GL_PIXEL_PACK_BUFFER_ARB, 0,	NULL, GL_STATIC_DRAW_ARB);
 			glBindBuffer(GL_PIXEL_PACK_BUFFER_ARB, 0);
 
@@ -1106,7 +1137,7 @@ void PyramidGL::GenerateFeatureDisplayVBO()
 			}
 			
 			//read back if we have enough buffer	
-			if(bsize >= esize)	glReadPixels(0, 0, w, h, GL_RGBA, GL_FLOAT, 0);
+			if(bsize >= esize)	ReadPixelsRGBA(0, 0, w, h, 0);
 			else glBufferData(GL_PIXEL_PACK_BUFFER_ARB, 0,	NULL, GL_STATIC_DRAW_ARB);
 			glBindBuffer(GL_PIXEL_PACK_BUFFER_ARB, 0);
 
@@ -1219,6 +1250,7 @@ void PyramidNaive::GenerateFeatureListCPU()
 				{
 					if(*p==0)continue;
 					if(m ==0 || k ==0 || k >= tex->GetImgHeight() -1 || m >= tex->GetImgWidth() -1 ) continue;
+					if(HasDetectionMask() && !IsInsideDetectionMask(idx, m + 0.5f, k + 0.5f)) continue;
 					list.push_back(m+0.5f);
 					list.push_back(k+0.5f);
 					list.push_back(0);
@@ -1259,6 +1291,95 @@ void PyramidNaive::GenerateFeatureListCPU()
 	}
 }
 
+int PyramidNaive::DownloadFeatureList(int idx, float * list, float * xy, float * response)
+{
+	int num = _levelFeatureNum[idx];
+	ReadFeatureList(idx, list);
+	for(int k = 0; k < num; ++k)
+	{
+		xy[k * 2] = list[k * 4];	xy[k * 2 + 1] = list[k * 4 + 1];
+	}
+	if(response == NULL) return 1;
+
+	//the DoG is stored in the green channel
+	GLTexImage * tex = GetBaseLevel(_octave_min + idx / param._dog_level_num, DATA_DOG) + idx % param._dog_level_num + 2;
+	if(ReadFeatureResponse(idx, tex, response)) return 1;
+	int w = tex->GetTexWidth();
+	vector<float> dog(w * tex->GetTexHeight());
+	tex->BindTex();
+	glGetTexImage(GlobalUtil::_texTarget, 0, GL_GREEN, GL_FLOAT, &dog[0]);
+	GLTexImage::UnbindTex();
+
+	for(int k = 0; k < num; ++k, list += 4)
+	{
+		int x = min(max((int) list[0], 0), tex->GetImgWidth() - 1);
+		int y = min(max((int) list[1], 0), tex->GetImgHeight() - 1);
+		response[k] = fabs(dog[y * w + x]);
+	}
+	return 1;
+}
+
+void PyramidGL::ReadFeatureList(int idx, float * list)
+{
+	FrameBufferObject fbo;
+	GLTexImage * ftex = _featureTex + idx;
+	int num = _levelFeatureNum[idx];
+	vector<float> buffer(ftex->GetImgWidth() * ftex->GetImgHeight() * 4);
+	glReadBuffer(GL_COLOR_ATTACHMENT0_EXT);
+	ftex->AttachToFBO(0);
+	ReadPixelsRGBA(0, 0, ftex->GetImgWidth(), ftex->GetImgHeight(), &buffer[0]);
+	memcpy(list, &buffer[0], num * 4 * sizeof(float));
+}
+
+//the DoG is sampled at the features on the gpu, and only the rows of the feature
+//texture that hold the features are read back. Returns 0 without the shader (CG)
+int PyramidGL::ReadFeatureResponse(int idx, GLTexImage * dog, float * response)
+{
+	FrameBufferObject fbo;
+	GLTexImage * ftex = _featureTex + idx, & tempTex = *_descriptorTex;
+	int num = _levelFeatureNum[idx], w = ftex->GetImgWidth(), rows = (num + w - 1) / w;
+	glActiveTexture(GL_TEXTURE1);
+	dog->BindTex();
+	glActiveTexture(GL_TEXTURE0);
+	ftex->BindTex();
+	if(!ShaderMan::UseShaderGenListResponse(dog->GetTexID()))
+	{
+		GLTexImage::UnbindMultiTex(2);
+		return 0;
+	}
+	glDrawBuffer(GL_COLOR_ATTACHMENT0_EXT);
+	tempTex.AttachToFBO(0);
+	ftex->FitTexViewPort();
+	ftex->DrawQuad();
+	ShaderMan::UnloadProgram();
+	GLTexImage::UnbindMultiTex(2);
+
+	vector<float> buffer(w * rows);
+	glReadBuffer(GL_COLOR_ATTACHMENT0_EXT);
+	{
+		SiftTraceScope trace("glReadPixels", "readback");
+		glReadPixels(0, 0, w, rows, GL_RED, GL_FLOAT, &buffer[0]);
+		trace.SetValue(w * rows * (double) sizeof(float));
+	}
+	tempTex.DetachFBO(0);
+	memcpy(response, &buffer[0], num * sizeof(float));
+	return 1;
+}
+
+void PyramidGL::UploadFeatureList(int idx, const float * list, int num)
+{
+	GLTexImage * ftex = _featureTex + idx;
+	SetLevelFeatureNum(idx, num);
+	if(num == 0) return;
+
+	int fw = ftex->GetImgWidth(), fh = ftex->GetImgHeight();
+	vector<float> buffer(list, list + num * 4);
+	buffer.resize(4 * fw * fh);
+	ftex->BindTex();
+	glTexSubImage2D(GlobalUtil::_texTarget, 0, 0, 0, fw, fh, GL_RGBA, GL_FLOAT, &buffer[0]);
+	GLTexImage::UnbindTex();
+}
+
 #define FEATURELIST_USE_PBO
 
 void PyramidGL::ReshapeFeatureListCPU()
@@ -1306,7 +1427,7 @@ void PyramidGL::ReshapeFeatureListCPU()
 
 		_featureTex[i].AttachToFBO(0);
 		_featureTex[i].FitTexViewPort();
-		glReadPixels(0, 0, _featureTex[i].GetImgWidth(), _featureTex[i].GetImgHeight(),GL_RGBA, GL_FLOAT, buffer1);
+		ReadPixelsRGBA(0, 0, _featureTex[i].GetImgWidth(), _featureTex[i].GetImgHeight(), buffer1);
 		
 		int fcount =0, ocount;
 		float * src = buffer1;
@@ -1316,7 +1437,7 @@ void PyramidGL::ReshapeFeatureListCPU()
 		{	
 			//read back orientations from another texture
 			_orientationTex[i].AttachToFBO(0);
-			glReadPixels(0, 0, _orientationTex[i].GetImgWidth(), _orientationTex[i].GetImgHeight(),GL_RGBA, GL_FLOAT, buffer2);
+			ReadPixelsRGBA(0, 0, _orientationTex[i].GetImgWidth(), _orientationTex[i].GetImgHeight(), buffer2);
 			//make the feature list
 			for(int j = 0; j < _levelFeatureNum[i]; j++, src+=4, orientation+=4)
 			{
@@ -1465,6 +1586,11 @@ void PyramidGL::CleanUpAfterSIFT()
 	GlobalUtil::CleanupOpenGL();
 }
 
+void PyramidGL::FinishDevice()
+{
+	glFinish();
+}
+
 void PyramidNaive::GetSimplifiedOrientation()
 {
 	//
@@ -1581,6 +1707,35 @@ inline void PyramidGL::NormalizeDescriptor(int num, float*pd)
 #endif
 }
 
+//-u8 writes the normalized descriptors as bytes, with the quantization of 
+//SiftPyramid::CopyFeatureVectorU8, instead of writing the floats back
+void PyramidGL::NormalizeDescriptorU8(int num, const float*pd, unsigned char* pb)
+{
+	for(int k = 0; k < num; k++, pd +=128, pb += 128)
+	{
+		int v;
+		float sq = 1.0f, sq2 = 1.0f, limit = FLT_MAX;
+		if(GlobalUtil::_NormalizedSIFT)
+		{
+			//the norm, and the norm after truncating to .2
+			for(v = 0, sq = 0; v < 128; v++) sq += pd[v] * pd[v];
+			sq = 1.0f / sqrtf(sq);
+			for(v = 0, sq2 = 0; v < 128; v++)
+			{
+				float t = min(pd[v] * sq, 0.2f);
+				sq2 += t * t;
+			}
+			sq2 = 1.0f / sqrtf(sq2);
+			limit = 0.2f;
+		}
+		for(v = 0; v < 128; v++)
+		{
+			int q = (int) floor(0.5 + 512.0f * min(pd[v] * sq, limit) * sq2);
+			pb[v] = (unsigned char) (q < 0 ? 0 : (q > 255 ? 255 : q));
+		}
+	}
+}
+
 inline void PyramidGL::InterlaceDescriptorF2(int w, int h, float* buf, float* pd, int step)
 {
 	/*
@@ -1675,12 +1830,20 @@ void PyramidGL::GetFeatureDescriptors()
 	int block_height = GlobalUtil::_DescriptorPPT/GlobalUtil::_DescriptorPPR;
 	float* pd =  &_descriptor_buffer[0], * pbuf  = NULL;
 	vector<float>read_buffer, descriptor_buffer2;
+	//the normalization runs on the cpu, and -u8 quantizes in the same pass
+	unsigned char * pb = GlobalUtil::_DescriptorU8 ? &_descriptor_buffer_u8[0] : NULL;
+	vector<unsigned char> descriptor_buffer_u8;
 
 	//use another buffer, if we need to re-order the descriptors
 	if(_keypoint_index.size() > 0)
 	{
 		descriptor_buffer2.resize(_descriptor_buffer.size());
 		pd = &descriptor_buffer2[0];
+		if(pb)
+		{
+			descriptor_buffer_u8.resize(_descriptor_buffer_u8.size());
+			pb = &descriptor_buffer_u8[0];
+		}
 	}
 	FrameBufferObject fbo;
 
@@ -1744,12 +1907,12 @@ void PyramidGL::GetFeatureDescriptors()
 				glReadBuffer(GL_COLOR_ATTACHMENT0_EXT + k);
 				if(GlobalUtil::_IsNvidia ||  w * h <=  16384) //were
 				{
-					glReadPixels(0, 0, w, h, GL_RGBA, GL_FLOAT, pbuf);
+					ReadPixelsRGBA(0, 0, w, h, pbuf);
 				}else
 				{
 					int hstep = 16384 / w; 
 					for(int kk = 0; kk < h; kk += hstep)
-						glReadPixels(0, kk, w, min(hstep, h - kk), GL_RGBA, GL_FLOAT, pbuf + w * kk * 4);
+						ReadPixelsRGBA(0, kk, w, min(hstep, h - kk), pbuf + w * kk * 4);
 				}
 			}
 	
@@ -1760,7 +1923,11 @@ void PyramidGL::GetFeatureDescriptors()
 			
 			//need to do normalization
 			//the new version uses SSE to speed up this part
-			if(GlobalUtil::_NormalizedSIFT) NormalizeDescriptor(_levelFeatureNum[idx], pd);
+			if(pb)
+			{
+				NormalizeDescriptorU8(_levelFeatureNum[idx], pd, pb);
+				pb += 128*_levelFeatureNum[idx];
+			}else if(GlobalUtil::_NormalizedSIFT) NormalizeDescriptor(_levelFeatureNum[idx], pd);
 
 			pd += 128*_levelFeatureNum[idx];
 			glReadBuffer(GL_NONE);
@@ -1774,9 +1941,12 @@ void PyramidGL::GetFeatureDescriptors()
 		for(i = 0; i < _featureNum; ++i)
 		{
 			int index = _keypoint_index[i];
-			memcpy(&_descriptor_buffer[index*128], &descriptor_buffer2[i*128], 128 * sizeof(float));
+			if(pb)	memcpy(&_descriptor_buffer_u8[index*128], &descriptor_buffer_u8[i*128], 128);
+			else	memcpy(&_descriptor_buffer[index*128], &descriptor_buffer2[i*128], 128 * sizeof(float));
 		}
 	}
+	//the float descriptors are not normalized with -u8
+	if(pb) _descriptor_u8 = 1;
 
 	////////////////////////
 	GLTexImage::UnbindMultiTex(3); 
@@ -1819,7 +1989,7 @@ void PyramidGL::DownloadKeypoints()
 			if(_levelFeatureNum[idx]>0)
 			{	
 				ftex->AttachToFBO(0);
-				glReadPixels(0, 0, ftex->GetImgWidth(), ftex->GetImgHeight(),GL_RGBA, GL_FLOAT, p);
+				ReadPixelsRGBA(0, 0, ftex->GetImgWidth(), ftex->GetImgHeight(), p);
 				ps = p;
 				for(int k = 0;  k < _levelFeatureNum[idx]; k++, ps+=4)
 				{
@@ -2104,6 +2274,7 @@ void PyramidPacked::DetectKeypointsEX()
 
 	for ( i = _octave_min; i < _octave_min + _octave_num; i++)
 	{
+		GlobalUtil::ProfileOctave(i + _down_sample_factor);
 		if(GlobalUtil::_timingO)
 		{
 			t0 = CLOCK();
@@ -2136,6 +2307,16 @@ void PyramidPacked::DetectKeypointsEX()
 				glFinish();
 				std::cout<<(CLOCK()-t)<<"\t";
 			}
+			if(GlobalUtil::Profiling(3))
+			{
+				glFinish();
+				GlobalUtil::ProfileLevel();
+			}
+		}
+		if(GlobalUtil::Profiling(2))
+		{
+			glFinish();
+			GlobalUtil::ProfileOctaveFinish();
 		}
 		if(GlobalUtil::_timingO)
 		{
@@ -2201,7 +2382,7 @@ void PyramidPacked::GenerateFeatureList(int i, int j)
 	{		
 		//read back one pixel
 		float fn[4];
-		glReadPixels(0, 0, 1, 1, GL_RGBA , GL_FLOAT, fn);
+		ReadPixelsRGBA(0, 0, 1, 1, fn);
 		fcount = (fn[0] + fn[1] + fn[2] + fn[3]);
 		if(fcount < 1) fcount = 0;
 
@@ -2247,7 +2428,7 @@ void PyramidPacked::GenerateFeatureList(int i, int j)
 
 		int tw = htex[1].GetDrawWidth(), th = htex[1].GetDrawHeight();
 		int fc = 0;
-		glReadPixels(0, 0, tw, th, GL_RGBA , GL_FLOAT, _histo_buffer);	
+		ReadPixelsRGBA(0, 0, tw, th, _histo_buffer);	
 		_keypoint_buffer.resize(0);
 		for(int y = 0, pos = 0; y < th; y++)
 		{
@@ -2338,7 +2519,7 @@ void PyramidPacked::GenerateFeatureList()
 		//for(int j = 0; j < param._dog_level_num; j++, idx++)
         FOR_EACH_LEVEL(j, reverse)
 		{
-            if(GlobalUtil::_TruncateMethod && GlobalUtil::_FeatureCountThreshold > 0
+            if(GlobalUtil::_TruncateMethod && !IsSelectingFeatures() && GlobalUtil::_FeatureCountThreshold > 0
 				&& _featureNum > GlobalUtil::_FeatureCountThreshold) 
 			{
 				_levelFeatureNum[i * param._dog_level_num + j] = 0;
@@ -2346,6 +2527,12 @@ void PyramidPacked::GenerateFeatureList()
 			}
             
             GenerateFeatureList(i, j); 
+			if(HasDetectionMask())
+			{
+				//the masked features do not count for the level dropping
+				MaskFeatureList(i * param._dog_level_num + j);
+				fbo.BindFBO();
+			}
 
 			if(GlobalUtil::_timingO)
 			{
@@ -2405,6 +2592,7 @@ void PyramidPacked::GenerateFeatureListCPU()
 					int yy = k + k + ( (t <2)? 0 : 1);
 					if(xx ==0 || yy == 0) continue;
 					if(xx >= tex->GetImgWidth() - 1 || yy >= tex->GetImgHeight() - 1)continue;
+					if(HasDetectionMask() && !IsInsideDetectionMask(idx, xx + 0.5f + p[1], yy + 0.5f + p[2])) continue;
 					list.push_back(xx + 0.5f + p[1]);
 					list.push_back(yy + 0.5f + p[2]);
 					list.push_back(GlobalUtil::_KeepExtremumSign && p[0] < 0 ? -1.0f : 1.0f);
@@ -2738,6 +2926,7 @@ void PyramidPacked::ResizePyramid( int w,  int h)
 	totalkb += ResizeFeatureStorage();
 
 	_allocated = 1;
+	_allocated_kb = totalkb;
 
 	if(GlobalUtil::_verbose && GlobalUtil::_timingS) std::cout<<"[Allocate Pyramid]:\t" <<(totalkb/1024)<<"MB\n";
 
@@ -2753,6 +2942,34 @@ void PyramidPacked::DestroyPyramidData()
 }
 
 
+int PyramidPacked::DownloadFeatureList(int idx, float * list, float * xy, float * response)
+{
+	int num = _levelFeatureNum[idx];
+	ReadFeatureList(idx, list);
+	for(int k = 0; k < num; ++k)
+	{
+		xy[k * 2] = list[k * 4];	xy[k * 2 + 1] = list[k * 4 + 1];
+	}
+	if(response == NULL) return 1;
+
+	//each texel of the DoG stores a 2x2 block of pixels
+	GLTexImage * tex = GetBaseLevel(_octave_min + idx / param._dog_level_num, DATA_DOG) + idx % param._dog_level_num + 2;
+	if(ReadFeatureResponse(idx, tex, response)) return 1;
+	int w = tex->GetTexWidth();
+	vector<float> dog(w * tex->GetTexHeight() * 4);
+	tex->BindTex();
+	glGetTexImage(GlobalUtil::_texTarget, 0, GL_RGBA, GL_FLOAT, &dog[0]);
+	GLTexImage::UnbindTex();
+
+	for(int k = 0; k < num; ++k, list += 4)
+	{
+		int x = min(max((int) list[0], 0), tex->GetImgWidth() - 1);
+		int y = min(max((int) list[1], 0), tex->GetImgHeight() - 1);
+		response[k] = fabs(dog[((y >> 1) * w + (x >> 1)) * 4 + (x & 1) + ((y & 1) << 1)]);
+	}
+	return 1;
+}
+
 GLTexImage*  PyramidPacked::GetLevelTexture(int octave, int level, int dataName)
 {
 	return _allPyramid+ (_pyramid_octave_first + octave - _octave_min) * param._level_num 
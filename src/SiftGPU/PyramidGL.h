@@ -39,13 +39,17 @@ protected:
 	GLTexImage* _featureTex;
 	GLTexImage* _descriptorTex;
 	GLTexImage* _orientationTex;
+	//the shaders compiled with the options of this pyramid
+	ShaderBag*	_shader_bag;
 public:
     void InitializeContext();
+	virtual void SelectShaders() {ShaderMan::SelectShaderBag(_shader_bag); }
 	void SetLevelFeatureNum(int idx, int num);
 	void GetTextureStorageSize(int num, int &fw, int& fh);
 	void GetAlignedStorageSize(int num, int align, int &fw, int &fh);
 	static void InterlaceDescriptorF2(int w, int h, float* buf, float* pd, int step);
 	static void NormalizeDescriptor(int num, float*pd);
+	static void NormalizeDescriptorU8(int num, const float*pd, unsigned char* pb);
 	virtual void DownloadKeypoints();
 	virtual int ResizeFeatureStorage();
 	////////////////////////////
@@ -56,7 +60,12 @@ public:
 	virtual void ReshapeFeatureListCPU();
 	virtual void GenerateFeatureDisplayVBO();
     virtual void CleanUpAfterSIFT();
+	virtual void FinishDevice();
 	virtual GLTexImage* GetBaseLevel(int octave, int dataName = DATA_GAUSSIAN)=0;
+protected:
+	void ReadFeatureList(int idx, float * list);
+	int  ReadFeatureResponse(int idx, GLTexImage * dog, float * response);
+	virtual void UploadFeatureList(int idx, const float * list, int num);
 public:
 	PyramidGL(SiftParam&sp);
 	virtual ~PyramidGL();
@@ -83,6 +92,7 @@ public:
 	void FitPyramid(int w, int h);
 	void ResizePyramid(int w, int h);
 	void FitHistogramPyramid();
+	virtual int  DownloadFeatureList(int idx, float * list, float * xy, float * response);
 	PyramidNaive(SiftParam & sp);
 	~PyramidNaive();
 private:
@@ -112,6 +122,7 @@ public:
 	GLTexImage* GetLevelTexture(int octave, int level);
 	GLTexImage* GetLevelTexture(int octave, int level, int dataName);
     virtual int  IsUsingRectDescription(){return _existing_keypoints & SIFT_RECT_DESCRIPTION; }
+	virtual int  DownloadFeatureList(int idx, float * list, float * xy, float * response);
 private:
     void GenerateFeatureList(int i, int j);
 };
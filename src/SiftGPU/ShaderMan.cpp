@@ -25,11 +25,13 @@
 #include "GL/glew.h"
 #include <vector>
 #include <iostream>
+#include <string>
 #include <stdlib.h>
 #include <math.h>
 using std::vector;
 using std::ostream;
 using std::endl;
+using std::string;
 
 
 #include "ProgramGLSL.h"
@@ -39,15 +41,61 @@ using std::endl;
 #include "ShaderMan.h"
 
 ///
-ShaderBag   * ShaderMan::s_bag = NULL;
+SIFTGPU_THREAD_LOCAL ShaderBag   * ShaderMan::s_bag = NULL;
+
+//the shader bags of a thread (OpenGL context). The pyramids whose options
+//compile to the same shaders share a bag, and it is deleted with the last one
+struct ShaderBagEntry
+{
+	string			key;
+	ShaderBag*		bag;
+	int				refs;
+	ShaderBagEntry*	next;
+};
+static SIFTGPU_THREAD_LOCAL ShaderBagEntry* s_bag_list = NULL;
+
+//the options that are compiled into the shaders
+static string GetShaderKey(SiftParam&param)
+{
+	int ivalue[] = 
+	{
+		GlobalUtil::_usePackedTex, GlobalUtil::_UseSiftGPUEX, GlobalUtil::_FullSupported, GlobalUtil::_IsNvidia,
+		GlobalUtil::_KeepShaderLoop, GlobalUtil::_UseDynamicIndexing, GlobalUtil::_MaxFilterWidth,
+		GlobalUtil::_MaxOrientation, GlobalUtil::_OrientationPack2, GlobalUtil::_FixedOrientation,
+		GlobalUtil::_SubpixelLocalization, GlobalUtil::_DescriptorPPT, GlobalUtil::_KeepExtremumSign, 
+		GlobalUtil::_PreciseBorder, GlobalUtil::_DarknessAdaption,
+		param._sigma_num, param._dog_level_num, param._level_num, param._level_min, param._level_max
+	};
+	float fvalue[] = 
+	{
+		param._sigma0, param._sigman, param._sigma_skip0, param._sigma_skip1,
+		param._dog_threshold, param._edge_threshold, GlobalUtil::_FilterWidthFactor, 
+		GlobalUtil::_OrientationWindowFactor, GlobalUtil::_DescriptorWindowFactor,
+		GlobalUtil::_MulitiOrientationThreshold, GlobalUtil::_OrientationGaussianFactor
+	};
+	string key((const char*) ivalue, sizeof(ivalue));
+	key.append((const char*) fvalue, sizeof(fvalue));
+	if(param._sigma) key.append((const char*) param._sigma, param._sigma_num * sizeof(float));
+	return key;
+}
+
+//the programs of the SIFT passes are traced as the kernel launches when they are used
+#define TRACE_SHADER(name)	if(SiftTracer::IsEnabled()) SiftTracer::Instant(name, "kernel")
 
 //////////////////////////////////////////////////////////////////////
 // Construction/Destruction
 //////////////////////////////////////////////////////////////////////
 
-void ShaderMan::InitShaderMan(SiftParam&param)
+ShaderBag* ShaderMan::InitShaderMan(SiftParam&param)
 {
-	if(s_bag) return;
+	string key = GetShaderKey(param);
+	ShaderBagEntry * entry = s_bag_list;
+	while(entry && entry->key != key) entry = entry->next;
+	if(entry)
+	{
+		entry->refs++;
+		return s_bag = entry->bag;
+	}
 
 	if(GlobalUtil::_usePackedTex )	s_bag = new ShaderBagPKSL;
 	else		                	s_bag =new ShaderBagGLSL;	
@@ -59,13 +107,24 @@ void ShaderMan::InitShaderMan(SiftParam&param)
     GlobalUtil::StopTimer();
 
 	GlobalUtil::CheckErrorsGL("InitShaderMan");
+
+	entry = new ShaderBagEntry;
+	entry->key = key;	entry->bag = s_bag;		entry->refs = 1;
+	entry->next = s_bag_list;	s_bag_list = entry;
+	return s_bag;
 }
 
 
-void ShaderMan::DestroyShaders()
+void ShaderMan::DestroyShaders(ShaderBag* bag)
 {
-	if(s_bag) delete s_bag;
-    s_bag   =   NULL; 
+	ShaderBagEntry ** pentry = &s_bag_list;
+	while(*pentry && (*pentry)->bag != bag) pentry = &(*pentry)->next;
+	if(*pentry == NULL || --(*pentry)->refs > 0) return;
+	ShaderBagEntry * entry = *pentry;
+	*pentry = entry->next;
+	if(s_bag == bag) s_bag = NULL;
+	delete entry->bag;
+	delete entry;
 }
 
 void ShaderMan::UnloadProgram()
@@ -76,6 +135,7 @@ void ShaderMan::UnloadProgram()
 void ShaderMan::FilterImage(FilterProgram* filter, GLTexImage *dst, GLTexImage *src, GLTexImage*tmp)
 {
     if(filter == NULL) return; 
+	TRACE_SHADER("FilterImage");
 
     //////////////////////////////
     src->FillMargin(filter->_size, 0);
@@ -138,6 +198,7 @@ void ShaderMan::FilterSampledImage(GLTexImage* tex, GLTexImage* buf)
 
 void ShaderMan::TextureCopy(GLTexImage*dst, GLTexImage*src)
 {
+	TRACE_SHADER("TextureCopy");
 
 	dst->AttachToFBO(0);
 
@@ -154,6 +215,7 @@ void ShaderMan::TextureCopy(GLTexImage*dst, GLTexImage*src)
 }
 void ShaderMan::TextureDownSample(GLTexImage *dst, GLTexImage *src, int scale)
 {
+	TRACE_SHADER("TextureDownSample");
 	//output parameter
 	
 	dst->AttachToFBO(0);
@@ -176,6 +238,7 @@ void ShaderMan::TextureDownSample(GLTexImage *dst, GLTexImage *src, int scale)
 
 void ShaderMan::TextureUpSample(GLTexImage *dst, GLTexImage *src, int scale)
 {
+	TRACE_SHADER("TextureUpSample");
 
 	//output parameter
 	dst->AttachToFBO(0);
@@ -217,6 +280,7 @@ void ShaderMan::UseShaderDisplayDOG()
 
 void ShaderMan::UseShaderRGB2Gray()
 {
+	TRACE_SHADER("RGB2Gray");
 	if(s_bag && s_bag->s_gray)s_bag->s_gray->UseProgram();
 }
 
@@ -238,6 +302,7 @@ void ShaderMan::UseShaderDisplayKeypoints()
 
 void ShaderMan::UseShaderGradientPass(int texP)
 {
+	TRACE_SHADER("GradientPass");
 	s_bag->s_grad_pass->UseProgram();
 	s_bag->SetGradPassParam(texP);	
 }
@@ -245,6 +310,7 @@ void ShaderMan::UseShaderGradientPass(int texP)
 
 void ShaderMan::UseShaderKeypoint(int texU, int texD)
 {
+	TRACE_SHADER("Keypoint");
 	s_bag->s_keypoint->UseProgram();
 	s_bag->SetDogTexParam(texU, texD);
 }
@@ -253,6 +319,7 @@ void ShaderMan::UseShaderKeypoint(int texU, int texD)
 
 void ShaderMan::UseShaderGenListInit(int w, int h, int tight)
 {
+	TRACE_SHADER("GenListInit");
 	if(tight)
 	{
 		s_bag->s_genlist_init_tight->UseProgram();
@@ -265,6 +332,7 @@ void ShaderMan::UseShaderGenListInit(int w, int h, int tight)
 
 void ShaderMan::UseShaderGenListHisto()
 {
+	TRACE_SHADER("GenListHisto");
 	s_bag->s_genlist_histo->UseProgram();
 
 }
@@ -274,22 +342,35 @@ void ShaderMan::UseShaderGenListHisto()
 
 void ShaderMan::UseShaderGenListStart(float fw, int tex0)
 {
+	TRACE_SHADER("GenListStart");
 	s_bag->s_genlist_start->UseProgram();
 	s_bag->SetGenListStartParam(fw, tex0);
 }
 
 void ShaderMan::UseShaderGenListStep(int tex, int tex0)
 {
+	TRACE_SHADER("GenListStep");
 	s_bag->s_genlist_step->UseProgram();
 	s_bag->SetGenListStepParam( tex,  tex0);
 }
 
 void ShaderMan::UseShaderGenListEnd(int ktex)
 {
+	TRACE_SHADER("GenListEnd");
 	s_bag->s_genlist_end->UseProgram();
 	s_bag->SetGenListEndParam(ktex);
 }
 
+//returns 0 if the shaders can't sample the responses
+int ShaderMan::UseShaderGenListResponse(int dtex)
+{
+	if(s_bag->s_genlist_response == NULL) return 0;
+	TRACE_SHADER("GenListResponse");
+	s_bag->s_genlist_response->UseProgram();
+	s_bag->SetGenListResponseParam(dtex);
+	return 1;
+}
+
 void ShaderMan::UseShaderDebug()
 {
 	if(s_bag->s_debug)	s_bag->s_debug->UseProgram();
@@ -302,22 +383,26 @@ void ShaderMan::UseShaderZeroPass()
 
 void ShaderMan::UseShaderGenVBO( float width, float fwidth, float size)
 {
+	TRACE_SHADER("GenVBO");
 	s_bag->s_vertex_list->UseProgram();
 	s_bag->SetGenVBOParam(width, fwidth, size);
 }
 void ShaderMan::UseShaderMarginCopy(int xmax, int ymax)
 {
+	TRACE_SHADER("MarginCopy");
 	s_bag->s_margin_copy->UseProgram();
 	s_bag->SetMarginCopyParam(xmax, ymax);
 	
 }
 void ShaderMan::UseShaderCopyKeypoint()
 {
+	TRACE_SHADER("CopyKeypoint");
 	s_bag->s_copy_key->UseProgram();
 }
 
 void ShaderMan::UseShaderSimpleOrientation(int oTex, float sigma, float sigma_step)
 {
+	TRACE_SHADER("SimpleOrientation");
 	s_bag->s_orientation->UseProgram();
 	s_bag->SetSimpleOrientationInput(oTex, sigma, sigma_step);
 }
@@ -326,6 +411,7 @@ void ShaderMan::UseShaderSimpleOrientation(int oTex, float sigma, float sigma_st
 
 void ShaderMan::UseShaderOrientation(int gtex, int width, int height, float sigma, int auxtex, float step, int keypoint_list)
 {
+	TRACE_SHADER("Orientation");
 	s_bag->s_orientation->UseProgram();
 
 	//changes in v345. 
@@ -339,6 +425,7 @@ void ShaderMan::UseShaderOrientation(int gtex, int width, int height, float sigm
 
 void ShaderMan::UseShaderDescriptor(int gtex, int otex, int dwidth, int fwidth,  int width, int height, float sigma)
 {
+	TRACE_SHADER("Descriptor");
 	s_bag->s_descriptor_fp->UseProgram();
 	s_bag->SetFeatureDescirptorParam(gtex, otex, (float)dwidth,  (float)fwidth, (float)width, (float)height, sigma);
 }
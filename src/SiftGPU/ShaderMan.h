@@ -40,7 +40,7 @@ class FilterGLSL;
 class ShaderMan
 {
 public:
-	static ShaderBag*   s_bag;
+	static SIFTGPU_THREAD_LOCAL ShaderBag*   s_bag;
 public:
 	static void SelectInitialSmoothingFilter(int octave_min, SiftParam&param); 
 	static void UseShaderMarginCopy(int xmax, int ymax);
@@ -54,6 +54,7 @@ public:
 	static void UseShaderGenListStart(float fw, int tex0);
 	static void UseShaderGenListStep(int tex, int tex0);
 	static void UseShaderGenListEnd(int ktex);
+	static int  UseShaderGenListResponse(int dtex);
 	static void UseShaderGenListHisto();
 	static void UseShaderGenListInit(int w, int h, int tight = 1);
 	static void UseShaderKeypoint(int texU, int texD);
@@ -71,8 +72,12 @@ public:
 	static void TextureDownSample(GLTexImage* dst, GLTexImage*src, int scale = 2);
 	static void TextureUpSample(GLTexImage* dst, GLTexImage*src, int scale);
 	///////////////////////////////////////////////
-	static void InitShaderMan(SiftParam&param);
-	static void DestroyShaders();
+	//load the shaders for the options, or share the loaded ones of the same options.
+	//The returned bag is used by the following calls until another is selected
+	static ShaderBag* InitShaderMan(SiftParam&param);
+	static void SelectShaderBag(ShaderBag* bag) {s_bag = bag; }
+	//release a bag of InitShaderMan
+	static void DestroyShaders(ShaderBag* bag);
 	static int  HaveShaderMan(){return s_bag != NULL;}
 	static void UnloadProgram();
 };
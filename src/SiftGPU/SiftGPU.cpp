@@ -31,6 +31,7 @@
 #include <vector>
 #include <algorithm>
 #include <math.h>
+#include <stdlib.h>
 
 #include <time.h>
 using namespace std;
@@ -43,6 +44,10 @@ using namespace std;
 #include "FrameBufferObject.h"
 #include "SiftPyramid.h"
 #include "PyramidGL.h"
+#include "FrameStream.h"
+#include "FeatureCache.h"
+#include "SiftGPURequest.h"
+#include "SiftProfiler.h"
 
 //CUDA works only with vc8 or higher
 #if defined(CUDA_SIFTGPU_ENABLED)
@@ -81,6 +86,89 @@ using namespace std;
 //just want to make this class invisible
 class ImageList:public std::vector<std::string> {};
 
+//the parameters of a SiftGPU instance are loaded into the thread-local GlobalParam
+//when its functions are called, and saved back when they return. The nested calls
+//of the same instance keep the loaded parameters. 
+static SIFTGPU_THREAD_LOCAL SiftConfig* s_active_config = NULL;
+
+class ConfigScope
+{
+	SiftConfig*	_config;
+	SiftConfig*	_previous;
+public:
+	ConfigScope(SiftConfig* config, SiftPyramid* pyramid)
+	{
+		//the shaders are shared per thread only by the instances of the same options
+		if(pyramid) pyramid->SelectShaders();
+		_config = config;
+		_previous = s_active_config;
+		if(_previous == _config) return;
+		if(_previous) GlobalParam::SaveConfig(*_previous);
+		GlobalParam::LoadConfig(*_config);
+		s_active_config = _config;
+	}
+	~ConfigScope()
+	{
+		if(_previous == _config) return;
+		//the parameters stay loaded for SiftMatchGPU
+		GlobalParam::SaveConfig(*_config);
+		if(_previous) GlobalParam::LoadConfig(*_previous);
+		s_active_config = _previous;
+	}
+};
+
+//the profiler of a SiftGPU instance is active between the scopes of a run, and the
+//outermost scope is the run. It follows the ConfigScope that loads -profile.
+class ProfileScope
+{
+	SiftProfiler*	_previous;
+	int				_outer;
+public:
+	ProfileScope(SiftProfiler*& profiler)
+	{
+		_previous = GlobalUtil::_profiler;
+		_outer = _previous == NULL || _previous != profiler;
+		if(!_outer) return;
+		if(GlobalUtil::_ProfileDetail > 0)
+		{
+			if(profiler == NULL) profiler = new SiftProfiler;
+			profiler->BeginRun();
+			GlobalUtil::_profiler = profiler;
+		}else
+		{
+			GlobalUtil::_profiler = NULL;
+		}
+	}
+	void Finish(int features)
+	{
+		if(_outer && GlobalUtil::_profiler) GlobalUtil::_profiler->EndRun(features);
+	}
+	~ProfileScope()
+	{
+		if(!_outer) return;
+		//the runs that return early are ended here, EndRun does nothing after Finish
+		if(GlobalUtil::_profiler) GlobalUtil::_profiler->EndRun(-1);
+		GlobalUtil::_profiler = _previous;
+	}
+};
+
+//the trace of -trace <file> is saved when the program exits
+static char s_trace_path[_MAX_PATH] = "";
+
+static void SaveTraceAtExit()
+{
+	if(s_trace_path[0]) SiftTracer::Save(s_trace_path);
+}
+
+static void StartTraceFile(const char * path)
+{
+	GlobalUtil::EnterGlobalLock();
+	if(s_trace_path[0] == 0) atexit(SaveTraceAtExit);
+	strncpy(s_trace_path, path, _MAX_PATH - 1);
+	GlobalUtil::LeaveGlobalLock();
+	SiftTracer::Start();
+}
+
 SiftGPU::SiftGPU(int np)
 { 
 	_texImage = new GLTexInput;
@@ -92,6 +180,11 @@ SiftGPU::SiftGPU(int np)
 	_current = 0;
 	_list = new ImageList();
 	_pyramid = NULL;
+	_stream = NULL;
+	_cache = NULL;
+	_config = new SiftConfig;
+	_profiler = NULL;
+	for(int i = 0; i < 10; ++i) _timing[i] = 0;
 }
 
 
@@ -100,7 +193,7 @@ SiftGPUEX::SiftGPUEX()
 {
 	_view = _sub_view = 0;
 	_view_debug = 0;
-	GlobalUtil::_UseSiftGPUEX = 1;
+	_config->_UseSiftGPUEX = 1;
 	srand((unsigned int)time(NULL));
 	RandomizeColor();
 }
@@ -115,6 +208,10 @@ void* SiftGPU::operator new (size_t  size){
   return p; 
 }
 
+void SiftGPU::operator delete (void * p){
+  free(p);
+}
+
 
 void SiftGPUEX::RandomizeColor()
 {
@@ -128,11 +225,22 @@ void SiftGPUEX::RandomizeColor()
 
 SiftGPU::~SiftGPU()
 {
-	if(_pyramid) delete _pyramid; 
-	delete _texImage;
+	{
+		ConfigScope scope(_config, _pyramid);
+		if(_stream)
+		{
+			_texImage = _stream->GetInput(0);
+			delete _stream;
+		}
+		if(_cache) delete _cache;
+		if(_pyramid) delete _pyramid; 
+		delete _texImage;
+	}
 	delete _list;
     delete[] _imgpath;
     delete[] _outpath;
+	delete _config;
+	if(_profiler) delete _profiler;
 }
 
 
@@ -194,7 +302,7 @@ inline void SiftGPU::InitSiftGPU()
 	{
 		GlobalUtil::StartTimer("Initialize Pyramids");
 		_pyramid->InitPyramid(GlobalUtil::_InitPyramidWidth, GlobalUtil::_InitPyramidHeight, 0);
-		GlobalUtil::StopTimer();
+		_pyramid->StopStageTimer();
 	}
 
 	ClockTimer::InitHighResolution();
@@ -203,6 +311,7 @@ inline void SiftGPU::InitSiftGPU()
 
 int	 SiftGPU::RunSIFT(int index)
 {
+	ConfigScope scope(_config, _pyramid);
 	if(_list->size()>0 )
 	{
 		index = index % _list->size();
@@ -222,6 +331,14 @@ int	 SiftGPU::RunSIFT(int index)
 
 int  SiftGPU::RunSIFT( int width,  int height, const void * data, unsigned int gl_format, unsigned int gl_type)
 {
+	ConfigScope scope(_config, _pyramid);
+	return RunSIFT(width, height, data, gl_format, gl_type, 0, NULL);
+}
+
+int  SiftGPU::RunSIFT( int width,  int height, const void * data, unsigned int gl_format, unsigned int gl_type,
+					  int row_bytes, const int * roi)
+{
+	ConfigScope scope(_config, _pyramid);
 
 	if(GlobalUtil::_GoodOpenGL ==0 ) return 0;
 	if(!_initialized) InitSiftGPU();
@@ -230,22 +347,42 @@ int  SiftGPU::RunSIFT( int width,  int height, const void * data, unsigned int g
 
 	if(width > 0 && height >0 && data != NULL)
 	{
+		ProfileScope profile(_profiler);
+		if(roi)
+		{
+			int pixel_size = GLTexInput::GetPixelSizeGL(gl_format, gl_type);
+			if(pixel_size == 0 || roi[0] < 0 || roi[1] < 0 || roi[2] <= 0 || roi[3] <= 0 ||
+				roi[0] + roi[2] > width || roi[1] + roi[3] > height)
+			{
+				std::cerr << "Invalid region of interest\n";
+				return 0;
+			}
+			if(row_bytes == 0) row_bytes = width * pixel_size;
+			data = ((const char*) data) + roi[1] * (size_t) row_bytes + roi[0] * pixel_size;
+			width = roi[2];
+			height = roi[3];
+		}
+
 		_imgpath[0] = 0;
+		SetupCache();
 		//try downsample the image on CPU
 		GlobalUtil::StartTimer("Upload Image data");
-		if(_texImage->SetImageData(width, height, data, gl_format, gl_type))
+		if(_texImage->SetImageData(width, height, data, gl_format, gl_type, row_bytes))
 		{
 			_image_loaded = 2; //gldata;
-			GlobalUtil::StopTimer();
+			_pyramid->StopStageTimer();
+			GlobalUtil::ProfileData(-1, (double) width * height * GLTexInput::GetPixelSizeGL(gl_format, gl_type));
 			_timing[0] = GlobalUtil::GetElapsedTime();
 			
 			//if the size of image is different, the pyramid need to be reallocated.
 			GlobalUtil::StartTimer("Initialize Pyramid");
-			_pyramid->InitPyramid(width, height, _texImage->_down_sampled);
-			GlobalUtil::StopTimer();
+			if(_texImage->_cache_hit < 0) _pyramid->InitPyramid(width, height, _texImage->_down_sampled);
+			_pyramid->StopStageTimer();
 			_timing[1] = GlobalUtil::GetElapsedTime();
 
-			return RunSIFT();
+			int result = RunSIFT();
+			profile.Finish(result ? _pyramid->GetFeatureNum() : -1);
+			return result;
 		}else
 		{
 			return 0;
@@ -257,8 +394,87 @@ int  SiftGPU::RunSIFT( int width,  int height, const void * data, unsigned int g
 
 }
 
+int SiftGPU::BeginStream(int width, int height, unsigned int gl_format, unsigned int gl_type, int row_bytes)
+{
+	ConfigScope scope(_config, _pyramid);
+	EndStream();
+	if(GlobalUtil::_GoodOpenGL ==0 ) return 0;
+	if(!_initialized) InitSiftGPU();
+	else GlobalUtil::SetGLParam();
+	if(GlobalUtil::_GoodOpenGL ==0 || width <= 0 || height <= 0) return 0;
+
+	_stream = new FrameStream(_texImage, width, height, gl_format, gl_type, row_bytes);
+	if(_stream->IsValid()) return 1;
+	delete _stream;
+	_stream = NULL;
+	return 0;
+}
+
+int SiftGPU::PushFrame(const void * data)
+{
+	ConfigScope scope(_config, _pyramid);
+	if(_stream == NULL || data == NULL) return 0;
+	_stream->PushFrame(data);
+	return 1;
+}
+
+int SiftGPU::PopFeatures()
+{
+	ConfigScope scope(_config, _pyramid);
+	if(_stream == NULL || _stream->GetQueuedNum() == 0) return -1;
+
+	ProfileScope profile(_profiler);
+	int width = _stream->GetWidth(), height = _stream->GetHeight();
+	//the frame is normally uploaded, and its pyramid built, by the previous PopFeatures
+	int uploaded = _stream->IsUploaded(0);
+	GlobalUtil::StartTimer("Upload Image data");
+	GLTexInput * input = _stream->UploadFrame(0, 1);
+	_pyramid->StopStageTimer();
+	if(input && !uploaded) GlobalUtil::ProfileData(-1, (double) width * height * GLTexInput::GetPixelSizeGL(_stream->GetFormat(), _stream->GetType()));
+	_timing[0] = uploaded ? 0 : GlobalUtil::GetElapsedTime();
+	int done = input != NULL;
+	if(done)
+	{
+		_texImage = input;
+		_imgpath[0] = 0;
+		_image_loaded = 2; 
+		//the pyramid is set up by the first frame, and kept for the rest of the stream
+		if(_stream->GetFrameCount() == 0)
+		{
+			GlobalUtil::StartTimer("Initialize Pyramid");
+			_pyramid->InitPyramid(width, height, _texImage->_down_sampled);
+			_pyramid->StopStageTimer();
+			_timing[1] = GlobalUtil::GetElapsedTime();
+		}else
+		{
+			_timing[1] = 0;
+		}
+
+		//the next frame is uploaded to the other input while this one is processed,
+		//and its pyramid is built while the features of this one are read
+		_stream->UploadFrame(1, 0);
+		done = RunSIFT();
+		GLTexInput * next = _stream->IsUploaded(1) ? _stream->UploadFrame(1, 0) : NULL;
+		if(done && next) _pyramid->PrebuildPyramid(next);
+	}
+	profile.Finish(done ? _pyramid->GetFeatureNum() : -1);
+	_stream->ReleaseFrame();
+	return done ? GetFeatureNum() : -1;
+}
+
+void SiftGPU::EndStream()
+{
+	ConfigScope scope(_config, _pyramid);
+	if(_stream == NULL) return;
+	_texImage = _stream->GetInput(0);
+	_pyramid->CancelPrebuild();
+	delete _stream;
+	_stream = NULL;
+}
+
 int  SiftGPU::RunSIFT(const char * imgpath)
 {
+	ConfigScope scope(_config, _pyramid);
 	if(imgpath && imgpath[0])
 	{
 		//set the new image
@@ -275,6 +491,7 @@ int  SiftGPU::RunSIFT(const char * imgpath)
 
 int SiftGPU::RunSIFT(int num, const SiftKeypoint * keys, int keys_have_orientation)
 {
+	ConfigScope scope(_config, _pyramid);
 	if(num <=0) return 0;
 	_pyramid->SetKeypointList(num, (const float*) keys, 1, keys_have_orientation);
 	return RunSIFT();
@@ -282,6 +499,7 @@ int SiftGPU::RunSIFT(int num, const SiftKeypoint * keys, int keys_have_orientati
 
 int SiftGPU::RunSIFT()
 {
+	ConfigScope scope(_config, _pyramid);
 	//check image data
 	if(_imgpath[0]==0 && _image_loaded == 0) return 0;
 
@@ -301,7 +519,31 @@ int SiftGPU::RunSIFT()
 		GlobalUtil::SetGLParam();
 	}
 
+	ProfileScope profile(_profiler);
 	timer.StartTimer("RUN SIFT");
+	SetupCache();
+
+	//the input of a cache hit is not uploaded. It is loaded again from the file if it
+	//is processed on the gpu, and the pixel data must be set again in that case
+	if(_image_loaded == 1 && _texImage->_cache_hit >= 0)
+	{
+		int cached = _texImage->_cache == NULL ? -1 : _cache->Load(FeatureCache::HashData(&_texImage->_data_hash,
+						sizeof(FeatureCache::Key), _texImage->_cache_seed), _pyramid->_keypoint_buffer, _pyramid->_descriptor_buffer);
+		if(cached >= 0)
+		{
+			_texImage->_cache_hit = cached;
+			_image_loaded = 2;
+		}else if(_imgpath[0])
+		{
+			_texImage->_cache = NULL;
+			_image_loaded = 0;
+		}else
+		{
+			std::cerr << "The input is not uploaded after a feature cache hit, set the image data again\n";
+			return 0;
+		}
+	}
+
 	//process input image file
 	if( _image_loaded ==0)
 	{
@@ -310,19 +552,19 @@ int SiftGPU::RunSIFT()
 		GlobalUtil::StartTimer("Load Input Image");
 		if(!_texImage->LoadImageFile(_imgpath, width, height)) return 0;
 		_image_loaded = 1;
-		GlobalUtil::StopTimer();
+		_pyramid->StopStageTimer();
 		_timing[0] = GlobalUtil::GetElapsedTime();
 
 		//make sure the pyrmid can hold the new image.
 		GlobalUtil::StartTimer("Initialize Pyramid");
-		_pyramid->InitPyramid(width, height, _texImage->_down_sampled);
-		GlobalUtil::StopTimer();
+		if(_texImage->_cache_hit < 0) _pyramid->InitPyramid(width, height, _texImage->_down_sampled);
+		_pyramid->StopStageTimer();
 		_timing[1] = GlobalUtil::GetElapsedTime();
 
 	}else
 	{
 		//change some global states
-        if(!GlobalUtil::_UseCUDA && !GlobalUtil::_UseOpenCL)
+        if(!GlobalUtil::_UseCUDA && !GlobalUtil::_UseOpenCL && _texImage->_cache_hit < 0)
 		{
 			GlobalUtil::FitViewPort(1,1);
 			_texImage->FitTexViewPort();
@@ -336,15 +578,31 @@ int SiftGPU::RunSIFT()
 		}
 	}
 
-	if(_pyramid->_allocated ==0 ) return 0;
+	int cached = _texImage->_cache_hit;
+	if(cached < 0 && _pyramid->_allocated ==0 ) return 0;
 
 
 #ifdef DEBUG_SIFTGPU
 	_pyramid->BeginDEBUG(_imgpath);
 #endif
 
-	//process the image
-	_pyramid->RunSIFT(_texImage);
+	if(cached >= 0)
+	{
+		_pyramid->CleanupBeforeSIFT();
+		_pyramid->SetFeatureNum(cached);
+		if(GlobalUtil::_verbose) std::cout << "[Feature Cache]:	" << cached << " features\n";
+	}else
+	{
+		//process the image
+		_pyramid->RunSIFT(_texImage);
+		if(_texImage->_cache && _texImage->_data_hash && _pyramid->GetSucessStatus())
+		{
+			FeatureCache::Key key = FeatureCache::HashData(&_texImage->_data_hash, sizeof(FeatureCache::Key), _texImage->_cache_seed);
+			if(GlobalUtil::_DescriptorPPT) _pyramid->ExpandDescriptorsU8();
+			_cache->Save(key, _pyramid->GetFeatureNum(), &_pyramid->_keypoint_buffer[0], 
+				GlobalUtil::_DescriptorPPT ? &_pyramid->_descriptor_buffer[0] : NULL);
+		}
+	}
 
     //read back the timing
 	_pyramid->GetPyramidTiming(_timing + 2);
@@ -358,12 +616,29 @@ int SiftGPU::RunSIFT()
 	timer.StopTimer();
 	if(GlobalUtil::_verbose)std::cout<<endl;
 
+	profile.Finish(_pyramid->GetSucessStatus() ? _pyramid->GetFeatureNum() : -1);
     return _pyramid->GetSucessStatus();
 }
 
 
+//the feature cache is not used for keypoint lists, detection masks, or for display
+void SiftGPU::SetupCache()
+{
+	if(_cache && !_pyramid->HasKeypointList() && !_pyramid->HasDetectionMask() && !GlobalUtil::_UseSiftGPUEX)
+	{
+		_texImage->_cache = _cache;
+		_texImage->_cache_seed = FeatureCache::HashParam(*this);
+		_texImage->_cache_keys = &_pyramid->_keypoint_buffer;
+		_texImage->_cache_descriptors = &_pyramid->_descriptor_buffer;
+	}else
+	{
+		_texImage->_cache = NULL;
+	}
+}
+
 void SiftGPU::SetKeypointList(int num, const SiftKeypoint * keys, int keys_have_orientation)
 {
+	ConfigScope scope(_config, _pyramid);
 	_pyramid->SetKeypointList(num, (const float*)keys, 0, keys_have_orientation);
 }
 
@@ -379,6 +654,7 @@ void SiftGPUEX::DisplayInput()
 
 void SiftGPU::SetVerbose(int verbose)
 {
+	ConfigScope scope(_config, _pyramid);
 	GlobalUtil::_timingO = verbose>2;
 	GlobalUtil::_timingL = verbose>3;
 	if(verbose == -1)
@@ -610,6 +886,7 @@ void SiftGPUEX::DisplayLevel(void (*UseDisplayShader)(), int i)
 
 void SiftGPUEX::DisplaySIFT()
 {
+	ConfigScope scope(_config, _pyramid);
 	if(_pyramid == NULL) return;
     glEnable(GlobalUtil::_texTarget);
 	switch(_view)
@@ -642,6 +919,7 @@ void SiftGPUEX::DisplaySIFT()
 
 void SiftGPUEX::SetView(int view, int sub_view, char *title)
 {
+	ConfigScope scope(_config, _pyramid);
 	const char* view_titles[] =
 	{
 		"Original Image",
@@ -688,18 +966,30 @@ void SiftGPU::PrintUsage()
 	<<"                    Use GPU first, and use CPU when reduction size <= pow(2,num)\n"
 	<<"                    When <num> is missing or equals -1, no GPU will be used\n"
 	<<"-noprep           : Upload raw data to GPU (default: RGB->LUM and down-sample on CPU)\n"
+	<<"-box              : Average pixel blocks when down-sampling on CPU (default: point sampling)\n"
 	<<"-sd               : Skip descriptor computation if specified\n"
 	<<"-unn    *         : Write unnormalized descriptor if specified\n"
 	<<"-b      *         : Write binary sift file if specified\n"
+	<<"-b8     *         : Write binary sift file with uint8 descriptors (dimension -128)\n"
+	<<"-u8               : Quantize the descriptors to uint8 on the GPU, and read back bytes\n"
+	<<"                    (for GetFeatureVectorU8, the float descriptors are then dequantized)\n"
 	<<"-fs <int>         : Block Size for freature storage <default : 4>\n"
     <<"-cuda <int=0>     : Use CUDA SiftGPU, and specifiy the device index\n"
 	<<"-tight            : Automatically resize pyramid to fit new images tightly\n"
 	<<"-p  <W>x<H>       : Inititialize the pyramids to contain image of WxH (eg -p 1024x768)\n"
-	<<"-tc[1|2|3] <int> *: Threshold for limiting the overall number of features (3 methods)\n"
+	<<"-tc[1|2|3|4] <int>: Threshold for limiting the overall number of features (4 methods)\n"
+	<<"                    -tc4 keeps the locations with the strongest DoG responses\n"
+	<<"-grid <int>       : Spread the -tc budget over a grid of NxN cells (by DoG response)\n"
+	<<"-anms             : Spread the -tc budget by adaptive non-maximal suppression\n"
 	<<"-v <int>          : Level of timing details. Same as calling Setverbose() function\n"
+	<<"-profile <int> *  : Profile the stages(1), octaves(2) and levels(3), see GetProfileScope\n"
+	<<"                    2 and 3 wait for the GPU after each octave or level\n"
+	<<"-trace <file>     : Save the timeline of all threads to file at exit (Chrome trace)\n"
 	<<"-loweo            : (0, 0) at center of top-left pixel (defaut: corner)\n"
 	<<"-maxd <int> *     : Max working dimension (default : 2560 (unpacked) / 3200 (packed))\n"
 	<<"-nomc             : Disabling auto-downsamping that try to fit GPU memory cap\n"
+	<<"-cpu <int>   *    : Number of threads for CPU-side processing (default : 0, all cores)\n"
+	<<"-cache <dir> [MB] : Cache the features of input images in dir, up to MB (default : 1024)\n"
 	<<"-exit             : Exit program after processing the input image\n"
 	<<"-unpack           : Use the old unpacked implementation\n"
 	<<"-di               : Use dynamic array indexing if available (defualt : no)\n"
@@ -715,6 +1005,7 @@ void SiftGPU::PrintUsage()
 
 void SiftGPU::ParseParam(int argc, char **argv)
 {
+	ConfigScope scope(_config, _pyramid);
     #define CHAR1_TO_INT(x)         ((x >= 'A' && x <= 'Z') ? x + 32 : x)
     #define CHAR2_TO_INT(str, i)    (str[i] ? CHAR1_TO_INT(str[i]) + (CHAR1_TO_INT(str[i+1]) << 8) : 0)  
     #define CHAR3_TO_INT(str, i)    (str[i] ? CHAR1_TO_INT(str[i]) + (CHAR2_TO_INT(str, i + 1) << 8) : 0)
@@ -728,6 +1019,8 @@ void SiftGPU::ParseParam(int argc, char **argv)
     #define mychar1    '1'
     #define mychar2    '2'
     #define mychar3    '3'
+    #define mychar4    '4'
+    #define mychar8    '8'
     #define mychara    'a'
     #define mycharb    'b'
     #define mycharc    'c'
@@ -839,6 +1132,9 @@ void SiftGPU::ParseParam(int argc, char **argv)
         case MAKEINT4(n, o, p, r): //noprep
 			GlobalUtil::_PreProcessOnCPU = 0;
             break;            
+        case MAKEINT3(b, o, x):
+			GlobalUtil::_DownSampleAverage = 1;
+            break;            
         case MAKEINT4(f, b, o, 1):
 			FrameBufferObject::UseSingleFBO =1;
             break;            
@@ -857,6 +1153,12 @@ void SiftGPU::ParseParam(int argc, char **argv)
         case MAKEINT1(b):
 			GlobalUtil::_BinarySIFT = 1;
             break;            
+        case MAKEINT2(b, 8):
+			GlobalUtil::_BinarySIFT = 2;
+            break;            
+        case MAKEINT2(u, 8):
+			GlobalUtil::_DescriptorU8 = 1;
+            break;            
         case MAKEINT4(t, i, g, h): //tight
 			GlobalUtil::_ForceTightPyramid = 1;
             break;            
@@ -922,6 +1224,9 @@ void SiftGPU::ParseParam(int argc, char **argv)
 		case MAKEINT4(n, o, m, c):
 			GlobalUtil::_FitMemoryCap = 0;
 			break;
+		case MAKEINT4(a, n, m, s):
+			GlobalUtil::_FeatureANMS = 1;
+			break;
         default:
             if(i + 1 >= argc) break;
             switch(opti)
@@ -940,6 +1245,21 @@ void SiftGPU::ParseParam(int argc, char **argv)
                 LoadImageList(param);
                 i++;
                 break;            
+            case MAKEINT4(c, a, c, h):
+                {
+                    //the size limit is optional
+                    int mb = 0;
+                    if(i + 2 < argc && sscanf(argv[i + 2], "%d", &mb) == 1 && mb > 0) i++;
+                    else mb = 0;
+                    if(_cache) delete _cache;
+                    _cache = new FeatureCache(param, mb);
+                    i++;
+                }
+                break;
+            case MAKEINT4(t, r, a, c):
+                StartTraceFile(param);
+                i++;
+                break;
             case MAKEINT1(o):
                 strcpy(_outpath, param);
                 i++;
@@ -1039,6 +1359,16 @@ void SiftGPU::ParseParam(int argc, char **argv)
                     }
                     break;
                 }
+            case MAKEINT4(g, r, i, d): 
+                {
+                    int num = 0;
+                    if(sscanf(param, "%d", &num) && num >=1)
+                    {
+                        GlobalUtil::_FeatureGridSize = num;
+                        i++;
+                    }
+                    break;
+                }
             case MAKEINT2(f, s): 
                 {
                     int num = 0;
@@ -1099,6 +1429,7 @@ void SiftGPU::ParseParam(int argc, char **argv)
                 }
             case MAKEINT3(t, c, 2): //downward
             case MAKEINT3(t, c, 3):
+            case MAKEINT3(t, c, 4): //strongest
             case MAKEINT2(t, c):  //tc
             case MAKEINT3(t, c, 1):  //
                 {
@@ -1106,6 +1437,7 @@ void SiftGPU::ParseParam(int argc, char **argv)
                     {
                         case MAKEINT3(t, c, 2): GlobalUtil::_TruncateMethod = 1; break;
                         case MAKEINT3(t, c, 3): GlobalUtil::_TruncateMethod = 2; break;
+                        case MAKEINT3(t, c, 4): GlobalUtil::_TruncateMethod = 3; break;
                         default:                GlobalUtil::_TruncateMethod = 0; break;
                     }
                     int num = -1;
@@ -1125,6 +1457,16 @@ void SiftGPU::ParseParam(int argc, char **argv)
                     }
                     break;                
                 }
+            case MAKEINT4(p, r, o, f): //profile
+                {
+                    int num = 0;
+                    if(sscanf(param, "%d", &num) && num >= 0 && num <= 3)
+                    {
+                        GlobalParam::_ProfileDetail = num;
+                        i++;
+                    }
+                    break;
+                }
             case MAKEINT4(m, a, x, d):   
                 {
                     int num = 0;
@@ -1144,6 +1486,16 @@ void SiftGPU::ParseParam(int argc, char **argv)
                     }
                     break;
                 } 
+            case MAKEINT3(c, p, u):
+                {
+                    int num = 0;
+                    if(sscanf(param, "%d", &num) && num >= 0)
+                    {
+                        GlobalUtil::_CPUThreadNum = num;
+                        i++;
+                    }
+                    break;
+                }
             default:
                 break;
             }	        
@@ -1287,6 +1639,7 @@ void SiftGPUEX::DisplayDebug()
 
 int SiftGPU::CreateContextGL()
 {
+	ConfigScope scope(_config, _pyramid);
     if(GlobalUtil::_UseOpenCL || GlobalUtil::_UseCUDA)
     {
         //do nothing
@@ -1305,17 +1658,20 @@ int SiftGPU::CreateContextGL()
 
 int SiftGPU::VerifyContextGL()
 {
+	ConfigScope scope(_config, _pyramid);
 	InitSiftGPU();
 	return (GlobalUtil::_GoodOpenGL > 0) + GlobalUtil::_FullSupported;
 }
 
 int SiftGPU::IsFullSupported()
 {
+	ConfigScope scope(_config, _pyramid);
 	return GlobalUtil::_GoodOpenGL > 0 &&  GlobalUtil::_FullSupported;
 }
 
 void SiftGPU::SaveSIFT(const char * szFileName)
 {
+	ConfigScope scope(_config, _pyramid);
 	_pyramid->SaveSIFT(szFileName);
 }
 
@@ -1326,6 +1682,7 @@ int SiftGPU::GetFeatureNum()
 
 void SiftGPU::GetFeatureVector(SiftKeypoint * keys, float * descriptors)
 {
+	ConfigScope scope(_config, _pyramid);
 //	keys.resize(_pyramid->GetFeatureNum());
 	if(GlobalUtil::_DescriptorPPT)
 	{
@@ -1338,13 +1695,33 @@ void SiftGPU::GetFeatureVector(SiftKeypoint * keys, float * descriptors)
 	}
 }
 
+void SiftGPU::GetFeatureVectorU8(SiftKeypoint * keys, unsigned char * descriptors)
+{
+	ConfigScope scope(_config, _pyramid);
+	_pyramid->CopyFeatureVectorU8((float*) keys, GlobalUtil::_DescriptorPPT ? descriptors : NULL);
+}
+
+void SiftGPU::SetDetectionMask(int width, int height, const unsigned char * mask)
+{
+	ConfigScope scope(_config, _pyramid);
+	if(_pyramid) _pyramid->SetDetectionMask(width, height, mask);
+}
+
+void SiftGPU::SetDetectionROI(int num, const int * rois)
+{
+	ConfigScope scope(_config, _pyramid);
+	if(_pyramid) _pyramid->SetDetectionROI(num, rois);
+}
+
 void SiftGPU::SetTightPyramid(int tight)
 {
+	ConfigScope scope(_config, _pyramid);
 	GlobalUtil::_ForceTightPyramid = tight;
 }
 
 int SiftGPU::AllocatePyramid(int width, int height)
 {
+	ConfigScope scope(_config, _pyramid);
 	_pyramid->_down_sample_factor = 0;
 	_pyramid->_octave_min = GlobalUtil::_octave_min_default;
 	if(GlobalUtil::_octave_min_default>=0)
@@ -1362,11 +1739,62 @@ int SiftGPU::AllocatePyramid(int width, int height)
 
 void SiftGPU::SetMaxDimension(int sz)
 {
+	ConfigScope scope(_config, _pyramid);
 	if(sz < GlobalUtil::_texMaxDimGL)
 	{
 		GlobalUtil::_texMaxDim = sz;
 	}
 }
+void SiftGPU::GetConfig(SiftConfig& config)
+{
+	ConfigScope scope(_config, _pyramid);
+	GlobalParam::SaveConfig(config);
+}
+
+void SiftGPU::SetConfig(const SiftConfig& config)
+{
+	ConfigScope scope(_config, _pyramid);
+	GlobalParam::LoadConfig(config, !_initialized);
+}
+
+int SiftGPU::GetPyramidMemoryKB()
+{
+	return _pyramid && _pyramid->_allocated ? _pyramid->_allocated_kb : 0;
+}
+
+void SiftGPU::GetImageDimension( int &w,  int &h)
+{
+	w = _texImage->GetImgWidth();
+	h = _texImage->GetImgHeight();
+}
+
+int SiftGPU::GetProfileScopeNum()
+{
+	return _profiler ? _profiler->GetScopeNum() : 0;
+}
+
+int SiftGPU::GetProfileScope(int index, SiftProfileScope& scope)
+{
+	return _profiler ? _profiler->GetScope(index, scope) : 0;
+}
+
+const char* SiftGPU::GetProfileJSON()
+{
+	if(_profiler == NULL) _profiler = new SiftProfiler;
+	return _profiler->GetJSON();
+}
+
+int SiftGPU::SaveProfile(const char * path)
+{
+	if(_profiler == NULL) _profiler = new SiftProfiler;
+	return _profiler->SaveJSON(path);
+}
+
+void SiftGPU::ResetProfile()
+{
+	if(_profiler) _profiler->Reset();
+}
+
 int SiftGPU::GetImageCount()
 {
 	return _list->size();
@@ -1404,15 +1832,9 @@ void SiftGPUEX::HSVtoRGB(float hsv[3],float rgb[3] )
 	}
 }
 
-void SiftGPUEX::GetImageDimension( int &w,  int &h)
-{
-	w = _texImage->GetImgWidth();
-	h = _texImage->GetImgHeight();
-
-}
-
 void SiftGPUEX::GetInitWindowPotition(int&x, int&y)
 {
+	ConfigScope scope(_config, _pyramid);
 	x = GlobalUtil::_WindowInitX;
 	y = GlobalUtil::_WindowInitY;
 }
@@ -1422,6 +1844,21 @@ SiftGPU* CreateNewSiftGPU(int np)
 	return new SiftGPU(np);
 }
 
+void StartSiftTrace(int events_per_thread)
+{
+	SiftTracer::Start(events_per_thread);
+}
+
+void StopSiftTrace()
+{
+	SiftTracer::Stop();
+}
+
+int SaveSiftTrace(const char * path)
+{
+	return SiftTracer::Save(path);
+}
+
 /////////////////////////////////////////////////////
 void* ComboSiftGPU::operator new (size_t  size){
   void * p = malloc(size);
@@ -1433,8 +1870,102 @@ void* ComboSiftGPU::operator new (size_t  size){
   return p; 
 }
 
+void ComboSiftGPU::operator delete (void * p){
+  free(p);
+}
+
 ComboSiftGPU* CreateComboSiftGPU()
 {
 	return new ComboSiftGPU();
 }
 
+//the asynchronous requests of a local ComboSiftGPU are finished before returning
+static SiftGPURequest* FinishRequest(ComboSiftGPU * combo, SiftGPURequest * request)
+{
+	request->_state = SiftGPURequest::REQUEST_CALLBACK;
+	if(request->_callback) request->_callback(combo, request, request->_user_data);
+	request->_state = SiftGPURequest::REQUEST_FINISHED;
+	if(!request->_released) return request;
+	delete request;
+	return NULL;
+}
+
+static SiftGPURequest* FinishRun(ComboSiftGPU * combo, SiftGPURequest * request, int success)
+{
+	int num = success ? combo->GetFeatureNum() : -1;
+	if(num > 0)
+	{
+		request->_keys.resize(num);
+		request->_descriptors.resize(num * 128);
+		combo->GetFeatureVector(&request->_keys[0], &request->_descriptors[0]);
+	}
+	request->_result = num;
+	return FinishRequest(combo, request);
+}
+
+SiftGPURequest* ComboSiftGPU::RunSIFTAsync(const char * imgpath, RequestCallback callback, void * user_data)
+{
+	return FinishRun(this, new SiftGPURequest(callback, user_data), RunSIFT(imgpath));
+}
+
+SiftGPURequest* ComboSiftGPU::RunSIFTAsync(int width, int height, const void * data, unsigned int gl_format, 
+										   unsigned int gl_type, RequestCallback callback, void * user_data)
+{
+	return FinishRun(this, new SiftGPURequest(callback, user_data), RunSIFT(width, height, data, gl_format, gl_type));
+}
+
+SiftGPURequest* ComboSiftGPU::RunSIFTAsync(int width, int height, const void * data, unsigned int gl_format, 
+										   unsigned int gl_type, int row_bytes, const int * roi, 
+										   RequestCallback callback, void * user_data)
+{
+	return FinishRun(this, new SiftGPURequest(callback, user_data), 
+					RunSIFT(width, height, data, gl_format, gl_type, row_bytes, roi));
+}
+
+SiftGPURequest* ComboSiftGPU::GetSiftMatchAsync(int max_match, float distmax, float ratiomax, 
+												int mutual_best_match, RequestCallback callback, void * user_data)
+{
+	SiftGPURequest * request = new SiftGPURequest(callback, user_data);
+	if(max_match > 0)
+	{
+		request->_matches.resize(max_match * 2);
+		request->_result = GetSiftMatch(max_match, (int(*)[2]) &request->_matches[0], distmax, ratiomax, mutual_best_match);
+		request->_matches.resize(std::max(request->_result, 0) * 2);
+	}else
+	{
+		request->_result = 0;
+	}
+	return FinishRequest(this, request);
+}
+
+int ComboSiftGPU::WaitRequest(SiftGPURequest * request)
+{
+	return request ? request->_result : -1;
+}
+
+int ComboSiftGPU::IsRequestFinished(SiftGPURequest * request)
+{
+	return 1;
+}
+
+void ComboSiftGPU::GetRequestFeatures(SiftGPURequest * request, SiftKeypoint * keys, float * descriptors)
+{
+	if(WaitRequest(request) <= 0) return;
+	if(keys)		std::copy(request->_keys.begin(), request->_keys.end(), keys);
+	if(descriptors)	std::copy(request->_descriptors.begin(), request->_descriptors.end(), descriptors);
+}
+
+void ComboSiftGPU::GetRequestMatches(SiftGPURequest * request, int match_buffer[][2])
+{
+	if(WaitRequest(request) <= 0 || request->_matches.empty()) return;
+	std::copy(request->_matches.begin(), request->_matches.end(), match_buffer[0]);
+}
+
+void ComboSiftGPU::ReleaseRequest(SiftGPURequest * request)
+{
+	if(request == NULL) return;
+	//a request that is released in its callback is deleted after the callback
+	if(request->_state == SiftGPURequest::REQUEST_CALLBACK)	request->_released = 1;
+	else													delete request;
+}
+
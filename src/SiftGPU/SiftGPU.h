@@ -85,11 +85,155 @@ public:
 	SIFTGPU_EXPORT SiftParam();
 };
 
+///////////////////////////////////////////////////////////////////
+//class SiftConfig
+//description: the parameters of one SiftGPU instance, which are
+//the typed version of the options of SiftGPU::ParseParam.
+//It is initialized with the default values, and passed to
+//SiftGPU::SetConfig. Check SiftGPU::PrintUsage for the meanings.
+////////////////////////////////////////////////////////////////////
+class SiftConfig
+{
+public:
+	//device selection and hardware status, fixed after initialization
+	unsigned int	_texTarget;
+	unsigned int	_iTexFormat;
+	int		_texMaxDimGL;
+	int		_MemCapGPU;
+	int		_usePackedTex;
+	int		_IsNvidia;
+	int		_KeepShaderLoop;
+	int		_UseCUDA;
+	int		_UseOpenCL;
+	int		_DeviceIndex;
+	int		_SupportNVFloat;
+	int		_SupportTextureRG;
+	int		_FullSupported;
+	int		_UseDynamicIndexing;
+	int		_MaxFilterWidth;
+	int		_DescriptorPPR;
+	int		_UseSiftGPUEX;
+	int		_GoodOpenGL;
+	//the options that are compiled into the programs, fixed after initialization
+	int		_MaxOrientation;
+	int		_OrientationPack2;
+	int		_SubpixelLocalization;
+	int		_DescriptorPPT;
+	int		_ListGenGPU;
+	int		_ListGenSkipGPU;
+	int		_octave_num_default;
+	int		_KeepExtremumSign;
+	//the options that can be changed at any time
+	int		_texMaxDim;
+	int		_texMinDim;
+	int		_FitMemoryCap;
+	int		_verbose;
+	int		_timingS;
+	int		_timingO;
+	int		_timingL;
+	int		_ProfileDetail;
+	int		_debug;
+	float	_FilterWidthFactor;
+	float	_OrientationWindowFactor;
+	float	_DescriptorWindowFactor;
+	float	_MaxFeaturePercent;
+	int		_MaxLevelFeatureNum;
+	int		_FeatureTexBlock;
+	int		_NarrowFeatureTex;
+	int		_ProcessOBO;
+	int		_TruncateMethod;
+	int		_PreciseBorder;
+	int		_ForceTightPyramid;
+	int		_octave_min_default;
+	int		_InitPyramidWidth;
+	int		_InitPyramidHeight;
+	int		_PreProcessOnCPU;
+	int		_FixedOrientation;
+	int		_LoweOrigin;
+	int		_ExitAfterSIFT;
+	int		_NormalizedSIFT;
+	int		_BinarySIFT;
+	int		_DescriptorU8;
+	int		_FeatureCountThreshold;
+	int		_FeatureGridSize;
+	int		_FeatureANMS;
+	int		_KeyPointListForceLevel0;
+	int		_DarknessAdaption;
+	int		_CPUThreadNum;
+	int		_DownSampleAverage;
+	float	_OrientationGaussianFactor;
+	float	_MulitiOrientationThreshold;
+	int		_WindowInitX;
+	int		_WindowInitY;
+	const char*	_WindowDisplay;
+public:
+	//-cuda <device>, -cl, and -pack/-unpack
+	inline void UseCUDA(int device = 0)		{_UseCUDA = 1; _UseOpenCL = 0; _DeviceIndex = device; }
+	inline void UseOpenCL()					{_UseOpenCL = 1; _UseCUDA = 0; }
+	inline void UseGLSL(int packed = 1)		{_UseCUDA = _UseOpenCL = 0; _usePackedTex = packed; if(!packed) _texMaxDim = 2560; }
+	//-fo, -no, -maxd
+	inline void SetFirstOctave(int octave)	{_octave_min_default = octave; }
+	inline void SetOctaveNum(int num)		{_octave_num_default = num; }
+	inline void SetMaxDimension(int sz)		{_texMaxDim = sz; }
+	//-m, -s, -ofix, -sd
+	inline void SetMaxOrientation(int num)	{_MaxOrientation = num < 1 ? 1 : (num > 4 ? 4 : num); }
+	inline void SetSubpixelLocalization(int num)	{_SubpixelLocalization = num < 0 ? 0 : (num > 5 ? 5 : num); }
+	inline void SetFixedOrientation(int fixed)		{_FixedOrientation = fixed; }
+	inline void SetDescriptorEnabled(int enabled)	{_DescriptorPPT = enabled ? 16 : 0; }
+	//-tc[1|2|3|4] <num> (method 0..3), -grid, -anms
+	inline void SetFeatureCount(int num, int method = 0)	{_FeatureCountThreshold = num; _TruncateMethod = method; }
+	inline void SetFeatureGrid(int size)	{_FeatureGridSize = size; }
+	inline void SetANMS(int anms)			{_FeatureANMS = anms; }
+	//-unn/-nd, -b/-b8, -u8, -loweo
+	inline void SetNormalizedSIFT(int normalized)	{_NormalizedSIFT = normalized; }
+	inline void SetBinarySIFT(int binary)	{_BinarySIFT = binary; }
+	inline void SetDescriptorU8(int u8)		{_DescriptorU8 = u8; }
+	inline void SetLoweOrigin(int lowe)		{_LoweOrigin = lowe; }
+	//-cpu, -box, -prep/-noprep, -tight, -p
+	inline void SetCPUThreadNum(int num)	{_CPUThreadNum = num; }
+	inline void SetBoxDownSample(int box)	{_DownSampleAverage = box; }
+	inline void SetPreProcessOnCPU(int cpu)	{_PreProcessOnCPU = cpu; }
+	inline void SetTightPyramid(int tight)	{_ForceTightPyramid = tight; }
+	inline void SetInitPyramid(int w, int h){_InitPyramidWidth = w; _InitPyramidHeight = h; }
+	//-v
+	inline void SetVerbose(int verbose)
+	{
+		_verbose = verbose > 0;		_timingS = verbose > 1;
+		_timingO = verbose > 2;		_timingL = verbose > 3;
+	}
+	//-profile
+	inline void SetProfile(int detail)		{_ProfileDetail = detail; }
+	SIFTGPU_EXPORT SiftConfig();
+};
+
+///////////////////////////////////////////////////////////////////
+//struct SiftProfileScope
+//description: one scope of the profile of a SiftGPU instance, which is
+//aggregated over the runs (-profile). The times are in seconds, and the
+//percentiles are estimated from a histogram of the wall times.
+////////////////////////////////////////////////////////////////////
+struct SiftProfileScope
+{
+	const char*	name;		//the path from the run, e.g. "run/Detect Keypoints/octave 0/level 1"
+	int		depth;			//0 for the run
+	int		count;			//the number of times that it is finished
+	double	wall, cpu;		//the total
+	double	wall_last, cpu_last;
+	double	wall_min, wall_max, wall_p50, wall_p90, wall_p99;
+	double	features;		//the average number of features, -1 if it is not recorded
+	double	features_last;
+	double	bytes;			//the total bytes that are uploaded or downloaded
+	double	bytes_last;
+};
+
 class LiteWindow;
 class GLTexInput;
 class ShaderMan;
 class SiftPyramid;
 class ImageList;
+class FrameStream;
+class FeatureCache;
+class SiftProfiler;
 ////////////////////////////////////////////////////////////////
 //class SIftGPU
 //description: Interface of SiftGPU lib
@@ -127,14 +271,24 @@ protected:
 	GLTexInput *   _texImage;
 	//the SiftPyramid
 	SiftPyramid *  _pyramid;
+	//the frame queue in streaming mode
+	FrameStream *  _stream;
+	//the feature cache for images that are seen before
+	FeatureCache * _cache;
+	//the parameters of this instance
+	SiftConfig *   _config;
+	//the profile of this instance, created by the first run with -profile
+	SiftProfiler * _profiler;
 	//print out the command line options
 	static void PrintUsage();
 	//Initialize OpenGL and SIFT paremeters, and create the shaders accordingly
 	void InitSiftGPU();
 	//load the image list from a file
 	void LoadImageList(const char *imlist);
+	//set up the feature cache lookup of the next input
+	void SetupCache();
 public:
-	//timing results for 10 steps
+	//timing results for 10 steps, see GetProfileScope for the stages, octaves and levels
 	float			    _timing[10];
     inline const char*  GetCurrentImagePath() {return _imgpath; }
 public:
@@ -194,6 +348,59 @@ public:
 	//none of the texture in processing can be larger
 	//automatic down-sample is used if necessary. 
 	SIFTGPU_EXPORT virtual void SetMaxDimension(int sz);
+	//run SIFT on pixel data with a row stride and an optional region of interest
+	//row_bytes is the distance between two rows in bytes (0 for tightly packed rows)
+	//roi = {x, y, width, height} selects a sub-window (NULL for the whole image), and 
+	//the keypoints are then in the coordinate system of the sub-window.
+	//The pixel data is never modified.
+	SIFTGPU_EXPORT virtual int  RunSIFT(int width, int height, const void * data, 
+										unsigned int gl_format, unsigned int gl_type, 
+										int row_bytes, const int * roi = 0);
+	//streaming mode for a sequence of frames of the same size and format:
+	//the pyramid and the staging buffers are allocated once. A helper thread
+	//converts or copies the next pushed frames while the current frame is 
+	//processed, the next frame is uploaded during the processing, and its 
+	//pyramid is built when PopFeatures returns. Push at least one frame ahead
+	//to get the overlap, and don't run other images between BeginStream and 
+	//EndStream.
+	SIFTGPU_EXPORT virtual int  BeginStream(int width, int height, unsigned int gl_format, 
+										unsigned int gl_type, int row_bytes = 0);
+	//queue a frame, the data must stay valid until the frame is popped
+	SIFTGPU_EXPORT virtual int  PushFrame(const void * data);
+	//run SIFT on the oldest queued frame, and return its number of features
+	//(-1 if the queue is empty or it fails); read the features with GetFeatureVector
+	SIFTGPU_EXPORT virtual int  PopFeatures();
+	//drop the queued frames and leave streaming mode
+	SIFTGPU_EXPORT virtual void EndStream();
+	//Copy the SIFT result with descriptors quantized to bytes (128 per feature) 
+	//using the scale of SiftMatchGPU::SetDescriptors, d = min(255, 512 * f + 0.5)
+	SIFTGPU_EXPORT virtual void GetFeatureVectorU8(SiftKeypoint * keys, unsigned char * descriptors);
+	//only keep the features on the nonzero pixels of a mask / inside a list of rectangles
+	//{x, y, width, height}, in the coordinate system of the keypoints. The masked features are 
+	//removed before computing orientations and descriptors. It stays in effect for the following
+	//images until cleared with NULL. Call after CreateContextGL/VerifyContextGL.
+	SIFTGPU_EXPORT virtual void SetDetectionMask(int width, int height, const unsigned char * mask);
+	SIFTGPU_EXPORT virtual void SetDetectionROI(int num, const int * rois);
+	//get/set the parameters of this instance; each instance has its own parameters, so
+	//differently configured instances can run in one process (one instance per thread).
+	//After initialization, the device selection and the options that are compiled into
+	//the programs (-m, -s, -sd, -lc, -no...) are kept. The OpenGL shaders of a thread are
+	//shared by its instances of the same options, and SiftMatchGPU uses the last active 
+	//instance's settings.
+	SIFTGPU_EXPORT virtual void GetConfig(SiftConfig& config);
+	SIFTGPU_EXPORT virtual void SetConfig(const SiftConfig& config);
+	//the GPU memory of the pyramid and the feature storage in KB, 0 before it is allocated
+	SIFTGPU_EXPORT virtual int  GetPyramidMemoryKB();
+	//the profile (-profile n) of the runs since the last ResetProfile. The scopes are numbered
+	//in the order they are first seen, and their names are valid until ResetProfile
+	SIFTGPU_EXPORT virtual int  GetProfileScopeNum();
+	SIFTGPU_EXPORT virtual int  GetProfileScope(int index, SiftProfileScope& scope);
+	//the profile as JSON, the string is valid until the next call
+	SIFTGPU_EXPORT virtual const char* GetProfileJSON();
+	SIFTGPU_EXPORT virtual int  SaveProfile(const char * path);
+	SIFTGPU_EXPORT virtual void ResetProfile();
+	//retrieve the size of current input image
+	SIFTGPU_EXPORT void GetImageDimension(int &w, int&h);
 	///
 public:
 	//overload the new operator because delete operator is virtual
@@ -201,7 +408,9 @@ public:
 	//compiler setting of /MT and /MTd). Without the overloaded operator
 	//deleting a SiftGPU object will cause a heap corruption in the 
 	//static link case (but not for the runtime dll loading).
+	//The memory is from malloc, so it is also released by the dll.
 	SIFTGPU_EXPORT void* operator new (size_t size); 
+	SIFTGPU_EXPORT void  operator delete (void * p);
 };
 
 
@@ -244,8 +453,6 @@ public:
 	SIFTGPU_EXPORT void ToggleDisplayDebug();
 	//randomize the display colors
 	SIFTGPU_EXPORT void RandomizeColor();
-	//retrieve the size of current input image
-	SIFTGPU_EXPORT void GetImageDimension(int &w, int&h);
 	//get the location of the window specified by user
 	SIFTGPU_EXPORT void GetInitWindowPotition(int& x, int& y);
 };
@@ -280,6 +487,8 @@ public:
 
 	//change gpu_language, check the enumerants in SIFTMATCH_LANGUAGE.
 	SIFTGPU_EXPORT virtual void SetLanguage(int gpu_language);
+	//the language in use after the context is created, SIFTMATCH_GLSL if CUDA is not available
+	inline int  GetLanguage() const {return __language;}
 
     //after calling SetLanguage, you can call SetDeviceParam to select GPU
     //-winpos, -display, -cuda [device_id] 
@@ -333,6 +542,7 @@ public:
 public:
 	//overload the new operator, the same reason as SiftGPU above
 	SIFTGPU_EXPORT void* operator new (size_t size);
+	SIFTGPU_EXPORT void  operator delete (void * p);
 };
 
 typedef SiftGPU::SiftKeypoint SiftKeypoint;
@@ -343,11 +553,41 @@ SIFTGPU_EXPORT_EXTERN SiftMatchGPU* CreateNewSiftMatchGPU(int max_sift = 4096);
 
 
 ////////////////////////////////////////////////////////////////////////////
+class SiftGPURequest;
 class ComboSiftGPU: public SiftGPU, public SiftMatchGPU 
 {
 public:
+	//called when the results of an asynchronous request are ready
+	typedef void (*RequestCallback)(ComboSiftGPU * combo, SiftGPURequest * request, void * user_data);
+	//asynchronous requests return a handle without waiting for the results. A remote
+	//ComboSiftGPU sends the request (with the pixels) and returns, the responses are
+	//read by one I/O thread that also runs the callbacks. A local ComboSiftGPU runs 
+	//the request and the callback before returning. Every request must be released 
+	//with ReleaseRequest (which can be called in its callback) before the ComboSiftGPU
+	//is deleted. The requests of one ComboSiftGPU are sent from one thread.
+	SIFTGPU_EXPORT virtual SiftGPURequest* RunSIFTAsync(const char * imgpath, 
+										RequestCallback callback = NULL, void * user_data = NULL);
+	SIFTGPU_EXPORT virtual SiftGPURequest* RunSIFTAsync(int width, int height, const void * data, 
+										unsigned int gl_format, unsigned int gl_type,
+										RequestCallback callback = NULL, void * user_data = NULL);
+	//the row stride and the region of interest of RunSIFT(..., row_bytes, roi)
+	SIFTGPU_EXPORT virtual SiftGPURequest* RunSIFTAsync(int width, int height, const void * data, 
+										unsigned int gl_format, unsigned int gl_type, int row_bytes, 
+										const int * roi, RequestCallback callback = NULL, void * user_data = NULL);
+	//match the descriptors that are set by SetDescriptors before this call
+	SIFTGPU_EXPORT virtual SiftGPURequest* GetSiftMatchAsync(int max_match, float distmax = 0.7, 
+										float ratiomax = 0.8, int mutual_best_match = 1, 
+										RequestCallback callback = NULL, void * user_data = NULL);
+	//wait for a request, and return its number of features or matches (-1 if it fails)
+	SIFTGPU_EXPORT virtual int  WaitRequest(SiftGPURequest * request);
+	SIFTGPU_EXPORT virtual int  IsRequestFinished(SiftGPURequest * request);
+	//the results of a finished request
+	SIFTGPU_EXPORT virtual void GetRequestFeatures(SiftGPURequest * request, SiftKeypoint * keys, float * descriptors);
+	SIFTGPU_EXPORT virtual void GetRequestMatches(SiftGPURequest * request, int match_buffer[][2]);
+	SIFTGPU_EXPORT virtual void ReleaseRequest(SiftGPURequest * request);
 	///////////////////////////////////////////////
 	SIFTGPU_EXPORT void* operator new (size_t size); 
+	SIFTGPU_EXPORT void  operator delete (void * p);
 };
 SIFTGPU_EXPORT_EXTERN ComboSiftGPU* CreateComboSiftGPU(); 
 
@@ -372,6 +612,21 @@ SIFTGPU_EXPORT_EXTERN ComboSiftGPU* CreateRemoteSiftGPU(int port = 7777, char* r
 //  // it doesn't really initialize SiftGPU untill you call CreateContextGL/VerifyContextGL
 //  delete combo;
 
+//A pool of servers that works as one ComboSiftGPU, each run goes to the healthy 
+//server with the fewest requests in flight, and it is retried on another one if
+//the connection fails. The servers are separated by ';', with a port for a local
+//server or host:port for a running server, followed by its own parameters
+//example:
+//	ComboSiftGPU * combo = CreateRemoteSiftGPUPool("7777 -cuda 0; 7778 -cuda 1; gpu1:7777");
+SIFTGPU_EXPORT_EXTERN ComboSiftGPU* CreateRemoteSiftGPUPool(const char * servers);
+
+//The timeline of all the threads of the process: the stages, the GPU programs, the
+//readbacks, the image loads and the server commands. Each thread keeps its last
+//events_per_thread events, and the file can be opened by chrome://tracing
+SIFTGPU_EXPORT_EXTERN void StartSiftTrace(int events_per_thread = 65536);
+SIFTGPU_EXPORT_EXTERN void StopSiftTrace();
+SIFTGPU_EXPORT_EXTERN int  SaveSiftTrace(const char * path);
+
 ////////////////////////////////////////////////////////////////////////
 //two internally used function.
 SIFTGPU_EXPORT int  CreateLiteWindow(LiteWindow* window);
@@ -0,0 +1,229 @@
+////////////////////////////////////////////////////////////////////////////
+//	File:		SiftGPUJobQueue.h
+//	Author:		SiftGPU contributors
+//	Description :	the jobs of SiftGPUPool and the queue that the workers
+//					take them from, which is also checked by siftgpu_test.
+//
+//	This file was added to SiftGPU in 2026 and is distributed under the
+//	same terms as the rest of SiftGPU, see the notice in SiftGPU.h.
+//
+////////////////////////////////////////////////////////////////////////////
+
+#ifndef SIFTGPU_JOB_QUEUE_H
+#define SIFTGPU_JOB_QUEUE_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#if defined(_WIN32)
+	#ifndef WIN32_LEAN_AND_MEAN
+	#define WIN32_LEAN_AND_MEAN
+	#endif
+	#include <windows.h>
+#else
+	#include <pthread.h>
+#endif
+
+#include "SiftGPU.h"
+#include "SiftGPUPool.h"
+
+class SiftGPUJob
+{
+public:
+	enum
+	{
+		JOB_QUEUED		= 0,
+		JOB_RUNNING		= 1,
+		JOB_CALLBACK	= 2,	//the results are ready, the callback is running
+		JOB_FINISHED	= 3
+	};
+	//input: an image file, or pixel data
+	std::string		_imgpath;
+	const void*		_data;
+	int				_width, _height, _row_bytes;
+	unsigned int	_gl_format, _gl_type;
+	SiftGPUPool::JobCallback _callback;
+	void*			_user_data;
+	//status and results
+	int				_state;
+	int				_released;
+	int				_feature_num;
+	std::vector<SiftGPU::SiftKeypoint> _keys;
+	std::vector<float>	_descriptors;
+public:
+	SiftGPUJob(SiftGPUPool::JobCallback callback, void * user_data)
+	{
+		_data = NULL;
+		_width = _height = _row_bytes = 0;
+		_gl_format = _gl_type = 0;
+		_callback = callback;
+		_user_data = user_data;
+		_state = JOB_QUEUED;
+		_released = 0;
+		_feature_num = -1;
+	}
+};
+
+/////////////////////////////////////////////////////////////////////////////
+//the jobs are taken by the workers in order, one lock protects the queue and
+//the status of all jobs. The jobs are much longer than the locking.
+/////////////////////////////////////////////////////////////////////////////
+class SiftGPUJobQueue
+{
+	//the workers on the same CUDA device (modulo DEVICE_LOCK_NUM) share a lock
+	enum { DEVICE_LOCK_NUM = 16 };
+#if defined(_WIN32)
+	CRITICAL_SECTION	_mutex;
+	CONDITION_VARIABLE	_job_cond;
+	CONDITION_VARIABLE	_done_cond;
+	CRITICAL_SECTION	_device_lock[DEVICE_LOCK_NUM];
+#else
+	pthread_mutex_t		_mutex;
+	pthread_cond_t		_job_cond;
+	pthread_cond_t		_done_cond;
+	pthread_mutex_t		_device_lock[DEVICE_LOCK_NUM];
+#endif
+	std::deque<SiftGPUJob*>	_jobs;
+	int					_stopped;
+public:
+#if defined(_WIN32)
+	SiftGPUJobQueue()
+	{
+		InitializeCriticalSection(&_mutex);
+		InitializeConditionVariable(&_job_cond);
+		InitializeConditionVariable(&_done_cond);
+		for(int i = 0; i < DEVICE_LOCK_NUM; ++i) InitializeCriticalSection(&_device_lock[i]);
+		_stopped = 0;
+	}
+	~SiftGPUJobQueue()
+	{
+		DeleteCriticalSection(&_mutex);
+		for(int i = 0; i < DEVICE_LOCK_NUM; ++i) DeleteCriticalSection(&_device_lock[i]);
+	}
+	void Lock()			{EnterCriticalSection(&_mutex); }
+	void Unlock()		{LeaveCriticalSection(&_mutex); }
+	void WaitJob()		{SleepConditionVariableCS(&_job_cond, &_mutex, INFINITE); }
+	void WaitDone()		{SleepConditionVariableCS(&_done_cond, &_mutex, INFINITE); }
+	void SignalJob()	{WakeConditionVariable(&_job_cond); }
+	void SignalDone()	{WakeAllConditionVariable(&_done_cond); }
+	void SignalStop()	{WakeAllConditionVariable(&_job_cond); }
+	void LockDevice(int device)		{EnterCriticalSection(&_device_lock[device % DEVICE_LOCK_NUM]); }
+	void UnlockDevice(int device)	{LeaveCriticalSection(&_device_lock[device % DEVICE_LOCK_NUM]); }
+#else
+	SiftGPUJobQueue()
+	{
+		pthread_mutex_init(&_mutex, NULL);
+		pthread_cond_init(&_job_cond, NULL);
+		pthread_cond_init(&_done_cond, NULL);
+		for(int i = 0; i < DEVICE_LOCK_NUM; ++i) pthread_mutex_init(&_device_lock[i], NULL);
+		_stopped = 0;
+	}
+	~SiftGPUJobQueue()
+	{
+		pthread_mutex_destroy(&_mutex);
+		pthread_cond_destroy(&_job_cond);
+		pthread_cond_destroy(&_done_cond);
+		for(int i = 0; i < DEVICE_LOCK_NUM; ++i) pthread_mutex_destroy(&_device_lock[i]);
+	}
+	void Lock()			{pthread_mutex_lock(&_mutex); }
+	void Unlock()		{pthread_mutex_unlock(&_mutex); }
+	void WaitJob()		{pthread_cond_wait(&_job_cond, &_mutex); }
+	void WaitDone()		{pthread_cond_wait(&_done_cond, &_mutex); }
+	void SignalJob()	{pthread_cond_signal(&_job_cond); }
+	void SignalDone()	{pthread_cond_broadcast(&_done_cond); }
+	void SignalStop()	{pthread_cond_broadcast(&_job_cond); }
+	void LockDevice(int device)		{pthread_mutex_lock(&_device_lock[device % DEVICE_LOCK_NUM]); }
+	void UnlockDevice(int device)	{pthread_mutex_unlock(&_device_lock[device % DEVICE_LOCK_NUM]); }
+#endif
+	void Push(SiftGPUJob * job)
+	{
+		Lock();
+		_jobs.push_back(job);
+		SignalJob();
+		Unlock();
+	}
+	//returns NULL when the queue is stopped and empty
+	SiftGPUJob* Pop()
+	{
+		Lock();
+		while(_jobs.empty() && !_stopped) WaitJob();
+		SiftGPUJob* job = NULL;
+		if(!_jobs.empty())
+		{
+			job = _jobs.front();
+			_jobs.pop_front();
+			job->_state = SiftGPUJob::JOB_RUNNING;
+		}
+		Unlock();
+		return job;
+	}
+	void Stop()
+	{
+		Lock();
+		_stopped = 1;
+		SignalStop();
+		Unlock();
+	}
+	int	IsStopped()
+	{
+		Lock();
+		int stopped = _stopped;
+		Unlock();
+		return stopped;
+	}
+	//the features of the job are ready, run the callback and wake up the waiting threads
+	void Finish(SiftGPUPool * pool, SiftGPUJob * job, int num)
+	{
+		Lock();
+		job->_feature_num = num;
+		job->_state = SiftGPUJob::JOB_CALLBACK;
+		SignalDone();
+		Unlock();
+
+		if(job->_callback) job->_callback(pool, job, job->_user_data);
+
+		Lock();
+		int released = job->_released;
+		job->_state = SiftGPUJob::JOB_FINISHED;
+		SignalDone();
+		Unlock();
+		//ReleaseJob was called during the callback
+		if(released) delete job;
+	}
+	//wait until the results are ready
+	int Wait(SiftGPUJob * job)
+	{
+		Lock();
+		while(job->_state < SiftGPUJob::JOB_CALLBACK) WaitDone();
+		int num = job->_feature_num;
+		Unlock();
+		return num;
+	}
+	int IsFinished(SiftGPUJob * job)
+	{
+		Lock();
+		int done = job->_state >= SiftGPUJob::JOB_CALLBACK;
+		Unlock();
+		return done;
+	}
+	void Release(SiftGPUJob * job)
+	{
+		Lock();
+		while(job->_state < SiftGPUJob::JOB_CALLBACK) WaitDone();
+		int in_callback = job->_state == SiftGPUJob::JOB_CALLBACK;
+		if(in_callback) job->_released = 1;
+		Unlock();
+		if(!in_callback) delete job;
+	}
+	//the jobs that are never taken by a worker
+	void Clear(SiftGPUPool * pool)
+	{
+		Lock();
+		std::deque<SiftGPUJob*> jobs;
+		jobs.swap(_jobs);
+		Unlock();
+		for(size_t i = 0; i < jobs.size(); ++i) Finish(pool, jobs[i], -1);
+	}
+};
+
+#endif
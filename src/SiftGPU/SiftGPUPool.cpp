@@ -0,0 +1,291 @@
+////////////////////////////////////////////////////////////////////////////
+//	File:		SiftGPUPool.cpp
+//	Author:		SiftGPU contributors
+//	Description :	implementation of the SiftGPUPool class.
+//
+//	This file was added to SiftGPU in 2026 and is distributed under the
+//	same terms as the rest of SiftGPU, see the notice in SiftGPU.h.
+//
+////////////////////////////////////////////////////////////////////////////
+
+#include "GL/glew.h"
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <iostream>
+#include <new>
+
+#if defined(_WIN32)
+	#ifndef WIN32_LEAN_AND_MEAN
+	#define WIN32_LEAN_AND_MEAN
+	#endif
+	#include <windows.h>
+#else
+	#include <pthread.h>
+#endif
+
+#include "GlobalUtil.h"
+#include "SiftGPU.h"
+#include "SiftGPUPool.h"
+#include "SiftGPUJobQueue.h"
+
+
+/////////////////////////////////////////////////////////////////////////////
+//a worker thread with its own SiftGPU, which is deleted in the thread
+/////////////////////////////////////////////////////////////////////////////
+class SiftGPUWorker
+{
+public:
+	SiftGPUPool*		_pool;
+	SiftGPUJobQueue*	_queue;
+	SiftGPU*			_sift;
+	//-1 for starting, 0 for failure, 1 for running
+	int					_status;
+	//the CUDA device, or -1 for OpenGL/OpenCL
+	int					_cuda_device;
+	int					_started;
+#if defined(_WIN32)
+	HANDLE				_thread;
+#else
+	pthread_t			_thread;
+#endif
+public:
+	SiftGPUWorker(SiftGPUPool * pool, SiftGPUJobQueue * queue)
+	{
+		_pool = pool;
+		_queue = queue;
+		_sift = CreateNewSiftGPU();
+		_status = -1;
+		_cuda_device = -1;
+		_started = 0;
+	}
+	~SiftGPUWorker()
+	{
+		Join();
+		if(_sift) delete _sift;
+	}
+	void Start()
+	{
+#if defined(_WIN32)
+		_thread = CreateThread(NULL, 0, RunThread, this, 0, 0);
+		_started = _thread != NULL;
+#else
+		_started = pthread_create(&_thread, NULL, RunThread, this) == 0;
+#endif
+		if(!_started) _status = 0;
+	}
+	void Join()
+	{
+		if(!_started) return;
+#if defined(_WIN32)
+		WaitForSingleObject(_thread, INFINITE);
+		CloseHandle(_thread);
+#else
+		pthread_join(_thread, NULL);
+#endif
+		_started = 0;
+	}
+#if defined(_WIN32)
+	static DWORD WINAPI RunThread(LPVOID param)
+#else
+	static void* RunThread(void* param)
+#endif
+	{
+		((SiftGPUWorker*) param)->Run();
+		return 0;
+	}
+	void Run()
+	{
+		//the contexts are created and initialized one at a time
+		GlobalUtil::EnterGlobalLock();
+		int status = _sift->CreateContextGL() == SiftGPU::SIFTGPU_FULL_SUPPORTED;
+		GlobalUtil::LeaveGlobalLock();
+		if(status)
+		{
+			SiftConfig config;
+			_sift->GetConfig(config);
+			_cuda_device = config._UseCUDA ? config._DeviceIndex : -1;
+		}
+
+		_queue->Lock();
+		_status = status;
+		_queue->SignalDone();
+		_queue->Unlock();
+
+		SiftGPUJob * job;
+		while(status && (job = _queue->Pop()) != NULL) RunJob(job);
+
+		//the OpenGL resources are released with the context of this thread
+		delete _sift;
+		_sift = NULL;
+		GlobalUtil::DestroyWindowEZ();
+	}
+	void RunJob(SiftGPUJob * job)
+	{
+		if(_cuda_device >= 0) _queue->LockDevice(_cuda_device);
+		int done = job->_data ?
+			_sift->RunSIFT(job->_width, job->_height, job->_data, job->_gl_format, job->_gl_type, job->_row_bytes) :
+			_sift->RunSIFT(job->_imgpath.c_str());
+		int num = done ? _sift->GetFeatureNum() : -1;
+		if(num > 0)
+		{
+			job->_keys.resize(num);
+			job->_descriptors.resize(128 * num);
+			_sift->GetFeatureVector(&job->_keys[0], &job->_descriptors[0]);
+		}
+		if(_cuda_device >= 0) _queue->UnlockDevice(_cuda_device);
+		_queue->Finish(_pool, job, num);
+	}
+};
+
+/////////////////////////////////////////////////////////////////////////////
+SiftGPUPool::SiftGPUPool(int worker_num, int argc, char** argv)
+{
+	_worker_num = worker_num > 0 ? worker_num : 1;
+	_queue = new SiftGPUJobQueue;
+	_workers = new SiftGPUWorker* [_worker_num];
+	for(int i = 0; i < _worker_num; ++i)
+	{
+		_workers[i] = new SiftGPUWorker(this, _queue);
+		if(argc > 0) _workers[i]->_sift->ParseParam(argc, argv);
+	}
+	_started = 0;
+}
+
+SiftGPUPool::~SiftGPUPool()
+{
+	//the queued jobs are finished before the workers stop
+	_queue->Stop();
+	for(int i = 0; i < _worker_num; ++i) delete _workers[i];
+	delete[] _workers;
+	_queue->Clear(this);
+	delete _queue;
+}
+
+void* SiftGPUPool::operator new (size_t  size){
+  void * p = malloc(size);
+  if (p == 0)
+  {
+	  const std::bad_alloc ba;
+	  throw ba;
+  }
+  return p;
+}
+
+void SiftGPUPool::operator delete (void * p){
+  free(p);
+}
+
+void SiftGPUPool::SetWorkerParam(int index, int argc, char** argv)
+{
+	if(_started || index < 0 || index >= _worker_num) return;
+	_workers[index]->_sift->ParseParam(argc, argv);
+}
+
+void SiftGPUPool::SetWorkerConfig(int index, const SiftConfig& config)
+{
+	if(_started || index < 0 || index >= _worker_num) return;
+	_workers[index]->_sift->SetConfig(config);
+}
+
+int SiftGPUPool::Start()
+{
+	if(!_started)
+	{
+		for(int i = 0; i < _worker_num; ++i) _workers[i]->Start();
+		_started = 1;
+	}
+
+	//wait for the initialization of the workers
+	int ready = 0;
+	_queue->Lock();
+	for(int i = 0; i < _worker_num; ++i)
+	{
+		while(_workers[i]->_status < 0) _queue->WaitDone();
+		ready += _workers[i]->_status;
+	}
+	_queue->Unlock();
+
+	if(ready == 0)
+	{
+		std::cerr << "SiftGPUPool: no worker is initialized\n";
+		_queue->Stop();
+		_queue->Clear(this);
+	}
+	return ready;
+}
+
+int SiftGPUPool::GetWorkerNum()
+{
+	return _worker_num;
+}
+
+SiftGPUJob* SiftGPUPool::Submit(SiftGPUJob * job)
+{
+	//the jobs fail right away if all the workers failed
+	if(_queue->IsStopped())		_queue->Finish(this, job, -1);
+	else						_queue->Push(job);
+	return job;
+}
+
+SiftGPUJob* SiftGPUPool::RunSIFT(const char * imgpath, JobCallback callback, void * user_data)
+{
+	SiftGPUJob * job = new SiftGPUJob(callback, user_data);
+	if(imgpath) job->_imgpath = imgpath;
+	return Submit(job);
+}
+
+SiftGPUJob* SiftGPUPool::RunSIFT(int width, int height, const void * data, unsigned int gl_format,
+								 unsigned int gl_type, int row_bytes, JobCallback callback, void * user_data)
+{
+	SiftGPUJob * job = new SiftGPUJob(callback, user_data);
+	job->_width = width;
+	job->_height = height;
+	job->_data = data;
+	job->_gl_format = gl_format;
+	job->_gl_type = gl_type;
+	job->_row_bytes = row_bytes;
+	if(data == NULL)
+	{
+		_queue->Finish(this, job, -1);
+		return job;
+	}
+	return Submit(job);
+}
+
+int SiftGPUPool::Wait(SiftGPUJob * job)
+{
+	return job ? _queue->Wait(job) : -1;
+}
+
+int SiftGPUPool::IsFinished(SiftGPUJob * job)
+{
+	return job ? _queue->IsFinished(job) : 1;
+}
+
+int SiftGPUPool::GetFeatureNum(SiftGPUJob * job)
+{
+	int num = Wait(job);
+	return num > 0 ? num : 0;
+}
+
+void SiftGPUPool::GetFeatureVector(SiftGPUJob * job, SiftGPU::SiftKeypoint * keys, float * descriptors)
+{
+	int num = GetFeatureNum(job);
+	if(num == 0) return;
+	if(keys)		std::copy(job->_keys.begin(), job->_keys.end(), keys);
+	if(descriptors) std::copy(job->_descriptors.begin(), job->_descriptors.end(), descriptors);
+}
+
+void SiftGPUPool::ReleaseJob(SiftGPUJob * job)
+{
+	if(job) _queue->Release(job);
+}
+
+SiftGPUPool * CreateSiftGPUPool(int worker_num, int argc, char** argv)
+{
+	return new SiftGPUPool(worker_num, argc, argv);
+}
+
@@ -0,0 +1,84 @@
+////////////////////////////////////////////////////////////////////////////
+//	File:		SiftGPUPool.h
+//	Author:		SiftGPU contributors
+//	Description :	interface for the SiftGPUPool class.
+//		SiftGPUPool:	a set of SiftGPU workers in one process, each running
+//						in its own thread with its own OpenGL context or CUDA
+//						device. Jobs are queued and the features are returned
+//						through the job handles or callbacks.
+//
+//	This file was added to SiftGPU in 2026 and is distributed under the
+//	same terms as the rest of SiftGPU, see the notice in SiftGPU.h.
+//
+////////////////////////////////////////////////////////////////////////////
+
+
+#ifndef SIFTGPU_POOL_H
+#define SIFTGPU_POOL_H
+
+#include "SiftGPU.h"
+
+class SiftGPUJob;
+class SiftGPUWorker;
+class SiftGPUJobQueue;
+
+/////////////////////////////////////////////////////////////////////////////
+//class SiftGPUPool
+//description: multi-threaded SiftGPU. The typical usage is
+//		SiftGPUPool * pool = CreateSiftGPUPool(2, argc, argv);
+//		pool->SetWorkerParam(1, argc1, argv1);	//optional, e.g. "-cuda 1"
+//		pool->Start();
+//		SiftGPUJob * job = pool->RunSIFT("image.jpg");
+//		int num = pool->Wait(job);
+//		pool->GetFeatureVector(job, keys, descriptors);
+//		pool->ReleaseJob(job);
+//Every job must be released with ReleaseJob, which can also be called inside
+//its callback. The workers on the same CUDA device run one job at a time,
+//because the CUDA code binds global texture references.
+/////////////////////////////////////////////////////////////////////////////
+class SiftGPUPool
+{
+public:
+	//called by the worker thread when the features of a job are ready
+	typedef void (*JobCallback)(SiftGPUPool * pool, SiftGPUJob * job, void * user_data);
+private:
+	int					_worker_num;
+	SiftGPUWorker**		_workers;
+	SiftGPUJobQueue*	_queue;
+	int					_started;
+private:
+	SiftGPUJob*	Submit(SiftGPUJob * job);
+public:
+	//each worker has its own SiftGPU, initialized with the parameters (argc, argv)
+	SIFTGPU_EXPORT SiftGPUPool(int worker_num, int argc = 0, char** argv = NULL);
+	//finishes the queued jobs and stops the workers
+	SIFTGPU_EXPORT virtual ~SiftGPUPool();
+	//more parameters for one worker, e.g. -cuda <device> or -display <name>. Call before Start
+	SIFTGPU_EXPORT virtual void SetWorkerParam(int index, int argc, char** argv);
+	SIFTGPU_EXPORT virtual void SetWorkerConfig(int index, const SiftConfig& config);
+	//start the worker threads and create their contexts;
+	//returns the number of workers that are initialized
+	SIFTGPU_EXPORT virtual int  Start();
+	SIFTGPU_EXPORT virtual int  GetWorkerNum();
+	//queue a job and return its handle. The pixel data must stay valid until the job is finished
+	SIFTGPU_EXPORT virtual SiftGPUJob* RunSIFT(const char * imgpath,
+										JobCallback callback = NULL, void * user_data = NULL);
+	SIFTGPU_EXPORT virtual SiftGPUJob* RunSIFT(int width, int height, const void * data,
+										unsigned int gl_format, unsigned int gl_type, int row_bytes = 0,
+										JobCallback callback = NULL, void * user_data = NULL);
+	//wait for a job, and return its number of features (-1 if it fails)
+	SIFTGPU_EXPORT virtual int  Wait(SiftGPUJob * job);
+	SIFTGPU_EXPORT virtual int  IsFinished(SiftGPUJob * job);
+	//the results of a finished job
+	SIFTGPU_EXPORT virtual int  GetFeatureNum(SiftGPUJob * job);
+	SIFTGPU_EXPORT virtual void GetFeatureVector(SiftGPUJob * job, SiftGPU::SiftKeypoint * keys, float * descriptors);
+	SIFTGPU_EXPORT virtual void ReleaseJob(SiftGPUJob * job);
+	//the same reason as SiftGPU
+	SIFTGPU_EXPORT void* operator new (size_t size);
+	SIFTGPU_EXPORT void  operator delete (void * p);
+};
+
+SIFTGPU_EXPORT_EXTERN SiftGPUPool * CreateSiftGPUPool(int worker_num, int argc = 0, char** argv = NULL);
+
+#endif
+
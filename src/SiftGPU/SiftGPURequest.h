@@ -0,0 +1,62 @@
+////////////////////////////////////////////////////////////////////////////
+//	File:		SiftGPURequest.h
+//	Author:		SiftGPU contributors
+//	Description :	the asynchronous requests of ComboSiftGPU.
+//		SiftGPURequest:	the handle and the results of one RunSIFTAsync or
+//						GetSiftMatchAsync. It is finished right away by a
+//						local ComboSiftGPU, or by the I/O thread of a remote one.
+//
+//	This file was added to SiftGPU in 2026 and is distributed under the
+//	same terms as the rest of SiftGPU, see the notice in SiftGPU.h.
+//
+////////////////////////////////////////////////////////////////////////////
+
+
+#ifndef SIFTGPU_REQUEST_H
+#define SIFTGPU_REQUEST_H
+
+#include <vector>
+
+class SiftGPURequest
+{
+public:
+	enum
+	{
+		REQUEST_PENDING		= 0,
+		REQUEST_CALLBACK	= 1,	//the results are ready, the callback is running
+		REQUEST_FINISHED	= 2
+	};
+	ComboSiftGPU::RequestCallback _callback;
+	void*			_user_data;
+	//the ComboSiftGPU that finishes the request, and its data for the request
+	ComboSiftGPU*	_owner;
+	void*			_context;
+	//request id and command of a remote ComboSiftGPU; the response of the
+	//synchronous calls (_sync = 1) is kept in _response
+	int				_id;
+	int				_command;
+	int				_sync;
+	std::vector<char> _response;
+	//status and results
+	int				_state;
+	int				_released;
+	int				_result;	//number of features or matches, -1 if it fails
+	std::vector<SiftGPU::SiftKeypoint> _keys;
+	std::vector<float>	_descriptors;
+	std::vector<int>	_matches;
+public:
+	SiftGPURequest(ComboSiftGPU::RequestCallback callback = NULL, void * user_data = NULL)
+	{
+		_callback = callback;
+		_user_data = user_data;
+		_owner = NULL;
+		_context = NULL;
+		_id = _command = _sync = 0;
+		_state = REQUEST_PENDING;
+		_released = 0;
+		_result = -1;
+	}
+};
+
+#endif
+
@@ -610,6 +610,10 @@ void* SiftMatchGPU::operator new (size_t  size){
   return p; 
 }
 
+void SiftMatchGPU::operator delete (void * p){
+  free(p);
+}
+
 
 SiftMatchGPU::SiftMatchGPU(int max_sift)
 {
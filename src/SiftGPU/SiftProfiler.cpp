@@ -0,0 +1,299 @@
+////////////////////////////////////////////////////////////////////////////
+//	File:		SiftProfiler.cpp
+//	Author:		SiftGPU contributors
+//	Description :	implementation of the SiftProfiler class.
+//
+//	This file was added to SiftGPU in 2026 and is distributed under the
+//	same terms as the rest of SiftGPU, see the notice in SiftGPU.h.
+//
+////////////////////////////////////////////////////////////////////////////
+
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <stdio.h>
+#include <string.h>
+
+#if defined(_WIN32)
+	#define WIN32_LEAN_AND_MEAN
+	#include <windows.h>
+	#pragma warning (disable : 4996)
+#else
+	#include <time.h>
+	#include <sys/time.h>
+#endif
+
+#include "SiftGPU.h"
+#include "SiftProfiler.h"
+
+SiftProfiler::SiftProfiler()
+{
+	_last = -1;
+	_level = 0;
+}
+
+double SiftProfiler::WallTime()
+{
+#if defined(_WIN32)
+	LARGE_INTEGER frequency, counter;
+	QueryPerformanceFrequency(&frequency);
+	QueryPerformanceCounter(&counter);
+	return double(counter.QuadPart) / double(frequency.QuadPart);
+#else
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	return now.tv_sec + now.tv_usec * 1e-6;
+#endif
+}
+
+double SiftProfiler::ThreadTime()
+{
+#if defined(_WIN32)
+	FILETIME creation, exit, kernel, user;
+	if(!GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user)) return 0;
+	ULARGE_INTEGER k, u;
+	k.LowPart = kernel.dwLowDateTime;	k.HighPart = kernel.dwHighDateTime;
+	u.LowPart = user.dwLowDateTime;		u.HighPart = user.dwHighDateTime;
+	return double(k.QuadPart + u.QuadPart) * 1e-7;
+#elif defined(CLOCK_THREAD_CPUTIME_ID)
+	struct timespec now;
+	if(clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now)) return 0;
+	return now.tv_sec + now.tv_nsec * 1e-9;
+#else
+	return double(clock()) / CLOCKS_PER_SEC;
+#endif
+}
+
+int SiftProfiler::GetNode(int parent, const char * name)
+{
+	for(size_t i = 0; i < _nodes.size(); ++i)
+	{
+		if(_nodes[i].parent == parent && _nodes[i].name == name) return (int) i;
+	}
+	Node node;
+	node.name = name;
+	node.path = parent < 0 ? std::string(name) : _nodes[parent].path + "/" + name;
+	node.parent = parent;
+	node.depth = parent < 0 ? 0 : _nodes[parent].depth + 1;
+	node.count = 0;
+	node.wall = node.cpu = node.wall_last = node.cpu_last = node.wall_min = node.wall_max = 0;
+	node.feature_count = 0;
+	node.features = node.features_last = 0;
+	node.bytes = node.bytes_last = 0;
+	for(int i = 0; i <= HISTOGRAM_SIZE; ++i) node.histogram[i] = 0;
+	_nodes.push_back(node);
+	return (int) _nodes.size() - 1;
+}
+
+void SiftProfiler::Open(const char * name, int type)
+{
+	OpenScope scope;
+	scope.node = GetNode(_stack.empty() ? -1 : _stack.back().node, name);
+	scope.type = type;
+	scope.cpu = ThreadTime();
+	scope.wall = WallTime();
+	_stack.push_back(scope);
+}
+
+void SiftProfiler::Close(int drop)
+{
+	double wall = WallTime(), cpu = ThreadTime();
+	OpenScope scope = _stack.back();
+	_stack.pop_back();
+	if(drop)
+	{
+		//a scope that is never finished, such as the empty level after the last one, is removed
+		if(scope.node + 1 == (int) _nodes.size() && _nodes[scope.node].count == 0) _nodes.pop_back();
+		return;
+	}
+
+	Node& node = _nodes[scope.node];
+	wall -= scope.wall;
+	cpu -= scope.cpu;
+	node.wall_min = node.count == 0 || wall < node.wall_min ? wall : node.wall_min;
+	node.wall_max = node.count == 0 || wall > node.wall_max ? wall : node.wall_max;
+	node.count++;
+	node.wall += wall;
+	node.cpu += cpu;
+	node.wall_last = wall;
+	node.cpu_last = cpu;
+	node.bytes_last = 0;
+
+	int bucket = 0;
+	for(double bound = 1e-5; bucket < HISTOGRAM_SIZE && wall > bound; bound *= 2.0) bucket++;
+	node.histogram[bucket]++;
+	_last = scope.node;
+}
+
+void SiftProfiler::BeginRun()
+{
+	_stack.clear();
+	_last = -1;
+	Open("run", SCOPE_RUN);
+}
+
+void SiftProfiler::EndRun(int features)
+{
+	if(_stack.empty()) return;
+	while(_stack.size() > 1) Close(1);
+	Close(0);
+	SetData(features, 0);
+}
+
+void SiftProfiler::Begin(const char * name)
+{
+	if(_stack.empty()) return;
+	Open(name, SCOPE_STAGE);
+}
+
+void SiftProfiler::End()
+{
+	//the octaves and levels that are left open by the stage are dropped
+	while(_stack.size() > 1 && _stack.back().type > SCOPE_STAGE) Close(1);
+	if(_stack.size() > 1) Close(0);
+}
+
+void SiftProfiler::BeginOctave(int octave, int detail)
+{
+	if(_stack.empty()) return;
+	char name[32];
+	sprintf(name, "octave %d", octave);
+	Open(name, SCOPE_OCTAVE);
+	_level = 0;
+	if(detail >= PROFILE_LEVEL) Open("level 0", SCOPE_LEVEL);
+}
+
+void SiftProfiler::NextLevel()
+{
+	if(_stack.empty() || _stack.back().type != SCOPE_LEVEL) return;
+	Close(0);
+	char name[32];
+	sprintf(name, "level %d", ++_level);
+	Open(name, SCOPE_LEVEL);
+}
+
+void SiftProfiler::EndOctave()
+{
+	if(_stack.empty()) return;
+	if(_stack.back().type == SCOPE_LEVEL) Close(1);
+	if(_stack.back().type == SCOPE_OCTAVE) Close(0);
+}
+
+void SiftProfiler::SetData(int features, double bytes)
+{
+	if(_last < 0) return;
+	Node& node = _nodes[_last];
+	if(features >= 0)
+	{
+		node.feature_count++;
+		node.features += features;
+		node.features_last = features;
+	}
+	node.bytes += bytes;
+	node.bytes_last += bytes;
+}
+
+double SiftProfiler::GetPercentile(const Node& node, double q) const
+{
+	if(node.count == 0) return 0;
+	double rank = q * node.count, lower = 0, upper = 1e-5;
+	int seen = 0;
+	for(int i = 0; i <= HISTOGRAM_SIZE; ++i, lower = upper, upper *= 2.0)
+	{
+		if(node.histogram[i] == 0 || seen + node.histogram[i] < rank)
+		{
+			seen += node.histogram[i];
+			continue;
+		}
+		//interpolate in the bucket, which is clamped to the range of the samples
+		if(i == HISTOGRAM_SIZE || upper > node.wall_max) upper = node.wall_max;
+		if(lower < node.wall_min) lower = node.wall_min;
+		double value = lower + (upper - lower) * (rank - seen) / node.histogram[i];
+		return value < lower ? lower : (value > upper ? upper : value);
+	}
+	return node.wall_max;
+}
+
+int SiftProfiler::GetScopeNum() const
+{
+	return (int) _nodes.size();
+}
+
+int SiftProfiler::GetScope(int index, SiftProfileScope& scope) const
+{
+	if(index < 0 || index >= (int) _nodes.size()) return 0;
+	const Node& node = _nodes[index];
+	scope.name = node.path.c_str();
+	scope.depth = node.depth;
+	scope.count = node.count;
+	scope.wall = node.wall;
+	scope.cpu = node.cpu;
+	scope.wall_last = node.wall_last;
+	scope.cpu_last = node.cpu_last;
+	scope.wall_min = node.wall_min;
+	scope.wall_max = node.wall_max;
+	scope.wall_p50 = GetPercentile(node, 0.50);
+	scope.wall_p90 = GetPercentile(node, 0.90);
+	scope.wall_p99 = GetPercentile(node, 0.99);
+	scope.features = node.feature_count ? node.features / node.feature_count : -1;
+	scope.features_last = node.feature_count ? node.features_last : -1;
+	scope.bytes = node.bytes;
+	scope.bytes_last = node.bytes_last;
+	return 1;
+}
+
+const char* SiftProfiler::GetJSON()
+{
+	//the scopes are listed in the order that they are first seen, the times are in milliseconds
+	char buf[1024];
+	_json = "{\"scopes\":[";
+	for(int i = 0; i < GetScopeNum(); ++i)
+	{
+		SiftProfileScope scope;
+		GetScope(i, scope);
+		std::string name;
+		for(const char* p = scope.name; *p; ++p)
+		{
+			if(*p == '"' || *p == '\\') name += '\\';
+			name += *p;
+		}
+		_json += i ? ",\n{\"name\":\"" : "\n{\"name\":\"";
+		_json += name;
+		sprintf(buf, "\",\"depth\":%d,\"count\":%d,"
+			"\"wall_ms\":%.3f,\"cpu_ms\":%.3f,\"wall_last_ms\":%.3f,\"cpu_last_ms\":%.3f,"
+			"\"wall_min_ms\":%.3f,\"wall_max_ms\":%.3f,\"wall_p50_ms\":%.3f,\"wall_p90_ms\":%.3f,\"wall_p99_ms\":%.3f,"
+			"\"features\":%.1f,\"features_last\":%.0f,\"bytes\":%.0f,\"bytes_last\":%.0f,\"histogram\":[",
+			scope.depth, scope.count,
+			scope.wall * 1000, scope.cpu * 1000, scope.wall_last * 1000, scope.cpu_last * 1000,
+			scope.wall_min * 1000, scope.wall_max * 1000, scope.wall_p50 * 1000, scope.wall_p90 * 1000, scope.wall_p99 * 1000,
+			scope.features, scope.features_last, scope.bytes, scope.bytes_last);
+		_json += buf;
+		for(int j = 0; j <= HISTOGRAM_SIZE; ++j)
+		{
+			sprintf(buf, j ? ",%d" : "%d", _nodes[i].histogram[j]);
+			_json += buf;
+		}
+		_json += "]}";
+	}
+	sprintf(buf, "],\n\"histogram_bounds_ms\":{\"first\":%g,\"factor\":2,\"size\":%d}}\n", 1e-2, HISTOGRAM_SIZE);
+	_json += buf;
+	return _json.c_str();
+}
+
+int SiftProfiler::SaveJSON(const char * path)
+{
+	std::ofstream out(path);
+	if(!out.is_open()) return 0;
+	out << GetJSON();
+	return out.good() ? 1 : 0;
+}
+
+void SiftProfiler::Reset()
+{
+	_nodes.clear();
+	_stack.clear();
+	_last = -1;
+	_level = 0;
+}
+
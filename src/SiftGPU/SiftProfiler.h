@@ -0,0 +1,98 @@
+////////////////////////////////////////////////////////////////////////////
+//	File:		SiftProfiler.h
+//	Author:		SiftGPU contributors
+//	Description :	interface for the SiftProfiler class.
+//		SiftProfiler:	the nested timing scopes (run, stage, octave, level)
+//						of a SiftGPU instance, with wall and cpu time, feature
+//						counts and bytes moved, aggregated over the runs
+//
+//	This file was added to SiftGPU in 2026 and is distributed under the
+//	same terms as the rest of SiftGPU, see the notice in SiftGPU.h.
+//
+////////////////////////////////////////////////////////////////////////////
+
+
+#ifndef SIFT_PROFILER_H
+#define SIFT_PROFILER_H
+
+struct SiftProfileScope;
+
+//The scopes are identified by their path from the run, e.g. "run/Detect Keypoints/octave 1/level 2".
+//A stage is a GlobalUtil::StartTimer/StopTimer pair, and the octaves and levels are the
+//steps of the stages that loop over the pyramid. The wall time of a stage covers the GPU
+//work only if the stage waits for it, so the octaves and levels wait for the GPU (-profile 2/3).
+class SiftProfiler
+{
+public:
+	enum
+	{
+		PROFILE_OFF		= 0,
+		PROFILE_STAGE	= 1,
+		PROFILE_OCTAVE	= 2,
+		PROFILE_LEVEL	= 3,
+		HISTOGRAM_SIZE	= 24	//the upper bound of bucket k is 10us * 2^k, plus one overflow bucket
+	};
+private:
+	struct Node
+	{
+		std::string	name;
+		std::string	path;
+		int		parent;
+		int		depth;
+		int		count;
+		double	wall, cpu, wall_last, cpu_last, wall_min, wall_max;
+		int		feature_count;
+		double	features, features_last;
+		double	bytes, bytes_last;
+		int		histogram[HISTOGRAM_SIZE + 1];
+	};
+	enum
+	{
+		SCOPE_RUN		= 0,
+		SCOPE_STAGE		= 1,
+		SCOPE_OCTAVE	= 2,
+		SCOPE_LEVEL		= 3
+	};
+	struct OpenScope
+	{
+		int		node;
+		int		type;
+		double	wall;
+		double	cpu;
+	};
+	std::vector<Node>		_nodes;
+	std::vector<OpenScope>	_stack;
+	int			_last;		//the scope that is closed last, for SetData
+	int			_level;		//the next level of the open octave
+	std::string	_json;
+private:
+	int		GetNode(int parent, const char * name);
+	void	Open(const char * name, int type);
+	void	Close(int drop);
+	double	GetPercentile(const Node& node, double q) const;
+public:
+	//a run is a RunSIFT of the SiftGPU, the scopes that are still open at EndRun are dropped
+	void	BeginRun();
+	void	EndRun(int features);
+	void	Begin(const char * name);
+	void	End();
+	//the octave has a level scope open, which NextLevel closes and starts a new one;
+	//the level that is open at EndOctave is dropped. Both are ignored below PROFILE_LEVEL
+	void	BeginOctave(int octave, int detail);
+	void	NextLevel();
+	void	EndOctave();
+	//the number of features and the bytes moved by the scope that is closed last
+	void	SetData(int features, double bytes);
+	int		GetScopeNum() const;
+	int		GetScope(int index, SiftProfileScope& scope) const;
+	const char*	GetJSON();
+	int		SaveJSON(const char * path);
+	void	Reset();
+	//seconds since an arbitrary moment, and the cpu seconds of the calling thread
+	static double WallTime();
+	static double ThreadTime();
+	SiftProfiler();
+};
+
+#endif
+
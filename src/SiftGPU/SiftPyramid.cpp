@@ -28,6 +28,7 @@
 #include <iomanip>
 #include <vector>
 #include <algorithm>
+#include <functional>
 #include <fstream>
 #include <math.h>
 using namespace std;
@@ -36,6 +37,10 @@ using namespace std;
 #include "SiftPyramid.h"
 #include "SiftGPU.h"
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#include <emmintrin.h>
+	#define SIFTGPU_SSE2
+#endif
 
 #ifdef DEBUG_SIFTGPU
 #include "IL/il.h"
@@ -46,20 +51,33 @@ using namespace std;
 
 
 
-void SiftPyramid::RunSIFT(GLTexInput*input)
+void SiftPyramid::PrebuildPyramid(GLTexInput*input)
 {
-    CleanupBeforeSIFT(); 
+	CleanupBeforeSIFT();
+	GlobalUtil::StartTimer("Build    Pyramid");
+	BuildPyramid(input);
+	StopStageTimer();
+	_timing[0] = GetElapsedTime();
+	_prebuilt = 1;
+}
 
+void SiftPyramid::RunSIFT(GLTexInput*input)
+{
 	if(_existing_keypoints & SIFT_SKIP_FILTERING)
 	{
-		
+		CleanupBeforeSIFT(); 
+	}else if(_prebuilt)
+	{
+		//the timing and the status of the prebuild are kept
 	}else
 	{
+		CleanupBeforeSIFT(); 
 		GlobalUtil::StartTimer("Build    Pyramid");
 		BuildPyramid(input);
-		GlobalUtil::StopTimer();
+		StopStageTimer();
 		_timing[0] = GetElapsedTime();
 	}
+	_prebuilt = 0;
 
 
 	if(_existing_keypoints)
@@ -68,29 +86,31 @@ void SiftPyramid::RunSIFT(GLTexInput*input)
 		GlobalUtil::StartTimer("Upload Feature List");
 		if(!(_existing_keypoints & SIFT_SKIP_FILTERING)) ComputeGradient();
 		GenerateFeatureListTex();
-		GlobalUtil::StopTimer();
+		StopStageTimer();
+		GlobalUtil::ProfileData(_featureNum, _featureNum * 4.0 * sizeof(float));
 		_timing[2] = GetElapsedTime();
 	}else
 	{
 
 		GlobalUtil::StartTimer("Detect Keypoints");
 		DetectKeypointsEX();
-		GlobalUtil::StopTimer();
+		StopStageTimer();
 		_timing[1] = GetElapsedTime();
 
 		if(GlobalUtil::_ListGenGPU ==1)
 		{
 			GlobalUtil::StartTimer("Get Feature List");
 			GenerateFeatureList();
-			GlobalUtil::StopTimer();
+			StopStageTimer();
 
 		}else
 		{
 			GlobalUtil::StartTimer("Transfer Feature List");
 			GenerateFeatureListCPU();
-			GlobalUtil::StopTimer();
+			StopStageTimer();
 		}
 	    LimitFeatureCount(0);
+		GlobalUtil::ProfileData(_featureNum);
 		_timing[2] = GetElapsedTime();
 	}
 
@@ -104,7 +124,7 @@ void SiftPyramid::RunSIFT(GLTexInput*input)
 		//some extra tricks are done to handle existing keypoint list
 		GlobalUtil::StartTimer("Feature Orientations");
 		GetFeatureOrientations();
-		GlobalUtil::StopTimer();
+		StopStageTimer();
 		_timing[3] = GetElapsedTime();
 
 		//for existing keypoint list, only the strongest orientation is kept.
@@ -113,14 +133,15 @@ void SiftPyramid::RunSIFT(GLTexInput*input)
 			GlobalUtil::StartTimer("MultiO Feature List");
 			ReshapeFeatureListCPU();
             LimitFeatureCount(1);
-			GlobalUtil::StopTimer();	
+			StopStageTimer();	
+			GlobalUtil::ProfileData(_featureNum);
 			_timing[4] = GetElapsedTime();
 		}
 	}else
 	{
 		GlobalUtil::StartTimer("Feature Orientations");
 		GetSimplifiedOrientation();
-		GlobalUtil::StopTimer();
+		StopStageTimer();
 		_timing[3] = GetElapsedTime();
 	}
 
@@ -136,7 +157,8 @@ void SiftPyramid::RunSIFT(GLTexInput*input)
 		if(GlobalUtil::_MaxOrientation < 2 || GlobalUtil::_FixedOrientation)
 #endif
 		DownloadKeypoints();
-		GlobalUtil::StopTimer();
+		StopStageTimer();
+		GlobalUtil::ProfileData(_featureNum, _featureNum * 4.0 * sizeof(float));
 		_timing[5] =  GetElapsedTime(); 
 	}
 
@@ -147,7 +169,9 @@ void SiftPyramid::RunSIFT(GLTexInput*input)
 		//desciprotrs are downloaded in descriptor computation of each level
 		GlobalUtil::StartTimer("Get Descriptor");
 		GetFeatureDescriptors();
-		GlobalUtil::StopTimer();
+		StopStageTimer();
+		//the bytes are read back when they are quantized on the gpu
+		GlobalUtil::ProfileData(_featureNum, _featureNum * 128.0 * (_descriptor_u8 && GlobalUtil::_UseCUDA ? 1 : sizeof(float)));
 		_timing[6] =  GetElapsedTime(); 
 	}
 
@@ -159,7 +183,7 @@ void SiftPyramid::RunSIFT(GLTexInput*input)
 	{
 		GlobalUtil::StartTimer("Gen. Display VBO");
 		GenerateFeatureDisplayVBO();
-		GlobalUtil::StopTimer();
+		StopStageTimer();
 		_timing[7] = GlobalUtil::GetElapsedTime();
 	}
     //clean up
@@ -169,8 +193,11 @@ void SiftPyramid::RunSIFT(GLTexInput*input)
 
 void SiftPyramid::LimitFeatureCount(int have_keylist)
 {
-
-	if(GlobalUtil::_FeatureCountThreshold <= 0 || _existing_keypoints) return;
+	if(_existing_keypoints) return;
+	if(GlobalUtil::_FeatureCountThreshold <= 0) return;
+	//the budget is selected before computing the orientations, and all the orientations
+	//of the selected locations are kept. The list generation already removed the masked features
+	if(IsSelectingFeatures() && (have_keylist || SelectFeatures(GlobalUtil::_FeatureCountThreshold))) return;
 	///////////////////////////////////////////////////////////////
 	//skip the lowest levels to reduce number of features. 
 
@@ -210,6 +237,279 @@ void SiftPyramid::LimitFeatureCount(int have_keylist)
 
 }
 
+//sort feature indices by decreasing response
+struct FeatureResponseGreater
+{
+	const float * response;
+	FeatureResponseGreater(const float * r) : response(r) {}
+	bool operator()(int a, int b) const {return response[a] > response[b] || (response[a] == response[b] && a < b); }
+};
+
+//keep the features with the strongest responses
+static void SelectStrongest(const vector<float>& response, int keep_num, vector<unsigned char>& keep)
+{
+	int num = (int) response.size();
+	//the response of the K-th strongest feature, and how many of the ties are kept
+	vector<float> sorted(response);
+	std::nth_element(sorted.begin(), sorted.begin() + (keep_num - 1), sorted.end(), std::greater<float>());
+	float threshold = sorted[keep_num - 1];
+	int ties = keep_num;
+	for(int k = 0; k < num; ++k) if(response[k] > threshold) ties--;
+	for(int k = 0; k < num; ++k)
+	{
+		keep[k] = response[k] > threshold || (response[k] == threshold && ties-- > 0);
+	}
+}
+
+//the extent of the candidates, order[k] is the index of the k-th candidate in xy
+static void GetFeatureExtent(const vector<float>& xy, const vector<int>& order, float& xmax, float& ymax)
+{
+	xmax = ymax = 0;
+	for(size_t k = 0; k < order.size(); ++k)
+	{
+		xmax = max(xmax, xy[order[k] * 2]);		ymax = max(ymax, xy[order[k] * 2 + 1]);
+	}
+}
+
+//give each cell of a NxN grid the same share of the budget, and spend the 
+//share of the sparse cells on the strongest remaining features
+static void SelectGrid(const vector<float>& xy, const vector<int>& order, int grid, 
+					   int keep_num, vector<unsigned char>& keep)
+{
+	int num = (int) order.size(), selected = 0, k;
+	float xmax, ymax;
+	GetFeatureExtent(xy, order, xmax, ymax);
+	float sx = grid / (xmax + 1.0f), sy = grid / (ymax + 1.0f);
+	int quota = max(keep_num / (grid * grid), 1);
+	vector<int> cell_count(grid * grid, 0);
+	for(k = 0; k < num && selected < keep_num; ++k)
+	{
+		int idx = order[k];
+		int cx = min((int) (xy[idx * 2] * sx), grid - 1);
+		int cy = min((int) (xy[idx * 2 + 1] * sy), grid - 1);
+		int & count = cell_count[cy * grid + cx];
+		if(count >= quota) continue;
+		count++;	selected++;		keep[idx] = 1;
+	}
+	for(k = 0; k < num && selected < keep_num; ++k)
+	{
+		int idx = order[k];
+		if(keep[idx]) continue;
+		selected++;		keep[idx] = 1;
+	}
+}
+
+//greedy suppression in the order of response: a feature is kept if no kept feature
+//is within the radius. returns the number of kept features (at most keep_num)
+static int SuppressRadius(const vector<float>& xy, const vector<int>& order, float radius,
+						  int keep_num, vector<unsigned char>& keep)
+{
+	int num = (int) order.size(), selected = 0;
+	float xmax, ymax, r2 = radius * radius;
+	GetFeatureExtent(xy, order, xmax, ymax);
+	//kept features are linked in cells of at least the radius size, so only the 
+	//3x3 neighboring cells are checked. The cells are enlarged for small radii,
+	//so that there are at most about 4 cells per candidate
+	float size = max(radius, sqrtf((xmax + 1.0f) * (ymax + 1.0f) / (4.0f * num + 16.0f)));
+	int gw = (int) (xmax / size) + 1, gh = (int) (ymax / size) + 1;
+	vector<int> head(gw * gh, -1), next(keep.size(), -1);
+	std::fill(keep.begin(), keep.end(), 0);
+	for(int k = 0; k < num && selected < keep_num; ++k)
+	{
+		int idx = order[k];
+		float x = xy[idx * 2], y = xy[idx * 2 + 1];
+		int cx = min(max((int) (x / size), 0), gw - 1), cy = min(max((int) (y / size), 0), gh - 1), suppressed = 0;
+		for(int j = max(cy - 1, 0); j <= min(cy + 1, gh - 1) && !suppressed; ++j)
+		{
+			for(int i = max(cx - 1, 0); i <= min(cx + 1, gw - 1) && !suppressed; ++i)
+			{
+				for(int m = head[j * gw + i]; m >= 0; m = next[m])
+				{
+					float dx = xy[m * 2] - x, dy = xy[m * 2 + 1] - y;
+					if(dx * dx + dy * dy < r2) {suppressed = 1; break; }
+				}
+			}
+		}
+		if(suppressed) continue;
+		next[idx] = head[cy * gw + cx];
+		head[cy * gw + cx] = idx;
+		selected++;		keep[idx] = 1;
+	}
+	return selected;
+}
+
+//approximate adaptive non-maximal suppression: binary search for the largest
+//radius whose greedy suppression still keeps the budget
+static void SelectANMS(const vector<float>& xy, const vector<int>& order, 
+					   int keep_num, vector<unsigned char>& keep)
+{
+	float xmax, ymax;
+	GetFeatureExtent(xy, order, xmax, ymax);
+	//the radius at which keep_num features evenly cover the image is an upper bound
+	float rlow = 0.5f, rhigh = 2.0f * sqrt((xmax + 1.0f) * (ymax + 1.0f) / keep_num) + 1.0f;
+	for(int iter = 0; iter < 16 && rhigh - rlow > 0.5f; ++iter)
+	{
+		float r = (rlow + rhigh) * 0.5f;
+		if(SuppressRadius(xy, order, r, keep_num, keep) >= keep_num) rlow = r;
+		else rhigh = r;
+	}
+	int selected = SuppressRadius(xy, order, rlow, keep_num, keep);
+	//fill up with the strongest suppressed features 
+	for(size_t k = 0; k < order.size() && selected < keep_num; ++k)
+	{
+		if(keep[order[k]]) continue;
+		selected++;		keep[order[k]] = 1;
+	}
+}
+
+int SiftPyramid::SelectKeypoints(const vector<float>& xy, vector<float>& response, 
+								 int keep_num, vector<unsigned char>& keep)
+{
+	//the masked features are not candidates
+	int num = (int) keep.size(), k;
+	vector<int> order;	order.reserve(num);
+	for(k = 0; k < num; ++k) 
+	{
+		if(keep[k]) order.push_back(k);
+		else		response[k] = -1.0f;
+	}
+	if((int) order.size() <= keep_num) return (int) order.size();
+	std::fill(keep.begin(), keep.end(), 0);
+	if(GlobalUtil::_FeatureGridSize > 0 || GlobalUtil::_FeatureANMS)
+	{
+		std::sort(order.begin(), order.end(), FeatureResponseGreater(&response[0]));
+		if(GlobalUtil::_FeatureANMS)	SelectANMS(xy, order, keep_num, keep);
+		else							SelectGrid(xy, order, GlobalUtil::_FeatureGridSize, keep_num, keep);
+	}else
+	{
+		SelectStrongest(response, keep_num, keep);
+	}
+	return keep_num;
+}
+
+int SiftPyramid::SelectFeatures(int keep_num)
+{
+	int n = param._dog_level_num * _octave_num, num = _featureNum;
+	if(num <= keep_num) return 1;
+
+	//download the feature lists and the responses of all levels
+	vector<float> list(num * 4), xy(num * 2), response(num);
+	int i, j, k, offset = 0;
+	for(i = 0; i < n; offset += _levelFeatureNum[i++])
+	{
+		if(_levelFeatureNum[i] == 0) continue;
+		if(!DownloadFeatureList(i, &list[offset * 4], &xy[offset * 2], &response[offset])) return 0;
+		ConvertLevelLocation(i, _levelFeatureNum[i], &xy[offset * 2]);
+	}
+
+	vector<unsigned char> keep(num, 1);
+	int count = SelectKeypoints(xy, response, keep_num, keep);
+	if(count == num) return 1;
+
+	//compact the lists of each level and upload them
+	for(i = 0, k = 0; i < n; ++i)
+	{
+		int level_num = _levelFeatureNum[i], start = k, level_count = 0;
+		for(j = 0; j < level_num; ++j, ++k)
+		{
+			if(!keep[k]) continue;
+			if(start + level_count != k) memcpy(&list[(start + level_count) * 4], &list[k * 4], 4 * sizeof(float));
+			level_count++;
+		}
+		if(level_count == level_num) continue;
+		UploadFeatureList(i, &list[start * 4], level_count);
+		_levelFeatureNum[i] = level_count;
+	}
+	_featureNum = count;
+	if(GlobalUtil::_verbose)
+	{
+		std::cout<<"#Features Selected:\t"<<_featureNum<<endl;
+	}
+	return 1;
+}
+
+void SiftPyramid::ConvertLevelLocation(int idx, int num, float * xy)
+{
+	//the same conversion as the keypoints returned to the user
+	float os = _octave_min>=0? float(1<<_octave_min): 1.0f/(1<<(-_octave_min));
+	if(_down_sample_factor>0) os *= float(1<<_down_sample_factor); 
+	os *= float(1 << (idx / param._dog_level_num));
+	float offset = GlobalUtil::_LoweOrigin? 0 : 0.5f;
+	for(int k = 0; k < num * 2; ++k) xy[k] = os * (xy[k] - 0.5f) + offset;
+}
+
+int SiftPyramid::IsInsideDetectionMask(int idx, float x, float y)
+{
+	float xy[2] = {x, y};
+	ConvertLevelLocation(idx, 1, xy);
+	return IsInsideDetectionMask(xy[0], xy[1]);
+}
+
+int SiftPyramid::MaskFeatureList(int idx)
+{
+	int num = _levelFeatureNum[idx], count = 0;
+	if(num == 0) return 1;
+	vector<float> list(num * 4), xy(num * 2);
+	if(!DownloadFeatureList(idx, &list[0], &xy[0], NULL))
+	{
+		//the features would be silently kept otherwise
+		std::cerr<<"SiftGPU: detection masks are not supported by this implementation\n";
+		SetFailStatus();
+		return 0;
+	}
+	ConvertLevelLocation(idx, num, &xy[0]);
+	for(int k = 0; k < num; ++k)
+	{
+		if(!IsInsideDetectionMask(xy[k * 2], xy[k * 2 + 1])) continue;
+		if(count != k) memcpy(&list[count * 4], &list[k * 4], 4 * sizeof(float));
+		count++;
+	}
+	if(count == num) return 1;
+	UploadFeatureList(idx, &list[0], count);
+	_levelFeatureNum[idx] = count;
+	_featureNum -= num - count;
+	return 1;
+}
+
+int SiftPyramid::IsInsideDetectionMask(float x, float y)
+{
+	int px = (int) floor(x), py = (int) floor(y);
+	if(_detection_mask.size() > 0)
+	{
+		if(px < 0 || py < 0 || px >= _mask_width || py >= _mask_height) return 0;
+		if(_detection_mask[py * _mask_width + px] == 0) return 0;
+	}
+	if(_detection_roi.size() > 0)
+	{
+		for(size_t i = 0; i < _detection_roi.size(); i += 4)
+		{
+			const int * roi = &_detection_roi[i];
+			if(px >= roi[0] && py >= roi[1] && px < roi[0] + roi[2] && py < roi[1] + roi[3]) return 1;
+		}
+		return 0;
+	}
+	return 1;
+}
+
+void SiftPyramid::SetDetectionMask(int width, int height, const unsigned char * mask)
+{
+	if(mask && width > 0 && height > 0)
+	{
+		_detection_mask.assign(mask, mask + width * height);
+		_mask_width = width;	_mask_height = height;
+	}else
+	{
+		_detection_mask.resize(0);
+		_mask_width = _mask_height = 0;
+	}
+}
+
+void SiftPyramid::SetDetectionROI(int num, const int * rois)
+{
+	if(rois && num > 0)	_detection_roi.assign(rois, rois + num * 4);
+	else				_detection_roi.resize(0);
+}
+
 void SiftPyramid::PrepareBuffer()
 {
 	//when there is no existing keypoint list, the feature list need to be downloaded
@@ -223,7 +523,9 @@ void SiftPyramid::PrepareBuffer()
 	{
 		//_descriptor_buffer.resize(128*(_featureNum + align)); 
 		_descriptor_buffer.resize(128 * _featureNum + 16 * GlobalUtil::_texMaxDim);//11/19/2008
+		if(GlobalUtil::_DescriptorU8) _descriptor_buffer_u8.resize(128 * _featureNum + 16 * GlobalUtil::_texMaxDim);
 	}
+	_descriptor_u8 = 0;
 
 }
 
@@ -238,9 +540,54 @@ int SiftPyramid:: GetRequiredOctaveNum(int inputsz)
 void SiftPyramid::CopyFeatureVector(float*keys, float *descriptors)
 {
 	if(keys)		memcpy(keys, &_keypoint_buffer[0], 4*_featureNum*sizeof(float));
+	if(descriptors)	ExpandDescriptorsU8();
 	if(descriptors)	memcpy(descriptors, &_descriptor_buffer[0], 128*_featureNum*sizeof(float));
 }
 
+void SiftPyramid::ExpandDescriptorsU8()
+{
+	if(_descriptor_u8 != 1) return;
+	//the inverse of the quantization, the bytes are still valid after this
+	int count = 128 * _featureNum;
+	if(_descriptor_buffer.size() < (size_t) count) _descriptor_buffer.resize(count);
+	for(int i = 0; i < count; ++i) _descriptor_buffer[i] = _descriptor_buffer_u8[i] * (1.0f / 512.0f);
+	_descriptor_u8 = 2;
+}
+
+//uint8 descriptors use the same scale as SiftMatchGPU and the ASCII files,
+//d = floor(512 * f + 0.5), saturated to 255 
+static void QuantizeDescriptors(const float * src, unsigned char * dst, int count)
+{
+	int i = 0;
+#if defined(SIFTGPU_SSE2)
+	const __m128 scale = _mm_set1_ps(512.0f), half = _mm_set1_ps(0.5f);
+	for(; i + 16 <= count; i += 16)
+	{
+		//the values are positive, so truncation equals floor
+		__m128i d0 = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(src + i), scale), half));
+		__m128i d1 = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(src + i + 4), scale), half));
+		__m128i d2 = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(src + i + 8), scale), half));
+		__m128i d3 = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(src + i + 12), scale), half));
+		//the packing instructions saturate to [0, 255]
+		__m128i d = _mm_packus_epi16(_mm_packs_epi32(d0, d1), _mm_packs_epi32(d2, d3));
+		_mm_storeu_si128((__m128i*) (dst + i), d);
+	}
+#endif
+	for(; i < count; ++i)
+	{
+		int v = (int) floor(0.5 + 512.0f * src[i]);
+		dst[i] = (unsigned char) (v < 0 ? 0 : (v > 255 ? 255 : v));
+	}
+}
+
+void SiftPyramid::CopyFeatureVectorU8(float*keys, unsigned char *descriptors)
+{
+	if(keys)		memcpy(keys, &_keypoint_buffer[0], 4*_featureNum*sizeof(float));
+	if(descriptors == NULL || _featureNum <= 0) return;
+	if(_descriptor_u8)	memcpy(descriptors, &_descriptor_buffer_u8[0], 128*_featureNum);
+	else				QuantizeDescriptors(&_descriptor_buffer[0], descriptors, 128*_featureNum);
+}
+
 void SiftPyramid:: SetKeypointList(int num, const float * keys, int run_on_current, int skip_orientation)
 {
 	//for each input keypoint
@@ -265,13 +612,30 @@ void SiftPyramid::SaveSIFT(const char * szFileName)
 {
 	if (_featureNum <=0) return;
 	float * pk = &_keypoint_buffer[0];
+	if(GlobalUtil::_DescriptorPPT && GlobalUtil::_BinarySIFT != 2) ExpandDescriptorsU8();
 
 	if(GlobalUtil::_BinarySIFT)
 	{
 		std::ofstream out(szFileName, ios::binary);
 		out.write((char* )(&_featureNum), sizeof(int));
 
-		if(GlobalUtil::_DescriptorPPT)
+		if(GlobalUtil::_DescriptorPPT && GlobalUtil::_BinarySIFT == 2)
+		{
+			//negative dimension for uint8 descriptors
+			int dim = -128;
+			out.write((char* )(&dim), sizeof(int));
+			unsigned char des[128];
+			float * pd = &_descriptor_buffer[0] ;
+			for(int i = 0; i < _featureNum; i++, pk+=4, pd +=128)
+			{
+				if(_descriptor_u8)	memcpy(des, &_descriptor_buffer_u8[i * 128], 128);
+				else				QuantizeDescriptors(pd, des, 128);
+				out.write((char* )(pk +1), sizeof(float));
+				out.write((char* )(pk), sizeof(float));
+				out.write((char* )(pk+2), 2 * sizeof(float));
+				out.write((char* )(des), 128);
+			}
+		}else if(GlobalUtil::_DescriptorPPT)
 		{
 			int dim = 128;
 			out.write((char* )(&dim), sizeof(int));
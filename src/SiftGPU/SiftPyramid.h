@@ -71,7 +71,15 @@ protected:
 	float*		_histo_buffer;
     //keypoint list
 	int			_existing_keypoints;
+	//the pyramid of the input is built ahead of RunSIFT, see PrebuildPyramid
+	int			_prebuilt;
+	//the descriptors of the last run are only in _descriptor_buffer_u8 (1), or in both buffers (2)
+	int			_descriptor_u8;
 	vector<int>	_keypoint_index;
+	//detection mask and rectangles {x, y, w, h}, in the coordinates of the keypoints
+	vector<unsigned char> _detection_mask;
+	int			_mask_width, _mask_height;
+	vector<int>	_detection_roi;
 	//display vbo
 	GLuint*	    _featureDisplayVBO;
 	GLuint*	 	_featurePointVBO;
@@ -90,20 +98,50 @@ public:
 	int			_pyramid_height;
 	int			_down_sample_factor;
 	int			_allocated; 
+	int			_allocated_kb;	//the pyramid and the feature storage
 	int		    _alignment;
     int         _siftgpu_failed;
 public:
 	vector<float>	_keypoint_buffer;
 	vector<float>	_descriptor_buffer;
+	//the uint8 descriptors read back with -u8
+	vector<unsigned char> _descriptor_buffer_u8;
 private:
 	inline  void PrepareBuffer();
 	inline  void LimitFeatureCount(int have_keylist = 0);
+	int		SelectFeatures(int keep_num);
+protected:
+	//convert the locations of level idx to the coordinates of the returned keypoints
+	void	ConvertLevelLocation(int idx, int num, float * xy);
+	int		IsInsideDetectionMask(float x, float y);
+	//the same for a location in level idx
+	int		IsInsideDetectionMask(int idx, float x, float y);
+	//remove the masked features from the list of level idx, called by the list generation 
+	//so that the level dropping of -tc counts only the unmasked features
+	int		MaskFeatureList(int idx);
+	//read back the feature list of a level (4 floats per feature), with the location 
+	//in the level and the DoG response (if not NULL) of each feature. returns 0 if not supported
+	virtual int  DownloadFeatureList(int idx, float * list, float * xy, float * response) {return 0; }
+	//replace the feature list of a level with a downloaded (and filtered) one
+	virtual void UploadFeatureList(int idx, const float * list, int num) {}
 public:
 	//shared by all implementations
 	virtual void RunSIFT(GLTexInput*input);
+	//build the pyramid of the next input, so that the next RunSIFT starts from the detection
+	void PrebuildPyramid(GLTexInput*input);
+	inline void CancelPrebuild() {_prebuilt = 0; }
 	virtual void SaveSIFT(const char * szFileName);
 	virtual void CopyFeatureVector(float*keys, float *descriptors);
+	virtual void CopyFeatureVectorU8(float*keys, unsigned char *descriptors);
 	virtual void SetKeypointList(int num, const float * keys, int run_on_current, int skip_orientation);
+	virtual void SetDetectionMask(int width, int height, const unsigned char * mask);
+	virtual void SetDetectionROI(int num, const int * rois);
+	//make the shaders of this pyramid current, when instances share a thread
+	virtual void SelectShaders() {}
+	//select keep_num of the features flagged in keep (xy and response of each), with 
+	//the grid or the ANMS selection if enabled. returns the number of kept features
+	static int SelectKeypoints(const vector<float>& xy, vector<float>& response, 
+								int keep_num, vector<unsigned char>& keep);
 	//implementation-dependent functions
 	virtual void GetFeatureDescriptors() = 0;
 	virtual void GenerateFeatureListTex() =0;
@@ -125,17 +163,32 @@ public:
     ////////////////////////////////
     virtual void CleanUpAfterSIFT()  {}
     virtual int  IsUsingRectDescription() {return 0; } 
+	//wait until the device has run the queued work
+	virtual void FinishDevice() {}
     static  int  GetRequiredOctaveNum(int inputsz); 
 
 	///inline functions, shared by all implementations
     inline void SetFailStatus() {_siftgpu_failed = 1; }
     inline int  GetSucessStatus() {return _siftgpu_failed == 0; }
 	inline int GetFeatureNum(){return _featureNum;}
+	//the buffers are filled by another source, e.g. the feature cache
+	inline void SetFeatureNum(int num) {_featureNum = num; _descriptor_u8 = 0; }
+	//fill the float descriptors from the uint8 descriptors of -u8
+	void ExpandDescriptorsU8();
+	inline int  HasKeypointList() {return _existing_keypoints; }
+	//the feature budget is met by the cpu selection instead of dropping levels
+	static inline int IsSelectingFeatures() 
+	{
+		return _TruncateMethod == 3 || _FeatureGridSize > 0 || _FeatureANMS; 
+	}
+	inline int HasDetectionMask() {return _detection_mask.size() > 0 || _detection_roi.size() > 0; }
 	inline int GetHistLevelNum(){return _hpLevelNum;}
 	inline const GLuint * GetFeatureDipslayVBO(){return _featureDisplayVBO;}
 	inline const GLuint * GetPointDisplayVBO(){return _featurePointVBO;}
 	inline const int * GetLevelFeatureNum(){return _levelFeatureNum;}
 	inline void	GetPyramidTiming(float * timing){	for(int i = 0; i < 8; i++) timing[i] = _timing[i];	}
+	//the end of a stage, which includes the work of the device when the stages are profiled
+	inline void StopStageTimer()	{	if(GlobalUtil::Profiling(1)) FinishDevice(); GlobalUtil::StopTimer();	}
     inline void CleanupBeforeSIFT() 
     {
         _siftgpu_failed = 0;
@@ -157,10 +210,14 @@ public:
 		_pyramid_octave_num = _pyramid_octave_first = 0;
 		_pyramid_width = _pyramid_height = 0;
 		_allocated = 0;
+		_allocated_kb = 0;
 		_down_sample_factor = 0;
 
 		/////
 		_existing_keypoints = 0;
+		_prebuilt = 0;
+		_descriptor_u8 = 0;
+		_mask_width = _mask_height = 0;
 	}
 	virtual ~SiftPyramid() {};	
 
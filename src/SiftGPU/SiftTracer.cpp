@@ -0,0 +1,322 @@
+////////////////////////////////////////////////////////////////////////////
+//	File:		SiftTracer.cpp
+//	Author:		SiftGPU contributors
+//	Description :	implementation of the SiftTracer class.
+//
+//	This file was added to SiftGPU in 2026 and is distributed under the
+//	same terms as the rest of SiftGPU, see the notice in SiftGPU.h.
+//
+////////////////////////////////////////////////////////////////////////////
+
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <stdio.h>
+#include <string.h>
+
+#if defined(_WIN32)
+	#define WIN32_LEAN_AND_MEAN
+	#include <windows.h>
+	#pragma warning (disable : 4996)
+	#define TRACE_BARRIER()	MemoryBarrier()
+	#define TRACE_PID()		((int) GetCurrentProcessId())
+#else
+	#include <unistd.h>
+	#include <pthread.h>
+	#define TRACE_BARRIER()	__sync_synchronize()
+	#define TRACE_PID()		((int) getpid())
+#endif
+
+#include "GL/glew.h"
+#include "GlobalUtil.h"
+#include "SiftTracer.h"
+
+struct TraceEvent
+{
+	double		ts;			//microseconds
+	double		dur;		//-1 for the instant events
+	double		value;
+	const char*	name;
+	const char*	category;
+	char		detail[SiftTracer::DETAIL_SIZE];
+};
+
+//the events of one thread, which is the only writer. The rings are kept for the
+//life of the process, since the events of the finished threads are still saved.
+//The ring of a thread that exits is taken by a new thread after the next Start
+struct TraceRing
+{
+	int			tid;
+	int			generation;
+	int			owned;		//0 after its thread exits, under the global lock
+	char		name[32];
+	std::vector<TraceEvent>	events;
+	volatile unsigned int	count;	//the events written since Start
+	TraceEvent	open[SiftTracer::MAX_DEPTH];
+	int			depth;
+};
+
+volatile int SiftTracer::_enabled = 0;
+static volatile int					s_generation = 0;
+static int							s_event_num = SiftTracer::DEFAULT_EVENT_NUM;
+static std::vector<TraceRing*>		s_rings;	//under the global lock
+static SIFTGPU_THREAD_LOCAL TraceRing* s_ring = NULL;
+static SIFTGPU_THREAD_LOCAL char		s_thread_name[32];
+
+static double TraceClock()
+{
+	return (double) ClockTimer::ClockUS();
+}
+
+//the rings are released when their threads exit
+#if defined(_WIN32)
+static DWORD	s_ring_key = FLS_OUT_OF_INDEXES;
+static VOID WINAPI ReleaseRing(PVOID ring)
+#else
+static pthread_key_t	s_ring_key;
+static int				s_ring_key_created = 0;
+static void ReleaseRing(void* ring)
+#endif
+{
+	if(ring == NULL) return;
+	GlobalUtil::EnterGlobalLock();
+	((TraceRing*) ring)->owned = 0;
+	GlobalUtil::LeaveGlobalLock();
+}
+
+//with the global lock held
+static void SetThreadRing(TraceRing* ring)
+{
+#if defined(_WIN32)
+	if(s_ring_key == FLS_OUT_OF_INDEXES) s_ring_key = FlsAlloc(ReleaseRing);
+	if(s_ring_key != FLS_OUT_OF_INDEXES) FlsSetValue(s_ring_key, ring);
+#else
+	if(!s_ring_key_created) s_ring_key_created = pthread_key_create(&s_ring_key, ReleaseRing) == 0;
+	if(s_ring_key_created) pthread_setspecific(s_ring_key, ring);
+#endif
+}
+
+static void CopyDetail(char* dst, const char* detail)
+{
+	dst[0] = 0;
+	if(detail == NULL) return;
+	strncpy(dst, detail, SiftTracer::DETAIL_SIZE - 1);
+	dst[SiftTracer::DETAIL_SIZE - 1] = 0;
+}
+
+//the ring of the calling thread for the current Start
+static TraceRing* GetRing()
+{
+	int generation = s_generation;
+	TraceRing* ring = s_ring;
+	if(ring && ring->generation == generation) return ring;
+	if(ring == NULL || ring->events.size() != (size_t) s_event_num)
+	{
+		//a new ring if the size is changed, the old one is left to the saving threads.
+		//The released rings whose events are not saved any more are taken first
+		TraceRing* next = NULL;
+		GlobalUtil::EnterGlobalLock();
+		if(ring) ring->owned = 0;
+		for(size_t i = 0; i < s_rings.size() && next == NULL; ++i)
+		{
+			TraceRing* other = s_rings[i];
+			if(other->owned || other->generation == generation || other->events.size() != (size_t) s_event_num) continue;
+			next = other;
+		}
+		if(next == NULL)
+		{
+			next = new TraceRing;
+			next->events.resize(s_event_num);
+			next->tid = (int) s_rings.size() + 1;
+			s_rings.push_back(next);
+		}
+		if(ring) next->tid = ring->tid;
+		next->count = 0;
+		next->depth = 0;
+		next->generation = -1;
+		next->owned = 1;
+		if(s_thread_name[0]) strcpy(next->name, s_thread_name);
+		else sprintf(next->name, "thread %d", next->tid);
+		SetThreadRing(next);
+		GlobalUtil::LeaveGlobalLock();
+		s_ring = ring = next;
+	}
+	ring->count = 0;
+	ring->depth = 0;
+	TRACE_BARRIER();
+	ring->generation = generation;
+	return ring;
+}
+
+static void PushEvent(TraceRing* ring, const TraceEvent& event)
+{
+	unsigned int count = ring->count;
+	ring->events[count % ring->events.size()] = event;
+	//the event is written before it is counted
+	TRACE_BARRIER();
+	ring->count = count + 1;
+}
+
+void SiftTracer::Start(int events_per_thread)
+{
+	GlobalUtil::EnterGlobalLock();
+	s_event_num = events_per_thread > 0 ? events_per_thread : DEFAULT_EVENT_NUM;
+	s_generation++;
+	_enabled = 1;
+	GlobalUtil::LeaveGlobalLock();
+}
+
+void SiftTracer::Stop()
+{
+	_enabled = 0;
+}
+
+void SiftTracer::Begin(const char * name, const char * category, const char * detail)
+{
+	TraceRing* ring = GetRing();
+	if(ring->depth < MAX_DEPTH)
+	{
+		TraceEvent& event = ring->open[ring->depth];
+		event.name = name;
+		event.category = category;
+		CopyDetail(event.detail, detail);
+		event.ts = TraceClock();
+	}
+	ring->depth++;
+}
+
+void SiftTracer::End(double value, const char * name)
+{
+	TraceRing* ring = s_ring;
+	//the scopes that are opened before Start are ignored
+	if(ring == NULL || ring->generation != s_generation || ring->depth == 0) return;
+	if(--ring->depth >= MAX_DEPTH) return;
+	TraceEvent event = ring->open[ring->depth];
+	event.dur = TraceClock() - event.ts;
+	event.value = value;
+	if(name) event.name = name;
+	PushEvent(ring, event);
+}
+
+void SiftTracer::Instant(const char * name, const char * category, const char * detail)
+{
+	TraceRing* ring = GetRing();
+	TraceEvent event;
+	event.ts = TraceClock();
+	event.dur = -1;
+	event.value = -1;
+	event.name = name;
+	event.category = category;
+	CopyDetail(event.detail, detail);
+	PushEvent(ring, event);
+}
+
+void SiftTracer::SetThreadName(const char * name)
+{
+	//the ring is created by the first event, which takes the name
+	strncpy(s_thread_name, name, sizeof(s_thread_name) - 1);
+	s_thread_name[sizeof(s_thread_name) - 1] = 0;
+	if(s_ring) strcpy(s_ring->name, s_thread_name);
+}
+
+static void AppendString(std::string& json, const char* text)
+{
+	json += '"';
+	for(const char* p = text; *p; ++p)
+	{
+		if(*p == '"' || *p == '\\')
+		{
+			json += '\\';
+			json += *p;
+		}else if((unsigned char) *p < 0x20)
+		{
+			char code[8];
+			sprintf(code, "\\u%04x", *p);
+			json += code;
+		}else
+		{
+			json += *p;
+		}
+	}
+	json += '"';
+}
+
+void SiftTracer::GetJSON(std::string& json)
+{
+	GlobalUtil::EnterGlobalLock();
+	std::vector<TraceRing*> rings = s_rings;
+	int generation = s_generation;
+	GlobalUtil::LeaveGlobalLock();
+
+	char buf[256];
+	int pid = TRACE_PID(), first = 1;
+	std::vector<TraceEvent> events;
+	json = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+	for(size_t i = 0; i < rings.size(); ++i)
+	{
+		TraceRing* ring = rings[i];
+		if(ring->generation != generation) continue;
+
+		//copy the events while the thread may be writing more; the ones that are 
+		//overwritten during the copy are dropped. Event now may be in the middle of 
+		//its write, which is into the slot of event now - size
+		unsigned int end = ring->count, size = (unsigned int) ring->events.size();
+		TRACE_BARRIER();
+		unsigned int begin = end > size ? end - size : 0;
+		events.resize(end - begin);
+		for(unsigned int j = begin; j < end; ++j) events[j - begin] = ring->events[j % size];
+		TRACE_BARRIER();
+		unsigned int now = ring->count;
+		unsigned int skip = now + 1 > size && now + 1 - size > begin ? now + 1 - size - begin : 0;
+		if(skip > events.size()) skip = (unsigned int) events.size();
+
+		sprintf(buf, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":",
+				first ? "" : ",", pid, ring->tid);
+		json += buf;
+		AppendString(json, ring->name);
+		json += "}}";
+		first = 0;
+		for(size_t j = skip; j < events.size(); ++j)
+		{
+			const TraceEvent& event = events[j];
+			json += ",\n{\"name\":";
+			AppendString(json, event.name);
+			json += ",\"cat\":";
+			AppendString(json, event.category);
+			if(event.dur >= 0)	sprintf(buf, ",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f", event.ts, event.dur);
+			else				sprintf(buf, ",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f", event.ts);
+			json += buf;
+			sprintf(buf, ",\"pid\":%d,\"tid\":%d", pid, ring->tid);
+			json += buf;
+			if(event.detail[0] || event.value >= 0)
+			{
+				json += ",\"args\":{";
+				if(event.detail[0])
+				{
+					json += "\"detail\":";
+					AppendString(json, event.detail);
+				}
+				if(event.value >= 0)
+				{
+					sprintf(buf, "%s\"value\":%.0f", event.detail[0] ? "," : "", event.value);
+					json += buf;
+				}
+				json += "}";
+			}
+			json += "}";
+		}
+	}
+	json += "\n]}\n";
+}
+
+int SiftTracer::Save(const char * path)
+{
+	std::string json;
+	GetJSON(json);
+	std::ofstream out(path, std::ios::binary);
+	if(!out.is_open()) return 0;
+	out << json;
+	return out.good() ? 1 : 0;
+}
+
@@ -0,0 +1,72 @@
+////////////////////////////////////////////////////////////////////////////
+//	File:		SiftTracer.h
+//	Author:		SiftGPU contributors
+//	Description :	interface for the SiftTracer class.
+//		SiftTracer:		timeline of the pipeline events of all the threads
+//						(stages, GPU launches, readbacks, image loads and
+//						server commands), saved in the Chrome trace format
+//		SiftTraceScope:	a traced scope of the calling thread
+//
+//	This file was added to SiftGPU in 2026 and is distributed under the
+//	same terms as the rest of SiftGPU, see the notice in SiftGPU.h.
+//
+////////////////////////////////////////////////////////////////////////////
+
+
+#ifndef SIFT_TRACER_H
+#define SIFT_TRACER_H
+
+#include <string>
+
+//The tracer is process-wide. Each thread writes its events to its own ring buffer
+//without locking, and the ring keeps the last events_per_thread events. The ring of
+//a thread that exits is reused by a new thread after the next Start. The names
+//and categories must be static strings, and the details are copied (truncated).
+//The JSON can be opened by chrome://tracing or https://ui.perfetto.dev
+class SiftTracer
+{
+public:
+	enum
+	{
+		DEFAULT_EVENT_NUM	= 65536,
+		MAX_DEPTH			= 32,	//the deeper scopes of a thread are not recorded
+		DETAIL_SIZE			= 64
+	};
+	static volatile int _enabled;
+public:
+	inline static int IsEnabled()	{	return _enabled;	}
+	//the events of the previous Start are cleared
+	static void Start(int events_per_thread = DEFAULT_EVENT_NUM);
+	static void Stop();
+	//a scope of the calling thread. value (e.g. bytes) is added as an argument if it is
+	//not negative, and name replaces the name of Begin if it is not NULL
+	static void Begin(const char * name, const char * category, const char * detail = NULL);
+	static void End(double value = -1, const char * name = NULL);
+	static void Instant(const char * name, const char * category, const char * detail = NULL);
+	//the name of the calling thread in the timeline
+	static void SetThreadName(const char * name);
+	//the events of all the threads since Start, in the Chrome trace event format
+	static void GetJSON(std::string& json);
+	static int  Save(const char * path);
+};
+
+class SiftTraceScope
+{
+	int		_active;
+	double	_value;
+public:
+	SiftTraceScope(const char * name, const char * category, const char * detail = NULL)
+	{
+		_active = SiftTracer::IsEnabled();
+		_value = -1;
+		if(_active) SiftTracer::Begin(name, category, detail);
+	}
+	inline void SetValue(double value)	{	_value = value;	}
+	~SiftTraceScope()
+	{
+		if(_active) SiftTracer::End(_value);
+	}
+};
+
+#endif
+
@@ -0,0 +1,83 @@
+////////////////////////////////////////////////////////////////////////////
+//	File:		BenchUtil.h
+//	Author:		SiftGPU contributors
+//	Description :	the timer, memory, percentile and JSON helpers that are
+//					shared by siftgpu_bench and siftmatch_bench
+//
+//	This file was added to SiftGPU in 2026 and is distributed under the
+//	same terms as the rest of SiftGPU, see the notice in SiftGPU.h.
+//
+////////////////////////////////////////////////////////////////////////////
+
+
+#ifndef BENCH_UTIL_H
+#define BENCH_UTIL_H
+
+#include <vector>
+#include <string>
+
+#ifdef _WIN32
+	#define WIN32_LEAN_AND_MEAN
+	#include <windows.h>
+	#include <psapi.h>
+	#pragma comment(lib, "psapi.lib")
+#else
+	#include <sys/time.h>
+	#include <sys/resource.h>
+#endif
+
+inline double GetSeconds()
+{
+#if defined(_WIN32)
+	LARGE_INTEGER frequency, counter;
+	QueryPerformanceFrequency(&frequency);
+	QueryPerformanceCounter(&counter);
+	return double(counter.QuadPart) / double(frequency.QuadPart);
+#else
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	return now.tv_sec + now.tv_usec * 1e-6;
+#endif
+}
+
+//the peak resident memory of the process so far
+inline int GetPeakMemoryKB()
+{
+#if defined(_WIN32)
+	PROCESS_MEMORY_COUNTERS counters;
+	if(!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) return 0;
+	return (int) (counters.PeakWorkingSetSize / 1024);
+#else
+	struct rusage usage;
+	if(getrusage(RUSAGE_SELF, &usage)) return 0;
+#if defined(__APPLE__)
+	return (int) (usage.ru_maxrss / 1024);
+#else
+	return (int) usage.ru_maxrss;
+#endif
+#endif
+}
+
+//the percentile q of sorted values, interpolated between the neighbors
+inline double GetPercentile(const std::vector<double>& sorted, double q)
+{
+	if(sorted.empty()) return 0;
+	double rank = q * (sorted.size() - 1);
+	size_t i = (size_t) rank;
+	if(i + 1 >= sorted.size()) return sorted.back();
+	return sorted[i] + (sorted[i + 1] - sorted[i]) * (rank - i);
+}
+
+//text as a JSON string, with the quotes and backslashes escaped
+inline void AppendString(std::string& json, const std::string& text)
+{
+	json += '"';
+	for(size_t i = 0; i < text.size(); ++i)
+	{
+		if(text[i] == '"' || text[i] == '\\') json += '\\';
+		json += text[i];
+	}
+	json += '"';
+}
+
+#endif
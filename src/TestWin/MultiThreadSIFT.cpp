@@ -94,9 +94,9 @@ private:
         InitializeSIFT();
         printf("done\n");
 
-        //The initialization part should be protected by a mutex in
-        //single-process-multi-thread mode. For now many parameters 
-        //are still global static variables. 
+        //The parameters of each SiftGPU are now kept per instance, but the 
+        //context creation and initialization are still serialized here. 
+        //SiftGPUPool (SiftGPUPool.h) manages such worker threads for you.
     }
 public:
     MultiThreadSIFT(int device_id = 0, const void* thread_param = NULL)
@@ -181,11 +181,10 @@ public:
         _sift->RunSIFT(filename);
 
         //////////////////////////////////////////////////////////////////////
-        //WARNING: the image loader (DeviL) used by SiftGPU is not thread-safe. 
-        //This demo will put the file loading part in InitializeSIFT, which
-        //is protected by a mutex. In your multi-thread application, you should
-        //load the image data outside SiftGPU, and specify the memory data to 
-        //SiftGPU directly. 
+        //NOTE: the image loader (DeviL) used by SiftGPU is not thread-safe, 
+        //and SiftGPU serializes the file decoding with a global lock. In your 
+        //multi-thread application, you can load the image data outside SiftGPU, 
+        //and specify the memory data to SiftGPU directly. 
         /////////////////////////////////////////////////////////////////////
     }
 };
@@ -0,0 +1,482 @@
+////////////////////////////////////////////////////////////////////////////
+//	File:		bench.cpp
+//	Author:		SiftGPU contributors
+//	Description :	siftgpu_bench, the speed of SiftGPU over image sizes,
+//					parameters and backends, saved as JSON and compared
+//					with a baseline. It supersedes speed.cpp.
+//
+//	This file was added to SiftGPU in 2026 and is distributed under the
+//	same terms as the rest of SiftGPU, see the notice in SiftGPU.h.
+//
+////////////////////////////////////////////////////////////////////////////
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <iostream>
+#include <fstream>
+using std::cout;
+
+#ifdef _WIN32
+	//dll import definition for win32
+	#define SIFTGPU_DLL
+	#define WIN32_LEAN_AND_MEAN
+	#include <windows.h>
+	#pragma warning (disable : 4996)
+	#if defined(_MSC_VER) && _MSC_VER < 1900
+		#define snprintf _snprintf
+	#endif
+#endif
+
+#include "GL/glew.h"
+#include "../SiftGPU/SiftGPU.h"
+#include "BenchUtil.h"
+
+//Each case is an image, a backend and a parameter set. A SiftGPU is created for
+//each backend and parameter set, and every image is run -warmup times before the
+//-n timed runs. The synthetic images are uploaded by every run, and the image files
+//are loaded once and run again from the texture, like speed.cpp. With -stages, the
+//runs are repeated with the timing of each stage, which waits for the GPU.
+//
+//The JSON has one case per line, and -baseline reads the cases of a previous JSON
+//by name: a case regresses if its median time grows by more than -threshold.
+//process_peak_rss_kb is the peak memory of the whole process when the case ends,
+//which includes the cases before it. Version 2 renames it from peak_rss_kb.
+
+#define BENCH_VERSION	2
+#define STAGE_NUM		9
+
+static const char* stage_names[STAGE_NUM] =
+{
+	"load_image", "initialize", "build_pyramid", "detection", "feature_list",
+	"orientation", "mo_feature_list", "download_keys", "descriptor"
+};
+
+struct BenchImage
+{
+	std::string	name;
+	std::string	path;		//empty for a synthetic image
+	int			width, height;
+	std::vector<unsigned char> pixels;
+};
+
+struct BenchCase
+{
+	std::string	name, image, backend, param;
+	int			width, height, runs, failed;
+	double		mean, min, max, p50, p90, p99;	//milliseconds
+	double		images_per_sec, mpixels_per_sec;
+	double		features, features_per_sec;
+	int			gpu_pyramid_kb;
+	int			process_peak_rss_kb;	//the peak of the process up to this case, not of the case
+	double		stages[STAGE_NUM];				//median of each stage, -1 if not measured
+	double		baseline;						//median of the baseline, -1 if not found
+	int			regression;
+};
+
+//blobs of random size and contrast over a gradient with noise, the same for the same size
+static void MakeSyntheticImage(BenchImage& image)
+{
+	int w = image.width, h = image.height;
+	unsigned int seed = (unsigned int) (w * 7919 + h);
+	std::vector<float> data(w * h);
+	for(int y = 0; y < h; ++y)
+	{
+		for(int x = 0; x < w; ++x)
+		{
+			seed = seed * 1103515245 + 12345;
+			data[y * w + x] = 64.0f + 128.0f * (x + y) / (w + h) + ((seed >> 16) % 16) - 8.0f;
+		}
+	}
+	int blob_num = w * h / 2000;
+	for(int i = 0; i < blob_num; ++i)
+	{
+		seed = seed * 1103515245 + 12345;	int cx = (seed >> 8) % w;
+		seed = seed * 1103515245 + 12345;	int cy = (seed >> 8) % h;
+		seed = seed * 1103515245 + 12345;	int r = 2 + (seed >> 8) % 19;
+		seed = seed * 1103515245 + 12345;	float c = ((seed >> 8) % 2 ? 1.0f : -1.0f) * (40 + (seed >> 12) % 60);
+		for(int y = std::max(0, cy - r); y <= std::min(h - 1, cy + r); ++y)
+		{
+			for(int x = std::max(0, cx - r); x <= std::min(w - 1, cx + r); ++x)
+			{
+				float d = float((x - cx) * (x - cx) + (y - cy) * (y - cy)) / (r * r);
+				if(d < 1.0f) data[y * w + x] += c * (1.0f - d);
+			}
+		}
+	}
+	image.pixels.resize(w * h);
+	for(int i = 0; i < w * h; ++i)
+		image.pixels[i] = (unsigned char) std::max(0.0f, std::min(255.0f, data[i]));
+}
+
+//the file names in an image list are relative to the folder of the list, like -il
+static void LoadImageList(const char* imlist, std::vector<BenchImage>& images)
+{
+	std::ifstream in(imlist);
+	std::string folder = imlist, filename;
+	size_t slash = folder.find_last_of("/\\");
+	folder = slash == std::string::npos ? "" : folder.substr(0, slash + 1);
+	while(in >> filename)
+	{
+		int absolute = filename[0] == '/' || filename[0] == '\\' || (filename.size() > 1 && filename[1] == ':');
+		BenchImage image;
+		image.name = filename;
+		image.path = absolute ? filename : folder + filename;
+		image.width = image.height = 0;
+		images.push_back(image);
+	}
+}
+
+//the items of a list separated by sep, without the surrounding spaces
+static void SplitList(const char* text, char sep, std::vector<std::string>& items)
+{
+	std::string item;
+	for(const char* p = text; ; ++p)
+	{
+		if(*p == sep || *p == 0)
+		{
+			size_t begin = item.find_first_not_of(" \t"), end = item.find_last_not_of(" \t");
+			items.push_back(begin == std::string::npos ? "" : item.substr(begin, end - begin + 1));
+			item.clear();
+			if(*p == 0) break;
+		}else
+		{
+			item += *p;
+		}
+	}
+}
+
+//the value of "key":value in a line of the JSON
+static int FindValue(const std::string& line, const char* key, std::string& value)
+{
+	std::string pattern = std::string("\"") + key + "\":";
+	size_t pos = line.find(pattern);
+	if(pos == std::string::npos) return 0;
+	pos += pattern.size();
+	value.clear();
+	if(pos < line.size() && line[pos] == '"')
+	{
+		for(++pos; pos < line.size() && line[pos] != '"'; ++pos)
+		{
+			if(line[pos] == '\\' && pos + 1 < line.size()) ++pos;
+			value += line[pos];
+		}
+	}else
+	{
+		while(pos < line.size() && line[pos] != ',' && line[pos] != '}') value += line[pos++];
+	}
+	return 1;
+}
+
+static int LoadBaseline(const char* path, std::vector<std::string>& names, std::vector<double>& p50)
+{
+	std::ifstream in(path);
+	if(!in.is_open()) return 0;
+	std::string line, name, value;
+	while(std::getline(in, line))
+	{
+		if(!FindValue(line, "name", name) || !FindValue(line, "p50_ms", value)) continue;
+		names.push_back(name);
+		p50.push_back(atof(value.c_str()));
+	}
+	return 1;
+}
+
+static void WriteJSON(std::string& json, const std::vector<BenchCase>& cases, int repeat, int warmup, double threshold)
+{
+	char buf[1024];
+	snprintf(buf, sizeof(buf), "{\"version\":%d,\"repeat\":%d,\"warmup\":%d,\"threshold\":%g,\"cases\":[",
+			BENCH_VERSION, repeat, warmup, threshold);
+	json = buf;
+	for(size_t i = 0; i < cases.size(); ++i)
+	{
+		const BenchCase& c = cases[i];
+		json += i ? ",\n{\"name\":" : "\n{\"name\":";
+		AppendString(json, c.name);
+		json += ",\"image\":";
+		AppendString(json, c.image);
+		json += ",\"backend\":";
+		AppendString(json, c.backend);
+		json += ",\"param\":";
+		AppendString(json, c.param);
+		snprintf(buf, sizeof(buf), ",\"width\":%d,\"height\":%d,\"runs\":%d,\"failed\":%d,"
+			"\"mean_ms\":%.3f,\"min_ms\":%.3f,\"p50_ms\":%.3f,\"p90_ms\":%.3f,\"p99_ms\":%.3f,\"max_ms\":%.3f,"
+			"\"images_per_sec\":%.3f,\"mpixels_per_sec\":%.3f,\"features\":%.1f,\"features_per_sec\":%.1f,"
+			"\"gpu_pyramid_kb\":%d,\"process_peak_rss_kb\":%d",
+			c.width, c.height, c.runs, c.failed, c.mean, c.min, c.p50, c.p90, c.p99, c.max,
+			c.images_per_sec, c.mpixels_per_sec, c.features, c.features_per_sec, c.gpu_pyramid_kb, c.process_peak_rss_kb);
+		json += buf;
+		if(c.stages[0] >= 0)
+		{
+			json += ",\"stages_p50_ms\":{";
+			for(int j = 0; j < STAGE_NUM; ++j)
+			{
+				snprintf(buf, sizeof(buf), "%s\"%s\":%.3f", j ? "," : "", stage_names[j], c.stages[j]);
+				json += buf;
+			}
+			json += "}";
+		}
+		if(c.baseline >= 0)
+		{
+			snprintf(buf, sizeof(buf), ",\"baseline_p50_ms\":%.3f,\"change\":%.4f,\"regression\":%d",
+					c.baseline, c.baseline > 0 ? c.p50 / c.baseline - 1.0 : 0.0, c.regression);
+			json += buf;
+		}
+		json += "}";
+	}
+	json += "\n]}\n";
+}
+
+//the SiftGPU parameters of a backend, NULL if the backend is unknown
+static const char* GetBackendParam(const std::string& backend)
+{
+	if(backend == "glsl")			return "";
+	else if(backend == "cuda")		return "-cuda";
+	else if(backend == "cl")		return "-cl";
+	else return NULL;
+}
+
+static int RunImage(SiftGPU& sift, const BenchImage& image)
+{
+	if(image.path.empty())
+		return sift.RunSIFT(image.width, image.height, &image.pixels[0], GL_LUMINANCE, GL_UNSIGNED_BYTE);
+	else
+		return sift.RunSIFT();
+}
+
+static void RunCase(SiftGPU& sift, const BenchImage& image, int repeat, int warmup, int stages, BenchCase& c)
+{
+	c.runs = c.failed = 0;
+	c.mean = c.min = c.max = c.p50 = c.p90 = c.p99 = 0;
+	c.images_per_sec = c.mpixels_per_sec = c.features = c.features_per_sec = 0;
+	c.baseline = -1;
+	c.regression = 0;
+	c.gpu_pyramid_kb = c.process_peak_rss_kb = 0;
+	for(int j = 0; j < STAGE_NUM; ++j) c.stages[j] = -1;
+
+	//the image file is loaded by the first run, and the later ones use the same texture
+	if(!image.path.empty() && !sift.RunSIFT(image.path.c_str()))
+	{
+		c.failed = 1;
+		return;
+	}
+	for(int i = 0; i < warmup; ++i) RunImage(sift, image);
+
+	std::vector<double> times;
+	double features = 0, total = 0;
+	for(int i = 0; i < repeat; ++i)
+	{
+		double t0 = GetSeconds();
+		int result = RunImage(sift, image);
+		double t = GetSeconds() - t0;
+		if(!result)
+		{
+			c.failed++;
+			continue;
+		}
+		times.push_back(t * 1000.0);
+		total += t;
+		features += sift.GetFeatureNum();
+	}
+	c.runs = (int) times.size();
+	c.gpu_pyramid_kb = sift.GetPyramidMemoryKB();
+	if(c.runs > 0)
+	{
+		std::sort(times.begin(), times.end());
+		c.mean = total * 1000.0 / c.runs;
+		c.min = times.front();
+		c.max = times.back();
+		c.p50 = GetPercentile(times, 0.50);
+		c.p90 = GetPercentile(times, 0.90);
+		c.p99 = GetPercentile(times, 0.99);
+		c.features = features / c.runs;
+		c.images_per_sec = total > 0 ? c.runs / total : 0;
+		c.features_per_sec = total > 0 ? features / total : 0;
+	}
+
+	if(stages && c.runs > 0)
+	{
+		//the timing of each stage waits for the GPU, so it is measured separately
+		std::vector<double> stage_times[STAGE_NUM];
+		sift.SetVerbose(-2);
+		for(int i = 0; i < repeat; ++i)
+		{
+			if(!RunImage(sift, image)) continue;
+			for(int j = 0; j < STAGE_NUM; ++j) stage_times[j].push_back(sift._timing[j] * 1000.0);
+		}
+		sift.SetVerbose(0);
+		for(int j = 0; j < STAGE_NUM; ++j)
+		{
+			std::sort(stage_times[j].begin(), stage_times[j].end());
+			c.stages[j] = GetPercentile(stage_times[j], 0.50);
+		}
+	}
+	c.process_peak_rss_kb = GetPeakMemoryKB();
+}
+
+int main(int argc, char * argv[])
+{
+	const char* sizes = "640x480,1280x720,1920x1080", * output = "siftgpu_bench.json", * baseline = NULL;
+	const char* params = ";-fo -1;-d 4;-m 2;-tc 2000;-lc 3;-fs 8", * backends = "glsl";
+	int repeat = 30, warmup = 2, stages = 0;
+	double threshold = 0.1;
+	std::vector<BenchImage> images;
+	std::vector<char*> common;
+	for(int i = 1; i < argc; ++i)
+	{
+		if(strcmp(argv[i], "-sizes") == 0 && i + 1 < argc)				sizes = argv[++i];
+		else if(strcmp(argv[i], "-il") == 0 && i + 1 < argc)			LoadImageList(argv[++i], images);
+		else if(strcmp(argv[i], "-params") == 0 && i + 1 < argc)		params = argv[++i];
+		else if(strcmp(argv[i], "-backends") == 0 && i + 1 < argc)		backends = argv[++i];
+		else if(strcmp(argv[i], "-n") == 0 && i + 1 < argc)				sscanf(argv[++i], "%d", &repeat);
+		else if(strcmp(argv[i], "-warmup") == 0 && i + 1 < argc)		sscanf(argv[++i], "%d", &warmup);
+		else if(strcmp(argv[i], "-o") == 0 && i + 1 < argc)				output = argv[++i];
+		else if(strcmp(argv[i], "-baseline") == 0 && i + 1 < argc)		baseline = argv[++i];
+		else if(strcmp(argv[i], "-threshold") == 0 && i + 1 < argc)		threshold = atof(argv[++i]);
+		else if(strcmp(argv[i], "-stages") == 0)						stages = 1;
+		else if(strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "-help") == 0)
+		{
+			std::cout
+			<<"usage: siftgpu_bench [-sizes <WxH,...>] [-il <image list>] [-params <p1;p2;...>]\n"
+			<<"                     [-backends <glsl,cuda,cl>] [-n <runs>] [-warmup <runs>] [-stages]\n"
+			<<"                     [-o <json>] [-baseline <json> [-threshold <ratio>]] [siftgpu_param]\n"
+			<<"-sizes      the synthetic images (default 640x480,1280x720,1920x1080, \"\" for none)\n"
+			<<"-il         the image files, e.g. data/listx.txt\n"
+			<<"-params     the parameter sets separated by ';', an empty one for the defaults\n"
+			<<"            (default \";-fo -1;-d 4;-m 2;-tc 2000;-lc 3;-fs 8\")\n"
+			<<"-backends   the backends separated by ',' (default glsl)\n"
+			<<"-n          the timed runs of each case (default 30), after -warmup runs (default 2)\n"
+			<<"-stages     the median time of each stage, by another -n runs that wait for the GPU\n"
+			<<"-o          where to save the JSON (default siftgpu_bench.json)\n"
+			<<"-baseline   a JSON of siftgpu_bench, a case regresses if its median time\n"
+			<<"            grows by more than -threshold (default 0.1), and the exit code is 2\n"
+			<<"The other parameters are passed to every SiftGPU\n"
+			<<"\n";
+			return 0;
+		}
+		else common.push_back(argv[i]);
+	}
+	if(repeat < 1) repeat = 1;
+	if(warmup < 0) warmup = 0;
+
+	std::vector<std::string> items;
+	SplitList(sizes, ',', items);
+	for(size_t i = 0; i < items.size(); ++i)
+	{
+		BenchImage image;
+		if(sscanf(items[i].c_str(), "%dx%d", &image.width, &image.height) != 2 ||
+			image.width <= 0 || image.height <= 0) continue;
+		char name[64];
+		snprintf(name, sizeof(name), "synthetic %dx%d", image.width, image.height);
+		image.name = name;
+		MakeSyntheticImage(image);
+		images.push_back(image);
+	}
+	if(images.empty())
+	{
+		std::cout << "No image to run, see -h\n";
+		return 1;
+	}
+
+	std::vector<std::string> backend_list, param_list, baseline_names;
+	std::vector<double> baseline_p50;
+	SplitList(backends, ',', backend_list);
+	SplitList(params, ';', param_list);
+	if(baseline && !LoadBaseline(baseline, baseline_names, baseline_p50))
+	{
+		std::cout << "Can't read the baseline " << baseline << "\n";
+		return 1;
+	}
+
+	std::vector<BenchCase> cases;
+	int regressions = 0;
+	for(size_t b = 0; b < backend_list.size(); ++b)
+	{
+		const char* backend_param = GetBackendParam(backend_list[b]);
+		if(backend_param == NULL)
+		{
+			std::cout << "Unknown backend " << backend_list[b] << "\n";
+			continue;
+		}
+		for(size_t p = 0; p < param_list.size(); ++p)
+		{
+			//the arguments of the SiftGPU: the backend, the common ones, and the parameter set
+			std::string text = std::string(backend_param) + " " + param_list[p];
+			std::vector<std::string> words;
+			std::vector<char*> args(common);
+			SplitList(text.c_str(), ' ', words);
+			for(size_t i = 0; i < words.size(); ++i) if(!words[i].empty()) args.push_back(&words[i][0]);
+
+			SiftGPU* sift = CreateNewSiftGPU();
+			if(!args.empty()) sift->ParseParam((int) args.size(), &args[0]);
+			sift->SetVerbose(0);
+			SiftConfig config;
+			int supported = sift->CreateContextGL() == SiftGPU::SIFTGPU_FULL_SUPPORTED;
+			if(supported)
+			{
+				//-cuda and -cl fall back to GLSL if they are not compiled
+				sift->GetConfig(config);
+				supported = config._UseCUDA == (backend_list[b] == "cuda") &&
+							config._UseOpenCL == (backend_list[b] == "cl");
+			}
+			if(!supported)
+			{
+				std::cout << "Backend " << backend_list[b] << " is not supported, skipped\n";
+				delete sift;
+				break;
+			}
+
+			for(size_t i = 0; i < images.size(); ++i)
+			{
+				BenchCase c;
+				c.image = images[i].name;
+				c.backend = backend_list[b];
+				c.param = param_list[p];
+				c.name = c.image + " | " + c.backend + (c.param.empty() ? "" : " | " + c.param);
+				c.width = images[i].width;
+				c.height = images[i].height;
+				RunCase(*sift, images[i], repeat, warmup, stages, c);
+				if(!images[i].path.empty() && c.runs > 0)
+				{
+					//the size of an image file is known after it is loaded
+					sift->GetImageDimension(c.width, c.height);
+				}
+				c.mpixels_per_sec = c.images_per_sec * c.width * c.height * 1e-6;
+				for(size_t k = 0; k < baseline_names.size(); ++k)
+				{
+					if(baseline_names[k] != c.name) continue;
+					c.baseline = baseline_p50[k];
+					c.regression = c.runs > 0 && c.p50 > c.baseline * (1.0 + threshold);
+					regressions += c.regression;
+				}
+				char line[512];
+				if(c.runs == 0)
+					snprintf(line, sizeof(line), "%-48s failed\n", c.name.c_str());
+				else if(c.baseline >= 0)
+					snprintf(line, sizeof(line), "%-48s %6.0f features  p50 %8.2fms  p99 %8.2fms  baseline %8.2fms  %+6.1f%%%s\n",
+							c.name.c_str(), c.features, c.p50, c.p99, c.baseline,
+							c.baseline > 0 ? (c.p50 / c.baseline - 1.0) * 100.0 : 0.0, c.regression ? "  REGRESSION" : "");
+				else
+					snprintf(line, sizeof(line), "%-48s %6.0f features  p50 %8.2fms  p99 %8.2fms  %7.1f images/s\n",
+							c.name.c_str(), c.features, c.p50, c.p99, c.images_per_sec);
+				std::cout << line;
+				cases.push_back(c);
+			}
+			delete sift;
+		}
+	}
+
+	std::string json;
+	WriteJSON(json, cases, repeat, warmup, threshold);
+	std::ofstream out(output);
+	out << json;
+	if(!out.good()) std::cout << "Can't write " << output << "\n";
+	else std::cout << "Saved " << cases.size() << " cases to " << output << "\n";
+	if(regressions) std::cout << regressions << " case(s) regressed by more than " << threshold * 100.0 << "%\n";
+	return regressions ? 2 : 0;
+}
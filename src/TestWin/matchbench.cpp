@@ -0,0 +1,580 @@
+////////////////////////////////////////////////////////////////////////////
+//	File:		matchbench.cpp
+//	Author:		SiftGPU contributors
+//	Description :	siftmatch_bench, the speed and the accuracy of SiftMatchGPU
+//					for every matching mode and language, over descriptor sets
+//					of different sizes, saved as JSON.
+//
+//	This file was added to SiftGPU in 2026 and is distributed under the
+//	same terms as the rest of SiftGPU, see the notice in SiftGPU.h.
+//
+////////////////////////////////////////////////////////////////////////////
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <iostream>
+#include <fstream>
+using std::cout;
+
+#ifdef _WIN32
+	//dll import definition for win32
+	#define SIFTGPU_DLL
+	#define WIN32_LEAN_AND_MEAN
+	#include <windows.h>
+	#pragma warning (disable : 4996)
+	#if defined(_MSC_VER) && _MSC_VER < 1900
+		#define snprintf _snprintf
+	#endif
+#endif
+
+#include "../SiftGPU/SiftGPU.h"
+#include "BenchUtil.h"
+
+//A synthetic pair has n random SIFT-like descriptors in each set. -overlap of the
+//second set are noisy copies of the first set, moved by (SHIFT_X, 0) with a pixel
+//of jitter, so the guiding homography is the shift and the guiding fundamental
+//matrix is that of a horizontal stereo pair. The pairs of -sift files (binary .sift
+//of -b or -b8) are run without the guided modes, since their geometry is unknown.
+//
+//The reference is the exact brute-force matching on the CPU with the same rules as
+//SiftMatchGPU: for each feature of the first set, the best of the second set has
+//acos(dot) < distmax and < ratiomax * the second best, and for the mutual match
+//the best of the first set for that feature is the same one. The guided modes set
+//the dot product of the pairs that break the guide to 0, like the GPU. -ref limits
+//the reference to a sample of the first set, and the recall and precision of the
+//GPU matches are measured on the same sample. SiftMatchGPU keeps at most as many
+//features as its texture size, so the larger sets lose recall to the truncation.
+//
+//process_peak_rss_kb is the peak memory of the whole process when the case ends,
+//which includes the cases before it. Version 2 renames it from peak_rss_kb.
+
+#define BENCH_VERSION	2
+#define IMAGE_WIDTH		1600
+#define IMAGE_HEIGHT	1200
+#define SHIFT_X			40.0f
+#define PATTERN_NUM		16
+#define PATTERN_NOISE	0.2f
+
+enum
+{
+	GUIDE_NONE	= 0,
+	GUIDE_H		= 1,
+	GUIDE_F		= 2,
+	GUIDE_NUM	= 3
+};
+
+static const char* guide_names[GUIDE_NUM] = {"match", "guided_h", "guided_f"};
+
+struct MatchSet
+{
+	std::string			name;
+	int					num[2];
+	std::vector<float>	descriptors[2];		//128 floats for each feature, normalized to 1
+	std::vector<float>	locations[2];		//x and y of each feature
+	std::vector<int>	truth;				//the true feature of the second set, -1 if none
+	int					guided;				//whether the guided modes can run
+};
+
+struct MatchCase
+{
+	std::string	name, set, language, mode;
+	int			num[2], mutual, runs, failed;
+	double		upload_p50, match_p50;					//milliseconds
+	double		mean, min, max, p50, p90, p99;			//milliseconds of upload and match
+	double		pairs_per_sec, matches;
+	double		recall, precision, correct;				//-1 if not measured
+	int			reference_num;
+	int			process_peak_rss_kb;	//the peak of the process up to this case, not of the case
+};
+
+static unsigned int s_seed = 1;
+
+static float RandomFloat()
+{
+	s_seed = s_seed * 1103515245 + 12345;
+	return ((s_seed >> 8) & 0xffff) / 65536.0f;
+}
+
+//normalized, clamped at 0.2 and normalized again, like the SIFT descriptors
+static void NormalizeDescriptor(float* d)
+{
+	for(int pass = 0; pass < 2; ++pass)
+	{
+		float sum = 0;
+		for(int k = 0; k < 128; ++k) sum += d[k] * d[k];
+		float scale = sum > 0 ? 1.0f / sqrtf(sum) : 0;
+		for(int k = 0; k < 128; ++k) d[k] = std::min(d[k] * scale, pass ? 1.0f : 0.2f);
+	}
+}
+
+//most of the bins of a SIFT descriptor are small, and the descriptors of an image
+//are alike, so each one is a random part on one of a few common patterns
+static void RandomDescriptor(float* d)
+{
+	static float patterns[PATTERN_NUM][128];
+	static int initialized = 0;
+	if(!initialized)
+	{
+		unsigned int seed = s_seed;
+		for(int i = 0; i < PATTERN_NUM; ++i)
+		{
+			for(int k = 0; k < 128; ++k)
+			{
+				float r = RandomFloat();
+				patterns[i][k] = r * r * r;
+			}
+			NormalizeDescriptor(patterns[i]);
+		}
+		s_seed = seed;
+		initialized = 1;
+	}
+	const float* pattern = patterns[(int) (RandomFloat() * PATTERN_NUM) % PATTERN_NUM];
+	for(int k = 0; k < 128; ++k)
+	{
+		float r = RandomFloat();
+		d[k] = pattern[k] + PATTERN_NOISE * r * r * r;
+	}
+	NormalizeDescriptor(d);
+}
+
+static void MakeSyntheticSet(int num, float overlap, float noise, MatchSet& set)
+{
+	char name[64];
+	snprintf(name, sizeof(name), "synthetic %d", num);
+	set.name = name;
+	set.guided = 1;
+	s_seed = (unsigned int) num;
+	for(int s = 0; s < 2; ++s)
+	{
+		set.num[s] = num;
+		set.descriptors[s].resize(128 * num);
+		set.locations[s].resize(2 * num);
+	}
+	for(int i = 0; i < num; ++i)
+	{
+		RandomDescriptor(&set.descriptors[0][128 * i]);
+		set.locations[0][2 * i] = RandomFloat() * IMAGE_WIDTH;
+		set.locations[0][2 * i + 1] = RandomFloat() * IMAGE_HEIGHT;
+	}
+
+	//the second set is shuffled, and its first num * overlap features are the copies
+	std::vector<int> order(num);
+	for(int i = 0; i < num; ++i) order[i] = i;
+	for(int i = num - 1; i > 0; --i) std::swap(order[i], order[(int) (RandomFloat() * (i + 1)) % (i + 1)]);
+	set.truth.assign(num, -1);
+	int copies = (int) (num * overlap);
+	for(int j = 0; j < num; ++j)
+	{
+		float* d = &set.descriptors[1][128 * j];
+		float* loc = &set.locations[1][2 * j];
+		if(j < copies)
+		{
+			int i = order[j];
+			const float* src = &set.descriptors[0][128 * i];
+			for(int k = 0; k < 128; ++k) d[k] = std::max(0.0f, src[k] + noise * (RandomFloat() * 2.0f - 1.0f));
+			NormalizeDescriptor(d);
+			loc[0] = set.locations[0][2 * i] + SHIFT_X + RandomFloat() * 2.0f - 1.0f;
+			loc[1] = set.locations[0][2 * i + 1] + RandomFloat() * 2.0f - 1.0f;
+			set.truth[i] = j;
+		}else
+		{
+			RandomDescriptor(d);
+			loc[0] = RandomFloat() * IMAGE_WIDTH;
+			loc[1] = RandomFloat() * IMAGE_HEIGHT;
+		}
+	}
+}
+
+//the binary .sift of -b (float) or -b8 (uint8) descriptors
+static int LoadSiftFile(const char* path, MatchSet& set, int index)
+{
+	std::ifstream in(path, std::ios::binary);
+	int num = 0, dim = 0;
+	in.read((char*) &num, sizeof(int));
+	in.read((char*) &dim, sizeof(int));
+	if(!in.good() || num <= 0 || (dim != 128 && dim != -128)) return 0;
+	set.num[index] = num;
+	set.descriptors[index].resize(128 * num);
+	set.locations[index].resize(2 * num);
+	std::vector<unsigned char> bytes(128);
+	for(int i = 0; i < num && in.good(); ++i)
+	{
+		float key[4];	//y, x, scale, orientation
+		float* d = &set.descriptors[index][128 * i];
+		in.read((char*) key, 4 * sizeof(float));
+		if(dim == 128)
+		{
+			in.read((char*) d, 128 * sizeof(float));
+		}else
+		{
+			in.read((char*) &bytes[0], 128);
+			for(int k = 0; k < 128; ++k) d[k] = bytes[k] / 512.0f;
+		}
+		set.locations[index][2 * i] = key[1];
+		set.locations[index][2 * i + 1] = key[0];
+	}
+	return in.good() ? 1 : 0;
+}
+
+//whether the pair (i, j) passes the guide, by the same tests as the GPU
+static int PassGuide(const MatchSet& set, int guide, int i, int j, float hdistmax, float fdistmax)
+{
+	const float* p1 = &set.locations[0][2 * i];
+	const float* p2 = &set.locations[1][2 * j];
+	if(guide == GUIDE_H)
+	{
+		//H is the shift
+		float dx = fabsf(p2[0] - (p1[0] + SHIFT_X)), dy = fabsf(p2[1] - p1[1]);
+		return std::max(dx, dy) <= hdistmax;
+	}else if(guide == GUIDE_F)
+	{
+		//F = [0 0 0; 0 0 -1; 0 1 0], so x2'Fx1 = y1 - y2 and the gradients are 1
+		float e = p1[1] - p2[1];
+		return e * e / 2.0f <= fdistmax;
+	}
+	return 1;
+}
+
+static float Dot(const float* a, const float* b)
+{
+	float sum = 0;
+	for(int k = 0; k < 128; ++k) sum += a[k] * b[k];
+	return sum;
+}
+
+//the best feature of the other set for feature index of set s, -1 if it fails the rules
+static int FindBest(const MatchSet& set, int s, int index, int guide, float distmax,
+					float ratiomax, float hdistmax, float fdistmax)
+{
+	const float* d = &set.descriptors[s][128 * index];
+	const std::vector<float>& other = set.descriptors[1 - s];
+	float best = -1.0f, second = -1.0f;
+	int best_index = -1;
+	for(int k = 0; k < set.num[1 - s]; ++k)
+	{
+		int pass = s == 0 ? PassGuide(set, guide, index, k, hdistmax, fdistmax) :
+							PassGuide(set, guide, k, index, hdistmax, fdistmax);
+		float v = pass ? Dot(d, &other[128 * k]) : 0.0f;
+		if(v > best)
+		{
+			second = best;
+			best = v;
+			best_index = k;
+		}else if(v > second)
+		{
+			second = v;
+		}
+	}
+	float dist1 = acosf(std::min(best, 1.0f)), dist2 = acosf(std::min(second, 1.0f));
+	if(dist1 >= distmax || dist1 >= ratiomax * dist2) return -1;
+	return best_index;
+}
+
+//the one-way and the mutual reference matches of the sampled features of the first set
+static void GetReference(const MatchSet& set, const std::vector<int>& sample, int guide, float distmax,
+						 float ratiomax, float hdistmax, float fdistmax, std::vector<int>& oneway, std::vector<int>& mutual)
+{
+	oneway.assign(set.num[0], -1);
+	mutual.assign(set.num[0], -1);
+	for(size_t k = 0; k < sample.size(); ++k)
+	{
+		int i = sample[k];
+		int j = FindBest(set, 0, i, guide, distmax, ratiomax, hdistmax, fdistmax);
+		if(j < 0) continue;
+		oneway[i] = j;
+		if(FindBest(set, 1, j, guide, distmax, ratiomax, hdistmax, fdistmax) == i) mutual[i] = j;
+	}
+}
+
+static void WriteJSON(std::string& json, const std::vector<MatchCase>& cases, int repeat, int warmup,
+					  float distmax, float ratiomax, float hdistmax, float fdistmax)
+{
+	char buf[1024];
+	snprintf(buf, sizeof(buf), "{\"version\":%d,\"repeat\":%d,\"warmup\":%d,\"distmax\":%g,\"ratiomax\":%g,"
+			"\"hdistmax\":%g,\"fdistmax\":%g,\"cases\":[", BENCH_VERSION, repeat, warmup,
+			distmax, ratiomax, hdistmax, fdistmax);
+	json = buf;
+	for(size_t i = 0; i < cases.size(); ++i)
+	{
+		const MatchCase& c = cases[i];
+		json += i ? ",\n{\"name\":" : "\n{\"name\":";
+		AppendString(json, c.name);
+		json += ",\"set\":";
+		AppendString(json, c.set);
+		json += ",\"language\":";
+		AppendString(json, c.language);
+		json += ",\"mode\":";
+		AppendString(json, c.mode);
+		snprintf(buf, sizeof(buf), ",\"mutual\":%d,\"num1\":%d,\"num2\":%d,\"runs\":%d,\"failed\":%d,"
+			"\"upload_p50_ms\":%.3f,\"match_p50_ms\":%.3f,"
+			"\"mean_ms\":%.3f,\"min_ms\":%.3f,\"p50_ms\":%.3f,\"p90_ms\":%.3f,\"p99_ms\":%.3f,\"max_ms\":%.3f,"
+			"\"pairs_per_sec\":%.0f,\"matches\":%.1f,\"reference_num\":%d,"
+			"\"recall\":%.4f,\"precision\":%.4f,\"correct\":%.4f,\"process_peak_rss_kb\":%d}",
+			c.mutual, c.num[0], c.num[1], c.runs, c.failed, c.upload_p50, c.match_p50,
+			c.mean, c.min, c.p50, c.p90, c.p99, c.max, c.pairs_per_sec, c.matches, c.reference_num,
+			c.recall, c.precision, c.correct, c.process_peak_rss_kb);
+		json += buf;
+	}
+	json += "\n]}\n";
+}
+
+static void RunCase(SiftMatchGPU& matcher, const MatchSet& set, int guide, int mutual, int repeat, int warmup,
+					float distmax, float ratiomax, float hdistmax, float fdistmax,
+					const std::vector<int>& sample, const std::vector<int>& reference, MatchCase& c)
+{
+	//H is the shift, and F is the horizontal stereo pair, see PassGuide
+	float H[3][3] = {{1, 0, SHIFT_X}, {0, 1, 0}, {0, 0, 1}};
+	float F[3][3] = {{0, 0, 0}, {0, 0, -1}, {0, 1, 0}};
+	int max_match = std::max(set.num[0], set.num[1]);
+	std::vector<int> buffer(2 * max_match);
+	int (*match_buffer)[2] = (int (*)[2]) &buffer[0];
+	std::vector<double> uploads, matches, totals;
+	double match_sum = 0, total = 0;
+	int result = 0;
+
+	matcher.SetMaxSift(max_match);
+	c.runs = c.failed = 0;
+	for(int r = 0; r < warmup + repeat; ++r)
+	{
+		//the descriptors are uploaded by every run (id -1)
+		double t0 = GetSeconds();
+		matcher.SetDescriptors(0, set.num[0], &set.descriptors[0][0]);
+		matcher.SetDescriptors(1, set.num[1], &set.descriptors[1][0]);
+		if(guide != GUIDE_NONE)
+		{
+			matcher.SetFeautreLocation(0, &set.locations[0][0]);
+			matcher.SetFeautreLocation(1, &set.locations[1][0]);
+		}
+		double t1 = GetSeconds();
+		if(guide == GUIDE_NONE)
+			result = matcher.GetSiftMatch(max_match, match_buffer, distmax, ratiomax, mutual);
+		else
+			result = matcher.GetGuidedSiftMatch(max_match, match_buffer, guide == GUIDE_H ? H : NULL,
+						guide == GUIDE_F ? F : NULL, distmax, ratiomax, hdistmax, fdistmax, mutual);
+		double t2 = GetSeconds();
+		if(r < warmup) continue;
+		if(result < 0)
+		{
+			c.failed++;
+			continue;
+		}
+		uploads.push_back((t1 - t0) * 1000.0);
+		matches.push_back((t2 - t1) * 1000.0);
+		totals.push_back((t2 - t0) * 1000.0);
+		total += t2 - t0;
+		match_sum += result;
+	}
+	c.runs = (int) totals.size();
+	c.upload_p50 = c.match_p50 = c.mean = c.min = c.max = c.p50 = c.p90 = c.p99 = 0;
+	c.pairs_per_sec = c.matches = 0;
+	c.recall = c.precision = c.correct = -1;
+	c.reference_num = 0;
+	if(c.runs > 0)
+	{
+		std::sort(uploads.begin(), uploads.end());
+		std::sort(matches.begin(), matches.end());
+		std::sort(totals.begin(), totals.end());
+		c.upload_p50 = GetPercentile(uploads, 0.50);
+		c.match_p50 = GetPercentile(matches, 0.50);
+		c.mean = total * 1000.0 / c.runs;
+		c.min = totals.front();
+		c.max = totals.back();
+		c.p50 = GetPercentile(totals, 0.50);
+		c.p90 = GetPercentile(totals, 0.90);
+		c.p99 = GetPercentile(totals, 0.99);
+		c.pairs_per_sec = total > 0 ? double(set.num[0]) * set.num[1] * c.runs / total : 0;
+		c.matches = match_sum / c.runs;
+
+		//the matches of the last run against the reference of the sample
+		std::vector<int> found(set.num[0], -1);
+		std::vector<char> sampled(set.num[0], 0);
+		for(size_t k = 0; k < sample.size(); ++k) sampled[sample[k]] = 1;
+		for(int k = 0; k < result; ++k)
+		{
+			int i = match_buffer[k][0];
+			if(i >= 0 && i < set.num[0]) found[i] = match_buffer[k][1];
+		}
+		int ref_num = 0, gpu_num = 0, both = 0, correct = 0, all = 0;
+		for(int i = 0; i < set.num[0]; ++i)
+		{
+			if(found[i] >= 0 && !set.truth.empty())
+			{
+				all++;
+				correct += set.truth[i] == found[i];
+			}
+			if(!sampled[i]) continue;
+			ref_num += reference[i] >= 0;
+			gpu_num += found[i] >= 0;
+			both += reference[i] >= 0 && reference[i] == found[i];
+		}
+		c.reference_num = ref_num;
+		c.recall = ref_num > 0 ? double(both) / ref_num : 1.0;
+		c.precision = gpu_num > 0 ? double(both) / gpu_num : 1.0;
+		if(!set.truth.empty()) c.correct = all > 0 ? double(correct) / all : 1.0;
+	}
+	c.process_peak_rss_kb = GetPeakMemoryKB();
+}
+
+int main(int argc, char * argv[])
+{
+	const char* sizes = "1000,4000,16000", * languages = "glsl", * output = "siftmatch_bench.json";
+	int repeat = 10, warmup = 1, ref_sample = 1000;
+	float overlap = 0.5f, noise = 0.07f;
+	float distmax = 0.7f, ratiomax = 0.8f, hdistmax = 32.0f, fdistmax = 16.0f;
+	std::vector<MatchSet> sets;
+	std::vector<char*> params;
+	for(int i = 1; i < argc; ++i)
+	{
+		if(strcmp(argv[i], "-sizes") == 0 && i + 1 < argc)				sizes = argv[++i];
+		else if(strcmp(argv[i], "-languages") == 0 && i + 1 < argc)		languages = argv[++i];
+		else if(strcmp(argv[i], "-n") == 0 && i + 1 < argc)				sscanf(argv[++i], "%d", &repeat);
+		else if(strcmp(argv[i], "-warmup") == 0 && i + 1 < argc)		sscanf(argv[++i], "%d", &warmup);
+		else if(strcmp(argv[i], "-ref") == 0 && i + 1 < argc)			sscanf(argv[++i], "%d", &ref_sample);
+		else if(strcmp(argv[i], "-overlap") == 0 && i + 1 < argc)		overlap = (float) atof(argv[++i]);
+		else if(strcmp(argv[i], "-noise") == 0 && i + 1 < argc)			noise = (float) atof(argv[++i]);
+		else if(strcmp(argv[i], "-distmax") == 0 && i + 1 < argc)		distmax = (float) atof(argv[++i]);
+		else if(strcmp(argv[i], "-ratiomax") == 0 && i + 1 < argc)		ratiomax = (float) atof(argv[++i]);
+		else if(strcmp(argv[i], "-hdistmax") == 0 && i + 1 < argc)		hdistmax = (float) atof(argv[++i]);
+		else if(strcmp(argv[i], "-fdistmax") == 0 && i + 1 < argc)		fdistmax = (float) atof(argv[++i]);
+		else if(strcmp(argv[i], "-o") == 0 && i + 1 < argc)				output = argv[++i];
+		else if(strcmp(argv[i], "-sift") == 0 && i + 2 < argc)
+		{
+			MatchSet set;
+			set.name = std::string(argv[i + 1]) + " " + argv[i + 2];
+			set.guided = 0;
+			if(LoadSiftFile(argv[i + 1], set, 0) && LoadSiftFile(argv[i + 2], set, 1)) sets.push_back(set);
+			else std::cout << "Can't read the features of " << set.name << "\n";
+			i += 2;
+		}
+		else if(strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "-help") == 0)
+		{
+			std::cout
+			<<"usage: siftmatch_bench [-sizes <n,...>] [-sift <file1> <file2>] [-languages <glsl,cuda>]\n"
+			<<"                       [-n <runs>] [-warmup <runs>] [-ref <n>] [-overlap <ratio>] [-noise <value>]\n"
+			<<"                       [-distmax <d>] [-ratiomax <r>] [-hdistmax <d>] [-fdistmax <d>]\n"
+			<<"                       [-o <json>] [device_param]\n"
+			<<"-sizes      the synthetic sets of n features each (default 1000,4000,16000, \"\" for none)\n"
+			<<"-sift       a pair of binary .sift files (-b or -b8), without the guided modes\n"
+			<<"-languages  the matcher languages separated by ',' (default glsl)\n"
+			<<"-n          the timed runs of each case (default 10), after -warmup runs (default 1)\n"
+			<<"-ref        the features of the first set checked by the CPU reference (default 1000, 0 for all)\n"
+			<<"-overlap    the part of the second set that matches the first one (default 0.5)\n"
+			<<"-noise      the noise of the matching descriptors (default 0.07)\n"
+			<<"-o          where to save the JSON (default siftmatch_bench.json)\n"
+			<<"The other parameters (e.g. -cuda 1, -display) go to SetDeviceParam\n"
+			<<"\n";
+			return 0;
+		}
+		else params.push_back(argv[i]);
+	}
+	if(repeat < 1) repeat = 1;
+	if(warmup < 0) warmup = 0;
+
+	std::vector<int> size_list;
+	const char* p = sizes;
+	while(*p)
+	{
+		int num = atoi(p);
+		if(num > 0) size_list.push_back(num);
+		while(*p && *p != ',') ++p;
+		if(*p) ++p;
+	}
+	for(size_t i = 0; i < size_list.size(); ++i)
+	{
+		MatchSet set;
+		MakeSyntheticSet(size_list[i], std::max(0.0f, std::min(1.0f, overlap)), noise, set);
+		sets.push_back(set);
+	}
+	if(sets.empty())
+	{
+		std::cout << "No descriptor set to match, see -h\n";
+		return 1;
+	}
+
+	std::vector<std::string> language_list;
+	for(p = languages; *p; )
+	{
+		std::string item;
+		while(*p && *p != ',') item += *p++;
+		if(*p) ++p;
+		if(!item.empty()) language_list.push_back(item);
+	}
+
+	std::vector<MatchCase> cases;
+	for(size_t s = 0; s < sets.size(); ++s)
+	{
+		const MatchSet& set = sets[s];
+		//the sample of the first set for the reference
+		std::vector<int> sample;
+		int step = ref_sample > 0 && set.num[0] > ref_sample ? set.num[0] / ref_sample : 1;
+		for(int i = 0; i < set.num[0] && (ref_sample <= 0 || (int) sample.size() < ref_sample); i += step) sample.push_back(i);
+
+		for(int guide = 0; guide < GUIDE_NUM; ++guide)
+		{
+			if(guide != GUIDE_NONE && !set.guided) continue;
+			std::vector<int> reference[2];
+			double t0 = GetSeconds();
+			GetReference(set, sample, guide, distmax, ratiomax, hdistmax, fdistmax, reference[0], reference[1]);
+			std::cout << set.name << " | " << guide_names[guide] << ": reference of " << sample.size()
+					  << " features in " << GetSeconds() - t0 << "s\n";
+
+			for(size_t l = 0; l < language_list.size(); ++l)
+			{
+				SiftMatchGPU* matcher = CreateNewSiftMatchGPU(std::max(set.num[0], set.num[1]));
+				int language = language_list[l] == "cuda" ? SiftMatchGPU::SIFTMATCH_CUDA :
+								language_list[l] == "glsl" ? SiftMatchGPU::SIFTMATCH_GLSL : -1;
+				if(language < 0)
+				{
+					std::cout << "Unknown language " << language_list[l] << "\n";
+					delete matcher;
+					continue;
+				}
+				matcher->SetLanguage(language);
+				if(!params.empty()) matcher->SetDeviceParam((int) params.size(), &params[0]);
+				//the matcher falls back to GLSL if CUDA is not compiled or not available
+				if(matcher->CreateContextGL() == 0 || matcher->GetLanguage() != language)
+				{
+					std::cout << "Language " << language_list[l] << " is not supported, skipped\n";
+					delete matcher;
+					continue;
+				}
+				for(int mutual = 1; mutual >= 0; --mutual)
+				{
+					MatchCase c;
+					c.set = set.name;
+					c.language = language_list[l];
+					c.mode = guide_names[guide];
+					c.mutual = mutual;
+					c.num[0] = set.num[0];
+					c.num[1] = set.num[1];
+					c.name = c.set + " | " + c.language + " | " + c.mode + (mutual ? " | mutual" : " | oneway");
+					RunCase(*matcher, set, guide, mutual, repeat, warmup, distmax, ratiomax, hdistmax, fdistmax,
+							sample, reference[mutual], c);
+					char line[512];
+					if(c.runs == 0)
+						snprintf(line, sizeof(line), "%-48s failed\n", c.name.c_str());
+					else
+						snprintf(line, sizeof(line), "%-48s %7.0f matches  p50 %8.2fms  p99 %8.2fms  %8.3g pairs/s  recall %.3f  precision %.3f\n",
+								c.name.c_str(), c.matches, c.p50, c.p99, c.pairs_per_sec, c.recall, c.precision);
+					std::cout << line;
+					cases.push_back(c);
+				}
+				delete matcher;
+			}
+		}
+	}
+
+	std::string json;
+	WriteJSON(json, cases, repeat, warmup, distmax, ratiomax, hdistmax, fdistmax);
+	std::ofstream out(output);
+	out << json;
+	if(!out.good()) std::cout << "Can't write " << output << "\n";
+	else std::cout << "Saved " << cases.size() << " cases to " << output << "\n";
+	return 0;
+}
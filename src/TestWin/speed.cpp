@@ -2,6 +2,8 @@
 //	File:		Speed.cpp
 //	Author:		Changchang Wu
 //	Description : Evaluate the speed of SiftGPU 
+//				siftgpu_bench (bench.cpp) sweeps sizes, parameters and backends,
+//				and saves the percentiles as JSON for comparing with a baseline
 //
 //
 //
@@ -0,0 +1,991 @@
+////////////////////////////////////////////////////////////////////////////
+//	File:		unittest.cpp
+//	Author:		SiftGPU contributors
+//	Description :	siftgpu_test, checks of the parts of SiftGPU that run
+//					without a GPU. Run by "make check".
+//
+//	This file was added to SiftGPU in 2026 and is distributed under the
+//	same terms as the rest of SiftGPU, see the notice in SiftGPU.h.
+//
+////////////////////////////////////////////////////////////////////////////
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+#include <algorithm>
+#include <string>
+#include <iostream>
+using std::vector;
+using std::string;
+using std::ostream;
+
+#ifdef _WIN32
+	#define WIN32_LEAN_AND_MEAN
+	#include <windows.h>
+	#include <process.h>
+	#include <direct.h>
+	#define getpid _getpid
+	#pragma warning (disable : 4996)
+#else
+	#include <unistd.h>
+	#include <dirent.h>
+	#include <sys/stat.h>
+	#include <pthread.h>
+#endif
+
+#include "GL/glew.h"
+#include "../SiftGPU/SiftGPU.h"
+#include "../SiftGPU/FeatureCache.h"
+#include "../SiftGPU/GlobalUtil.h"
+#include "../SiftGPU/GLTexImage.h"
+#include "../SiftGPU/ShaderMan.h"
+#include "../SiftGPU/SiftPyramid.h"
+#include "../SiftGPU/PyramidGL.h"
+#include "../SiftGPU/SiftProfiler.h"
+#include "../SiftGPU/SiftTracer.h"
+#include "../SiftGPU/SiftGPUJobQueue.h"
+#include "../ServerSiftGPU/ServerQueue.h"
+#include "../ServerSiftGPU/ServerCodec.h"
+#include "../ServerSiftGPU/ServerStore.h"
+
+//Each test is a function of checks, and the program returns 1 if any check fails.
+//The tests to run can be given by name on the command line, all of them by default.
+
+static int s_checks = 0, s_failures = 0;
+
+#define CHECK(cond)	Check((cond) != 0, #cond, __FILE__, __LINE__)
+
+static void Check(int passed, const char * text, const char * file, int line)
+{
+	s_checks++;
+	if(passed) return;
+	s_failures++;
+	std::cerr << file << ":" << line << ": check failed: " << text << "\n";
+}
+
+//a new directory for the files of a test
+static string MakeTempDirectory(const char * name)
+{
+	char path[256];
+#ifdef _WIN32
+	sprintf(path, "siftgpu_test_%s_%d", name, (int) getpid());
+	_mkdir(path);
+#else
+	sprintf(path, "/tmp/siftgpu_test_%s_%d", name, (int) getpid());
+	mkdir(path, 0755);
+#endif
+	return path;
+}
+
+//run func(arg, 0..num-1) on num threads, also on a computer with fewer cores
+static void RunThreads(int num, void (*func)(void*, int), void* arg)
+{
+	int threads = GlobalUtil::_CPUThreadNum;
+	GlobalUtil::_CPUThreadNum = num;
+	GlobalUtil::RunParallel(num, func, arg);
+	GlobalUtil::_CPUThreadNum = threads;
+}
+
+static int CountFiles(const string& path)
+{
+	int count = 0;
+#ifdef _WIN32
+	WIN32_FIND_DATAA data;
+	HANDLE find = FindFirstFileA((path + "/*").c_str(), &data);
+	if(find != INVALID_HANDLE_VALUE)
+	{
+		do
+		{
+			if(!(data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) count++;
+		}while(FindNextFileA(find, &data));
+		FindClose(find);
+	}
+#else
+	DIR * dir = opendir(path.c_str());
+	if(dir)
+	{
+		struct dirent * entry;
+		while((entry = readdir(dir)) != NULL)
+		{
+			if(strcmp(entry->d_name, ".") && strcmp(entry->d_name, "..")) count++;
+		}
+		closedir(dir);
+	}
+#endif
+	return count;
+}
+
+static void RemoveTempDirectory(const string& path)
+{
+#ifdef _WIN32
+	WIN32_FIND_DATAA data;
+	HANDLE find = FindFirstFileA((path + "/*").c_str(), &data);
+	if(find != INVALID_HANDLE_VALUE)
+	{
+		do
+		{
+			if(!(data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) remove((path + "/" + data.cFileName).c_str());
+		}while(FindNextFileA(find, &data));
+		FindClose(find);
+	}
+	_rmdir(path.c_str());
+#else
+	DIR * dir = opendir(path.c_str());
+	if(dir)
+	{
+		struct dirent * entry;
+		while((entry = readdir(dir)) != NULL)
+		{
+			if(strcmp(entry->d_name, ".") && strcmp(entry->d_name, "..")) remove((path + "/" + entry->d_name).c_str());
+		}
+		closedir(dir);
+	}
+	rmdir(path.c_str());
+#endif
+}
+
+static int ParseNetpbm(const char * text, int header[4], size_t& offset)
+{
+	return GLTexInput::ParseNetpbmHeader((const unsigned char*) text, strlen(text), header, offset);
+}
+
+static void TestNetpbmHeader()
+{
+	int header[4];
+	size_t offset;
+	CHECK(ParseNetpbm("P5 640 480 255\nraster", header, offset));
+	CHECK(header[0] == '5' && header[1] == 640 && header[2] == 480 && header[3] == 255 && offset == 15);
+	CHECK(GLTexInput::GetNetpbmRasterSize(header) == 640 * 480);
+	//comments, and the 16-bit color raster
+	CHECK(ParseNetpbm("P6\n# comment\n3 2\n# more\n65535\n", header, offset) && header[3] == 65535);
+	CHECK(GLTexInput::GetNetpbmRasterSize(header) == 3 * 2 * 3 * 2);
+	CHECK(ParseNetpbm("P2 2 2 15\n1 2 3 4", header, offset) && offset == 10);
+
+	//unsupported formats, missing or out of range values
+	CHECK(!ParseNetpbm("P4 8 8\n", header, offset));
+	CHECK(!ParseNetpbm("P5 8 8", header, offset));
+	CHECK(!ParseNetpbm("P5 0 8 255 ", header, offset));
+	CHECK(!ParseNetpbm("P5 8 8 65536 ", header, offset));
+	CHECK(!ParseNetpbm("P5 8 99999999999999999999 255 ", header, offset));
+	//the pixel count of 65536 x 65537 wraps an int
+	CHECK(!ParseNetpbm("P5 65536 65537 255 ", header, offset));
+	CHECK(!ParseNetpbm("P6 40000 40000 255 ", header, offset));
+	CHECK(ParseNetpbm("P5 40000 40000 255 ", header, offset));
+	//a truncated raw file is smaller than its raster
+	CHECK(GLTexInput::GetNetpbmRasterSize(header) == (size_t) 40000 * 40000);
+}
+
+//the first sample of each ds x ds block of an image of (w * ds) x (h * ds) pixels, the rest is noise
+template <class T> static void UpSampleNoise(const vector<T>& in, int w, int h, int nch, int ds, vector<T>& out)
+{
+	out.resize(in.size() * ds * ds);
+	for(size_t i = 0; i < out.size(); ++i) out[i] = (T) (rand() & 0xff);
+	for(int y = 0; y < h; ++y)
+		for(int x = 0; x < w; ++x)
+			for(int k = 0; k < nch; ++k) out[((size_t) y * ds * w * ds + x * ds) * nch + k] = in[((size_t) y * w + x) * nch + k];
+}
+
+static void TestDownSamplePitch()
+{
+	//rows with padding give the same result as tightly packed rows
+	const int w = 37, h = 5, nch = 3, pitch = w * nch + 7;
+	vector<unsigned char> packed(w * h * nch), padded(pitch * h, 0xee), o1(w * h), o2(w * h);
+	vector<float> f1(w * h), f2(w * h);
+	for(size_t i = 0; i < packed.size(); ++i) packed[i] = (unsigned char) rand();
+	for(int y = 0; y < h; ++y) memcpy(&padded[y * pitch], &packed[y * w * nch], w * nch);
+	CHECK(GLTexInput::DownSamplePixelDataI(GL_RGB, w, h, 1, &packed[0], &o1[0]));
+	CHECK(GLTexInput::DownSamplePixelDataI(GL_RGB, w, h, 1, &padded[0], &o2[0], pitch));
+	CHECK(o1 == o2);
+	CHECK(GLTexInput::DownSamplePixelDataI2F(GL_RGB, w, h, 1, &packed[0], &f1[0]));
+	CHECK(GLTexInput::DownSamplePixelDataI2F(GL_RGB, w, h, 1, &padded[0], &f2[0], 0, pitch));
+	CHECK(f1 == f2);
+
+	//a region of interest is a pointer into the image with the pitch of the image
+	vector<unsigned char> roi(3 * 2 * nch), o3(3 * 2), o4(3 * 2);
+	for(int y = 0; y < 2; ++y) memcpy(&roi[y * 3 * nch], &packed[((y + 2) * w + 4) * nch], 3 * nch);
+	CHECK(GLTexInput::DownSamplePixelDataI(GL_RGB, 3, 2, 1, &roi[0], &o3[0]));
+	CHECK(GLTexInput::DownSamplePixelDataI(GL_RGB, 3, 2, 1, &padded[2 * pitch + 4 * nch], &o4[0], pitch));
+	CHECK(o3 == o4);
+}
+
+static void TestConvertRow()
+{
+	//full-resolution rows take the SSE path, while ds = 2 without the box filter
+	//takes the scalar path on the first sample of each block
+	const int w = 53, h = 3, ds = 2;
+	const unsigned int formats[3] = {GL_LUMINANCE, GL_RGB, GL_RGBA};
+	const int nchannels[3] = {1, 3, 4};
+	int average = GlobalUtil::_DownSampleAverage;
+	GlobalUtil::_DownSampleAverage = 0;
+	for(int f = 0; f < 3; ++f)
+	{
+		int nch = nchannels[f];
+		vector<unsigned char> in(w * h * nch), big;
+		vector<float> fin(w * h * nch), fbig;
+		for(size_t i = 0; i < in.size(); ++i) fin[i] = (in[i] = (unsigned char) rand()) / 255.0f;
+		UpSampleNoise(in, w, h, nch, ds, big);
+		UpSampleNoise(fin, w, h, nch, ds, fbig);
+
+		vector<unsigned char> o1(w * h), o2(w * h);
+		CHECK(GLTexInput::DownSamplePixelDataI(formats[f], w, h, 1, &in[0], &o1[0]));
+		CHECK(GLTexInput::DownSamplePixelDataI(formats[f], w * ds, h * ds, ds, &big[0], &o2[0]));
+		CHECK(o1 == o2);
+
+		vector<float> f1(w * h), f2(w * h);
+		float diff = 0;
+		CHECK(GLTexInput::DownSamplePixelDataI2F(formats[f], w, h, 1, &in[0], &f1[0]));
+		CHECK(GLTexInput::DownSamplePixelDataI2F(formats[f], w * ds, h * ds, ds, &big[0], &f2[0]));
+		for(int i = 0; i < w * h; ++i) diff = std::max(diff, (float) fabs(f1[i] - f2[i]));
+		CHECK(diff < 1e-6f);
+
+		CHECK(GLTexInput::DownSamplePixelDataF(formats[f], w, h, 1, &fin[0], &f1[0]));
+		CHECK(GLTexInput::DownSamplePixelDataF(formats[f], w * ds, h * ds, ds, &fbig[0], &f2[0]));
+		for(int i = 0; i < w * h; ++i) diff = std::max(diff, (float) fabs(f1[i] - f2[i]));
+		CHECK(diff < 1e-6f);
+	}
+	GlobalUtil::_DownSampleAverage = average;
+}
+
+static void SaveCacheEntry(void* dir, int index)
+{
+	FeatureCache cache((const char*) dir, 16);
+	vector<float> keys(4 * 500), des(128 * 500, 0.25f);
+	for(int i = 0; i < 500; ++i) keys[4 * i] = (float) i;
+	for(int i = 0; i < 10; ++i) cache.Save(7, 500, &keys[0], &des[0]);
+}
+
+static void TestFeatureCache()
+{
+	//the hash depends on every byte and on the seed
+	unsigned char data[100];
+	for(int i = 0; i < 100; ++i) data[i] = (unsigned char) (i * 7);
+	FeatureCache::Key h1 = FeatureCache::HashData(data, 100, 0);
+	CHECK(h1 == FeatureCache::HashData(data, 100, 0));
+	CHECK(h1 != FeatureCache::HashData(data, 100, 1));
+	CHECK(h1 != FeatureCache::HashData(data, 99, 0));
+	data[40] ^= 1;
+	CHECK(h1 != FeatureCache::HashData(data, 100, 0));
+
+	//and the parameter hash on the parameters that change the result
+	SiftParam param;
+	param._dog_threshold = 0.02f / 3;
+	FeatureCache::Key p1 = FeatureCache::HashParam(param);
+	CHECK(p1 == FeatureCache::HashParam(param));
+	param._dog_threshold = 0.01f / 3;
+	CHECK(p1 != FeatureCache::HashParam(param));
+
+	string dir = MakeTempDirectory("cache");
+	{
+		FeatureCache cache(dir.c_str(), 1);
+		vector<float> keys(4 * 3), des(128 * 3), lkeys, ldes;
+		for(size_t i = 0; i < keys.size(); ++i) keys[i] = i * 0.5f;
+		for(size_t i = 0; i < des.size(); ++i) des[i] = (i % 128) / 512.0f;
+
+		//the features are loaded back as they are saved
+		CHECK(cache.Load(1, lkeys, ldes) == -1);
+		cache.Save(1, 3, &keys[0], &des[0]);
+		CHECK(cache.Load(1, lkeys, ldes) == 3);
+		CHECK(lkeys.size() >= keys.size() && memcmp(&lkeys[0], &keys[0], keys.size() * sizeof(float)) == 0);
+		CHECK(ldes.size() >= des.size() && memcmp(&ldes[0], &des[0], des.size() * sizeof(float)) == 0);
+
+		//with the keypoints only, and with no features
+		cache.Save(2, 3, &keys[0], NULL);
+		CHECK(cache.Load(2, lkeys, ldes) == 3);
+		CHECK(memcmp(&lkeys[0], &keys[0], keys.size() * sizeof(float)) == 0);
+		cache.Save(3, 0, NULL, NULL);
+		CHECK(cache.Load(3, lkeys, ldes) == 0);
+
+		//the files are found by another instance
+		FeatureCache other(dir.c_str(), 1);
+		CHECK(other.Load(1, lkeys, ldes) == 3);
+		CHECK(other.Load(3, lkeys, ldes) == 0);
+
+		//the entries are evicted to keep the cache under 1 MB
+		vector<float> big(128 * 1200, 1.0f), bigkeys(4 * 1200, 2.0f);
+		cache.Save(4, 1200, &bigkeys[0], &big[0]);
+		cache.Save(5, 1200, &bigkeys[0], &big[0]);
+		CHECK((cache.Load(4, lkeys, ldes) >= 0) + (cache.Load(5, lkeys, ldes) >= 0) == 1);
+	}
+	RemoveTempDirectory(dir);
+
+	//writers of the same entry on several threads leave one complete file
+	dir = MakeTempDirectory("cache_threads");
+	RunThreads(8, SaveCacheEntry, (void*) dir.c_str());
+	{
+		FeatureCache cache(dir.c_str(), 16);
+		vector<float> lkeys, ldes;
+		CHECK(cache.Load(7, lkeys, ldes) == 500);
+		CHECK(lkeys[4 * 499] == 499.0f && ldes[128 * 500 - 1] == 0.25f);
+	}
+	CHECK(CountFiles(dir) == 1);
+	RemoveTempDirectory(dir);
+}
+
+static void TestSiftConfig()
+{
+	//the typed parameters of an instance are read back as they are set
+	SiftGPU a, b;
+	SiftConfig config, ca, cb, defaults;
+	config.SetFirstOctave(-1);
+	config.SetFeatureCount(700, 2);
+	config.SetDescriptorU8(1);
+	config.SetVerbose(0);
+	a.SetConfig(config);
+	a.GetConfig(ca);
+	CHECK(ca._octave_min_default == -1 && ca._FeatureCountThreshold == 700 && ca._TruncateMethod == 2);
+	CHECK(ca._DescriptorU8 == 1 && ca._verbose == 0);
+
+	//and each instance keeps its own, also when they are used alternately
+	b.GetConfig(cb);
+	CHECK(cb._octave_min_default == defaults._octave_min_default && cb._FeatureCountThreshold == defaults._FeatureCountThreshold);
+	CHECK(cb._DescriptorU8 == defaults._DescriptorU8);
+	char opt1[] = "-fo", val1[] = "1", opt2[] = "-m", val2[] = "2", opt3[] = "-v", val3[] = "0";
+	char * argv[] = {opt1, val1, opt2, val2, opt3, val3};
+	b.ParseParam(6, argv);
+	b.GetConfig(cb);
+	a.GetConfig(ca);
+	CHECK(cb._octave_min_default == 1 && cb._MaxOrientation == 2);
+	CHECK(ca._octave_min_default == -1 && ca._MaxOrientation == defaults._MaxOrientation);
+
+	//the config of one instance is copied to another
+	b.SetConfig(ca);
+	b.GetConfig(cb);
+	CHECK(cb._octave_min_default == -1 && cb._FeatureCountThreshold == 700 && cb._MaxOrientation == ca._MaxOrientation);
+	CHECK(cb._DescriptorU8 == 1 && cb._TruncateMethod == 2);
+}
+
+//the jobs of the job queue test are numbered with _width
+struct JobQueueTest
+{
+	SiftGPUJobQueue		queue;
+	vector<SiftGPUJob*>	jobs;
+	vector<int>			order[4];
+};
+
+static void CountCallback(SiftGPUPool*, SiftGPUJob * job, void * user_data)
+{
+	(*(int*) user_data)++;
+}
+
+//index 0 queues the jobs and stops the queue, the others run them
+static void RunJobQueue(void* arg, int index)
+{
+	JobQueueTest& test = *(JobQueueTest*) arg;
+	if(index == 0)
+	{
+		for(size_t i = 0; i < test.jobs.size(); ++i) test.queue.Push(test.jobs[i]);
+		test.queue.Stop();
+		return;
+	}
+	SiftGPUJob * job;
+	while((job = test.queue.Pop()) != NULL)
+	{
+		test.order[index].push_back(job->_width);
+		test.queue.Finish(NULL, job, job->_width * 2);
+	}
+}
+
+static void TestJobQueue()
+{
+	//the jobs are taken in order, and the results are kept until they are released
+	{
+		SiftGPUJobQueue queue;
+		int calls = 0;
+		SiftGPUJob * a = new SiftGPUJob(CountCallback, &calls), * b = new SiftGPUJob(NULL, NULL);
+		queue.Push(a);
+		queue.Push(b);
+		CHECK(!queue.IsFinished(a) && a->_state == SiftGPUJob::JOB_QUEUED);
+		CHECK(queue.Pop() == a && a->_state == SiftGPUJob::JOB_RUNNING);
+		queue.Finish(NULL, a, 12);
+		CHECK(queue.IsFinished(a) && queue.Wait(a) == 12 && calls == 1);
+		CHECK(queue.Pop() == b);
+		queue.Finish(NULL, b, 0);
+		queue.Release(a);
+		queue.Release(b);
+	}
+
+	//after Stop the queued jobs are still taken, then Pop returns NULL, and 
+	//Clear finishes the jobs that are never taken
+	{
+		SiftGPUJobQueue queue;
+		int calls = 0;
+		SiftGPUJob * a = new SiftGPUJob(CountCallback, &calls), * b = new SiftGPUJob(CountCallback, &calls);
+		queue.Push(a);
+		queue.Push(b);
+		queue.Stop();
+		CHECK(queue.IsStopped());
+		CHECK(queue.Pop() == a);
+		queue.Finish(NULL, a, 5);
+		queue.Clear(NULL);
+		CHECK(queue.Wait(b) == -1 && calls == 2);
+		CHECK(queue.Pop() == NULL);
+		queue.Release(a);
+		queue.Release(b);
+	}
+
+	//workers on several threads take every job once, each in the queue order
+	JobQueueTest test;
+	for(int i = 0; i < 200; ++i)
+	{
+		test.jobs.push_back(new SiftGPUJob(NULL, NULL));
+		test.jobs.back()->_width = i;
+	}
+	RunThreads(4, RunJobQueue, &test);
+	int taken = 0, ordered = 1, results = 1;
+	for(int t = 1; t < 4; ++t)
+	{
+		taken += (int) test.order[t].size();
+		for(size_t i = 1; i < test.order[t].size(); ++i) ordered &= test.order[t][i] > test.order[t][i - 1];
+	}
+	for(size_t i = 0; i < test.jobs.size(); ++i)
+	{
+		results &= test.queue.Wait(test.jobs[i]) == (int) i * 2;
+		test.queue.Release(test.jobs[i]);
+	}
+	CHECK(taken == 200 && ordered && results);
+}
+
+static void TestDescriptorU8()
+{
+	//the uint8 descriptors of -u8 are normalized and quantized in one pass, 
+	//and match the float normalization followed by the quantization
+	const int num = 20;
+	vector<float> raw(128 * num), des;
+	srand(1);
+	for(size_t i = 0; i < raw.size(); ++i) raw[i] = (rand() % 1000) * ((i % 7) == 0 ? 0.01f : 0.001f);
+	for(int normalized = 1; normalized >= 0; --normalized)
+	{
+		GlobalUtil::_NormalizedSIFT = normalized;
+		des = raw;
+		for(int k = 0; normalized && k < num; ++k)
+		{
+			//normalize, truncate to .2 and renormalize
+			float * pd = &des[k * 128], sq = 0;
+			for(int v = 0; v < 128; ++v) sq += pd[v] * pd[v];
+			for(int v = 0; v < 128; ++v) pd[v] = std::min(pd[v] / sqrtf(sq), 0.2f);
+			sq = 0;
+			for(int v = 0; v < 128; ++v) sq += pd[v] * pd[v];
+			for(int v = 0; v < 128; ++v) pd[v] /= sqrtf(sq);
+		}
+		vector<unsigned char> bytes(128 * num);
+		PyramidGL::NormalizeDescriptorU8(num, &raw[0], &bytes[0]);
+		int diff = 0, saturated = 0;
+		for(size_t i = 0; i < des.size(); ++i)
+		{
+			int v = (int) floor(0.5 + 512.0f * des[i]);
+			v = v < 0 ? 0 : (v > 255 ? 255 : v);
+			if(abs(v - bytes[i]) > diff) diff = abs(v - bytes[i]);
+			saturated += bytes[i] == 255;
+		}
+		//the rounding may differ by one where the product is close to .5
+		CHECK(diff <= 1);
+		CHECK(normalized ? saturated == 0 : saturated > 0);
+	}
+	GlobalUtil::_NormalizedSIFT = 1;
+}
+
+static void TestSelectKeypoints()
+{
+	//a dense cluster of strong features in a corner and weak ones spread over the image
+	vector<float> xy, response;
+	int k, i, j;
+	for(k = 0; k < 100; ++k)
+	{
+		xy.push_back(10.0f + (k % 10));	xy.push_back(10.0f + (k / 10));	response.push_back(1.0f + k);
+	}
+	for(j = 0; j < 10; ++j) for(i = 0; i < 10; ++i)
+	{
+		xy.push_back(50.0f + i * 100);	xy.push_back(50.0f + j * 100);	response.push_back(0.5f);
+	}
+	int num = (int) response.size();
+	vector<float> resp;
+	vector<unsigned char> keep;
+
+	//the strongest features are all in the cluster
+	resp = response;	keep.assign(num, 1);
+	CHECK(SiftPyramid::SelectKeypoints(xy, resp, 50, keep) == 50);
+	CHECK(std::count(keep.begin(), keep.end(), 1) == 50 && std::count(keep.begin() + 100, keep.end(), 1) == 0);
+
+	//the masked (unflagged) features are never selected
+	resp = response;	keep.assign(num, 1);
+	for(k = 50; k < 100; ++k) keep[k] = 0;
+	CHECK(SiftPyramid::SelectKeypoints(xy, resp, 50, keep) == 50);
+	CHECK(std::count(keep.begin() + 50, keep.begin() + 100, 1) == 0);
+
+	//the suppression spreads the selection over the image
+	GlobalUtil::_FeatureANMS = 1;
+	resp = response;	keep.assign(num, 1);
+	CHECK(SiftPyramid::SelectKeypoints(xy, resp, 50, keep) == 50);
+	CHECK(std::count(keep.begin(), keep.end(), 1) == 50 && std::count(keep.begin() + 100, keep.end(), 1) >= 40);
+
+	//a tiny radius over a huge extent does not allocate a cell per radius
+	xy[0] = 1e6f;	xy[1] = 1e6f;
+	resp = response;	keep.assign(num, 1);
+	CHECK(SiftPyramid::SelectKeypoints(xy, resp, 199, keep) == 199);
+	CHECK(keep[0] == 1);
+	GlobalUtil::_FeatureANMS = 0;
+
+	//each cell of the grid gets its share
+	GlobalUtil::_FeatureGridSize = 2;
+	xy[0] = 10.0f;	xy[1] = 10.0f;
+	resp = response;	keep.assign(num, 1);
+	CHECK(SiftPyramid::SelectKeypoints(xy, resp, 40, keep) == 40);
+	CHECK(std::count(keep.begin() + 100, keep.end(), 1) >= 30);
+	GlobalUtil::_FeatureGridSize = 0;
+}
+
+//a pyramid of one octave with the feature lists in memory, for the cpu filtering
+class ListPyramid : public SiftPyramid
+{
+	vector< vector<float> > _lists;
+	int						_counts[3];
+public:
+	ListPyramid(SiftParam& sp) : SiftPyramid(sp), _lists(3)
+	{
+		_octave_num = 1;	_levelFeatureNum = _counts;
+		for(int i = 0; i < 3; ++i) _counts[i] = 0;
+	}
+	void SetList(int idx, const vector<float>& list)
+	{
+		_lists[idx] = list;		_counts[idx] = (int) list.size() / 4;	_featureNum += _counts[idx];
+	}
+	const vector<float>& GetList(int idx) {return _lists[idx]; }
+	void SetOctaveMin(int octave_min) {_octave_min = octave_min; }
+	int  MaskLevel(int idx) {return MaskFeatureList(idx); }
+	virtual int  DownloadFeatureList(int idx, float * list, float * xy, float * response)
+	{
+		for(int k = 0; k < _counts[idx]; ++k)
+		{
+			memcpy(list + k * 4, &_lists[idx][k * 4], 4 * sizeof(float));
+			xy[k * 2] = list[k * 4];	xy[k * 2 + 1] = list[k * 4 + 1];
+			if(response) response[k] = list[k * 4 + 3];
+		}
+		return 1;
+	}
+	virtual void UploadFeatureList(int idx, const float * list, int num) 
+	{
+		_lists[idx].assign(list, list + num * 4);	_counts[idx] = num;
+	}
+	virtual void GetFeatureDescriptors() {}
+	virtual void GenerateFeatureListTex() {}
+	virtual void ReshapeFeatureListCPU() {}
+	virtual void GenerateFeatureDisplayVBO() {}
+	virtual void DownloadKeypoints() {}
+	virtual void GenerateFeatureListCPU() {}
+	virtual void GenerateFeatureList() {}
+	virtual GLTexImage* GetLevelTexture(int octave, int level) {return NULL; }
+	virtual GLTexImage* GetLevelTexture(int octave, int level, int dataName) {return NULL; }
+	virtual void BuildPyramid(GLTexInput * input) {}
+	virtual void ResizePyramid(int w, int h) {}
+	virtual void InitPyramid(int w, int h, int ds = 0) {}
+	virtual void DetectKeypointsEX() {}
+	virtual void ComputeGradient() {}
+	virtual void GetFeatureOrientations() {}
+	virtual void GetSimplifiedOrientation() {}
+};
+
+static void TestDetectionMask()
+{
+	//the locations of a level are scaled to the keypoints, which are at pixel 
+	//centers (x + 0.5) by default and at integers with -loweo
+	SiftParam param;
+	param._dog_level_num = 3;
+	float data[] = {10.5f, 10.5f, 0, 1,  2.5f, 2.5f, 0, 2,  10.3f, 10.5f, 0, 3,  20.5f, 20.5f, 0, 4};
+	vector<float> list(data, data + 16);
+	unsigned char mask[32 * 32];
+	memset(mask, 0, sizeof(mask));
+	for(int y = 10; y < 30; ++y) for(int x = 10; x < 30; ++x) mask[y * 32 + x] = 1;
+	for(int lowe = 0; lowe <= 1; ++lowe)
+	{
+		GlobalUtil::_LoweOrigin = lowe;
+		ListPyramid pyramid(param);
+		pyramid.SetDetectionMask(32, 32, mask);
+		pyramid.SetList(1, list);
+		CHECK(pyramid.MaskLevel(1) && pyramid.GetFeatureNum() == 3 - lowe);
+		CHECK(pyramid.GetList(1).size() == (size_t) (3 - lowe) * 4 && pyramid.GetList(1)[3] == 1 && pyramid.GetList(1)[7] == (lowe ? 4 : 3));
+
+		//with the rectangles, and in the upsampled octave
+		int roi[] = {5, 5, 8, 8,  18, 18, 4, 4};
+		ListPyramid upsampled(param);
+		upsampled.SetDetectionMask(0, 0, NULL);
+		upsampled.SetDetectionROI(2, roi);
+		upsampled.SetOctaveMin(-1);
+		upsampled.SetList(0, list);
+		CHECK(upsampled.MaskLevel(0) && upsampled.GetFeatureNum() == 3 - lowe);
+	}
+	GlobalUtil::_LoweOrigin = 0;
+}
+
+static void TestServerQueue()
+{
+	//the sessions are not used by the queue, only their addresses
+	ServerSession * s[6];
+	for(int i = 0; i < 6; ++i) s[i] = (ServerSession*) (size_t) (i + 1);
+
+	//no limit without a depth
+	ServerQueue unlimited;
+	for(int i = 0; i < 6; ++i) unlimited.Push(s[i], ServerSiftGPU::PRIORITY_BATCH);
+	CHECK(unlimited.Depth() == 6 && unlimited.Admit(ServerSiftGPU::PRIORITY_BATCH));
+
+	//a request is admitted if fewer than max_depth of the same or a higher priority are ahead of it
+	ServerQueue queue(2);
+	queue.Push(s[0], ServerSiftGPU::PRIORITY_BATCH);
+	queue.Push(s[1], ServerSiftGPU::PRIORITY_BATCH);
+	CHECK(!queue.Admit(ServerSiftGPU::PRIORITY_BATCH) && queue.Admit(ServerSiftGPU::PRIORITY_NORMAL));
+	queue.Push(s[2], ServerSiftGPU::PRIORITY_NORMAL);
+	queue.Push(s[3], ServerSiftGPU::PRIORITY_INTERACTIVE);
+	queue.Push(s[4], ServerSiftGPU::PRIORITY_NORMAL);
+	CHECK(!queue.Admit(ServerSiftGPU::PRIORITY_NORMAL) && queue.Admit(ServerSiftGPU::PRIORITY_INTERACTIVE));
+	CHECK(queue.Depth() == 5);
+
+	//a worker of the normal class leaves the batch requests
+	CHECK(queue.Pop(ServerSiftGPU::PRIORITY_NORMAL) == s[3]);
+	CHECK(queue.Pop(ServerSiftGPU::PRIORITY_NORMAL) == s[2]);
+	CHECK(queue.Pop(ServerSiftGPU::PRIORITY_NORMAL) == s[4]);
+	CHECK(queue.Depth() == 2 && queue.Admit(ServerSiftGPU::PRIORITY_NORMAL));
+
+	//the oldest first within a priority
+	queue.Push(s[5], ServerSiftGPU::PRIORITY_INTERACTIVE);
+	CHECK(queue.Pop(ServerSiftGPU::PRIORITY_BATCH) == s[5]);
+	CHECK(queue.Pop(ServerSiftGPU::PRIORITY_BATCH) == s[0]);
+	CHECK(queue.Pop(ServerSiftGPU::PRIORITY_BATCH) == s[1]);
+	CHECK(queue.Depth() == 0);
+
+	//a stopped queue returns instead of waiting
+	queue.Stop();
+	CHECK(queue.Pop(ServerSiftGPU::PRIORITY_BATCH) == NULL);
+}
+
+static void TestFeatureCodec()
+{
+	typedef ServerSiftGPU S;
+	//the LZ blocks with long literals, long and overlapping matches
+	vector<unsigned char> raw;
+	srand(2);
+	for(int i = 0; i < 600; ++i) raw.push_back((unsigned char) rand());
+	raw.insert(raw.end(), 1000, 7);
+	raw.insert(raw.end(), raw.begin(), raw.begin() + 300);
+	for(int i = 0; i < 20; ++i) raw.push_back((unsigned char) rand());
+	vector<char> lz;
+	LzCompress(&raw[0], raw.size(), lz);
+	vector<unsigned char> unpacked(raw.size());
+	CHECK(lz.size() < raw.size() - 1000);
+	CHECK(LzDecompress((const unsigned char*) &lz[0], lz.size(), &unpacked[0], unpacked.size()) && unpacked == raw);
+	CHECK(!LzDecompress((const unsigned char*) &lz[0], lz.size(), &unpacked[0], unpacked.size() - 1));
+	CHECK(!LzDecompress((const unsigned char*) &lz[0], lz.size() - 1, &unpacked[0], unpacked.size()));
+
+	//features with sparse descriptors, as many of the normalized ones
+	const int num = 50;
+	vector<SiftGPU::SiftKeypoint> keys(num), dkeys;
+	vector<float> des(128 * num, 0), ddes;
+	for(int i = 0; i < num; ++i)
+	{
+		keys[i].x = (rand() % 64000) * 0.05f;
+		keys[i].y = (rand() % 48000) * 0.05f;
+		//the scales of -sign are negative for the minima
+		keys[i].s = (1.0f + (rand() % 1000) * 0.01f) * (i % 3 == 0 ? -1.0f : 1.0f);
+		keys[i].o = (rand() % 6283) * 0.001f - 3.1415f;
+		for(int j = 0; j < 128; j += 1 + rand() % 4) des[i * 128 + j] = (rand() % 200) * 0.001f;
+	}
+	vector<char> packed;
+	EncodeFeatures(num, &keys[0], &des[0], S::ENCODING_FLOAT, packed);
+	CHECK(packed.size() == sizeof(FeatureEncoding) + num * (sizeof(SiftGPU::SiftKeypoint) + 128 * sizeof(float)));
+	CHECK(DecodeFeatures(&packed[0], packed.size(), num, dkeys, ddes) == num);
+	CHECK(memcmp(&dkeys[0], &keys[0], num * sizeof(SiftGPU::SiftKeypoint)) == 0 && ddes == des);
+
+	//the compact encoding is within the quantization steps, and the same with or without LZ
+	const int encodings[] = {S::ENCODING_U8 | S::ENCODING_KEY16, S::ENCODING_COMPACT};
+	vector<float> udes;
+	for(int e = 0; e < 2; ++e)
+	{
+		EncodeFeatures(num, &keys[0], &des[0], encodings[e], packed);
+		CHECK(DecodeFeatures(&packed[0], packed.size(), num, dkeys, ddes) == num);
+		FeatureEncoding header;
+		memcpy(&header, &packed[0], sizeof(header));
+		CHECK(header.raw_size == num * (8 + 128) && (e ? header.packed_size < header.raw_size : header.packed_size == header.raw_size));
+		float kd = 0, sd = 0, od = 0, dd = 0;
+		for(int i = 0; i < num; ++i)
+		{
+			kd = std::max(kd, std::max(fabs(dkeys[i].x - keys[i].x), fabs(dkeys[i].y - keys[i].y)) * header.step);
+			sd = std::max(sd, (float) fabs(dkeys[i].s / keys[i].s - 1.0f));
+			od = std::max(od, (float) fabs(dkeys[i].o - keys[i].o));
+		}
+		for(int i = 0; i < num * 128; ++i) dd = std::max(dd, (float) fabs(ddes[i] - des[i]));
+		CHECK(kd <= 0.501f && sd <= 0.00035f && od <= 3.1416f / 32768 + 1e-5f && dd <= 0.5f / 512 + 1e-6f);
+		if(e == 0) udes = ddes;
+		else CHECK(ddes == udes);
+	}
+
+	//the scale keeps its sign and its relative precision from 2^-16 to 2^16
+	CHECK(DecodeScale16(EncodeScale16(0.0f)) == 0.0f && DecodeScale16(EncodeScale16(-1.0f)) == -1.0f);
+	CHECK(DecodeScale16(EncodeScale16(1.0f)) == 1.0f && DecodeScale16(EncodeScale16(-2.5f)) < 0);
+	CHECK(fabs(DecodeScale16(EncodeScale16(3000.0f)) / 3000.0f - 1.0f) < 0.00035f);
+	CHECK(fabs(DecodeScale16(EncodeScale16(-0.01f)) / -0.01f - 1.0f) < 0.00035f);
+	CHECK(DecodeScale16(EncodeScale16(1e6f)) > 65000.0f && DecodeScale16(EncodeScale16(-1e6f)) < -65000.0f);
+
+	//a corrupted or truncated response is not decoded
+	CHECK(DecodeFeatures(&packed[0], packed.size(), num + 1, dkeys, ddes) == 0);
+	CHECK(DecodeFeatures(&packed[0], packed.size() - 1, num, dkeys, ddes) == 0);
+	FeatureEncoding header;
+	memcpy(&header, &packed[0], sizeof(header));
+	header.packed_size--;
+	memcpy(&packed[0], &header, sizeof(header));
+	CHECK(DecodeFeatures(&packed[0], packed.size(), num, dkeys, ddes) == 0);
+}
+
+//num features of id in the store tests, with descriptors of the value 0.25
+static void PutFeatures(ServerFeatureStore& store, const char * id, int num)
+{
+	vector<SiftGPU::SiftKeypoint> keys(num);
+	vector<float> des(num * 128, 0.25f);
+	for(int i = 0; i < num; ++i) keys[i].x = (float) i;
+	store.Put(id, num, keys, des);
+}
+
+struct FeatureStoreTest
+{
+	ServerFeatureStore*	store;
+	int					errors[8];
+};
+
+//threads that store and read the features of 40 ids in a store of about 16 of them
+static void UseFeatureStore(void* arg, int index)
+{
+	FeatureStoreTest& test = *(FeatureStoreTest*) arg;
+	vector<char> des;
+	float value = 0.25f;
+	unsigned char byte;
+	QuantizeDescriptors(&value, 1, &byte);
+	for(int i = 0; i < 400; ++i)
+	{
+		int k = (index * 7 + i) % 40;
+		char id[16];	sprintf(id, "id%d", k);
+		if(i % 3 == 0) PutFeatures(*test.store, id, 400 + k);
+		int num = test.store->Get(id, des);
+		//an id is either stored or dropped, never a mix
+		if(num >= 0 && (num != 400 + k || des.size() != (size_t) num * 128 || (unsigned char) des[0] != byte)) test.errors[index]++;
+	}
+}
+
+static void TestFeatureStore()
+{
+	//4 entries of 2000 features fit in 1 MB, and the least recently used one is dropped
+	{
+		ServerFeatureStore store(1, NULL, 0);
+		vector<char> des;
+		double stats[5];
+		PutFeatures(store, "a", 2000);
+		PutFeatures(store, "b", 2000);
+		PutFeatures(store, "c", 2000);
+		PutFeatures(store, "d", 2000);
+		CHECK(store.Get("a", des) == 2000 && des.size() == 2000 * 128);
+		PutFeatures(store, "e", 2000);
+		CHECK(store.Get("b", des) == -1);
+		CHECK(store.Get("a", des) == 2000 && store.Get("c", des) == 2000 && store.Get("e", des) == 2000);
+		store.GetStats(stats);
+		CHECK(stats[0] == 4 && stats[1] <= (1 << 20) && stats[2] == 4 && stats[4] == 1);
+
+		//an id is replaced, and the features larger than the memory are not kept
+		PutFeatures(store, "a", 10);
+		CHECK(store.Get("a", des) == 10 && des.size() == 10 * 128);
+		PutFeatures(store, "big", 9000);
+		CHECK(store.Get("big", des) == -1);
+		PutFeatures(store, "none", 0);
+		CHECK(store.Get("none", des) == 0);
+	}
+
+	//with a folder, the dropped features are read back from the files
+	string dir = MakeTempDirectory("store");
+	{
+		ServerFeatureStore store(1, dir.c_str(), 16);
+		vector<char> des;
+		double stats[5];
+		const char * ids[] = {"a", "b", "c", "d", "e", "f"};
+		for(int i = 0; i < 6; ++i) PutFeatures(store, ids[i], 2000);
+		CHECK(store.Get("a", des) == 2000 && des.size() == 2000 * 128);
+		store.GetStats(stats);
+		CHECK(stats[3] == 1 && stats[4] == 0);
+	}
+	{
+		ServerFeatureStore store(1, dir.c_str(), 16);
+		vector<char> des;
+		CHECK(store.Get("f", des) == 2000 && store.Get("x", des) == -1);
+	}
+	RemoveTempDirectory(dir);
+
+	//Put and Get on several threads, with the entries dropped all the time
+	ServerFeatureStore store(1, NULL, 0);
+	FeatureStoreTest test = {&store, {0, 0, 0, 0, 0, 0, 0, 0}};
+	RunThreads(8, UseFeatureStore, &test);
+	double stats[5];
+	store.GetStats(stats);
+	int errors = 0;
+	for(int i = 0; i < 8; ++i) errors += test.errors[i];
+	CHECK(errors == 0 && stats[1] <= (1 << 20) && stats[2] + stats[4] == 8 * 400);
+}
+
+static int FindScope(SiftProfiler& profiler, const char* name, SiftProfileScope& scope)
+{
+	for(int i = 0; i < profiler.GetScopeNum(); ++i)
+	{
+		if(profiler.GetScope(i, scope) && strcmp(scope.name, name) == 0) return 1;
+	}
+	return 0;
+}
+
+static void TestProfiler()
+{
+	//two runs of a stage with one octave of two levels, the level that is
+	//still open at EndOctave is dropped and the scopes are aggregated
+	SiftProfiler profiler;
+	SiftProfileScope scope;
+	for(int run = 0; run < 2; ++run)
+	{
+		profiler.BeginRun();
+		profiler.Begin("Detect");
+		profiler.BeginOctave(0, SiftProfiler::PROFILE_LEVEL);
+		profiler.NextLevel();
+		profiler.NextLevel();
+		profiler.EndOctave();
+		profiler.End();
+		profiler.SetData(-1, 1000.0 * (run + 1));
+		profiler.EndRun(100 + 100 * run);
+	}
+	CHECK(profiler.GetScopeNum() == 5);
+	CHECK(FindScope(profiler, "run", scope) && scope.depth == 0 && scope.count == 2);
+	CHECK(scope.features == 150 && scope.features_last == 200);
+	CHECK(FindScope(profiler, "run/Detect", scope) && scope.depth == 1 && scope.count == 2);
+	CHECK(scope.bytes == 3000 && scope.bytes_last == 2000 && scope.features == -1);
+	CHECK(FindScope(profiler, "run/Detect/octave 0/level 1", scope) && scope.depth == 3 && scope.count == 2);
+	CHECK(!FindScope(profiler, "run/Detect/octave 0/level 2", scope));
+	CHECK(scope.wall_min <= scope.wall_max && scope.wall <= 2 * scope.wall_max + 1e-9);
+	const char* json = profiler.GetJSON();
+	CHECK(strstr(json, "\"name\":\"run/Detect/octave 0\"") != NULL);
+
+	//nine short scopes and a long one, the median stays below the long
+	//scope and the 99th percentile is in its bucket
+	profiler.Reset();
+	CHECK(profiler.GetScopeNum() == 0);
+	for(int i = 0; i < 10; ++i)
+	{
+		profiler.BeginRun();
+		profiler.Begin("wait");
+		if(i == 9) for(double start = SiftProfiler::WallTime(); SiftProfiler::WallTime() - start < 5e-3;);
+		profiler.End();
+		profiler.EndRun(0);
+	}
+	CHECK(FindScope(profiler, "run/wait", scope) && scope.count == 10);
+	CHECK(scope.wall_max >= 5e-3 && scope.wall_min <= scope.wall_p50);
+	CHECK(scope.wall_p50 <= scope.wall_p90 && scope.wall_p90 <= scope.wall_p99 && scope.wall_p99 <= scope.wall_max);
+	CHECK(scope.wall_p50 < 1e-3 && scope.wall_p99 > 2.5e-3);
+}
+
+//the events of a thread that exits
+#ifdef _WIN32
+static unsigned __stdcall TraceThread(void*)
+#else
+static void* TraceThread(void*)
+#endif
+{
+	SiftTracer::Instant("thread", "test");
+	return 0;
+}
+
+static void RunTraceThread()
+{
+#ifdef _WIN32
+	HANDLE thread = (HANDLE) _beginthreadex(NULL, 0, TraceThread, NULL, 0, NULL);
+	WaitForSingleObject(thread, INFINITE);
+	CloseHandle(thread);
+#else
+	pthread_t thread;
+	if(pthread_create(&thread, NULL, TraceThread, NULL) == 0) pthread_join(thread, NULL);
+#endif
+}
+
+static int CountText(const std::string& text, const char* pattern)
+{
+	int count = 0;
+	for(size_t pos = text.find(pattern); pos != std::string::npos; pos = text.find(pattern, pos + 1)) count++;
+	return count;
+}
+
+static void TestTracer()
+{
+	//a ring of 8 keeps the last 8 events after it wraps, and the oldest one is 
+	//not saved since the next event may be written over it during the copy
+	SiftTracer::Start(8);
+	char detail[16];
+	for(int i = 0; i < 20; ++i)
+	{
+		sprintf(detail, "event %d", i);
+		SiftTracer::Instant("wrap", "test", detail);
+	}
+	std::string json;
+	SiftTracer::GetJSON(json);
+	CHECK(CountText(json, "\"wrap\"") == 7);
+	CHECK(json.find("\"event 12\"") == std::string::npos && json.find("\"event 13\"") != std::string::npos);
+	CHECK(json.find("\"event 19\"") != std::string::npos);
+
+	//the events of a thread that has exited are kept until the next Start,
+	//and then its ring is taken by a new thread with the same id
+	RunTraceThread();
+	SiftTracer::GetJSON(json);
+	size_t pos = json.find("\"thread\"");
+	CHECK(pos != std::string::npos);
+	size_t tid = json.find("\"tid\":", pos);
+	std::string first = tid == std::string::npos ? "" : json.substr(tid, json.find('}', tid) - tid);
+	SiftTracer::Start(8);
+	RunTraceThread();
+	SiftTracer::GetJSON(json);
+	CHECK(CountText(json, "\"thread\"") == 1 && CountText(json, "\"wrap\"") == 0);
+	pos = json.find("\"thread\"");
+	tid = pos == std::string::npos ? pos : json.find("\"tid\":", pos);
+	CHECK(first.size() && tid != std::string::npos && json.compare(tid, first.size(), first) == 0);
+	SiftTracer::Stop();
+}
+
+struct UnitTest
+{
+	const char *	name;
+	void			(*run)();
+};
+
+static const UnitTest s_tests[] =
+{
+	{"netpbm",		TestNetpbmHeader},
+	{"pitch",		TestDownSamplePitch},
+	{"sse",			TestConvertRow},
+	{"cache",		TestFeatureCache},
+	{"config",		TestSiftConfig},
+	{"jobs",		TestJobQueue},
+	{"u8",			TestDescriptorU8},
+	{"select",		TestSelectKeypoints},
+	{"mask",		TestDetectionMask},
+	{"queue",		TestServerQueue},
+	{"codec",		TestFeatureCodec},
+	{"store",		TestFeatureStore},
+	{"profile",	TestProfiler},
+	{"tracer",		TestTracer},
+};
+
+int main(int argc, char** argv)
+{
+	int count = sizeof(s_tests) / sizeof(s_tests[0]), run = 0;
+	for(int i = 0; i < count; ++i)
+	{
+		int selected = argc <= 1;
+		for(int j = 1; j < argc; ++j) if(strcmp(argv[j], s_tests[i].name) == 0) selected = 1;
+		if(!selected) continue;
+		int failures = s_failures;
+		s_tests[i].run();
+		std::cout << s_tests[i].name << (failures == s_failures ? ": passed\n" : ": FAILED\n");
+		run++;
+	}
+	std::cout << run << " tests, " << s_checks << " checks, " << s_failures << " failures\n";
+	return s_failures || run == 0 ? 1 : 0;
+}
+